@@ -65,10 +65,12 @@ namespace cmudb {
         if (tar == nullptr) return tar;
         if (tar->is_dirty_) {
             //todo:理解这个条件
+            // 页面上还暂存在事务日志缓冲里的修改先合并，拿到LSN
+            if (log_manager_ != nullptr) log_manager_->MergePage(tar);
             if (ENABLE_LOGGING && log_manager_->GetPersistentLSN() < tar->GetLSN())
                 log_manager_->Flush(true);
             //2 将页面中的内容写回到磁盘
-            disk_manager_->WritePage(tar->GetPageId(), tar->data_);
+            writePage(tar);
         }
         // 3
         page_table_->Remove(tar->GetPageId());
@@ -77,6 +79,7 @@ namespace cmudb {
         disk_manager_->ReadPage(page_id, tar->data_);
         tar->pin_count_ = 1;
         tar->is_dirty_ = false;
+        tar->rec_lsn_ = INVALID_LSN;
         tar->page_id_ = page_id;
 
         return tar;
@@ -127,7 +130,11 @@ namespace cmudb {
             return false;
         }
         if (tar->is_dirty_) {
-            disk_manager_->WritePage(page_id, tar->GetData());
+            if (log_manager_ != nullptr) log_manager_->MergePage(tar);
+            // WAL：页面的日志先落盘
+            if (ENABLE_LOGGING && log_manager_->GetPersistentLSN() < tar->GetLSN())
+                log_manager_->Flush(true);
+            writePage(tar);
             tar->is_dirty_ = false;
         }
 
@@ -153,8 +160,11 @@ namespace cmudb {
                 return false;
             }
             replacer_->Erase(tar);
+            // 暂存的记录指着这个页面，页面重用之前合并
+            if (log_manager_ != nullptr) log_manager_->MergePage(tar);
             page_table_->Remove(page_id);
             tar->is_dirty_ = false;
+            tar->rec_lsn_ = INVALID_LSN;
             tar->ResetMemory();
             tar->page_id_ = INVALID_PAGE_ID;
             free_list_->push_back(tar);
@@ -182,9 +192,10 @@ namespace cmudb {
 
         page_id = disk_manager_->AllocatePage();
         if (tar->is_dirty_) {
+            if (log_manager_ != nullptr) log_manager_->MergePage(tar);
             if (ENABLE_LOGGING && log_manager_->GetPersistentLSN() < tar->GetLSN())
                 log_manager_->Flush(true);
-            disk_manager_->WritePage(tar->GetPageId(), tar->data_);
+            writePage(tar);
         }
         page_table_->Remove(tar->GetPageId());
         page_table_->Insert(page_id, tar);
@@ -192,11 +203,31 @@ namespace cmudb {
         tar->page_id_ = page_id;
         tar->ResetMemory();
         tar->is_dirty_ = false;
+        tar->rec_lsn_ = INVALID_LSN;
         tar->pin_count_ = 1;
 
         return tar;
     }
 
+    void BufferPoolManager::writePage(Page *page) {
+        page->rec_lsn_ = INVALID_LSN;
+        disk_manager_->WritePage(page->GetPageId(), page->GetData());
+    }
+
+/**
+ * 模糊检查点用的脏页表，不写回任何页面
+ */
+    DirtyPageTable BufferPoolManager::GetDirtyPageTable() {
+        lock_guard<mutex> lck(latch_);
+        DirtyPageTable dirty_pages;
+        for (size_t i = 0; i < pool_size_; i++) {
+            lsn_t rec_lsn = pages_[i].rec_lsn_;
+            if (rec_lsn != INVALID_LSN && pages_[i].page_id_ != INVALID_PAGE_ID)
+                dirty_pages.emplace_back(pages_[i].page_id_, rec_lsn);
+        }
+        return dirty_pages;
+    }
+
     Page *BufferPoolManager::GetVictimPage() {
         Page *tar = nullptr;
         if (free_list_->empty()) {
@@ -4,4 +4,11 @@ namespace cmudb {
   std::atomic<bool> ENABLE_LOGGING(false);  // for virtual table
   std::chrono::duration<long long int> LOG_TIMEOUT =
    std::chrono::seconds(1);
+  std::chrono::milliseconds CYCLE_DETECTION_INTERVAL =
+   std::chrono::milliseconds(50);
+  std::chrono::microseconds GROUP_COMMIT_MAX_DELAY =
+   std::chrono::microseconds(5000);
+  std::chrono::milliseconds CHECKPOINT_INTERVAL =
+   std::chrono::milliseconds(30000);
+  std::atomic<int> LOG_COMPRESSION_LEVEL(0);
 }
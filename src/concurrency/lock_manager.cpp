@@ -7,6 +7,29 @@ using namespace std;
 
 namespace cmudb {
 
+    LockManager::LockManager(bool strict_2PL, DeadlockPolicy policy)
+            : strict_2PL_(strict_2PL), policy_(policy) {
+        if (policy_ == DeadlockPolicy::DETECTION) {
+            cycle_detection_thread_ = new thread(&LockManager::runCycleDetection, this);
+        }
+    }
+
+    LockManager::~LockManager() {
+        if (cycle_detection_thread_ != nullptr) {
+            {
+                lock_guard<mutex> lg(detectionMutex_);
+                stopDetection_ = true;
+            }
+            detectionCv_.notify_one();
+            cycle_detection_thread_->join();
+            delete cycle_detection_thread_;
+        }
+        for (auto &shard : shards_) {
+            for (auto &entry : shard.lockTable_) delete entry.second;
+            for (auto txList : shard.freeLists_) delete txList;
+        }
+    }
+
     bool LockManager::LockShared(Transaction *txn, const RID &rid) {
         return lockTemplate(txn, rid, LockMode::SHARED);
     }
@@ -18,26 +41,129 @@ namespace cmudb {
     bool LockManager::LockUpgrade(Transaction *txn, const RID &rid) {
         return lockTemplate(txn, rid, LockMode::UPGRADING);
     }
+
+/**
+ * 找到rid对应的TX LIST，没有的话从分片的池中取一个放进锁表
+ * 调用者必须持有分片的latch
+ */
+    LockManager::TxList *LockManager::acquireList(LockTableShard &shard,
+                                                  const RID &rid) {
+        auto it = shard.lockTable_.find(rid);
+        if (it != shard.lockTable_.end()) return it->second;
+        TxList *txList;
+        if (shard.freeLists_.empty()) {
+            txList = new TxList;
+        } else {
+            txList = shard.freeLists_.back();
+            shard.freeLists_.pop_back();
+        }
+        txList->shard_ = &shard;
+        txList->key_ = rid;
+        shard.lockTable_.emplace(rid, txList);
+        return txList;
+    }
+
+/**
+ * 把已经空了的TX LIST从锁表中删掉，放回分片的池中
+ * 调用者必须持有分片的latch
+ */
+    void LockManager::releaseList(LockTableShard &shard,
+                                  unordered_map<RID, TxList *>::iterator it) {
+        TxList *txList = it->second;
+        assert(txList->locks_.empty());
+        shard.lockTable_.erase(it);
+        txList->hasUpgrading_ = false;
+        shard.freeLists_.push_back(txList);
+    }
+
+/**
+ * 多粒度锁的相容矩阵
+ *        IS  IX  S  SIX  X
+ *   IS   y   y   y   y   n
+ *   IX   y   y   n   n   n
+ *   S    y   n   y   n   n
+ *   SIX  y   n   n   n   n
+ *   X    n   n   n   n   n
+ */
+    bool LockManager::compatible(LockMode held, LockMode requested) {
+        if (held == LockMode::INTENTION_SHARED)
+            return requested != LockMode::EXCLUSIVE &&
+                   requested != LockMode::UPGRADING;
+        if (requested == LockMode::INTENTION_SHARED)
+            return held != LockMode::EXCLUSIVE && held != LockMode::UPGRADING;
+        if (held == LockMode::INTENTION_EXCLUSIVE)
+            return requested == LockMode::INTENTION_EXCLUSIVE;
+        if (held == LockMode::SHARED) return requested == LockMode::SHARED;
+        return false;
+    }
+
+/**
+ * 每种模式看成它所允许的操作的集合：IS={is}, IX={is,ix}, S={is,s},
+ * SIX={is,ix,s}, X=全部。两种模式的上确界就是集合的并
+ */
+    namespace {
+        int modeBits(LockMode mode) {
+            switch (mode) {
+                case LockMode::INTENTION_SHARED: return 1;
+                case LockMode::INTENTION_EXCLUSIVE: return 3;
+                case LockMode::SHARED: return 5;
+                case LockMode::SHARED_INTENTION_EXCLUSIVE: return 7;
+                default: return 15;
+            }
+        }
+    }  // namespace
+
+    LockMode LockManager::supremum(LockMode a, LockMode b) {
+        switch (modeBits(a) | modeBits(b)) {
+            case 1: return LockMode::INTENTION_SHARED;
+            case 3: return LockMode::INTENTION_EXCLUSIVE;
+            case 5: return LockMode::SHARED;
+            case 7: return LockMode::SHARED_INTENTION_EXCLUSIVE;
+            default: return LockMode::EXCLUSIVE;
+        }
+    }
+
+/**
+ * 页或者表上持有S/SIX时，下面的行不用再加读锁；持有X时什么都不用加
+ */
+    bool LockManager::RowLockCovered(Transaction *txn, const RID &rid,
+                                     LockMode mode) {
+        auto pages = txn->GetPageLockSet();
+        auto page = pages->find(rid.GetPageId());
+        if (page == pages->end()) return false;
+        auto covers = [mode](LockMode held) {
+            if (held == LockMode::EXCLUSIVE) return true;
+            return mode == LockMode::SHARED &&
+                   (held == LockMode::SHARED ||
+                    held == LockMode::SHARED_INTENTION_EXCLUSIVE);
+        };
+        if (covers(page->second.second)) return true;
+        auto tables = txn->GetTableLockSet();
+        auto table = tables->find(page->second.first);
+        return table != tables->end() && covers(table->second);
+    }
+
 /**
  * 在LOCK TEMPLATE 中，大致分为4个模块
- * 第一个模块是找到对应的TX LIST并且获得锁
+ * 第一个模块是找到对应的分片和TX LIST并且获得分片的锁
  * 第二个模块是针对LOCK UPGRADING，因为需要抹掉原来的读锁，才能升级为写锁。
  * 第三个模块是判断是否可以GRANT。
  * 第四个模块就是往TX LIST里插入，同时阻塞或者拿锁成功就往TXN
  * 里面放入对应的RID记录
+ * 已经被页锁或表锁覆盖的行不再加锁，回滚时也会走到这里，所以放在状态检查之前
  */
     bool LockManager::lockTemplate(Transaction *txn, const RID &rid,
                                    LockMode mode) {
+        if (RowLockCovered(txn, rid, mode)) return true;
         // step 1
         //事务在缩减阶段，不能加锁
         if (txn->GetState() != TransactionState::GROWING) {
             txn->SetState(TransactionState::ABORTED);
             return false;
         }
-        unique_lock<mutex> tableLatch(mutex_);
-        TxList &txList = lockTable_[rid];
-        unique_lock<mutex> txListLatch(txList.mutex_);
-        tableLatch.unlock();
+        LockTableShard &shard = getShard(rid);
+        unique_lock<mutex> shardLatch(shard.mutex_);
+        TxList &txList = *acquireList(shard, rid);
 
         if (mode == LockMode::UPGRADING) {  // step 2
             if (txList.hasUpgrading_) {
@@ -51,23 +177,186 @@ namespace cmudb {
                               });
             if (it == txList.locks_.end() || it->mode_ != LockMode::SHARED ||
                 !it->granted_) {
+                if (txList.locks_.empty()) releaseList(shard, shard.lockTable_.find(rid));
                 txn->SetState(TransactionState::ABORTED);
                 return false;
             }
-            txList.locks_.erase(it);
-            assert(txn->GetSharedLockSet()->erase(rid) == 1);
+            txList.erase(it, &shard.freeItems_);
+            txn->GetSharedLockSet()->erase(rid);
+            // 原来的读锁可能挡着排在后面的请求
+            txList.grantWaiting();
         }
         // step 3
         bool canGrant = txList.checkCanGrant(mode);
         // WAIT-DIE policy
         //当事务Ti申请的数据项被Tj持有，仅当Ti的时间戳小于Tj的（Ti比Tj老）时，
         //允许Ti等待，否则Ti回滚（死亡）
-        if (!canGrant && txList.locks_.back().tid_ < txn->GetTransactionId()) {
+        //DETECTION模式下总是等待，由后台线程打破死锁
+        if (policy_ == DeadlockPolicy::WAIT_DIE && !canGrant &&
+            txList.locks_.back().tid_ < txn->GetTransactionId()) {
             txn->SetState(TransactionState::ABORTED);
             return false;
         }
         // step 4
-        txList.insert(txn, rid, mode, canGrant, &txListLatch);
+        bool upgradingMode = (mode == LockMode::UPGRADING);
+        auto it = txList.emplace(txList.locks_.end(), txn,
+                                 upgradingMode && canGrant ? LockMode::EXCLUSIVE
+                                                           : mode,
+                                 canGrant, &shard.freeItems_);
+        if (!canGrant) {
+            txList.hasUpgrading_ |= upgradingMode;
+            if (!txList.wait(it, &shardLatch, &shard.freeItems_)) {
+                if (txList.locks_.empty()) releaseList(shard, shard.lockTable_.find(rid));
+                return false;
+            }
+        }
+        if (mode == LockMode::SHARED) {
+            txn->GetSharedLockSet()->insert(rid);
+        } else {
+            txn->GetExclusiveLockSet()->insert(rid);
+        }
+        shardLatch.unlock();
+        countRowLock(txn, rid);
+        return true;
+    }
+
+/**
+ * 表锁和页锁的加锁。事务已经持有这个粒度上的锁时做锁转换：
+ * 1.新模式和其他事务已授予的锁都相容，原地转换
+ * 2.否则把转换请求插在所有等待请求的前面，授予后删掉原来的请求
+ * wait为false时(锁升级用)，不能立刻授予就直接返回false，不会回滚事务
+ */
+    bool LockManager::lockGranule(Transaction *txn, const RID &key,
+                                  LockMode mode, bool wait) {
+        LockTableShard &shard = getShard(key);
+        unique_lock<mutex> shardLatch(shard.mutex_);
+        TxList &txList = *acquireList(shard, key);
+        txn_id_t tid = txn->GetTransactionId();
+        auto own = find_if(txList.locks_.begin(), txList.locks_.end(),
+                           [tid](const TxItem &item) { return item.tid_ == tid; });
+        if (own != txList.locks_.end()) mode = supremum(own->mode_, mode);
+
+        // wait-die: 要等的事务里有比自己老的，自己就回滚
+        bool canGrant = true, waitsForOlder = false;
+        for (auto &tx : txList.locks_) {
+            if (tx.tid_ == tid || tx.aborted_) continue;
+            // 锁转换只需要和已授予的锁相容，新请求还要排在所有等待请求后面
+            if (own != txList.locks_.end() && !tx.granted_) continue;
+            if (!tx.granted_ || !compatible(tx.mode_, mode)) {
+                canGrant = false;
+                waitsForOlder |= tx.tid_ < tid;
+            }
+        }
+        if (canGrant) {
+            if (own != txList.locks_.end()) {
+                own->mode_ = mode;
+            } else {
+                txList.emplace(txList.locks_.end(), txn, mode, true, &shard.freeItems_);
+            }
+            return true;
+        }
+        if (!wait || (policy_ == DeadlockPolicy::WAIT_DIE && waitsForOlder)) {
+            if (txList.locks_.empty()) releaseList(shard, shard.lockTable_.find(key));
+            if (wait) txn->SetState(TransactionState::ABORTED);
+            return false;
+        }
+        auto pos = own != txList.locks_.end() ? txList.firstWaiting()
+                                              : txList.locks_.end();
+        auto it = txList.emplace(pos, txn, mode, false, &shard.freeItems_);
+        if (!txList.wait(it, &shardLatch, &shard.freeItems_)) {
+            if (txList.locks_.empty()) releaseList(shard, shard.lockTable_.find(key));
+            return false;
+        }
+        if (own != txList.locks_.end()) txList.erase(own, &shard.freeItems_);
+        return true;
+    }
+
+    bool LockManager::LockTable(Transaction *txn, page_id_t table_id,
+                                LockMode mode) {
+        auto tables = txn->GetTableLockSet();
+        auto held = tables->find(table_id);
+        if (held != tables->end() && supremum(held->second, mode) == held->second)
+            return true;
+        if (txn->GetState() != TransactionState::GROWING) {
+            txn->SetState(TransactionState::ABORTED);
+            return false;
+        }
+        if (!lockGranule(txn, RID(table_id, TABLE_LOCK_SLOT), mode, true))
+            return false;
+        if (held != tables->end()) mode = supremum(held->second, mode);
+        (*tables)[table_id] = mode;
+        return true;
+    }
+
+/**
+ * 加页锁之前先在表上加对应的意向锁：页上的IS/S需要表上的IS，其余需要IX
+ */
+    bool LockManager::LockPage(Transaction *txn, page_id_t table_id,
+                               page_id_t page_id, LockMode mode) {
+        auto pages = txn->GetPageLockSet();
+        auto held = pages->find(page_id);
+        if (held != pages->end() &&
+            supremum(held->second.second, mode) == held->second.second)
+            return true;
+        if (txn->GetState() != TransactionState::GROWING) {
+            txn->SetState(TransactionState::ABORTED);
+            return false;
+        }
+        bool readOnly = mode == LockMode::INTENTION_SHARED || mode == LockMode::SHARED;
+        if (!LockTable(txn, table_id,
+                       readOnly ? LockMode::INTENTION_SHARED
+                                : LockMode::INTENTION_EXCLUSIVE))
+            return false;
+        if (!lockGranule(txn, RID(page_id, PAGE_LOCK_SLOT), mode, true))
+            return false;
+        if (held != pages->end()) mode = supremum(held->second.second, mode);
+        (*pages)[page_id] = make_pair(table_id, mode);
+        return true;
+    }
+
+/**
+ * 页锁下面的行锁按表计数，到了阈值就尝试升级成表锁
+ */
+    void LockManager::countRowLock(Transaction *txn, const RID &rid) {
+        auto pages = txn->GetPageLockSet();
+        auto page = pages->find(rid.GetPageId());
+        if (page == pages->end()) return;
+        page_id_t table_id = page->second.first;
+        int &count = (*txn->GetRowLockCount())[table_id];
+        if (++count < escalation_threshold_) return;
+        // 升级失败也清零，再攒够一批行锁之后重试
+        count = 0;
+        escalate(txn, table_id);
+    }
+
+/**
+ * 锁升级：表上的IS升级为S，IX/SIX升级为X，然后释放这张表上所有的行锁。
+ * 升级只在不需要等待时进行，否则可能和持有意向锁的事务互相等待
+ */
+    bool LockManager::escalate(Transaction *txn, page_id_t table_id) {
+        auto tables = txn->GetTableLockSet();
+        auto table = tables->find(table_id);
+        if (table == tables->end()) return false;
+        LockMode target = table->second == LockMode::INTENTION_SHARED
+                          ? LockMode::SHARED : LockMode::EXCLUSIVE;
+        if (supremum(table->second, target) == table->second) return false;
+        if (!lockGranule(txn, RID(table_id, TABLE_LOCK_SLOT), target, false))
+            return false;
+        table->second = target;
+
+        auto pages = txn->GetPageLockSet();
+        txn_id_t tid = txn->GetTransactionId();
+        for (auto lockSet : {txn->GetSharedLockSet(), txn->GetExclusiveLockSet()}) {
+            for (auto it = lockSet->begin(); it != lockSet->end();) {
+                auto page = pages->find(it->GetPageId());
+                if (page != pages->end() && page->second.first == table_id) {
+                    release(*it, tid);
+                    it = lockSet->erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
         return true;
     }
 
@@ -76,9 +365,75 @@ namespace cmudb {
  * 2.随后定位到要删除的元素的TXLIST，从里面抹除，从TRANSACTIONS的LOCK集合里抹除对应的RID。
  * 3.然后判断是否TXLIST EMPTY，抹除对应的KEY。
  * 4.最后判断是否可以GRANT锁给其他的TX。
+ * 整个过程只持有RID所在分片的latch
  */
     bool LockManager::Unlock(Transaction *txn, const RID &rid) {
-        if (strict_2PL_) {  // step1
+        if (!checkUnlock(txn)) return false;  // step1
+        // step 2
+        // 行锁已经随锁升级释放掉了
+        if (txn->GetSharedLockSet()->erase(rid) == 0 &&
+            txn->GetExclusiveLockSet()->erase(rid) == 0)
+            return false;
+        bool released = release(rid, txn->GetTransactionId());
+        assert(released);
+        return released;
+    }
+
+    bool LockManager::UnlockTable(Transaction *txn, page_id_t table_id) {
+        if (!checkUnlock(txn)) return false;
+        txn->GetRowLockCount()->erase(table_id);
+        if (txn->GetTableLockSet()->erase(table_id) == 0) return false;
+        return release(RID(table_id, TABLE_LOCK_SLOT), txn->GetTransactionId());
+    }
+
+    bool LockManager::UnlockPage(Transaction *txn, page_id_t page_id) {
+        if (!checkUnlock(txn)) return false;
+        if (txn->GetPageLockSet()->erase(page_id) == 0) return false;
+        return release(RID(page_id, PAGE_LOCK_SLOT), txn->GetTransactionId());
+    }
+
+/**
+ * 沿着事务的请求链表收集所有的锁请求，按分片和TX LIST排序之后，
+ * 每个分片只加一次latch，每个TX LIST删完这个事务的请求后只唤醒一次
+ */
+    bool LockManager::UnlockAll(Transaction *txn) {
+        if (!checkUnlock(txn)) return false;
+        vector<TxItem *> items;
+        LockChainNode *head = txn->GetLockChain();
+        for (LockChainNode *node = head->next_; node != head; node = node->next_) {
+            items.push_back(static_cast<TxItem *>(node));
+        }
+        sort(items.begin(), items.end(), [](const TxItem *a, const TxItem *b) {
+            if (a->list_->shard_ != b->list_->shard_)
+                return a->list_->shard_ < b->list_->shard_;
+            return a->list_ < b->list_;
+        });
+        for (size_t i = 0; i < items.size();) {
+            LockTableShard &shard = *items[i]->list_->shard_;
+            lock_guard<mutex> shardLatch(shard.mutex_);
+            while (i < items.size() && items[i]->list_->shard_ == &shard) {
+                TxList *txList = items[i]->list_;
+                while (i < items.size() && items[i]->list_ == txList) {
+                    txList->erase(items[i]->self_, &shard.freeItems_);
+                    i++;
+                }
+                if (txList->locks_.empty()) {
+                    releaseList(shard, shard.lockTable_.find(txList->key_));
+                } else {
+                    txList->grantWaiting();
+                }
+            }
+        }
+        txn->GetSharedLockSet()->clear();
+        txn->GetExclusiveLockSet()->clear();
+        txn->GetPageLockSet()->clear();
+        txn->GetTableLockSet()->clear();
+        txn->GetRowLockCount()->clear();
+        return true;
+    }
+
+    bool LockManager::checkUnlock(Transaction *txn) {
+        if (strict_2PL_) {
             if (txn->GetState() != TransactionState::COMMITTED &&
                 txn->GetState() != TransactionState::ABORTED) {
                 txn->SetState(TransactionState::ABORTED);
@@ -87,43 +442,107 @@ namespace cmudb {
         } else if (txn->GetState() == TransactionState::GROWING) {
             txn->SetState(TransactionState::SHRINKING);
         }
-        unique_lock<mutex> tableLatch(mutex_);
-        TxList &txList = lockTable_[rid];
-        unique_lock<mutex> txListLatch(txList.mutex_);
-        // step 2
+        return true;
+    }
+
+    bool LockManager::release(const RID &key, txn_id_t tid) {
+        LockTableShard &shard = getShard(key);
+        lock_guard<mutex> shardLatch(shard.mutex_);
+        auto entry = shard.lockTable_.find(key);
+        if (entry == shard.lockTable_.end()) return false;
+        TxList &txList = *entry->second;
         auto it = find_if(txList.locks_.begin(), txList.locks_.end(),
-                          [txn](const TxItem &item) {
-                              return item.tid_ == txn->GetTransactionId();
-                          });
-        assert(it != txList.locks_.end());
-        auto lockSet = it->mode_ == LockMode::SHARED ? txn->GetSharedLockSet()
-                                                     : txn->GetExclusiveLockSet();
-        //set::erase返回：
-        //   1.（输入的参数为迭代器时）后随最后被移除的元素的迭代器
-        //   2.（输入的参数为key时）被移除的元素数
-        assert(lockSet->erase(rid) == 1);
-        txList.locks_.erase(it);
+                          [tid](const TxItem &item) { return item.tid_ == tid; });
+        if (it == txList.locks_.end()) return false;
+        txList.erase(it, &shard.freeItems_);
         //step 3
         //如果后面没有事务需要加锁，就把数据项从锁表中删除掉
         if (txList.locks_.empty()) {
-            lockTable_.erase(rid);
+            releaseList(shard, entry);
             return true;
         }
-        tableLatch.unlock();
         // step 4
-        for (auto &tx : txList.locks_) {
-            if (tx.granted_) break;
-            tx.Grant();  // grant blocking one
-            if (tx.mode_ == LockMode::SHARED) {
-                continue;
+        txList.grantWaiting();
+        return true;
+    }
+
+/**
+ * 死锁检测线程每隔CYCLE_DETECTION_INTERVAL醒来一次，检查等待图中是否有环
+ */
+    void LockManager::runCycleDetection() {
+        unique_lock<mutex> lk(detectionMutex_);
+        while (!detectionCv_.wait_for(lk, CYCLE_DETECTION_INTERVAL,
+                                      [this] { return stopDetection_; })) {
+            lk.unlock();
+            breakCycles();
+            lk.lock();
+        }
+    }
+
+/**
+ * 1.按顺序锁住所有分片，得到一个一致的等待图：每个等待中的请求指向排在它前面、
+ *   且与它不相容的请求所属的事务
+ * 2.从txn id最小的结点开始DFS找环，找到就回滚环中最年轻(txn id最大)的事务，
+ *   把它从图中删掉之后继续找，直到没有环为止
+ */
+    void LockManager::breakCycles() {
+        vector<unique_lock<mutex>> latches;
+        for (auto &shard : shards_) latches.emplace_back(shard.mutex_);
+
+        map<txn_id_t, set<txn_id_t>> waitsFor;
+        unordered_map<txn_id_t, TxItem *> waiting;
+        for (auto &shard : shards_) {
+            for (auto &entry : shard.lockTable_) {
+                auto &locks = entry.second->locks_;
+                for (auto it = locks.begin(); it != locks.end(); ++it) {
+                    if (it->granted_ || it->aborted_) continue;
+                    waiting[it->tid_] = &*it;
+                    for (auto ahead = locks.begin(); ahead != it; ++ahead) {
+                        if (ahead->aborted_ || ahead->tid_ == it->tid_) continue;
+                        if (compatible(ahead->mode_, it->mode_)) continue;
+                        waitsFor[it->tid_].insert(ahead->tid_);
+                    }
+                }
+            }
+        }
+
+        while (true) {
+            vector<txn_id_t> path;
+            set<txn_id_t> visited;
+            txn_id_t victim = INVALID_TXN_ID;
+            for (auto &node : waitsFor) {
+                if (findCycle(node.first, waitsFor, &path, &visited, &victim)) break;
             }
-            if (tx.mode_ == LockMode::UPGRADING) {
-                txList.hasUpgrading_ = false;
-                tx.mode_ = LockMode::EXCLUSIVE;
+            if (victim == INVALID_TXN_ID) break;
+            // 环上的事务都在等待，牺牲者醒来后自己把请求从队列中移除
+            TxItem *item = waiting[victim];
+            item->txn_->SetState(TransactionState::ABORTED);
+            item->Abort();
+            waitsFor.erase(victim);
+            for (auto &node : waitsFor) node.second.erase(victim);
+        }
+    }
+
+    bool LockManager::findCycle(txn_id_t tid,
+                                const map<txn_id_t, set<txn_id_t>> &waitsFor,
+                                vector<txn_id_t> *path, set<txn_id_t> *visited,
+                                txn_id_t *victim) {
+        auto onPath = find(path->begin(), path->end(), tid);
+        if (onPath != path->end()) {
+            *victim = *max_element(onPath, path->end());
+            return true;
+        }
+        // 已经搜索过并且不在环上
+        if (!visited->insert(tid).second) return false;
+        path->push_back(tid);
+        auto edges = waitsFor.find(tid);
+        if (edges != waitsFor.end()) {
+            for (txn_id_t next : edges->second) {
+                if (findCycle(next, waitsFor, path, visited, victim)) return true;
             }
-            break;
         }
-        return true;
+        path->pop_back();
+        return false;
     }
 
 }  // namespace cmudb
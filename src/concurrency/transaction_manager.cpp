@@ -5,23 +5,102 @@
 #include "concurrency/transaction_manager.h"
 #include "table/table_heap.h"
 
+#include <algorithm>
 #include <cassert>
+#include <iterator>
+#include <vector>
 namespace cmudb {
 
-    Transaction *TransactionManager::Begin() {
-        Transaction *txn = new Transaction(next_txn_id_++);
+    Transaction *TransactionManager::Begin(ConcurrencyMode mode) {
+        if (mode != ConcurrencyMode::TWO_PHASE_LOCKING) {
+            std::unique_lock<std::mutex> lk(txn_latch_);
+            losers_cv_.wait(lk, [this] { return losers_ == 0; });
+        }
+        Transaction *txn = new Transaction(next_txn_id_++, mode);
+
+        if (version_store_ != nullptr) {
+            std::lock_guard<std::mutex> guard(ts_latch_);
+            txn->SetReadTs(last_commit_ts_);
+            if (mode != ConcurrencyMode::TWO_PHASE_LOCKING)
+                active_snapshots_.insert(last_commit_ts_);
+        }
 
         if (ENABLE_LOGGING) {
             assert(txn->GetPrevLSN() == INVALID_LSN);
             LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::BEGIN};
+            std::lock_guard<std::mutex> guard(txn_latch_);
             txn->SetPrevLSN(log_manager_->AppendLogRecord(log));
+            active_txns_.emplace(txn->GetTransactionId(), txn->GetPrevLSN());
         }
 
         return txn;
     }
 
-    void TransactionManager::Commit(Transaction *txn) {
+    bool TransactionManager::Commit(Transaction *txn) {
+        lsn_t commit_lsn;
+        if (!orderCommit(txn, &commit_lsn)) return false;
+        // 读到txn的写的事务只能在锁释放之后加锁，它的提交记录在日志中排在txn后面，
+        // 等到它自己的提交记录持久化时txn一定也持久化了，不会先于txn报告成功。
+        // 不加锁的快照读没有这个顺序，commit_lsn已经包括了它读到的那些提交
+        if (commit_lsn != INVALID_LSN) log_manager_->WaitForPersistent(commit_lsn);
+        return true;
+    }
+
+    void TransactionManager::CommitAsync(Transaction *txn,
+                                         std::function<void(bool)> callback) {
+        lsn_t commit_lsn;
+        if (!orderCommit(txn, &commit_lsn)) {
+            callback(false);
+        } else if (commit_lsn == INVALID_LSN) {
+            callback(true);
+        } else {
+            log_manager_->OnPersistent(commit_lsn, [callback] { callback(true); });
+        }
+    }
+
+    std::future<bool> TransactionManager::CommitAsync(Transaction *txn) {
+        auto promise = std::make_shared<std::promise<bool>>();
+        CommitAsync(txn, [promise](bool committed) { promise->set_value(committed); });
+        return promise->get_future();
+    }
+
+/**
+ * 提交中不用等待日志落盘的部分：验证(乐观事务)、盖戳、追加COMMIT记录并释放所有的锁。
+ * 返回false表示乐观事务验证失败，已经回滚。
+ * 快照事务的commit_lsn是自己的COMMIT和它的快照能看到的所有COMMIT中最大的LSN
+ */
+    bool TransactionManager::orderCommit(Transaction *txn, lsn_t *commit_lsn) {
+        *commit_lsn = INVALID_LSN;
+        // the validation latch is held until the installed writes are stamped
+        std::unique_lock<std::mutex> validation(validation_latch_, std::defer_lock);
+        if (txn->GetMode() == ConcurrencyMode::OPTIMISTIC &&
+            !installWrites(txn, &validation)) {
+            if (validation.owns_lock()) validation.unlock();
+            txn->SetState(TransactionState::ABORTED);
+            rollback(txn);
+            return false;
+        }
         txn->SetState(TransactionState::COMMITTED);
+        // publish the new versions before the deletes below free their slots
+        timestamp_t oldest = -1;
+        bool unlogged = false;
+        if (version_store_ != nullptr) {
+            std::lock_guard<std::mutex> guard(ts_latch_);
+            txn->SetCommitTs(++last_commit_ts_);
+            version_store_->Commit(txn);
+            // 之后开始的快照能看到这些版本了，COMMIT记录要等下面的删除做完才追加
+            if (ENABLE_LOGGING) {
+                unlogged_commits_.insert(txn->GetCommitTs());
+                unlogged = true;
+            }
+            endSnapshot(txn);
+            if (++commits_since_gc_ == VERSION_GC_INTERVAL) {
+                commits_since_gc_ = 0;
+                oldest = active_snapshots_.empty() ? last_commit_ts_
+                                                   : *active_snapshots_.begin();
+            }
+        }
+        if (validation.owns_lock()) validation.unlock();
         // truly delete before commit
         auto write_set = txn->GetWriteSet();
         while (!write_set->empty()) {
@@ -35,30 +114,106 @@ namespace cmudb {
         }
         write_set->clear();
 
-        if (ENABLE_LOGGING) {//, you need to make sure your log records are permanently stored on disk file before release the
-            // locks. But instead of forcing flush, you need to wait for LOG_TIMEOUT or other operations to implicitly trigger
-            // the flush operations. write log and update transaction's prev_lsn here
+        if (ENABLE_LOGGING) {
+            // write log and update transaction's prev_lsn here
+            // 暂存的记录和COMMIT一起合并到日志中，整个事务只预留一次
             LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::COMMIT};
-            txn->SetPrevLSN(log_manager_->AppendLogRecord(log));
-            log_manager_->Flush(false);
+            *commit_lsn = log_manager_->MergeLogRecords(txn, &log);
+            endTxn(txn);
         }
-
-        // release all the lock
-        std::unordered_set<RID> lock_set;
-        for (auto item : *txn->GetSharedLockSet())
-            lock_set.emplace(item);
-        for (auto item : *txn->GetExclusiveLockSet())
-            lock_set.emplace(item);
-        // release all the lock
-        for (auto locked_rid : lock_set) {
-            lock_manager_->Unlock(txn, locked_rid);
+        if (unlogged) {
+            std::lock_guard<std::mutex> guard(ts_latch_);
+            unlogged_commits_.erase(txn->GetCommitTs());
+            max_commit_lsn_ = std::max(max_commit_lsn_, *commit_lsn);
+            logged_cv_.notify_all();
         }
+
+        // early lock release: the commit record is in the log buffer, so the
+        // locks go now instead of after the group flush
+        lock_manager_->UnlockAll(txn);
+        if (oldest >= 0) version_store_->Collect(oldest);
+        // a snapshot read takes no lock, so it may have seen versions whose
+        // COMMIT follows ours in the log: wait for those as well
+        if (*commit_lsn != INVALID_LSN &&
+            txn->GetMode() != ConcurrencyMode::TWO_PHASE_LOCKING)
+            *commit_lsn = std::max(*commit_lsn, observedCommitLSN(txn));
+        return true;
+    }
+
+/**
+ * 提交时间戳不大于txn快照的提交都已经追加了COMMIT之后，它们中最大的LSN
+ * 不会超过max_commit_lsn_。发布版本和追加COMMIT之间只有删除，等待很短
+ */
+    lsn_t TransactionManager::observedCommitLSN(Transaction *txn) {
+        std::unique_lock<std::mutex> lk(ts_latch_);
+        logged_cv_.wait(lk, [this, txn] {
+            return unlogged_commits_.empty() ||
+                   *unlogged_commits_.begin() > txn->GetReadTs();
+        });
+        return max_commit_lsn_;
     }
 
     void TransactionManager::Abort(Transaction *txn) {
         txn->SetState(TransactionState::ABORTED);
+        // 乐观事务缓冲的更新和删除还没有写到页面上，直接丢掉
+        if (txn->GetMode() == ConcurrencyMode::OPTIMISTIC) {
+            auto write_set = txn->GetWriteSet();
+            write_set->erase(std::remove_if(write_set->begin(), write_set->end(),
+                                            [](const WriteRecord &item) {
+                                                return item.wtype_ != WType::INSERT;
+                                            }),
+                             write_set->end());
+        }
+        rollback(txn);
+    }
+
+/**
+ * 插入在执行时已经写到页面上了(对别的快照不可见)，缓冲在write_set_中的只有更新和删除。
+ * 先按RID的顺序给它们加写锁，然后在validation_latch_下验证读集和写集中的元组
+ * 在快照之后都没有被改过，最后按原来的顺序把写装到页面上。
+ * 装上的写重新以普通的写记录追加到write_set_中，失败时可以照常回滚
+ */
+    bool TransactionManager::installWrites(
+            Transaction *txn, std::unique_lock<std::mutex> *validation) {
+        assert(version_store_ != nullptr);
+        auto write_set = txn->GetWriteSet();
+        auto buffered_begin = std::stable_partition(
+                write_set->begin(), write_set->end(),
+                [](const WriteRecord &item) { return item.wtype_ == WType::INSERT; });
+        std::vector<WriteRecord> buffered(buffered_begin, write_set->end());
+        write_set->erase(buffered_begin, write_set->end());
+
+        std::vector<const WriteRecord *> lock_order;
+        for (auto &item : buffered) lock_order.push_back(&item);
+        std::sort(lock_order.begin(), lock_order.end(),
+                  [](const WriteRecord *a, const WriteRecord *b) {
+                      return a->rid_.Get() < b->rid_.Get();
+                  });
+        for (auto item : lock_order) {
+            if (!item->table_->LockBufferedWrite(item->rid_, txn)) return false;
+        }
+
+        validation->lock();
+        for (auto &rid : *txn->GetReadSet()) {
+            if (!version_store_->Validate(txn, rid)) return false;
+        }
+        for (auto &item : buffered) {
+            if (!version_store_->Validate(txn, item.rid_)) return false;
+        }
+        for (auto &item : buffered) {
+            if (!item.table_->ApplyBufferedWrite(item, txn)) return false;
+        }
+        return true;
+    }
+
+    // undo the writes in the write set, then release every lock
+    void TransactionManager::rollback(Transaction *txn) {
         // rollback before releasing lock
         auto write_set = txn->GetWriteSet();
+        std::vector<RID> written;
+        if (version_store_ != nullptr) {
+            for (auto &item : *write_set) written.push_back(item.rid_);
+        }
         while (!write_set->empty()) {
             auto &item = write_set->back();
             auto table = item.table_;
@@ -75,23 +230,72 @@ namespace cmudb {
             write_set->pop_back();
         }
         write_set->clear();
+        // the pages are restored, the old versions become the newest again
+        if (version_store_ != nullptr) {
+            version_store_->Rollback(txn, written);
+            std::lock_guard<std::mutex> guard(ts_latch_);
+            endSnapshot(txn);
+        }
 
         if (ENABLE_LOGGING) {
             // write log and update transaction's prev_lsn here
             LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::ABORT};
-            txn->SetPrevLSN(log_manager_->AppendLogRecord(log));
-            log_manager_->Flush(false);
+            log_manager_->MergeLogRecords(txn, &log);
+            endTxn(txn);
         }
 
-        // release all the lock
-        std::unordered_set<RID> lock_set;
-        for (auto item : *txn->GetSharedLockSet())
-            lock_set.emplace(item);
-        for (auto item : *txn->GetExclusiveLockSet())
-            lock_set.emplace(item);
-        // release all the lock
-        for (auto locked_rid : lock_set) {
-            lock_manager_->Unlock(txn, locked_rid);
-        }
+        // release all the lock, the abort record does not have to be durable:
+        // without it recovery rolls txn back anyway
+        lock_manager_->UnlockAll(txn);
+    }
+
+/**
+ * 模糊检查点的开始：BEGIN_CHECKPOINT和活跃事务表的拷贝都在txn_latch_下进行，
+ * 这期间没有事务能追加BEGIN，表中的事务正好是在检查点开始时还没结束的事务
+ */
+    lsn_t TransactionManager::BeginCheckpoint(ActiveTxnTable *active_txns) {
+        assert(ENABLE_LOGGING);
+        LogRecord log{INVALID_TXN_ID, INVALID_LSN, LogRecordType::BEGIN_CHECKPOINT};
+        std::lock_guard<std::mutex> guard(txn_latch_);
+        lsn_t begin_lsn = log_manager_->AppendLogRecord(log);
+        active_txns->assign(active_txns_.begin(), active_txns_.end());
+        return begin_lsn;
+    }
+
+    Transaction *TransactionManager::AdoptLoser(txn_id_t txn_id, lsn_t begin_lsn,
+                                                lsn_t last_lsn) {
+        assert(ENABLE_LOGGING);
+        txn_id_t next = next_txn_id_;
+        while (next <= txn_id && !next_txn_id_.compare_exchange_weak(next, txn_id + 1)) {}
+        Transaction *txn = new Transaction(txn_id);
+        txn->SetPrevLSN(last_lsn);
+        std::lock_guard<std::mutex> guard(txn_latch_);
+        // 检查点的redo点不会越过loser的BEGIN，回滚完之前再崩溃也能重新回滚
+        active_txns_.emplace(txn_id, begin_lsn);
+        losers_++;
+        return txn;
+    }
+
+    void TransactionManager::EndLoser(Transaction *txn) {
+        txn->SetState(TransactionState::ABORTED);
+        LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::ABORT};
+        txn->SetPrevLSN(log_manager_->AppendLogRecord(log));
+        endTxn(txn);
+        lock_manager_->UnlockAll(txn);
+        std::lock_guard<std::mutex> guard(txn_latch_);
+        if (--losers_ == 0) losers_cv_.notify_all();
+    }
+
+    // COMMIT或ABORT已经在日志缓冲中
+    void TransactionManager::endTxn(Transaction *txn) {
+        std::lock_guard<std::mutex> guard(txn_latch_);
+        active_txns_.erase(txn->GetTransactionId());
+    }
+
+    // caller holds ts_latch_
+    void TransactionManager::endSnapshot(Transaction *txn) {
+        if (txn->GetMode() == ConcurrencyMode::TWO_PHASE_LOCKING) return;
+        auto it = active_snapshots_.find(txn->GetReadTs());
+        if (it != active_snapshots_.end()) active_snapshots_.erase(it);
     }
 } // namespace cmudb
@@ -0,0 +1,139 @@
+/**
+ * version_store.cpp
+ */
+
+#include <algorithm>
+
+#include "concurrency/version_store.h"
+
+namespace cmudb {
+
+/**
+ * 别人没有提交的版本，或者在自己的快照之后提交的版本，都说明快照读到的已经过时了。
+ * 没有版本链时页面上的版本比所有活跃的快照都老，对txn一定可见
+ */
+    bool VersionStore::Validate(Transaction *txn, const RID &rid) {
+        VersionShard &shard = getShard(rid);
+        std::lock_guard<std::mutex> guard(shard.mutex_);
+        auto it = shard.chains_.find(rid);
+        if (it == shard.chains_.end()) return true;
+        const VersionChain &chain = it->second;
+        if (chain.writer_ != INVALID_TXN_ID)
+            return chain.writer_ == txn->GetTransactionId();
+        return chain.ts_ <= txn->GetReadTs();
+    }
+
+/**
+ * 快照事务只能在页面上的版本对自己可见时覆盖它。
+ * 乐观事务在提交时已经验证过，安装写的时候不再检查
+ */
+    bool VersionStore::CheckWrite(Transaction *txn, const RID &rid) {
+        if (txn->GetMode() != ConcurrencyMode::SNAPSHOT_ISOLATION) return true;
+        return Validate(txn, rid);
+    }
+
+/**
+ * 同一个事务多次写同一个元组时只保留写之前提交的那个版本
+ * 没有版本链说明页面上的版本比所有活跃的快照都老，时间戳记为0
+ */
+    void VersionStore::RecordWrite(Transaction *txn, const RID &rid,
+                                   const Tuple *old) {
+        VersionShard &shard = getShard(rid);
+        std::lock_guard<std::mutex> guard(shard.mutex_);
+        VersionChain &chain = shard.chains_[rid];
+        if (chain.writer_ == txn->GetTransactionId()) return;
+        UndoVersion undo{chain.ts_, old != nullptr, Tuple{}};
+        if (old != nullptr) undo.tuple_ = *old;
+        chain.undo_.push_front(std::move(undo));
+        chain.writer_ = txn->GetTransactionId();
+    }
+
+    VersionStore::Visibility VersionStore::Read(Transaction *txn, const RID &rid,
+                                                Tuple *tuple) {
+        VersionShard &shard = getShard(rid);
+        std::lock_guard<std::mutex> guard(shard.mutex_);
+        auto it = shard.chains_.find(rid);
+        if (it == shard.chains_.end()) return Visibility::IN_PLACE;
+        const VersionChain &chain = it->second;
+        if (chain.writer_ == txn->GetTransactionId()) return Visibility::IN_PLACE;
+        if (chain.writer_ == INVALID_TXN_ID && chain.ts_ <= txn->GetReadTs())
+            return Visibility::IN_PLACE;
+        for (auto &undo : chain.undo_) {
+            if (undo.ts_ > txn->GetReadTs()) continue;
+            if (!undo.present_) return Visibility::INVISIBLE;
+            *tuple = undo.tuple_;
+            return Visibility::UNDO;
+        }
+        return Visibility::INVISIBLE;
+    }
+
+/**
+ * 调用者保证提交按时间戳顺序串行进行，新的快照要么看到一个事务的全部写，
+ * 要么一个都看不到
+ */
+    void VersionStore::Commit(Transaction *txn) {
+        for (auto &item : *txn->GetWriteSet()) {
+            VersionShard &shard = getShard(item.rid_);
+            std::lock_guard<std::mutex> guard(shard.mutex_);
+            auto it = shard.chains_.find(item.rid_);
+            if (it == shard.chains_.end() ||
+                it->second.writer_ != txn->GetTransactionId())
+                continue;
+            it->second.writer_ = INVALID_TXN_ID;
+            it->second.ts_ = txn->GetCommitTs();
+        }
+    }
+
+/**
+ * 页面已经恢复成写之前的样子，把链头的旧版本弹出来作为页面上的版本。
+ * 链空了并且时间戳是0，说明链是这个事务建的，页面上的版本对谁都可见，直接删掉
+ */
+    void VersionStore::Rollback(Transaction *txn, const std::vector<RID> &rids) {
+        for (auto &rid : rids) {
+            VersionShard &shard = getShard(rid);
+            std::lock_guard<std::mutex> guard(shard.mutex_);
+            auto it = shard.chains_.find(rid);
+            if (it == shard.chains_.end() ||
+                it->second.writer_ != txn->GetTransactionId())
+                continue;
+            VersionChain &chain = it->second;
+            chain.writer_ = INVALID_TXN_ID;
+            chain.ts_ = chain.undo_.front().ts_;
+            chain.undo_.pop_front();
+            if (chain.undo_.empty() && chain.ts_ == 0) shard.chains_.erase(it);
+        }
+    }
+
+/**
+ * 所有活跃的快照都能看到页面上的版本时，整条链都可以删掉；
+ * 否则只保留每个快照可能读到的版本：第一个ts不大于oldest的旧版本及更新的版本
+ */
+    void VersionStore::Collect(timestamp_t oldest) {
+        for (auto &shard : shards_) {
+            std::lock_guard<std::mutex> guard(shard.mutex_);
+            for (auto it = shard.chains_.begin(); it != shard.chains_.end();) {
+                VersionChain &chain = it->second;
+                if (chain.writer_ == INVALID_TXN_ID && chain.ts_ <= oldest) {
+                    it = shard.chains_.erase(it);
+                    continue;
+                }
+                auto visible = std::find_if(
+                        chain.undo_.begin(), chain.undo_.end(),
+                        [oldest](const UndoVersion &undo) { return undo.ts_ <= oldest; });
+                if (visible != chain.undo_.end())
+                    chain.undo_.erase(visible + 1, chain.undo_.end());
+                ++it;
+            }
+        }
+    }
+
+    size_t VersionStore::Size() {
+        size_t size = 0;
+        for (auto &shard : shards_) {
+            std::lock_guard<std::mutex> guard(shard.mutex_);
+            size += shard.chains_.size();
+        }
+        return size;
+    }
+
+} // namespace cmudb
@@ -1,11 +1,15 @@
 /**
  * disk_manager.cpp
  */
+#include <algorithm>
 #include <assert.h>
 #include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
 #include <iostream>
 #include <sys/stat.h>
 #include <thread>
+#include <unistd.h>
 
 #include "common/logger.h"
 #include "disk/disk_manager.h"
@@ -17,9 +21,11 @@ namespace cmudb {
  * 打开/创建一个数据库文件和日志文件
  * 输入参数为数据库的名字
  */
-    DiskManager::DiskManager(const std::string &db_file)
-            : file_name_(db_file), next_page_id_(0), num_flushes_(0), flush_log_(false),
-              flush_log_f_(nullptr) {
+    DiskManager::DiskManager(const std::string &db_file, int log_stripes,
+                             int64_t log_segment_size)
+            : log_stripes_(log_stripes), log_segment_size_(log_segment_size),
+              log_start_(0), log_end_(0), file_name_(db_file), next_page_id_(0),
+              num_flushes_(0), num_data_syncs_(0), flush_log_(false), flush_log_f_(nullptr) {
         std::string::size_type n = file_name_.find(".");
         //没有在文件名字中发现“.”，文件格式不正确
         if (n == std::string::npos) {
@@ -27,19 +33,30 @@ namespace cmudb {
             return;
         }
         log_name_ = file_name_.substr(0, n) + ".log";
+        master_name_ = file_name_.substr(0, n) + ".master";
 
-        log_io_.open(log_name_,
-                     std::ios::binary | std::ios::in | std::ios::app | std::ios::out);
-        // 如果打开或创建文件失败
-        if (!log_io_.is_open()) {
-            log_io_.clear();
-            // 重新创建
-            log_io_.open(log_name_, std::ios::binary | std::ios::trunc | std::ios::app |
-                                    std::ios::out);
-            log_io_.close();
-            // 以原来的模式重新打开文件
-            log_io_.open(log_name_, std::ios::binary | std::ios::in | std::ios::app |
-                                    std::ios::out);
+        if (log_segment_size_ == 0) {
+            openSegment(0);
+        } else {
+            // 找出目录中所有的段：<log_name_>.<16位十六进制的起始偏移量>
+            std::string::size_type slash = log_name_.rfind('/');
+            std::string dir = slash == std::string::npos ? "." : log_name_.substr(0, slash);
+            std::string prefix = log_name_.substr(slash + 1) + ".";
+            DIR *dirp = opendir(dir.c_str());
+            while (dirp != nullptr) {
+                struct dirent *entry = readdir(dirp);
+                if (entry == nullptr) break;
+                std::string name = entry->d_name;
+                if (name.size() != prefix.size() + 16 || name.compare(0, prefix.size(), prefix) != 0 ||
+                    name.find_first_not_of("0123456789abcdef", prefix.size()) != std::string::npos)
+                    continue;
+                openSegment(std::stoll(name.substr(prefix.size()), nullptr, 16));
+            }
+            if (dirp != nullptr) closedir(dirp);
+        }
+        if (!log_segments_.empty()) {
+            log_start_ = log_segments_.begin()->first;
+            log_end_ = log_segments_.rbegin()->first + log_segments_.rbegin()->second.size;
         }
 
         db_io_.open(db_file,
@@ -50,11 +67,13 @@ namespace cmudb {
             db_io_.close();
             db_io_.open(db_file, std::ios::binary | std::ios::in | std::ios::out);
         }
+        db_fd_ = open(db_file.c_str(), O_RDONLY);
     }
 
     DiskManager::~DiskManager() {
         db_io_.close();
-        log_io_.close();
+        if (db_fd_ >= 0) close(db_fd_);
+        for (auto &segment : log_segments_) closeSegment(segment.second);
     }
 
 /**
@@ -79,9 +98,11 @@ namespace cmudb {
  */
     void DiskManager::ReadPage(page_id_t page_id, char *page_data) {
         int offset = page_id * PAGE_SIZE;
-        //检查给的page_id是否合法
-        if (offset > GetFileSize(file_name_)) {
-            LOG_DEBUG("I/O error while reading");
+        if (offset >= GetFileSize(file_name_)) {
+            // 还没写过的页面(分配了还没刷出去，或者崩溃前没来得及写)，不是I/O错误，
+            // redo从全零的页面开始。不能去读：读到文件末尾
+            // 会让db_io_进入fail状态，之后的读写都不再生效
+            memset(page_data, 0, PAGE_SIZE);
         } else {
             // 从offset位置开始读取
             db_io_.seekp(offset);
@@ -97,16 +118,41 @@ namespace cmudb {
         }
     }
 
+/**
+ * WritePage每次都flush了流，写过的页面都已经在内核里，同步只读的描述符就够了，
+ * 不用碰db_io_(它由缓冲池的latch保护)
+ */
+    bool DiskManager::SyncData() {
+        if (db_fd_ < 0 || fdatasync(db_fd_) != 0) {
+            LOG_DEBUG("I/O error while syncing the db file");
+            return false;
+        }
+        num_data_syncs_++;
+        return true;
+    }
+
+/**
+ * 让内核异步地把页面读进页缓存，之后的ReadPage不用等待磁盘。并行redo的
+ * 每个线程在处理一批记录之前预取它们的页面，这样同时在途的读请求就有很多个
+ */
+    void DiskManager::PrefetchPage(page_id_t page_id) {
+        if (db_fd_ < 0) return;
+        posix_fadvise(db_fd_, static_cast<off_t>(page_id) * PAGE_SIZE, PAGE_SIZE,
+                      POSIX_FADV_WILLNEED);
+    }
+
 /**
  * 将日志内容写入磁盘文件
- * 仅在同步完成后返回，并且仅执行顺序写入
+ * 仅在fdatasync完成后返回，并且仅执行顺序写入。
+ * 跨越多个条带时每个条带文件由一个线程并行写入和同步
+ * @return: false表示写入或同步失败，这些日志不算写到了磁盘
  */
-    void DiskManager::WriteLog(char *log_data, int size) {
+    bool DiskManager::WriteLog(char *log_data, int size) {
         assert(log_data != buffer_used);
         buffer_used = log_data;
         //如果日志缓冲区为空，则对num_flushes_没有影响
         if (size == 0)
-            return;
+            return true;
 
         flush_log_ = true;
 
@@ -115,36 +161,225 @@ namespace cmudb {
                    std::future_status::ready);
 
         num_flushes_ += 1;
-        log_io_.write(log_data, size);
-
-        if (log_io_.bad()) {
+        std::lock_guard<std::mutex> latch(log_latch_);
+        // 当前段写满后在两次写之间切到新的段
+        if (log_segments_.empty() ||
+            (log_segment_size_ > 0 && log_segments_.rbegin()->second.size >= log_segment_size_))
+            openSegment(log_end_);
+        LogSegment &segment = log_segments_.rbegin()->second;
+        int64_t offset = segment.size;
+        // 一次写入涉及的条带数
+        int touched = std::min<int64_t>(
+                log_stripes_, (offset + size - 1) / LOG_STRIPE_SIZE - offset / LOG_STRIPE_SIZE + 1);
+        std::vector<std::future<bool>> writers;
+        for (int i = 1; i < touched; i++)
+            writers.push_back(std::async(std::launch::async, [&, i] {
+                return writeStripe(segment, (stripeOf(offset) + i) % log_stripes_, log_data,
+                                   offset, size);
+            }));
+        bool written = writeStripe(segment, stripeOf(offset), log_data, offset, size);
+        for (auto &writer : writers) written = writer.get() && written;
+        flush_log_ = false;
+        if (!written) {
+            // 段的大小不变，重试时写回同一个位置，可以用同一个缓冲区
             LOG_DEBUG("I/O error while writing log");
-            return;
+            buffer_used = nullptr;
+            return false;
         }
-        // 需要刷新以保持磁盘文件同步
-        log_io_.flush();
-        flush_log_ = false;
+        segment.size += size;
+        log_end_ = segment.start + segment.size;
+        return true;
+    }
+
+    bool DiskManager::writeStripe(LogSegment &segment, int stripe, const char *log_data,
+                                  int64_t offset, int size) {
+        int fd = segment.fds[stripe];
+        if (fd < 0) return false;
+        for (int64_t pos = offset; pos < offset + size;) {
+            int64_t chunk = std::min<int64_t>(offset + size,
+                                              (pos / LOG_STRIPE_SIZE + 1) * LOG_STRIPE_SIZE) - pos;
+            if (stripeOf(pos) == stripe) {
+                int64_t physical = physicalOf(pos);
+                reserveLog(segment, stripe, physical + chunk);
+                // pwrite可能只写了一部分
+                for (int64_t done = 0; done < chunk;) {
+                    ssize_t n = pwrite(fd, log_data + (pos - offset) + done,
+                                       chunk - done, physical + done);
+                    if (n <= 0) return false;
+                    done += n;
+                }
+            }
+            pos += chunk;
+        }
+        // 只同步数据和文件大小，不需要同步修改时间等元数据
+        return fdatasync(fd) == 0;
+    }
+
+    void DiskManager::reserveLog(LogSegment &segment, int stripe, int64_t end) {
+        int64_t &reserved = segment.reserved[stripe];
+        if (end <= reserved) return;
+        int64_t reserve = (end - reserved + LOG_PREALLOCATE_SIZE - 1) /
+                          LOG_PREALLOCATE_SIZE * LOG_PREALLOCATE_SIZE;
+        // 分段时不需要预留超过一个段的空间
+        if (log_segment_size_ > 0)
+            reserve = std::max(end - reserved, std::min(
+                    reserve, physicalOf(log_segment_size_ + LOG_STRIPE_SIZE) - reserved));
+#ifdef FALLOC_FL_KEEP_SIZE
+        // 预留失败不影响正确性，写的时候再分配
+        fallocate(segment.fds[stripe], FALLOC_FL_KEEP_SIZE, reserved, reserve);
+#endif
+        reserved += reserve;
+    }
+
+    std::string DiskManager::segmentName(int64_t start, int stripe) const {
+        std::string name = log_name_;
+        if (log_segment_size_ > 0) {
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(start));
+            name += std::string(".") + hex;
+        }
+        return stripe == 0 ? name : name + "." + std::to_string(stripe);
+    }
+
+    DiskManager::LogSegment &DiskManager::openSegment(int64_t start) {
+        LogSegment &segment = log_segments_[start];
+        segment.start = start;
+        for (int i = 0; i < log_stripes_; i++) {
+            std::string name = segmentName(start, i);
+            int fd = open(name.c_str(), O_RDWR | O_CREAT, 0644);
+            if (fd < 0) {
+                LOG_DEBUG("can't open log file %s", name.c_str());
+            }
+            segment.fds.push_back(fd);
+            segment.reserved.push_back(0);
+            struct stat stat_buf;
+            if (fd < 0 || fstat(fd, &stat_buf) != 0 || stat_buf.st_size == 0)
+                continue;
+            // 条带文件中最后一个(可能不满的)单元在段中的位置
+            int64_t units = (stat_buf.st_size - 1) / LOG_STRIPE_SIZE;
+            int64_t end = (units * log_stripes_ + i) * LOG_STRIPE_SIZE +
+                          (stat_buf.st_size - units * LOG_STRIPE_SIZE);
+            segment.size = std::max(segment.size, end);
+            segment.reserved[i] = stat_buf.st_size;
+        }
+        return segment;
+    }
+
+    void DiskManager::closeSegment(LogSegment &segment) {
+        for (int fd : segment.fds)
+            if (fd >= 0) close(fd);
+        segment.fds.clear();
+    }
+
+/**
+ * 删除或归档所有在offset之前结束的段，当前正在写的段总是保留。
+ * 段以记录开头，所以截断之后redo仍然可以从GetLogStart()开始
+ */
+    int DiskManager::TruncateLog(int64_t offset) {
+        std::lock_guard<std::mutex> latch(log_latch_);
+        if (log_segment_size_ == 0) return 0;
+        int removed = 0;
+        while (log_segments_.size() > 1) {
+            auto next = std::next(log_segments_.begin());
+            if (next->first > offset) break;
+            LogSegment &segment = log_segments_.begin()->second;
+            closeSegment(segment);
+            for (int i = 0; i < log_stripes_; i++) {
+                std::string name = segmentName(segment.start, i);
+                if (log_archive_.empty()) {
+                    unlink(name.c_str());
+                } else {
+                    std::string::size_type slash = name.rfind('/');
+                    std::string archived = log_archive_ + "/" + name.substr(slash + 1);
+                    if (rename(name.c_str(), archived.c_str()) != 0) {
+                        LOG_DEBUG("can't archive log file %s", name.c_str());
+                    }
+                }
+            }
+            log_segments_.erase(log_segments_.begin());
+            log_start_ = next->first;
+            removed++;
+        }
+        return removed;
+    }
+
+/**
+ * 先写临时文件并同步，再rename覆盖原来的主记录，崩溃时要么是旧的要么是新的
+ */
+    bool DiskManager::WriteMasterRecord(int64_t checkpoint_offset, lsn_t checkpoint_lsn,
+                                        int64_t redo_offset) {
+        int64_t record[3] = {checkpoint_offset, checkpoint_lsn, redo_offset};
+        std::string temp = master_name_ + ".tmp";
+        int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, record, sizeof(record)) != sizeof(record) ||
+            fdatasync(fd) != 0) {
+            LOG_DEBUG("I/O error while writing master record");
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        close(fd);
+        if (rename(temp.c_str(), master_name_.c_str()) != 0) {
+            LOG_DEBUG("I/O error while writing master record");
+            return false;
+        }
+        return true;
+    }
+
+/**
+ * 主记录指向的位置不在现有的日志中时(比如日志被删掉了)当作没有检查点
+ */
+    bool DiskManager::ReadMasterRecord(int64_t *checkpoint_offset, lsn_t *checkpoint_lsn,
+                                       int64_t *redo_offset) {
+        int64_t record[3];
+        int fd = open(master_name_.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        bool read_all = read(fd, record, sizeof(record)) == sizeof(record);
+        close(fd);
+        if (!read_all || record[0] < log_start_ || record[0] >= log_end_ ||
+            record[2] < log_start_ || record[2] > record[0])
+            return false;
+        *checkpoint_offset = record[0];
+        *checkpoint_lsn = static_cast<lsn_t>(record[1]);
+        *redo_offset = record[2];
+        return true;
+    }
+
+    void DiskManager::SetLogArchive(const std::string &dir) {
+        std::lock_guard<std::mutex> latch(log_latch_);
+        log_archive_ = dir;
     }
 
 /**
  * 将日志内容读入给定的存储区
- * 始终从头开始读取并执行顺序读取
+ * 从GetLogStart()开始执行顺序读取，可以跨越段和条带
  * @return: false表示已经结束
  */
-    bool DiskManager::ReadLog(char *log_data, int size, int offset) {
-        if (offset >= GetFileSize(log_name_)) {
+    bool DiskManager::ReadLog(char *log_data, int size, int64_t offset) {
+        std::lock_guard<std::mutex> latch(log_latch_);
+        if (offset >= log_end_ || offset < log_start_) {
             // LOG_DEBUG("end of log file");
-            // LOG_DEBUG("file size is %d", GetFileSize(log_name_));
             return false;
         }
-        log_io_.seekp(offset);
-        log_io_.read(log_data, size);
+        int read_count = 0;
+        int readable = static_cast<int>(std::min<int64_t>(size, log_end_ - offset));
+        auto segment = std::prev(log_segments_.upper_bound(offset));
+        while (read_count < readable) {
+            int64_t pos = offset + read_count - segment->first;
+            if (pos >= segment->second.size) {
+                ++segment;
+                continue;
+            }
+            int chunk = static_cast<int>(std::min<int64_t>(
+                    std::min<int64_t>(readable - read_count, segment->second.size - pos),
+                    LOG_STRIPE_SIZE - pos % LOG_STRIPE_SIZE));
+            ssize_t n = pread(segment->second.fds[stripeOf(pos)], log_data + read_count,
+                              chunk, physicalOf(pos));
+            if (n <= 0) break;
+            read_count += n;
+        }
         // if log file ends before reading "size"
-        int read_count = log_io_.gcount();
-        if (read_count < size) {
-            log_io_.clear();
+        if (read_count < size)
             memset(log_data + read_count, 0, size - read_count);
-        }
 
         return true;
     }
@@ -166,6 +401,8 @@ namespace cmudb {
  */
     int DiskManager::GetNumFlushes() const { return num_flushes_; }
 
+    int DiskManager::GetNumDataSyncs() const { return num_data_syncs_; }
+
 /**
  * 如果当前正在清除日志，则返回true
  */
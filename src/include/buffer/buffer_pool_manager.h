@@ -36,6 +36,9 @@ namespace cmudb {
 
         bool CheckAllUnpined();
 
+        // page -> recLSN of every page with logged changes not yet on disk
+        DirtyPageTable GetDirtyPageTable();
+
     private:
         size_t pool_size_; // number of pages in buffer pool
         Page *pages_;      // array of pages
@@ -46,6 +49,8 @@ namespace cmudb {
         std::list<Page *> *free_list_; // to find a free page for replacement
         std::mutex latch_;             // to protect shared data structure
         Page *GetVictimPage();
+        // 写回磁盘之前清掉recLSN，之后的修改会重新设置它
+        void writePage(Page *page);
 
     };
 } // namespace cmudb
@@ -14,8 +14,17 @@ namespace cmudb {
 
 extern std::chrono::duration<long long int> LOG_TIMEOUT;
 
+extern std::chrono::milliseconds CYCLE_DETECTION_INTERVAL;
+
+extern std::chrono::microseconds GROUP_COMMIT_MAX_DELAY;
+
+extern std::chrono::milliseconds CHECKPOINT_INTERVAL;
+
 extern std::atomic<bool> ENABLE_LOGGING;
 
+// LZ4 compression level of flushed log segments, 0 writes them as they are
+extern std::atomic<int> LOG_COMPRESSION_LEVEL;
+
 #define INVALID_PAGE_ID -1 // representing an invalid page id
 #define INVALID_TXN_ID -1  // representing an invalid txn id
 #define INVALID_LSN -1     // representing an invalid lsn
@@ -23,11 +32,29 @@ extern std::atomic<bool> ENABLE_LOGGING;
 #define PAGE_SIZE 512     // size of a data page in byte
 #define LOG_BUFFER_SIZE                                                            \
   ((BUFFER_POOL_SIZE + 1) * PAGE_SIZE) // size of a log buffer in byte
+#define LOG_BUFFER_COUNT 4             // log buffer segments in the ring
+#define TXN_LOG_BUFFER_SIZE 2048      // bytes a transaction stages before merging
+#define GROUP_COMMIT_SIZE 8            // waiting commits that trigger a flush
+#define GROUP_COMMIT_BYTES 1024        // unflushed bytes that trigger a flush
+#define LOG_STRIPE_COUNT 1             // log files the log is striped across
+#define LOG_STRIPE_SIZE 4096           // bytes per log stripe unit
+#define LOG_PREALLOCATE_SIZE (1 << 20) // log file space reserved ahead of writes
+#define LOG_SEGMENT_SIZE 0             // bytes per log segment, 0 for one log file
+#define RECOVERY_THREADS 4             // threads applying redo records
+#define LOG_READ_SIZE (1 << 20)        // log bytes recovery reads at once
+#define LOG_RETRY_MS 10                // wait before writing a failed segment again
+#define LOG_SHIP_TIMEOUT_MS 1000       // a standby not taking log for this long is dropped
 #define BUCKET_SIZE 50                 // size of extensible hash bucket
 #define BUFFER_POOL_SIZE 10            // size of buffer pool
+#define LOCK_TABLE_SHARDS 64           // number of lock table partitions
+#define LOCK_ESCALATION_THRESHOLD 1000 // row locks per table before escalation
+#define PARKER_SPIN_COUNT 1000         // polls before a waiter parks in kernel
+#define VERSION_STORE_SHARDS 16        // number of version chain partitions
+#define VERSION_GC_INTERVAL 64         // commits between version chain pruning
 
 typedef int32_t page_id_t; // page id type
 typedef int32_t txn_id_t;  // transaction id type
 typedef int32_t lsn_t;     // log sequence number type
+typedef int64_t timestamp_t; // mvcc begin/commit timestamp type
 
 } // namespace cmudb
\ No newline at end of file
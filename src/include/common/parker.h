@@ -0,0 +1,85 @@
+/**
+ * parker.h
+ *
+ * One-shot wakeup word a single thread can wait on. The waiter spins for a
+ * while and then parks in the kernel (futex on Linux), so a short wait never
+ * sleeps and a wakeup costs one atomic exchange plus, only when the waiter is
+ * already asleep, one syscall.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "common/config.h"
+
+namespace cmudb {
+    class Parker {
+        // word_ is EMPTY while nobody has called Unpark, PARKED once the waiter
+        // went to sleep, otherwise the (positive) value passed to Unpark
+        static const int EMPTY = 0;
+        static const int PARKED = -1;
+
+    public:
+        Parker() : word_(EMPTY) {}
+
+        Parker(const Parker &) = delete;
+
+        Parker &operator=(const Parker &) = delete;
+
+        // must not race with Park/Unpark
+        void Reset() { word_.store(EMPTY, std::memory_order_relaxed); }
+
+        // block until Unpark is called, return its value
+        int Park() {
+            for (int i = 0; i < PARKER_SPIN_COUNT; i++) {
+                int value = word_.load(std::memory_order_acquire);
+                if (value != EMPTY) return value;
+            }
+            int expected = EMPTY;
+            if (!word_.compare_exchange_strong(expected, PARKED,
+                                               std::memory_order_acq_rel))
+                return expected;
+            int value;
+            while ((value = word_.load(std::memory_order_acquire)) == PARKED) {
+                sleep();
+            }
+            return value;
+        }
+
+        // value must be positive
+        void Unpark(int value) {
+            if (word_.exchange(value, std::memory_order_acq_rel) == PARKED) wake();
+        }
+
+    private:
+#ifdef __linux__
+        void sleep() {
+            syscall(SYS_futex, reinterpret_cast<int *>(&word_),
+                    FUTEX_WAIT_PRIVATE, PARKED, nullptr, nullptr, 0);
+        }
+
+        void wake() {
+            syscall(SYS_futex, reinterpret_cast<int *>(&word_),
+                    FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+#else
+        // no futex: poll with a short sleep
+        void sleep() { std::this_thread::sleep_for(std::chrono::microseconds(50)); }
+
+        void wake() {}
+#endif
+
+        std::atomic<int> word_;
+        static_assert(sizeof(std::atomic<int>) == sizeof(int),
+                      "futex word must be a plain int");
+    };
+} // namespace cmudb
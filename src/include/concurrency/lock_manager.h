@@ -1,7 +1,9 @@
 /**
  * lock_manager.h
  *
- * Tuple level lock manager, use wait-die to prevent deadlocks
+ * Multi-granularity (table/page/tuple) lock manager, use wait-die to prevent
+ * deadlocks, or optionally a background waits-for graph detector that only
+ * aborts on real deadlocks
  */
 
 #pragma once
@@ -10,81 +12,177 @@
 #include <cassert>
 #include <condition_variable>
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <set>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "common/parker.h"
 #include "common/rid.h"
 #include "concurrency/transaction.h"
 using namespace std;
 namespace cmudb {
 
-    enum class LockMode { SHARED = 0, EXCLUSIVE, UPGRADING };
+    // WAIT_DIE: 年轻的事务一遇到冲突就回滚
+    // DETECTION: 冲突时总是等待，由后台线程在等待图中找环并回滚环中最年轻的事务
+    enum class DeadlockPolicy { WAIT_DIE = 0, DETECTION };
 
     class LockManager {
+        struct TxList;
+        struct LockTableShard;
+
         /**
          * 每个TRANSACTION需要记录是否是GRANT的，TX ID，还有上锁的模式
          * 因为一个TRANSACTION 如果能GRANT，要么就GRANT了，要么就WAIT了。
-         * 所以对每一个ITEM，我们用一个CONDITIONAL VARIABLE来控制WAIT和 NOTIFY。
+         * 所以对每一个ITEM，我们用一个Parker来控制WAIT和 NOTIFY：先自旋一会儿，
+         * 等不到再在futex上睡眠。granted_和aborted_由分片的latch保护，
+         * 等待者只看Parker返回的结果。
+         * 同一个事务的所有请求通过LockChainNode串在事务上，list_和self_
+         * 让提交时不用查锁表就能找到请求所在的位置
          */
-        struct TxItem {
-            TxItem(txn_id_t tid, LockMode mode, bool granted)
-                    : tid_(tid), mode_(mode), granted_(granted) {}
+        struct TxItem : public LockChainNode {
+            TxItem(Transaction *txn, LockMode mode, bool granted)
+                    : txn_(txn), tid_(txn->GetTransactionId()), mode_(mode),
+                      granted_(granted), aborted_(false) {}
 
-            void Wait() {
-                unique_lock<mutex> ul(mutex_);
-                cv_.wait(ul, [this] { return this->granted_; });
-            }
+            // 返回false表示等待期间被死锁检测选为牺牲者
+            bool Wait() { return parker_.Park() == GRANTED; }
 
             void Grant() {
-                lock_guard<mutex> lg(mutex_);
                 granted_ = true;
-                cv_.notify_one();
+                parker_.Unpark(GRANTED);
             }
 
-            mutex mutex_;
-            condition_variable cv_;
+            void Abort() {
+                aborted_ = true;
+                parker_.Unpark(ABORTED);
+            }
+
+            static const int GRANTED = 1;
+            static const int ABORTED = 2;
+            Parker parker_;
+            Transaction *txn_;
             txn_id_t tid_;
             LockMode mode_;
             bool granted_;
+            bool aborted_;
+            TxList *list_ = nullptr;
+            list<TxItem>::iterator self_;
         };
 
+        /**
+         * TxList由所在分片的latch保护，本身不再带锁。
+         * TxItem的链表节点从分片的池(pool)中splice过来，用完再splice回去，
+         * 避免每次加锁都new一个节点。
+         * 已经授予的请求总是排在队列的前面。
+         */
         struct TxList {
-            mutex mutex_;
             list<TxItem> locks_;
-            bool hasUpgrading_;
+            bool hasUpgrading_ = false;
+            // 所在的分片和锁表中的key，由acquireList设置
+            LockTableShard *shard_ = nullptr;
+            RID key_;
             bool checkCanGrant(LockMode mode) {
                 //在当前没有加锁的数据项上，总是授予第一次加锁请求
-                if (locks_.empty()) return true;
                 //当事务向已被加锁的数据项申请加锁时，只有当该请求与当前的持有的锁相容时，
                 //并且所有先前的请求都已被授予锁的条件下，锁管理器才为该请求授予锁
-                const auto last = &locks_.back();
-                if (mode == LockMode::SHARED) {
-                    return last->granted_ && last->mode_ == LockMode::SHARED;
+                for (auto &tx : locks_) {
+                    if (!tx.granted_ || !compatible(tx.mode_, mode)) return false;
                 }
-                return false;
+                return true;
             }
-            void insert(Transaction *txn, const RID &rid, LockMode mode,
-                        bool granted, unique_lock<mutex> *lock) {
-                bool upgradingMode = (mode == LockMode::UPGRADING);
-                if (upgradingMode && granted) mode = LockMode::EXCLUSIVE;
-                locks_.emplace_back(txn->GetTransactionId(), mode, granted);
-                auto &last = locks_.back();
+            list<TxItem>::iterator emplace(list<TxItem>::iterator pos,
+                                           Transaction *txn, LockMode mode,
+                                           bool granted, list<TxItem> *pool) {
+                if (pool->empty()) {
+                    auto it = locks_.emplace(pos, txn, mode, granted);
+                    link(it, txn);
+                    return it;
+                }
+                locks_.splice(pos, *pool, pool->begin());
+                auto it = prev(pos);
+                link(it, txn);
+                it->txn_ = txn;
+                it->tid_ = txn->GetTransactionId();
+                it->mode_ = mode;
+                it->granted_ = granted;
+                it->aborted_ = false;
+                it->parker_.Reset();
+                return it;
+            }
+            // 释放分片的latch等待授予，返回时重新持有latch。返回false表示等待时
+            // 被选为死锁的牺牲者，此时请求已经从队列中移除
+            bool wait(list<TxItem>::iterator it, unique_lock<mutex> *lock,
+                      list<TxItem> *pool) {
+                lock->unlock();
+                bool granted = it->Wait();
+                lock->lock();
                 if (!granted) {
-                    hasUpgrading_ |= upgradingMode;
-                    lock->unlock();
-                    last.Wait();
+                    if (it->mode_ == LockMode::UPGRADING) hasUpgrading_ = false;
+                    erase(it, pool);
+                    grantWaiting();
                 }
-                if (mode == LockMode::SHARED) {
-                    txn->GetSharedLockSet()->insert(rid);
+                return granted;
+            }
+            void link(list<TxItem>::iterator it, Transaction *txn) {
+                it->list_ = this;
+                it->self_ = it;
+                it->LinkAfter(txn->GetLockChain());
+            }
+            void erase(list<TxItem>::iterator it, list<TxItem> *pool) {
+                it->Unlink();
+                if (pool->size() < POOL_CAPACITY) {
+                    pool->splice(pool->end(), locks_, it);
                 } else {
-                    txn->GetExclusiveLockSet()->insert(rid);
+                    locks_.erase(it);
+                }
+            }
+            // 第一个还没有授予的请求，锁转换请求插在它前面
+            list<TxItem>::iterator firstWaiting() {
+                return find_if(locks_.begin(), locks_.end(),
+                               [](const TxItem &tx) { return !tx.granted_; });
+            }
+            // 从队头开始，按顺序授予与已持有的锁(同一事务的除外)相容的等待请求
+            void grantWaiting() {
+                vector<pair<txn_id_t, LockMode>> held;
+                for (auto &tx : locks_) {
+                    // 牺牲者会自己把请求移除
+                    if (tx.aborted_) continue;
+                    if (!tx.granted_) {
+                        for (auto &h : held) {
+                            if (h.first != tx.tid_ && !compatible(h.second, tx.mode_))
+                                return;
+                        }
+                        if (tx.mode_ == LockMode::UPGRADING) {
+                            hasUpgrading_ = false;
+                            tx.mode_ = LockMode::EXCLUSIVE;
+                        }
+                        tx.Grant();
+                    }
+                    held.emplace_back(tx.tid_, tx.mode_);
                 }
             }
         };
 
+        /**
+         * 锁表按RID的哈希划分成LOCK_TABLE_SHARDS个分片，每个分片有独立的latch，
+         * 不同分片上的加锁和解锁互不阻塞。空闲的TxList和TxItem留在分片的池中复用。
+         */
+        struct LockTableShard {
+            mutex mutex_;
+            unordered_map<RID, TxList *> lockTable_;
+            vector<TxList *> freeLists_;
+            list<TxItem> freeItems_;
+        };
+
     public:
-        LockManager(bool strict_2PL) : strict_2PL_(strict_2PL){};
+        LockManager(bool strict_2PL,
+                    DeadlockPolicy policy = DeadlockPolicy::WAIT_DIE);
+
+        ~LockManager();
 
         /*** below are APIs need to implement ***/
         // lock:
@@ -92,6 +190,7 @@ namespace cmudb {
         // it should be blocked on waiting and should return true when granted
         // note the behavior of trying to lock locked rids by same txn is undefined
         // it is transaction's job to keep track of its current locks
+        // a tuple lock is skipped when a page/table lock of the txn covers it
         bool LockShared(Transaction *txn, const RID &rid);
         bool LockExclusive(Transaction *txn, const RID &rid);
         bool LockUpgrade(Transaction *txn, const RID &rid);
@@ -100,12 +199,81 @@ namespace cmudb {
         // release the lock hold by the txn
         bool Unlock(Transaction *txn, const RID &rid);
         /*** END OF APIs ***/
+
+        // release every tuple/page/table lock of the txn at commit/abort, one
+        // latch acquisition per shard and one wakeup pass per lock queue
+        bool UnlockAll(Transaction *txn);
+
+        /**
+         * Table and page locks for multi-granularity locking. A table is
+         * identified by its first page id. Requesting a mode while already
+         * holding one on the same table/page converts the lock to the least
+         * mode covering both. Tuple locks taken under a page lock are counted
+         * per table; past the escalation threshold they are traded for a S/X
+         * table lock if it can be granted without waiting.
+         */
+        bool LockTable(Transaction *txn, page_id_t table_id, LockMode mode);
+        bool LockPage(Transaction *txn, page_id_t table_id, page_id_t page_id,
+                      LockMode mode);
+        bool UnlockTable(Transaction *txn, page_id_t table_id);
+        bool UnlockPage(Transaction *txn, page_id_t page_id);
+
+        inline void SetEscalationThreshold(int threshold) {
+            escalation_threshold_ = threshold;
+        }
+
+        // whether a page/table lock held by txn already grants mode on the tuple
+        static bool RowLockCovered(Transaction *txn, const RID &rid, LockMode mode);
+
+        // IS/IX/S/SIX/X 相容矩阵，UPGRADING按X处理
+        static bool compatible(LockMode held, LockMode requested);
+        // 能同时覆盖两种模式的最弱的锁模式
+        static LockMode supremum(LockMode a, LockMode b);
+
     private:
+        // upper bound of pooled TxItem nodes kept by each shard
+        static const size_t POOL_CAPACITY = 256;
+        // 表锁和页锁也放在锁表里，用保留的slot号和行锁区分。
+        // 不用负数，否则RID::Get()的符号扩展会把page id抹掉，所有表锁落到同一个分片
+        static const int TABLE_LOCK_SLOT = 0x7FFFFFFF;
+        static const int PAGE_LOCK_SLOT = 0x7FFFFFFE;
+
         bool lockTemplate(Transaction *txn, const RID &rid, LockMode mode);
+        // 表锁/页锁的加锁和锁转换，wait为false时不能立刻授予就放弃
+        bool lockGranule(Transaction *txn, const RID &key, LockMode mode,
+                         bool wait);
+        bool checkUnlock(Transaction *txn);
+        void countRowLock(Transaction *txn, const RID &rid);
+        bool escalate(Transaction *txn, page_id_t table_id);
+        // 把请求从队列中删掉并唤醒可以授予的请求，不检查2PL
+        bool release(const RID &key, txn_id_t tid);
+
+        // RID的哈希就是page_id和slot拼起来的整数，先打散再取模，避免同一slot扎堆
+        inline LockTableShard &getShard(const RID &rid) {
+            uint64_t h = hash<RID>()(rid) * 0x9E3779B97F4A7C15ULL;
+            return shards_[(h >> 32) % LOCK_TABLE_SHARDS];
+        }
+
+        // 后台死锁检测：周期性地构建等待图(waits-for graph)并回滚环中最年轻的事务
+        void runCycleDetection();
+        void breakCycles();
+        bool findCycle(txn_id_t tid, const map<txn_id_t, set<txn_id_t>> &waitsFor,
+                       vector<txn_id_t> *path, set<txn_id_t> *visited,
+                       txn_id_t *victim);
+
+        TxList *acquireList(LockTableShard &shard, const RID &rid);
+        void releaseList(LockTableShard &shard,
+                         unordered_map<RID, TxList *>::iterator it);
 
         bool strict_2PL_;
-        mutex mutex_;
-        unordered_map<RID, TxList> lockTable_;
+        DeadlockPolicy policy_;
+        int escalation_threshold_ = LOCK_ESCALATION_THRESHOLD;
+        LockTableShard shards_[LOCK_TABLE_SHARDS];
+        // cycle detection thread, only used by DeadlockPolicy::DETECTION
+        std::thread *cycle_detection_thread_ = nullptr;
+        bool stopDetection_ = false;
+        mutex detectionMutex_;
+        condition_variable detectionCv_;
     };
 
 }  // namespace cmudb
@@ -8,6 +8,7 @@
 #include <deque>
 #include <memory>
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "common/config.h"
@@ -30,8 +31,59 @@ enum class TransactionState { GROWING, SHRINKING, COMMITTED, ABORTED };
 
 enum class WType { INSERT = 0, DELETE, UPDATE };
 
+/**
+ * How a transaction is isolated. TWO_PHASE_LOCKING locks every tuple it reads
+ * or writes; SNAPSHOT_ISOLATION reads the versions committed before it began
+ * without locking and only locks what it writes. OPTIMISTIC reads the same
+ * snapshot, buffers its updates and deletes, and at commit validates that
+ * nothing it read or wrote changed since it began. The last two need a
+ * VersionStore.
+ */
+enum class ConcurrencyMode {
+  TWO_PHASE_LOCKING = 0,
+  SNAPSHOT_ISOLATION,
+  OPTIMISTIC
+};
+
+/**
+ * Lock modes. Rows only use SHARED/EXCLUSIVE/UPGRADING, tables and pages also
+ * take the intention modes (IS, IX, SIX) of multi-granularity locking.
+ */
+enum class LockMode {
+  SHARED = 0,
+  EXCLUSIVE,
+  UPGRADING,
+  INTENTION_SHARED,
+  INTENTION_EXCLUSIVE,
+  SHARED_INTENTION_EXCLUSIVE
+};
+
 class TableHeap;
 
+/**
+ * Intrusive link embedded in the lock manager's request objects. The requests
+ * of a transaction form a circular list through it, headed by the transaction,
+ * so commit/abort can release every lock without looking anything up. Only the
+ * thread running the transaction touches its chain, so it needs no latch.
+ */
+struct LockChainNode {
+  LockChainNode *prev_ = nullptr;
+  LockChainNode *next_ = nullptr;
+
+  inline void LinkAfter(LockChainNode *head) {
+    prev_ = head;
+    next_ = head->next_;
+    head->next_->prev_ = this;
+    head->next_ = this;
+  }
+
+  inline void Unlink() {
+    prev_->next_ = next_;
+    next_->prev_ = prev_;
+    prev_ = next_ = nullptr;
+  }
+};
+
 // write set record
 class WriteRecord {
 public:
@@ -49,15 +101,24 @@ public:
 class Transaction {
 public:
   Transaction(Transaction const &) = delete;
-  explicit Transaction(txn_id_t txn_id)
+  explicit Transaction(
+      txn_id_t txn_id,
+      ConcurrencyMode mode = ConcurrencyMode::TWO_PHASE_LOCKING)
       : state_(TransactionState::GROWING),
         thread_id_(std::this_thread::get_id()),
-        txn_id_(txn_id), prev_lsn_(INVALID_LSN), shared_lock_set_{new std::unordered_set<RID>},
-        exclusive_lock_set_{new std::unordered_set<RID>} {
+        txn_id_(txn_id), mode_(mode), read_ts_(0), commit_ts_(0),
+        prev_lsn_(INVALID_LSN), shared_lock_set_{new std::unordered_set<RID>},
+        exclusive_lock_set_{new std::unordered_set<RID>},
+        table_lock_set_{new std::unordered_map<page_id_t, LockMode>},
+        page_lock_set_{
+            new std::unordered_map<page_id_t, std::pair<page_id_t, LockMode>>},
+        row_lock_count_{new std::unordered_map<page_id_t, int>},
+        read_set_{new std::unordered_set<RID>} {
     // initialize sets
     write_set_.reset(new std::deque<WriteRecord>);
     page_set_.reset(new std::deque<Page *>);
     deleted_page_set_.reset(new std::unordered_set<page_id_t>);
+    lock_chain_.prev_ = lock_chain_.next_ = &lock_chain_;
   }
 
   ~Transaction() = default;
@@ -69,6 +130,16 @@ public:
 
   inline txn_id_t GetTransactionId() const { return txn_id_; }
 
+  inline ConcurrencyMode GetMode() const { return mode_; }
+
+  inline timestamp_t GetReadTs() const { return read_ts_; }
+
+  inline void SetReadTs(timestamp_t read_ts) { read_ts_ = read_ts; }
+
+  inline timestamp_t GetCommitTs() const { return commit_ts_; }
+
+  inline void SetCommitTs(timestamp_t commit_ts) { commit_ts_ = commit_ts; }
+
   inline std::shared_ptr<std::deque<WriteRecord>> GetWriteSet() {
     return write_set_;
   }
@@ -93,6 +164,27 @@ public:
     return exclusive_lock_set_;
   }
 
+  inline std::shared_ptr<std::unordered_map<page_id_t, LockMode>>
+  GetTableLockSet() {
+    return table_lock_set_;
+  }
+
+  inline std::shared_ptr<
+      std::unordered_map<page_id_t, std::pair<page_id_t, LockMode>>>
+  GetPageLockSet() {
+    return page_lock_set_;
+  }
+
+  inline std::shared_ptr<std::unordered_map<page_id_t, int>> GetRowLockCount() {
+    return row_lock_count_;
+  }
+
+  inline LockChainNode *GetLockChain() { return &lock_chain_; }
+
+  inline std::shared_ptr<std::unordered_set<RID>> GetReadSet() {
+    return read_set_;
+  }
+
   inline TransactionState GetState() { return state_; }
 
   inline void SetState(TransactionState state) { state_ = state; }
@@ -101,16 +193,28 @@ public:
 
   inline void SetPrevLSN(lsn_t prev_lsn) { prev_lsn_ = prev_lsn; }
 
+  inline std::shared_ptr<TxnLogBuffer> GetLogBuffer() { return log_buffer_; }
+
+  inline void SetLogBuffer(std::shared_ptr<TxnLogBuffer> log_buffer) {
+    log_buffer_ = std::move(log_buffer);
+  }
+
 private:
   TransactionState state_;
   // thread id, single-threaded transactions
   std::thread::id thread_id_;
   // transaction id
   txn_id_t txn_id_;
+  ConcurrencyMode mode_;
+  // snapshot: sees every version committed at or before read_ts_
+  timestamp_t read_ts_;
+  timestamp_t commit_ts_;
   // Below are used by transaction, undo set
   std::shared_ptr<std::deque<WriteRecord>> write_set_;
   // prev lsn
   lsn_t prev_lsn_;
+  // 暂存还没合并到日志的记录，第一次暂存时由日志管理器创建
+  std::shared_ptr<TxnLogBuffer> log_buffer_;
 
   // Below are used by concurrent index
   // 此deque包含在索引操作期间被锁存页面的指针
@@ -123,5 +227,18 @@ private:
   std::shared_ptr<std::unordered_set<RID>> shared_lock_set_;
   // set包含了被该事务上了排他锁的元组的rid
   std::shared_ptr<std::unordered_set<RID>> exclusive_lock_set_;
+  // 表(用第一个页面的id标识)上持有的锁
+  std::shared_ptr<std::unordered_map<page_id_t, LockMode>> table_lock_set_;
+  // 页面上持有的锁：page id -> (所属表, 锁模式)
+  std::shared_ptr<std::unordered_map<page_id_t, std::pair<page_id_t, LockMode>>>
+      page_lock_set_;
+  // 每张表上持有的行锁数，超过阈值后升级为表锁
+  std::shared_ptr<std::unordered_map<page_id_t, int>> row_lock_count_;
+  // 该事务所有锁请求组成的侵入式链表的表头
+  LockChainNode lock_chain_;
+
+  // Below are used by optimistic transactions
+  // set包含了读过的元组的rid，读到的都是read_ts_时的版本，提交时逐个验证
+  std::shared_ptr<std::unordered_set<RID>> read_set_;
 };
 } // namespace cmudb
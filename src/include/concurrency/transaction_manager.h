@@ -6,30 +6,105 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
 #include <unordered_set>
 
 #include "common/config.h"
 #include "concurrency/lock_manager.h"
+#include "concurrency/version_store.h"
 #include "logging/log_manager.h"
 
 namespace cmudb {
     class TransactionManager {
     public:
         TransactionManager(LockManager *lock_manager,
-                           LogManager *log_manager = nullptr)
+                           LogManager *log_manager = nullptr,
+                           VersionStore *version_store = nullptr)
                 : next_txn_id_(0), lock_manager_(lock_manager),
-                  log_manager_(log_manager) {}
+                  log_manager_(log_manager), version_store_(version_store) {}
 
-        Transaction *Begin();
+        // snapshot isolation and optimistic mode need a version store
+        Transaction *Begin(
+                ConcurrencyMode mode = ConcurrencyMode::TWO_PHASE_LOCKING);
 
-        void Commit(Transaction *txn);
+        // return false if an optimistic transaction failed validation, it is
+        // aborted and rolled back instead
+        bool Commit(Transaction *txn);
+
+        /**
+         * Commit without waiting for the log flush: returns once the commit is
+         * ordered (locks released), callback(true) runs on the log flush thread
+         * when the commit record is on disk, or right away with false if
+         * validation failed. txn may be deleted as soon as this returns. Keep
+         * the callback short, it delays the next group flush, and do not
+         * begin, commit or abort a transaction in it (see
+         * LogManager::OnPersistent): that appends log records on the flush
+         * thread and deadlocks it.
+         */
+        void CommitAsync(Transaction *txn, std::function<void(bool)> callback);
+        std::future<bool> CommitAsync(Transaction *txn);
 
         void Abort(Transaction *txn);
 
+        /**
+         * Append a BEGIN_CHECKPOINT record and copy the transactions that were
+         * active at that point (txn -> LSN of its BEGIN record). Every record
+         * of a transaction missing from the table either follows the returned
+         * LSN or belongs to a transaction that had already ended.
+         */
+        lsn_t BeginCheckpoint(ActiveTxnTable *active_txns);
+
+        /**
+         * Restart recovery: take over a transaction that was active at the
+         * crash (a loser) so it can be rolled back while new transactions
+         * run. The caller locks its rows and rolls it back, then calls
+         * EndLoser. Transaction ids issued afterwards are larger than txn_id,
+         * snapshot and optimistic transactions do not begin until every
+         * loser has ended (their reads take no row locks).
+         */
+        Transaction *AdoptLoser(txn_id_t txn_id, lsn_t begin_lsn, lsn_t last_lsn);
+        // append ABORT for a rolled back loser and release its locks
+        void EndLoser(Transaction *txn);
+
     private:
+        // commit_lsn是COMMIT记录的LSN，没有开启日志时为INVALID_LSN
+        bool orderCommit(Transaction *txn, lsn_t *commit_lsn);
+        // 给缓冲的写加锁，验证读集和写集，把写装到页面上；返回时持有validation
+        bool installWrites(Transaction *txn,
+                           std::unique_lock<std::mutex> *validation);
+        void rollback(Transaction *txn);
+        void endSnapshot(Transaction *txn);
+        // 等txn的快照能看到的提交都追加了COMMIT，返回它们的COMMIT LSN的上界
+        lsn_t observedCommitLSN(Transaction *txn);
+        void endTxn(Transaction *txn);
+
         std::atomic<txn_id_t> next_txn_id_;
         LockManager *lock_manager_;
         LogManager *log_manager_;
+        VersionStore *version_store_;
+        // 时间戳的分配、提交时给版本盖戳和活跃快照的登记都在ts_latch_下串行进行
+        std::mutex ts_latch_;
+        // 乐观事务的验证、安装和盖戳串行进行，保证验证过的版本在提交前不会被别的乐观事务覆盖
+        std::mutex validation_latch_;
+        timestamp_t last_commit_ts_ = 0;
+        std::multiset<timestamp_t> active_snapshots_;
+        int commits_since_gc_ = 0;
+        // 版本已经发布、COMMIT还没有追加的提交时间戳，和已追加的最大COMMIT LSN，
+        // 都由ts_latch_保护
+        std::set<timestamp_t> unlogged_commits_;
+        lsn_t max_commit_lsn_ = INVALID_LSN;
+        std::condition_variable logged_cv_;
+        // 开启日志时登记活跃事务的BEGIN记录，BEGIN的追加和登记在txn_latch_下一起进行
+        std::mutex txn_latch_;
+        std::map<txn_id_t, lsn_t> active_txns_;
+        // 还没有回滚完的loser个数，由txn_latch_保护
+        int losers_ = 0;
+        std::condition_variable losers_cv_;
     };
 
 } // namespace cmudb
@@ -0,0 +1,89 @@
+/**
+ * version_store.h
+ *
+ * In-memory undo store for multi-version concurrency control. The newest
+ * version of a tuple always stays in the table page; every write pushes the
+ * version it overwrote onto the tuple's version chain, so snapshot readers can
+ * walk back to the version that was committed when they began.
+ */
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "common/config.h"
+#include "common/rid.h"
+#include "concurrency/transaction.h"
+#include "table/tuple.h"
+
+namespace cmudb {
+
+    class VersionStore {
+        // 被覆盖的旧版本，ts_是写入它的事务的提交时间戳，
+        // present_为false表示那时元组还不存在(或者已经被删除)
+        struct UndoVersion {
+            timestamp_t ts_;
+            bool present_;
+            Tuple tuple_;
+        };
+
+        /**
+         * 页面上的版本由writer_写入，没有提交时writer_是写者的txn id，
+         * 提交之后writer_为INVALID_TXN_ID，ts_是它的提交时间戳。
+         * undo_从新到旧排列
+         */
+        struct VersionChain {
+            txn_id_t writer_ = INVALID_TXN_ID;
+            timestamp_t ts_ = 0;
+            std::deque<UndoVersion> undo_;
+        };
+
+        struct VersionShard {
+            std::mutex mutex_;
+            std::unordered_map<RID, VersionChain> chains_;
+        };
+
+    public:
+        // where a snapshot read finds the visible version
+        enum class Visibility { IN_PLACE = 0, UNDO, INVISIBLE };
+
+        // whether the version of rid seen by txn's snapshot is still the
+        // newest one: not overwritten by a later commit or an uncommitted write
+        bool Validate(Transaction *txn, const RID &rid);
+
+        // first-updater-wins: a snapshot transaction may not overwrite a version
+        // committed after its snapshot or still being written by someone else
+        bool CheckWrite(Transaction *txn, const RID &rid);
+
+        // called under the page write latch right after the page is modified;
+        // old is the overwritten tuple, nullptr when rid was free (insert)
+        void RecordWrite(Transaction *txn, const RID &rid, const Tuple *old);
+
+        // called under the page read latch, fills tuple when the visible
+        // version comes from the undo chain
+        Visibility Read(Transaction *txn, const RID &rid, Tuple *tuple);
+
+        // stamp every version written by txn with its commit timestamp
+        void Commit(Transaction *txn);
+
+        // forget the versions of an aborted txn, after its writes are undone
+        void Rollback(Transaction *txn, const std::vector<RID> &rids);
+
+        // drop the versions no snapshot at or after oldest can see any more
+        void Collect(timestamp_t oldest);
+
+        // number of tuples with a version chain
+        size_t Size();
+
+    private:
+        inline VersionShard &getShard(const RID &rid) {
+            return shards_[std::hash<RID>()(rid) % VERSION_STORE_SHARDS];
+        }
+
+        VersionShard shards_[VERSION_STORE_SHARDS];
+    };
+
+} // namespace cmudb
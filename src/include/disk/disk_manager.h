@@ -12,7 +12,10 @@
 #include <atomic>
 #include <fstream>
 #include <future>
+#include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "common/config.h"
 
@@ -20,7 +23,11 @@ namespace cmudb {
 
     class DiskManager {
     public:
-        DiskManager(const std::string &db_file);
+        // the log is striped across log_stripes files: <db>.log, <db>.log.1, ...
+        // With log_segment_size > 0 it is split into segments named by their
+        // starting log offset instead: <db>.log.<offset in hex>[.<stripe>]
+        DiskManager(const std::string &db_file, int log_stripes = LOG_STRIPE_COUNT,
+                    int64_t log_segment_size = LOG_SEGMENT_SIZE);
 
         ~DiskManager();
 
@@ -28,9 +35,41 @@ namespace cmudb {
 
         void ReadPage(page_id_t page_id, char *page_data);
 
-        void WriteLog(char *log_data, int size);
+        // force the pages written so far to disk; WritePage only hands them to
+        // the OS. False if the data file could not be synced
+        bool SyncData();
 
-        bool ReadLog(char *log_data, int size, int offset);
+        // hint that page_id will be read soon, the kernel reads it ahead
+        void PrefetchPage(page_id_t page_id);
+
+        // false if the log could not be written and synced; nothing counts as
+        // written then, the next WriteLog writes at the same offset again
+        bool WriteLog(char *log_data, int size);
+
+        bool ReadLog(char *log_data, int size, int64_t offset);
+
+        // offset of the oldest log record still on disk, where redo starts
+        inline int64_t GetLogStart() const { return log_start_; }
+
+        // offset the next WriteLog goes to
+        inline int64_t GetLogEnd() const { return log_end_; }
+
+        // the master record points recovery at the last complete checkpoint:
+        // the log offset to scan for its END_CHECKPOINT record (with LSN
+        // checkpoint_lsn) and the offset redo starts at. False if the old
+        // record is still in place
+        bool WriteMasterRecord(int64_t checkpoint_offset, lsn_t checkpoint_lsn,
+                               int64_t redo_offset);
+        // false if there is no (valid) master record
+        bool ReadMasterRecord(int64_t *checkpoint_offset, lsn_t *checkpoint_lsn,
+                              int64_t *redo_offset);
+
+        // recycle the segments that end at or before offset (a redo point);
+        // returns the number of segments removed
+        int TruncateLog(int64_t offset);
+
+        // move truncated segments into dir instead of deleting them
+        void SetLogArchive(const std::string &dir);
 
         page_id_t AllocatePage();
 
@@ -38,6 +77,8 @@ namespace cmudb {
 
         int GetNumFlushes() const;
 
+        int GetNumDataSyncs() const;
+
         bool GetFlushState() const;
 
         inline void SetFlushLogFuture(std::future<void> *f) { flush_log_f_ = f; }
@@ -47,14 +88,56 @@ namespace cmudb {
     private:
         int GetFileSize(const std::string &name);
 
-        // stream to write log file
-        std::fstream log_io_;
+        // 一个日志段，段内的偏移量按LOG_STRIPE_SIZE轮流分到各个条带文件
+        struct LogSegment {
+            int64_t start = 0;  // logical offset of the first byte
+            int64_t size = 0;   // logical bytes in the segment
+            // one file per stripe, written with pwrite + fdatasync
+            std::vector<int> fds;
+            // preallocated bytes of each stripe file
+            std::vector<int64_t> reserved;
+        };
+
+        inline int stripeOf(int64_t offset) const {
+            return static_cast<int>(offset / LOG_STRIPE_SIZE % log_stripes_);
+        }
+        inline int64_t physicalOf(int64_t offset) const {
+            return offset / LOG_STRIPE_SIZE / log_stripes_ * LOG_STRIPE_SIZE +
+                   offset % LOG_STRIPE_SIZE;
+        }
+        std::string segmentName(int64_t start, int stripe) const;
+        // 打开或创建从start开始的段，由条带文件的大小算出段的大小
+        LogSegment &openSegment(int64_t start);
+        void closeSegment(LogSegment &segment);
+        // 把段中[offset, offset + size)落在stripe上的部分写入并同步到磁盘
+        bool writeStripe(LogSegment &segment, int stripe, const char *log_data,
+                         int64_t offset, int size);
+        // 在写之前按LOG_PREALLOCATE_SIZE预留文件空间，不改变文件大小
+        void reserveLog(LogSegment &segment, int stripe, int64_t end);
+
         std::string log_name_;
+        // <db>.master, replaced atomically by WriteMasterRecord
+        std::string master_name_;
+        int log_stripes_;
+        // 0: a single segment named log_name_
+        int64_t log_segment_size_;
+        // segments on disk by starting offset. A segment only rolls over
+        // between two WriteLog calls, so every segment starts with a record
+        std::map<int64_t, LogSegment> log_segments_;
+        // logical offsets of the oldest byte on disk and of the next WriteLog
+        std::atomic<int64_t> log_start_;
+        std::atomic<int64_t> log_end_;
+        std::string log_archive_;
+        // protects log_segments_ and log_archive_
+        std::mutex log_latch_;
         // stream to write db file
         std::fstream db_io_;
+        // read-only descriptor of the db file for read-ahead hints and syncs
+        int db_fd_ = -1;
         std::string file_name_;
         std::atomic<page_id_t> next_page_id_;
         int num_flushes_;
+        std::atomic<int> num_data_syncs_;
         bool flush_log_;
         std::future<void> *flush_log_f_;
         char *buffer_used = nullptr;
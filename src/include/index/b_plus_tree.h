@@ -15,6 +15,7 @@
 
 #include "concurrency/transaction.h"
 #include "index/index_iterator.h"
+#include "logging/index_log.h"
 #include "page/b_plus_tree_internal_page.h"
 #include "page/b_plus_tree_leaf_page.h"
 
@@ -25,10 +26,13 @@ namespace cmudb {
     INDEX_TEMPLATE_ARGUMENTS
     class BPlusTree {
     public:
+        // with a log manager, inserts and removes in a transaction write the
+        // pages they change to the log, see IndexLog
         explicit BPlusTree(const std::string &name,
                            BufferPoolManager *buffer_pool_manager,
                            const KeyComparator &comparator,
-                           page_id_t root_page_id = INVALID_PAGE_ID);
+                           page_id_t root_page_id = INVALID_PAGE_ID,
+                           LogManager *log_manager = nullptr);
 
         // Returns true if this B+ tree has no keys and values.
         bool IsEmpty() const;
@@ -143,6 +147,11 @@ namespace cmudb {
         }
 
 
+        // B+树页面的数据就在Page的开头
+        static inline Page *pageOf(BPlusTreePage *node) {
+            return reinterpret_cast<Page *>(node);
+        }
+
         int isBalanced(page_id_t pid);
         bool isPageCorr(page_id_t pid,pair<KeyType,KeyType> &out);
         // member variable
@@ -152,6 +161,9 @@ namespace cmudb {
         KeyComparator comparator_;
         RWMutex mutex_;
         static thread_local int rootLockedCnt;
+        LogManager *log_manager_;
+        // 当前线程正在执行的插入/删除的日志
+        static thread_local IndexLog *indexLog;
 
     };
 } // namespace cmudb
\ No newline at end of file
@@ -10,8 +10,10 @@
 #pragma once
 
 #include <cstring>
+#include <vector>
 
 #include "table/tuple.h"
+#include "type/type_kernel.h"
 #include "type/value.h"
 
 namespace cmudb {
@@ -29,18 +31,19 @@ public:
     memcpy(data, &key, sizeof(int64_t));
   }
 
+  // VARCHAR values point into the key, comparing them copies nothing
   inline Value ToValue(Schema *schema, int column_id) const {
-    const char *data_ptr;
-    const TypeId column_type = schema->GetType(column_id);
-    const bool is_inlined = schema->IsInlined(column_id);
-    if (is_inlined) {
-      data_ptr = (data + schema->GetOffset(column_id));
-    } else {
-      int32_t offset = *reinterpret_cast<int32_t *>(
-          const_cast<char *>(data + schema->GetOffset(column_id)));
-      data_ptr = (data + offset);
-    }
-    return Value::DeserializeFrom(data_ptr, column_type);
+    return Value::DeserializeView(GetColumnData(schema, column_id),
+                                  schema->GetType(column_id));
+  }
+
+  // serialized data of a column, where ToValue would read it
+  inline const char *GetColumnData(Schema *schema, int column_id) const {
+    if (schema->IsInlined(column_id))
+      return data + schema->GetOffset(column_id);
+    int32_t offset = *reinterpret_cast<const int32_t *>(
+        data + schema->GetOffset(column_id));
+    return data + offset;
   }
 
   // NOTE: for test purpose only
@@ -61,7 +64,9 @@ public:
 };
 
 /**
- * Function object returns true if lhs < rhs, used for trees
+ * Function object returns true if lhs < rhs, used for trees.
+ * The compare kernel of each key column is chosen once, in the constructor;
+ * columns without one are compared through Value.
  */
 template <size_t KeySize> class GenericComparator {
 public:
@@ -70,6 +75,15 @@ public:
     int column_count = key_schema_->GetColumnCount();
 
     for (int i = 0; i < column_count; i++) {
+      TypeKernel::CompareFunc compare = kernels_[i];
+      if (compare != nullptr) {
+        int order = compare(lhs.GetColumnData(key_schema_, i),
+                            rhs.GetColumnData(key_schema_, i));
+        // NULL和任何值比较都不是小于也不是大于，和下面一样看下一列
+        if (order != 0 && order != TypeKernel::ORDER_NULL)
+          return order;
+        continue;
+      }
       Value lhs_value = (lhs.ToValue(key_schema_, i));
       Value rhs_value = (rhs.ToValue(key_schema_, i));
 
@@ -85,13 +99,20 @@ public:
 
   GenericComparator(const GenericComparator &other) {
     this->key_schema_ = other.key_schema_;
+    this->kernels_ = other.kernels_;
   }
 
   // constructor
-  GenericComparator(Schema *key_schema) : key_schema_(key_schema) {}
+  GenericComparator(Schema *key_schema) : key_schema_(key_schema) {
+    for (int i = 0; i < key_schema_->GetColumnCount(); i++) {
+      TypeId type = key_schema_->GetType(i);
+      kernels_.push_back(TypeKernel::GetCompare(type, type));
+    }
+  }
 
 private:
   Schema *key_schema_;
+  std::vector<TypeKernel::CompareFunc> kernels_;
 };
 
 } // namespace cmudb
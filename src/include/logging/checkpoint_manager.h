@@ -0,0 +1,56 @@
+/**
+ * checkpoint_manager.h
+ * Fuzzy checkpoints: log the dirty page table and the active transaction
+ * table without flushing pages or stopping transactions, point the master
+ * record at the checkpoint and recycle the log before its redo point.
+ */
+
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "buffer/buffer_pool_manager.h"
+#include "concurrency/transaction_manager.h"
+#include "disk/disk_manager.h"
+#include "logging/log_manager.h"
+
+namespace cmudb {
+
+    class CheckpointManager {
+    public:
+        CheckpointManager(TransactionManager *transaction_manager,
+                          BufferPoolManager *buffer_pool_manager,
+                          LogManager *log_manager, DiskManager *disk_manager)
+                : transaction_manager_(transaction_manager),
+                  buffer_pool_manager_(buffer_pool_manager),
+                  log_manager_(log_manager), disk_manager_(disk_manager) {}
+
+        ~CheckpointManager() { StopCheckpointThread(); }
+
+        // take a checkpoint now, logging must be enabled. Returns false if the
+        // tables do not fit in one log buffer, or the data file or the master
+        // record could not be synced; the previous checkpoint stays in effect
+        // and no log is truncated
+        bool Checkpoint();
+
+        // checkpoint every CHECKPOINT_INTERVAL until stopped
+        void RunCheckpointThread();
+        void StopCheckpointThread();
+
+    private:
+        void runCheckpoints();
+
+        TransactionManager *transaction_manager_;
+        BufferPoolManager *buffer_pool_manager_;
+        LogManager *log_manager_;
+        DiskManager *disk_manager_;
+        // 同一时刻只做一个检查点
+        std::mutex checkpoint_latch_;
+        std::thread *checkpoint_thread_ = nullptr;
+        bool stopCheckpoint_ = false;
+        std::mutex threadMutex_;
+        std::condition_variable threadCv_;
+    };
+
+} // namespace cmudb
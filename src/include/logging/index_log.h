@@ -0,0 +1,53 @@
+/**
+ * index_log.h
+ * Write-ahead logging for one B+ tree operation: the bytes every page
+ * changed, before and after, closed by an INDEX_END record. The records of an
+ * operation form a nested top action: once INDEX_END is in the log recovery
+ * only redoes them, without it recovery undoes them with the before images.
+ */
+
+#pragma once
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "concurrency/transaction.h"
+#include "logging/log_manager.h"
+#include "page/page.h"
+
+namespace cmudb {
+
+    class IndexLog {
+    public:
+        // logs nothing unless logging is enabled and the operation runs in
+        // a transaction
+        IndexLog(LogManager *log_manager, Transaction *txn)
+                : log_manager_(log_manager), txn_(txn) {}
+
+        ~IndexLog() { assert(images_.empty()); }
+
+        // remember the image of page before the operation changes it, the
+        // page must stay pinned (and latched) until Log
+        void Track(Page *page);
+
+        // append a record of type for the bytes page changed since Track
+        void Log(Page *page, LogRecordType type);
+
+        // end the operation, later undo of the transaction skips its records
+        void End();
+
+    private:
+        inline bool enabled() const {
+            return ENABLE_LOGGING && log_manager_ != nullptr && txn_ != nullptr;
+        }
+
+        LogManager *log_manager_;
+        Transaction *txn_;
+        // 操作开始之前事务的最后一条记录
+        lsn_t undo_next_lsn_ = INVALID_LSN;
+        bool logged_ = false;
+        // 修改之前的页面，一次操作只涉及少数几个页面
+        std::vector<std::pair<Page *, std::unique_ptr<char[]>>> images_;
+    };
+
+} // namespace cmudb
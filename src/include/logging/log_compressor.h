@@ -0,0 +1,41 @@
+/**
+ * log_compressor.h
+ * Compression of flushed log segments, in the LZ4 block format: a sequence
+ * is a token, literals and a back reference into the bytes already
+ * decompressed. Tuple images in insert, delete and update records repeat
+ * column values and text, so whole segments compress well.
+ */
+
+#pragma once
+#include <cstdint>
+
+namespace cmudb {
+
+    class LogCompressor {
+    public:
+        /**
+         * Compress size bytes at src into dst. level (at least 1) is how many
+         * earlier positions with the same hash are tried for each match, more
+         * compress better and slower. Returns the compressed size, 0 if it
+         * would not fit into capacity bytes
+         */
+        static int Compress(const char *src, int size, char *dst, int capacity, int level);
+        // false if src is not a block that decompresses to exactly raw_size bytes
+        static bool Decompress(const char *src, int size, char *dst, int raw_size);
+
+    private:
+        static const int MIN_MATCH = 4;
+        // 最后一个匹配至少在结尾之前12个字节开始，最后5个字节总是字面量
+        static const int MF_LIMIT = 12;
+        static const int LAST_LITERALS = 5;
+        static const int MAX_OFFSET = 65535;
+        static const int HASH_BITS = 12;
+
+        // 长度的低4位在token里，超出15的部分用255的序列加上余数表示
+        static bool putLength(char **out, char *end, int length);
+        static bool getLength(const uint8_t **in, const uint8_t *end, int *length);
+        static bool putSequence(char **out, char *end, const char *literals,
+                                int literal_length, int offset, int match_length);
+    };
+
+} // namespace cmudb
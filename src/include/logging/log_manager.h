@@ -7,30 +7,99 @@
 
 #pragma once
 #include <algorithm>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <future>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <utility>
+#include <vector>
 
 #include "disk/disk_manager.h"
+#include "logging/log_compressor.h"
 #include "logging/log_record.h"
+#include "logging/log_shipper.h"
+#include "page/page.h"
 using namespace std;
 namespace cmudb {
 
+    class Transaction;
+
+    /**
+     * A transaction's private log buffer. Staged records get their LSNs when
+     * the buffer is merged into the log, all of them in one reservation. Each
+     * page points to the one buffer holding its unmerged records (its
+     * stager), so the buffer may outlive its transaction.
+     */
+    struct TxnLogBuffer {
+        std::mutex latch_;
+        // the last merged record, the prevLSN of the next one
+        lsn_t prev_lsn_ = INVALID_LSN;
+        // staged records and the pages they changed
+        std::vector<std::pair<LogRecord, Page *>> records_;
+        // encoded size of records_, a few bytes short at most
+        int32_t size_ = 0;
+    };
+
     class LogManager {
     public:
+        // group commit metrics. Commits that were already durable when they
+        // asked (covered by an earlier flush) never wait and are not counted
+        struct GroupCommitStats {
+            uint64_t groups = 0;          // flushes with at least one waiting commit
+            uint64_t commits = 0;         // waiting commits made durable by them
+            uint64_t max_group_size = 0;
+            std::chrono::microseconds total_wait{0};  // commit wait time
+            std::chrono::microseconds max_wait{0};
+            std::chrono::microseconds flush_latency{0};  // smoothed log write latency
+
+            double AverageGroupSize() const {
+                return groups == 0 ? 0 : static_cast<double>(commits) / groups;
+            }
+            std::chrono::microseconds AverageWait() const {
+                return commits == 0 ? std::chrono::microseconds(0)
+                                    : total_wait / static_cast<int64_t>(commits);
+            }
+        };
+
+        // log write metrics, compression (LOG_COMPRESSION_LEVEL) included
+        struct FlushStats {
+            uint64_t flushes = 0;        // segments written
+            uint64_t log_bytes = 0;      // bytes of records in them
+            uint64_t written_bytes = 0;  // bytes written, after compression
+            std::chrono::microseconds flush_time{0};  // compressing and writing
+            uint64_t write_errors = 0;   // failed segment writes, retried
+
+            double CompressionRatio() const {
+                return written_bytes == 0 ? 1 : static_cast<double>(log_bytes) / written_bytes;
+            }
+            // log bytes flushed per second of flush time
+            double Throughput() const {
+                return flush_time.count() == 0
+                       ? 0 : static_cast<double>(log_bytes) * 1000000 / flush_time.count();
+            }
+        };
+
         LogManager(DiskManager *disk_manager)
-                : needFlush_(false),next_lsn_(0), persistent_lsn_(INVALID_LSN),
+                : needFlush_(false), reserved_(0), persistent_lsn_(INVALID_LSN),
                   disk_manager_(disk_manager) {
             // TODO: you may intialize your own defined memeber variables here
-            log_buffer_ = new char[LOG_BUFFER_SIZE];
-            flush_buffer_ = new char[LOG_BUFFER_SIZE];
+            for (int i = 0; i < LOG_BUFFER_COUNT; i++) {
+                buffers_[i] = new char[LOG_BUFFER_SIZE];
+                filled_[i] = 0;
+                sealed_[i] = false;
+            }
+            for (auto &frame : frames_) frame = new char[LOG_BUFFER_SIZE];
         }
 
         ~LogManager() {
-            delete[] log_buffer_;
-            delete[] flush_buffer_;
-            log_buffer_ = nullptr;
-            flush_buffer_ = nullptr;
+            for (auto &buffer : buffers_) {
+                delete[] buffer;
+                buffer = nullptr;
+            }
+            for (auto &frame : frames_) delete[] frame;
         }
         // spawn a separate thread to wake up periodically to flush
         void RunFlushThread();
@@ -38,29 +107,150 @@ namespace cmudb {
 
         // append a log record into log buffer
         lsn_t AppendLogRecord(LogRecord &log_record);
+        /**
+         * Stage log_record, a change txn made to page under the page's write
+         * latch, in txn's log buffer instead of appending it. The record and
+         * page get their LSNs once the buffer is merged: when it holds
+         * TXN_LOG_BUFFER_SIZE bytes, at commit/abort, or before another
+         * transaction changes page or page is written out.
+         */
+        void StageLogRecord(Transaction *txn, LogRecord &log_record, Page *page);
+        // merge txn's log buffer, followed by last if given, into the log in
+        // one reservation. Returns txn's prevLSN after that
+        lsn_t MergeLogRecords(Transaction *txn, LogRecord *last = nullptr);
+        // merge the log buffer holding page's unmerged records, if any
+        void MergePage(Page *page);
+        // encode a record that has its LSN and size into data, the reverse
+        // of LogRecovery::DeserializeLogRecord
+        static void SerializeLogRecord(const LogRecord &log_record, char *data);
 
         // get/set helper functions
         inline lsn_t GetPersistentLSN() { return persistent_lsn_; }
         inline void SetPersistentLSN(lsn_t lsn) { persistent_lsn_ = lsn; }
-        inline char *GetLogBuffer() { return log_buffer_; }
+        inline char *GetLogBuffer() { return buffers_[segmentOf(reserved_)]; }
 
         void Flush(bool force);
+
+        // block until every record up to and including lsn is on disk. Does not
+        // force a flush, the next group commit wakes it: GROUP_COMMIT_SIZE
+        // waiting commits, GROUP_COMMIT_BYTES unflushed, or the commit delay
+        // (none of them when GROUP_COMMIT_MAX_DELAY is zero)
+        void WaitForPersistent(lsn_t lsn);
+
+        // run callback on the flush thread once every record up to and
+        // including lsn is on disk (right away if it already is). The callback
+        // must not append log records or commit a transaction: an append may
+        // wait for the flush thread to free a segment and a commit waits for
+        // it to flush, so either deadlocks the flush thread. Hand such work to
+        // another thread
+        void OnPersistent(lsn_t lsn, std::function<void()> callback);
+
+        GroupCommitStats GetGroupCommitStats();
+        FlushStats GetFlushStats();
+
+        // continue the LSNs of the log on disk (found by recovery) instead of
+        // starting over at 0. Only before logging starts
+        void SetNextLSN(lsn_t lsn);
+
+        // offset in the log file to read from to see every record from lsn on:
+        // the start of the flushed log segment holding lsn. lsn must be persistent
+        int64_t GetLogOffset(lsn_t lsn);
+        // forget the offsets of the segments before the one holding lsn
+        void DiscardLogOffsets(lsn_t lsn);
+
+        // stream every flushed segment to a hot standby before the records in
+        // it count as persistent. Only before RunFlushThread
+        inline void SetLogShipper(LogShipper *shipper) { shipper_ = shipper; }
+
+        // log buffer reservations so far, by single records and merges
+        inline uint64_t GetReservationCount() { return reservations_; }
     private:
+        /**
+         * 预留字：| 下一个LSN (32位) | 正在追加的段 (8位) | 段中已预留的字节数 (24位) |
+         * LSN和偏移量在同一个原子操作中分配，段中的记录总是按LSN排列。
+         * 段组成一个环，追加的段写满后切到下一个空闲的段，刷新线程按顺序把封住的段写到磁盘
+         */
+        static const int SEGMENT_SHIFT = 24;
+        static const int LSN_SHIFT = 32;
+        static const uint64_t OFFSET_MASK = (1ULL << SEGMENT_SHIFT) - 1;
+        static_assert(LOG_BUFFER_SIZE <= OFFSET_MASK, "log buffer too large");
+        static_assert(LOG_BUFFER_COUNT >= 2 && LOG_BUFFER_COUNT <= 256,
+                      "need 2 to 256 log buffer segments");
+        static inline int32_t offsetOf(uint64_t word) {
+            return static_cast<int32_t>(word & OFFSET_MASK);
+        }
+        static inline int segmentOf(uint64_t word) {
+            return static_cast<int>((word >> SEGMENT_SHIFT) & 0xFF);
+        }
+        static inline lsn_t lsnOf(uint64_t word) {
+            return static_cast<lsn_t>(word >> LSN_SHIFT);
+        }
+        static inline int nextSegment(int segment) {
+            return (segment + 1) % LOG_BUFFER_COUNT;
+        }
+        // 合并的一批记录要放进一个段：不满的缓冲加上最后一条记录(最大的是更新)和COMMIT
+        static_assert(TXN_LOG_BUFFER_SIZE + 3 * PAGE_SIZE <= LOG_BUFFER_SIZE,
+                      "a merged transaction log buffer must fit a log segment");
+        // 一次预留count条记录的空间和连续的LSN并序列化，返回第一个LSN。
+        // chain为true时第一条之后的记录的prevLSN都是前一条
+        lsn_t appendLogRecords(LogRecord *const *records, int count, bool chain);
+        // 合并buffer中的记录和last，第一条记录的prevLSN不早于prev_lsn。
+        // 返回合并的最后一条记录的LSN
+        lsn_t merge(const std::shared_ptr<TxnLogBuffer> &buffer, LogRecord *last,
+                    lsn_t prev_lsn);
+        // 封住word中正在追加的段并切到下一个段，下一个段还没刷完或者CAS失败(word
+        // 被更新为当前值)时返回false
+        bool advance(uint64_t *word);
+        // 按顺序写出所有封住的段，all为true时也封住并写出正在追加的段。
+        // 有段没能写到磁盘时返回false，它和之后的段都还封着
+        bool flushSegments(bool all);
+        /**
+         * 压缩的段：| 0 | 原来的长度 varint | 压缩后的长度 varint | LZ4块 |。
+         * 记录的长度不会是0，读日志的看到0就知道后面是压缩的段。
+         * 返回要写的字节数，*data换成压缩的段；压缩后没有变小就原样写
+         */
+        int compress(char **data, int size);
+        // GROUP_COMMIT_MAX_DELAY为0时关闭自适应组提交，提交只等超时、段写满或者强制刷新
+        static inline bool groupCommit() { return GROUP_COMMIT_MAX_DELAY.count() > 0; }
+        // 下面的函数都要持有latch_
+        // 登记一个等待落盘的提交，凑够一组时唤醒刷新线程
+        void addWaiter(lsn_t lsn);
+        // 等待的提交够多或者未刷新的字节够多，不用再等
+        bool groupReady();
+        // 最早的等待者最多等多久：一次写日志的时间，不超过GROUP_COMMIT_MAX_DELAY
+        std::chrono::steady_clock::time_point groupDeadline();
+        // 把已经落盘的等待者移出并记入统计
+        void completeGroup();
+
         // TODO: you may add your own member variables
         // also remember to change constructor accordingly
-        int32_t logBufferOffset_ = 0;
-        int32_t flushBufferSize_ = 0;
         atomic<bool> needFlush_; //for group commit
-        lsn_t lastLsn_ = INVALID_LSN; //update in append log, use it in flush
         condition_variable appendCv_; // for notifying append thread
-        // atomic counter, record the next log sequence number
-        std::atomic<lsn_t> next_lsn_;
+        // 等待落盘的回调，按LSN排序，由latch_保护
+        multimap<lsn_t, std::function<void()>> durableCallbacks_;
+        // 等待落盘的提交(同步和异步)的LSN和开始等待的时间，由latch_保护
+        multimap<lsn_t, std::chrono::steady_clock::time_point> waiters_;
+        GroupCommitStats stats_;
+        // 每个写到磁盘的段中第一条记录的LSN -> 段在日志文件中的偏移量，由latch_保护
+        map<lsn_t, int64_t> logOffsets_;
+        // next lsn, active buffer and its reserved bytes, see above
+        std::atomic<uint64_t> reserved_;
+        std::atomic<uint64_t> reservations_{0};
         // log records before & include persistent_lsn_ have been written to disk
         std::atomic<lsn_t> persistent_lsn_;
-        // log_buffer_ for concurrently appending log records
-        char *log_buffer_;
-        // flush_buffer_ for flushing
-        char *flush_buffer_;
+        // appenders serialize into the active segment concurrently while the
+        // sealed ones are flushed
+        char *buffers_[LOG_BUFFER_COUNT];
+        // bytes of each segment already serialized, the flusher waits for it
+        // to reach the sealed size
+        std::atomic<int32_t> filled_[LOG_BUFFER_COUNT];
+        // set by whoever seals the segment, cleared once it is on disk;
+        // sealedSize_/sealedLsn_ are published by the release store of sealed_
+        std::atomic<bool> sealed_[LOG_BUFFER_COUNT];
+        int32_t sealedSize_[LOG_BUFFER_COUNT];
+        lsn_t sealedLsn_[LOG_BUFFER_COUNT];
+        // next segment to write, only used by the flush thread
+        int flushSegment_ = 0;
         // latch to protect shared member variables
         std::mutex latch_;
         // flush thread
@@ -69,6 +259,13 @@ namespace cmudb {
         std::condition_variable cv_;
         // disk manager
         DiskManager *disk_manager_;
+        // hot standby, only used by the flush thread
+        LogShipper *shipper_ = nullptr;
+        // compressed segments, used in turn (WriteLog takes a different buffer
+        // each time), and the metrics, protected by latch_
+        char *frames_[2];
+        int frame_ = 0;
+        FlushStats flushStats_;
     };
 
 } // namespace cmudb
@@ -2,31 +2,67 @@
  * log_record.h
  * For every write opeartion on table page, you should write ahead a
  * corresponding log record.
- * For EACH log record, HEADER is like (5 fields in common, 20 bytes in totoal)
+ * Records are encoded compactly: integers are varints (7 bits per byte, low
+ * bits first), ids that may be invalid (-1) are stored plus one, and LSNs
+ * that point back into the log are stored as the distance from the record's
+ * own LSN (0 for INVALID_LSN).
+ * For EACH log record, HEADER is like
  *-------------------------------------------------------------
- * | size | LSN | transID | prevLSN | LogType |
+ * | size | LSN | LogType | transID | prevLSN |
  *-------------------------------------------------------------
+ * size (varint) counts the bytes after itself, the LSN is a fixed 4 bytes,
+ * LogType one byte, transID a varint and prevLSN a back reference.
+ * A rid is | page_id | slot_num |, a tuple is | tuple_size | tuple_data |
  * For insert type log record
  *-------------------------------------------------------------
- * | HEADER | tuple_rid | tuple_size | tuple_data(char[] array) |
+ * | HEADER | tuple_rid | tuple |
  *-------------------------------------------------------------
  * For delete type(including markdelete, rollbackdelete, applydelete)
  *-------------------------------------------------------------
- * | HEADER | tuple_rid | tuple_size | tuple_data(char[] array) |
+ * | HEADER | tuple_rid | tuple |
  *-------------------------------------------------------------
- * For update type log record
+ * For update type log record: the new tuple is the old one with the bytes
+ * between a common prefix and a common suffix replaced
  *------------------------------------------------------------------------------
- * | HEADER | tuple_rid | tuple_size | old_tuple_data | tuple_size |
- * | new_tuple_data |
+ * | HEADER | tuple_rid | old_tuple | prefix_size | suffix_size |
+ * | middle_size | middle_data |
  *------------------------------------------------------------------------------
  * For new page type log record
  *-------------------------------------------------------------
  * | HEADER | prev_page_id | page_id
  *-------------------------------------------------------------
+ * For end checkpoint type log record (begin checkpoint is just a HEADER)
+ *------------------------------------------------------------------------------
+ * | HEADER | begin_lsn | dirty_page_count | (page_id, rec_lsn)... |
+ * | active_txn_count | (txn_id, first_lsn)... |
+ *------------------------------------------------------------------------------
+ * where the LSNs are stored plus one
+ * For compensation log record, written when recovery undoes a record: the
+ * action that undid it (insert/delete/update type), redone like that type,
+ * and the next record of the transaction left to undo
+ *------------------------------------------------------------------------------
+ * | HEADER | undo_next_lsn | action type | action (as above, no HEADER) |
+ *------------------------------------------------------------------------------
+ * For B+ tree page type log record (index insert/delete, split, merge,
+ * redistribute, root change): the bytes of one page an index operation
+ * changed, before and after
+ *------------------------------------------------------------------------------
+ * | HEADER | page_id | offset | length | old_data | new_data |
+ *------------------------------------------------------------------------------
+ * For index end type log record, which closes the records of an index
+ * operation (a nested top action): the record before the operation
+ *-------------------------------------------------------------
+ * | HEADER | undo_next_lsn |
+ *-------------------------------------------------------------
  */
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "common/config.h"
 #include "table/tuple.h"
@@ -45,8 +81,32 @@ namespace cmudb {
         ABORT,
         // when create a new page in heap table
         NEWPAGE,
+        // fuzzy checkpoint, see CheckpointManager
+        BEGIN_CHECKPOINT,
+        END_CHECKPOINT,
+        // compensation log record, see LogRecovery::StartUndo
+        CLR,
+        // B+ tree page changes, see IndexLog
+        INDEX_INSERT,
+        INDEX_DELETE,
+        INDEX_SPLIT,
+        INDEX_MERGE,
+        INDEX_REDISTRIBUTE,
+        INDEX_ROOT,
+        INDEX_END,
     };
 
+    // true for the record types that carry B+ tree page bytes
+    inline bool IsIndexPageRecord(LogRecordType type) {
+        return type >= LogRecordType::INDEX_INSERT && type <= LogRecordType::INDEX_ROOT;
+    }
+
+    // dirty page table: page -> recLSN, the first record that dirtied the page
+    // since it was last written out
+    typedef std::vector<std::pair<page_id_t, lsn_t>> DirtyPageTable;
+    // active transaction table: txn -> the LSN of its BEGIN record
+    typedef std::vector<std::pair<txn_id_t, lsn_t>> ActiveTxnTable;
+
     class LogRecord {
         friend class LogManager;
 
@@ -62,7 +122,7 @@ namespace cmudb {
 
         // constructor for Transaction type(BEGIN/COMMIT/ABORT)
         LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type)
-                : size_(HEADER_SIZE),
+                : size_(0),
                   lsn_(INVALID_LSN),
                   txn_id_(txn_id),
                   prev_lsn_(prev_lsn),
@@ -86,8 +146,7 @@ namespace cmudb {
                 delete_tuple_ = tuple;
             }
             // calculate log record size
-            //tuple的size类型为int32_t
-            size_ = HEADER_SIZE + sizeof(RID) + sizeof(int32_t) + tuple.GetLength();
+            body_size_ = RIDSize(rid) + BytesSize(tuple.GetLength());
         }
 
         // constructor for UPDATE type
@@ -101,23 +160,102 @@ namespace cmudb {
                   update_rid_(update_rid),
                   old_tuple_(old_tuple),
                   new_tuple_(new_tuple) {
+            // 新元组只记和旧元组不同的中间一段，小的更新只占几个字节
+            int32_t old_length = old_tuple.GetLength();
+            int32_t new_length = new_tuple.GetLength();
+            int32_t limit = std::min(old_length, new_length);
+            const char *old_data = old_tuple.GetData();
+            const char *new_data = new_tuple.GetData();
+            while (update_prefix_ < limit &&
+                   old_data[update_prefix_] == new_data[update_prefix_])
+                update_prefix_++;
+            while (update_suffix_ < limit - update_prefix_ &&
+                   old_data[old_length - 1 - update_suffix_] ==
+                   new_data[new_length - 1 - update_suffix_])
+                update_suffix_++;
             // calculate log record size
-            size_ = HEADER_SIZE + sizeof(RID) + old_tuple.GetLength() +
-                    new_tuple.GetLength() + 2 * sizeof(int32_t);
+            body_size_ = RIDSize(update_rid) + BytesSize(old_length) +
+                         VarintSize(update_prefix_) + VarintSize(update_suffix_) +
+                         BytesSize(new_length - update_prefix_ - update_suffix_);
         }
 
         // constructor for NEWPAGE type
         LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
                   page_id_t prev_page_id, page_id_t page_id)
-                : size_(HEADER_SIZE),
-                  lsn_(INVALID_LSN),
+                : lsn_(INVALID_LSN),
                   txn_id_(txn_id),
                   prev_lsn_(prev_lsn),
                   log_record_type_(log_record_type),
                   prev_page_id_(prev_page_id),
                   page_id_(page_id) {
             // calculate log record size
-            size_ = HEADER_SIZE + sizeof(page_id_t) * 2;
+            body_size_ = VarintSize(prev_page_id + 1) + VarintSize(page_id + 1);
+        }
+
+        // constructor for B+ tree page types, the bytes at offset of page_id
+        // changed from old_data to new_data
+        LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
+                  page_id_t page_id, int32_t offset, std::string old_data,
+                  std::string new_data)
+                : lsn_(INVALID_LSN),
+                  txn_id_(txn_id),
+                  prev_lsn_(prev_lsn),
+                  log_record_type_(log_record_type),
+                  page_id_(page_id),
+                  index_offset_(offset),
+                  old_data_(std::move(old_data)),
+                  new_data_(std::move(new_data)) {
+            assert(IsIndexPageRecord(log_record_type));
+            assert(old_data_.size() == new_data_.size());
+            int32_t length = static_cast<int32_t>(old_data_.size());
+            body_size_ = VarintSize(page_id + 1) + VarintSize(offset) +
+                         BytesSize(length) + length;
+        }
+
+        // constructor for INDEX_END type
+        LogRecord(txn_id_t txn_id, lsn_t prev_lsn, lsn_t undo_next_lsn)
+                : lsn_(INVALID_LSN),
+                  txn_id_(txn_id),
+                  prev_lsn_(prev_lsn),
+                  log_record_type_(LogRecordType::INDEX_END),
+                  undo_next_lsn_(undo_next_lsn) {}
+
+        // constructor for END_CHECKPOINT type
+        LogRecord(lsn_t begin_lsn, const DirtyPageTable &dirty_pages,
+                  const ActiveTxnTable &active_txns)
+                : lsn_(INVALID_LSN),
+                  txn_id_(INVALID_TXN_ID),
+                  prev_lsn_(INVALID_LSN),
+                  log_record_type_(LogRecordType::END_CHECKPOINT),
+                  begin_lsn_(begin_lsn),
+                  dirty_pages_(dirty_pages),
+                  active_txns_(active_txns) {
+            // calculate log record size
+            body_size_ = VarintSize(begin_lsn + 1) + VarintSize(dirty_pages.size()) +
+                         VarintSize(active_txns.size());
+            for (auto &entry : dirty_pages)
+                body_size_ += VarintSize(entry.first + 1) + VarintSize(entry.second + 1);
+            for (auto &entry : active_txns)
+                body_size_ += VarintSize(entry.first + 1) + VarintSize(entry.second + 1);
+        }
+
+        // constructor for CLR type, action is the insert/delete/update or
+        // B+ tree page type record that undoes the record before undo_next_lsn
+        LogRecord(txn_id_t txn_id, lsn_t prev_lsn, lsn_t undo_next_lsn,
+                  const LogRecord &action)
+                : LogRecord(action) {
+            assert((action.log_record_type_ >= LogRecordType::INSERT &&
+                    action.log_record_type_ <= LogRecordType::UPDATE) ||
+                   IsIndexPageRecord(action.log_record_type_));
+            size_ = 0;
+            lsn_ = INVALID_LSN;
+            txn_id_ = txn_id;
+            prev_lsn_ = prev_lsn;
+            log_record_type_ = LogRecordType::CLR;
+            action_type_ = action.log_record_type_;
+            undo_next_lsn_ = undo_next_lsn;
+            // the action type byte
+            body_size_ = action.body_size_ + 1;
         }
 
         ~LogRecord() {}
@@ -128,10 +266,24 @@ namespace cmudb {
 
         inline RID &GetInsertRID() { return insert_rid_; }
 
+        inline RID &GetUpdateRID() { return update_rid_; }
+
+        inline Tuple &GetOldTuple() { return old_tuple_; }
+
+        inline Tuple &GetNewTuple() { return new_tuple_; }
+
         inline page_id_t GetNewPageRecord() { return prev_page_id_; }
 
+        // the length in the log, known once the record is appended or read
         inline int32_t GetSize() { return size_; }
 
+        // the length the record takes when it gets LSN lsn: the back
+        // references to earlier records are shorter the closer they are
+        inline int32_t GetSize(lsn_t lsn) const {
+            int32_t rest = restSize(lsn);
+            return VarintSize(rest) + rest;
+        }
+
         inline lsn_t GetLSN() { return lsn_; }
 
         inline txn_id_t GetTxnId() { return txn_id_; }
@@ -140,6 +292,25 @@ namespace cmudb {
 
         inline LogRecordType &GetLogRecordType() { return log_record_type_; }
 
+        inline lsn_t GetBeginLSN() { return begin_lsn_; }
+
+        inline DirtyPageTable &GetDirtyPages() { return dirty_pages_; }
+
+        inline ActiveTxnTable &GetActiveTxns() { return active_txns_; }
+
+        inline lsn_t GetUndoNextLSN() { return undo_next_lsn_; }
+
+        // the page operation the record describes: the action of a CLR
+        inline LogRecordType GetActionType() const {
+            return log_record_type_ == LogRecordType::CLR ? action_type_
+                                                          : log_record_type_;
+        }
+
+        // the header page has no LSN field, its records are always redone
+        inline bool IsHeaderPageRecord() const {
+            return IsIndexPageRecord(GetActionType()) && page_id_ == HEADER_PAGE_ID;
+        }
+
         // For debug purpose
         inline std::string ToString() const {
             std::ostringstream os;
@@ -154,9 +325,94 @@ namespace cmudb {
         }
 
     private:
-        // 四种操作类型一定要有的公共字段header
+        // the header and the back reference of a CLR or an index end, after
+        // the size field
+        inline int32_t restSize(lsn_t lsn) const {
+            int32_t rest = sizeof(lsn_t) + 1 + VarintSize(txn_id_ + 1) +
+                           VarintSize(BackRef(lsn, prev_lsn_)) + body_size_;
+            if (log_record_type_ == LogRecordType::CLR ||
+                log_record_type_ == LogRecordType::INDEX_END)
+                rest += VarintSize(BackRef(lsn, undo_next_lsn_));
+            return rest;
+        }
+
+        // 编码用的小函数，LogManager序列化、LogRecovery反序列化时共用。
+        // Get*在data为nullptr或者越过end时返回nullptr，连着读的时候最后检查一次就行
+        static inline int VarintSize(uint32_t value) {
+            int size = 1;
+            for (; value >= 0x80; value >>= 7) size++;
+            return size;
+        }
+
+        static inline char *PutVarint(char *data, uint32_t value) {
+            for (; value >= 0x80; value >>= 7)
+                *data++ = static_cast<char>(value | 0x80);
+            *data++ = static_cast<char>(value);
+            return data;
+        }
+
+        static inline const char *GetVarint(const char *data, const char *end,
+                                            uint32_t *value) {
+            *value = 0;
+            if (data == nullptr) return nullptr;
+            for (int shift = 0; shift < 35 && data < end; shift += 7) {
+                auto byte = static_cast<uint8_t>(*data++);
+                *value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) return data;
+            }
+            return nullptr;
+        }
+
+        // an earlier LSN as its distance from lsn, 0 for INVALID_LSN
+        static inline uint32_t BackRef(lsn_t lsn, lsn_t target) {
+            return target == INVALID_LSN ? 0 : static_cast<uint32_t>(lsn - target);
+        }
+
+        static inline lsn_t FromBackRef(lsn_t lsn, uint32_t ref) {
+            return ref == 0 ? INVALID_LSN : lsn - static_cast<lsn_t>(ref);
+        }
+
+        static inline int RIDSize(const RID &rid) {
+            return VarintSize(rid.GetPageId() + 1) + VarintSize(rid.GetSlotNum() + 1);
+        }
+
+        static inline char *PutRID(char *data, const RID &rid) {
+            data = PutVarint(data, rid.GetPageId() + 1);
+            return PutVarint(data, rid.GetSlotNum() + 1);
+        }
+
+        static inline const char *GetRID(const char *data, const char *end, RID *rid) {
+            uint32_t page_id, slot_num;
+            data = GetVarint(data, end, &page_id);
+            data = GetVarint(data, end, &slot_num);
+            rid->Set(static_cast<page_id_t>(page_id) - 1, static_cast<int>(slot_num) - 1);
+            return data;
+        }
+
+        // | size | data |
+        static inline int BytesSize(int32_t size) { return VarintSize(size) + size; }
+
+        static inline char *PutBytes(char *data, const char *bytes, int32_t size) {
+            data = PutVarint(data, size);
+            memcpy(data, bytes, size);
+            return data + size;
+        }
+
+        static inline const char *GetBytes(const char *data, const char *end,
+                                           const char **bytes, int32_t *size) {
+            uint32_t length;
+            data = GetVarint(data, end, &length);
+            if (data == nullptr || length > static_cast<uint32_t>(end - data)) return nullptr;
+            *bytes = data;
+            *size = static_cast<int32_t>(length);
+            return data + length;
+        }
+
+        // 所有类型都有的公共字段header
         // the length of log record(for serialization, in bytes)
         int32_t size_ = 0;
+        // the part of the length that does not depend on the LSN
+        int32_t body_size_ = 0;
         // must have fields
         lsn_t lsn_ = INVALID_LSN;
         txn_id_t txn_id_ = INVALID_TXN_ID;
@@ -175,11 +431,27 @@ namespace cmudb {
         RID update_rid_;
         Tuple old_tuple_;
         Tuple new_tuple_;
+        // new_tuple_ shares this many leading and trailing bytes with old_tuple_
+        int32_t update_prefix_ = 0;
+        int32_t update_suffix_ = 0;
 
         // case4: for new page operation
         page_id_t prev_page_id_ = INVALID_PAGE_ID;
         page_id_t page_id_ = INVALID_PAGE_ID;
-        const static int HEADER_SIZE = 20;
+
+        // case5: for end checkpoint, begin_lsn_ is the matching BEGIN_CHECKPOINT
+        lsn_t begin_lsn_ = INVALID_LSN;
+        DirtyPageTable dirty_pages_;
+        ActiveTxnTable active_txns_;
+
+        // case6: for compensation log record and index end
+        lsn_t undo_next_lsn_ = INVALID_LSN;
+        LogRecordType action_type_ = LogRecordType::INVALID;
+
+        // case7: for B+ tree page operation, page_id_ is the page
+        int32_t index_offset_ = 0;
+        std::string old_data_;
+        std::string new_data_;
     };  // namespace cmudb
 
 }  // namespace cmudb
@@ -5,45 +5,167 @@
 
 #pragma once
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "buffer/buffer_pool_manager.h"
 #include "concurrency/lock_manager.h"
+#include "concurrency/transaction_manager.h"
 #include "logging/log_record.h"
+#include "page/table_page.h"
 
 namespace cmudb {
 
     class LogRecovery {
     public:
+        // redo_threads threads apply the redo records, partitioned by page
         LogRecovery(DiskManager *disk_manager,
-                    BufferPoolManager *buffer_pool_manager)
+                    BufferPoolManager *buffer_pool_manager,
+                    int redo_threads = RECOVERY_THREADS)
                 : disk_manager_(disk_manager), buffer_pool_manager_(buffer_pool_manager),
-                  offset_(0) {
-            // global transaction through recovery phase
-            log_buffer_ = new char[LOG_BUFFER_SIZE];
-        }
+                  redo_threads_(std::max(redo_threads, 1)) {}
 
-        ~LogRecovery() {
-            delete[] log_buffer_;
-            log_buffer_ = nullptr;
-        }
+        ~LogRecovery() { WaitForUndo(); }
 
         void Redo();
+        // roll back the losers on this thread without logging, flush the pages
+        // recovery changed and end every loser with an ABORT record
         void Undo();
-        bool DeserializeLogRecord(const char *data, LogRecord &log_record);
+        /**
+         * Restart undo: continue the LSNs of the log, start logging, lock the
+         * rows of every loser and return. The losers are rolled back in the
+         * background, on up to redo_threads threads, writing a CLR for every
+         * undone record so a crash during undo does not undo anything twice.
+         * New transactions may run meanwhile, the ones touching a loser's
+         * rows wait or die like with any other lock holder.
+         */
+        void StartUndo(TransactionManager *transaction_manager,
+                       LockManager *lock_manager, LogManager *log_manager);
+        // block until every loser is rolled back
+        void WaitForUndo();
+        // hot standby: redo one record streamed from the primary, in LSN
+        // order and on this thread, after Redo
+        void Replay(LogRecord &log);
+        // write back the pages Redo and Replay changed
+        void FlushPages();
+        // the largest LSN Redo or Replay has seen
+        inline lsn_t GetMaxLSN() const { return max_lsn_; }
+        // false if the record starting at data does not end before end
+        static bool DeserializeLogRecord(const char *data, const char *end,
+                                         LogRecord &log_record);
+        // if data starts a complete compressed log segment (see
+        // LogManager::compress) that ends before end, decompress it into raw
+        // (LOG_BUFFER_SIZE bytes) and return its size in the log, else 0
+        static int DecompressLogFrame(const char *data, const char *end, char *raw,
+                                      int *raw_size);
 
     private:
+        static_assert(LOG_READ_SIZE >= LOG_BUFFER_SIZE,
+                      "a log read window must hold any record");
+        // 分析阶段看到的还没有结束的事务
+        struct TxnLog {
+            lsn_t begin_lsn_ = INVALID_LSN;
+            lsn_t last_lsn_ = INVALID_LSN;
+            // LSN -> 日志偏移量，只记录还没结束的事务的记录(BEGIN除外)，按LSN排列
+            std::vector<std::pair<lsn_t, int64_t>> offsets_;
+        };
+        // undo读记录用的窗口，每个undo线程一个。沿着prev_lsn_往回走的记录
+        // 大多落在同一个窗口里，不用每条记录都读一次日志
+        struct LogWindow {
+            std::unique_ptr<char[]> data_{new char[LOG_READ_SIZE]};
+            int64_t start_ = 0;
+            int size_ = 0;
+            // 最近解压的压缩段，offset_是它在日志中的偏移量
+            std::unique_ptr<char[]> frame_{new char[LOG_BUFFER_SIZE]};
+            int64_t frame_offset_ = -1;
+            int frame_size_ = 0;
+        };
+
+        // 一个redo线程：按LSN的顺序处理分到它的页面上的记录
+        struct RedoWorker {
+            std::mutex latch_;
+            std::condition_variable work_cv_;
+            std::condition_variable idle_cv_;
+            std::deque<LogRecord> queue_;
+            bool busy_ = false;
+            bool stop_ = false;
+            std::unordered_set<page_id_t> recovered_pages_;
+            std::thread thread_;
+        };
+
+        void runRedoWorker(RedoWorker *worker);
+        void dispatch(const LogRecord &log);
+        // wait until every worker has applied all its records
+        void drainWorkers();
+        /**
+         * Parse the log forward from offset, calling visit(record, its offset)
+         * until it returns false or the log ends. The log is read in
+         * LOG_READ_SIZE windows, the next one in the background while the
+         * current one is parsed
+         */
+        void scanLog(int64_t offset,
+                     const std::function<bool(LogRecord &, int64_t)> &visit);
+        // the record of txn_log with LSN lsn, false if it is not indexed
+        bool readRecord(const TxnLog &txn_log, lsn_t lsn, LogWindow *window,
+                        LogRecord *log);
+        // the record with LSN lsn starting at offset in the window, or in the
+        // compressed segment starting there
+        bool recordAt(LogWindow *window, int64_t offset, lsn_t lsn, LogRecord *log);
+        // load the dirty page table of the checkpoint in the master record,
+        // returns the offset redo starts at
+        int64_t readCheckpoint();
+        // true if log is before the checkpoint and its page was clean
+        bool skipRedo(const LogRecord &log, int64_t offset);
+        // redo log on its page(s) if the page LSN is older
+        void redoRecord(LogRecord &log, std::unordered_set<page_id_t> &recovered_pages);
+        // the row an insert/delete/update record or CLR changes, slot 0 of
+        // the page for a B+ tree page record
+        static RID ridOf(const LogRecord &log);
+        // the insert/delete/update or B+ tree page type record that undoes log
+        static LogRecord undoAction(const LogRecord &log);
+        static void applyAction(TablePage *page, LogRecord &action);
+        // the header page has no LSN field, it only goes into the dirty page table
+        static void setPageLSN(Page *page, const LogRecord &log, lsn_t lsn);
+        // the table (first page) page_id belongs to, by the prev page links
+        page_id_t tableOf(page_id_t page_id,
+                          std::unordered_map<page_id_t, page_id_t> *tables);
+        void runUndoWorker();
+        void undoLoser(Transaction *txn, TxnLog &txn_log, LogWindow *window);
+        // undo the records of txn back from lsn with CLRs, with index_only
+        // stop at the first record that is not part of an unfinished B+ tree
+        // operation. Returns the LSN undo stopped at
+        lsn_t undoRecords(Transaction *txn, const TxnLog &txn_log, lsn_t lsn,
+                          LogWindow *window, bool index_only);
+
         // Don't forget to initialize newly added variable in constructor
         DiskManager *disk_manager_;
         BufferPoolManager *buffer_pool_manager_;
-        //维护活跃的事务及其对应的最新lsn
-        std::unordered_map<txn_id_t, lsn_t> active_txn_;
-        //将日志序列号映射到日志文件偏移量，以供撤消
-        std::unordered_map<lsn_t, int> lsn_mapping_;
-        // log buffer related
-        int offset_;
-        char *log_buffer_;
+        int redo_threads_;
+        std::vector<std::unique_ptr<RedoWorker>> workers_;
+        //维护活跃的事务及其记录
+        std::unordered_map<txn_id_t, TxnLog> active_txn_;
+        // 扫描到的最大的LSN，重启之后的LSN接着它分配
+        lsn_t max_lsn_ = INVALID_LSN;
+        // 主记录指向的检查点的脏页表，只用来跳过检查点之前的记录
+        std::unordered_map<page_id_t, lsn_t> dirty_pages_;
+        int64_t checkpoint_offset_ = 0;
+        // redo和undo改过的页面，恢复结束时写回磁盘
+        std::unordered_set<page_id_t> recovered_pages_;
+        // restart undo
+        TransactionManager *transaction_manager_ = nullptr;
+        LogManager *log_manager_ = nullptr;
+        std::mutex undo_latch_;
+        // 等待回滚的loser，由undo_latch_保护
+        std::vector<std::pair<Transaction *, TxnLog *>> losers_;
+        std::vector<std::thread> undo_threads_;
     };
 
 } // namespace cmudb
@@ -0,0 +1,74 @@
+/**
+ * log_replica.h
+ * Hot standby: keeps a read-only copy of a database current by redoing the
+ * log a LogShipper streams from the primary. Received records go to the
+ * standby's own log before they are applied, so a restarted standby redoes
+ * its log and asks the primary for the rest. The standby process must not
+ * enable logging. A new standby starts from an empty log, so it has to
+ * connect before the primary truncates its log for the first time.
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "buffer/buffer_pool_manager.h"
+#include "common/rwmutex.h"
+#include "disk/disk_manager.h"
+#include "logging/log_recovery.h"
+
+namespace cmudb {
+
+    class LogReplica {
+    public:
+        LogReplica(const std::string &db_file, const std::string &socket_path);
+
+        ~LogReplica();
+
+        // redo the local log, then accept the primary on the socket
+        void Start();
+        // stop receiving and write back the pages changed so far
+        void Stop();
+
+        // run read against the standby's pages while no record is applied.
+        // It sees the database as of a record boundary, changes of
+        // transactions still running on the primary included
+        void Read(const std::function<void(BufferPoolManager *)> &read);
+
+        lsn_t GetAppliedLSN();
+        // false if the record with LSN lsn is not applied within timeout
+        bool WaitForLSN(lsn_t lsn, std::chrono::milliseconds timeout);
+
+    private:
+        void runReceiver();
+        // receive from the primary until it disconnects or Stop
+        void receive(int fd);
+        // log and apply the complete records at the front of data, returns
+        // the bytes they take, -1 if the local log cannot be written
+        int apply(char *data, int size);
+
+        DiskManager *disk_manager_;
+        BufferPoolManager *buffer_pool_manager_;
+        LogRecovery *log_recovery_;
+        std::string socket_path_;
+        int listen_fd_ = -1;
+        std::thread *receiver_ = nullptr;
+        // readers against the applier
+        RWMutex pages_latch_;
+        // protects applied_lsn_, conn_fd_ and stop_
+        std::mutex latch_;
+        std::condition_variable applied_cv_;
+        lsn_t applied_lsn_ = INVALID_LSN;
+        int conn_fd_ = -1;
+        bool stop_ = false;
+        // a compressed log segment decompressed, only used by the receiver
+        std::unique_ptr<char[]> frame_{new char[LOG_BUFFER_SIZE]};
+    };
+
+} // namespace cmudb
@@ -0,0 +1,56 @@
+/**
+ * log_shipper.h
+ * Log shipping for a hot standby: the flush thread hands every log segment it
+ * wrote to the shipper, which streams the bytes to a LogReplica listening on
+ * a unix domain socket. A standby that connects late, or reconnects, first
+ * gets the part of the log it is missing read back from disk.
+ *
+ * There is no base backup: a standby can only be seeded from the log, so it
+ * must connect (starting from an empty log) before the primary truncates
+ * the log for the first time. Once a checkpoint has recycled the segments
+ * it would start from, the primary refuses it; such a standby needs a copy
+ * of the primary's files taken offline.
+ */
+
+#pragma once
+#include <chrono>
+#include <string>
+
+#include "disk/disk_manager.h"
+
+namespace cmudb {
+
+    class LogShipper {
+    public:
+        LogShipper(DiskManager *disk_manager, const std::string &socket_path)
+                : disk_manager_(disk_manager), socket_path_(socket_path) {}
+
+        ~LogShipper() { disconnect(); }
+
+        // called by the flush thread once the size bytes at log offset offset
+        // are on disk. Blocks until the standby's socket takes them, at most
+        // LOG_SHIP_TIMEOUT_MS per send; a standby that does not take them in
+        // time is dropped and not connected to again for as long. Without a
+        // standby (or after a failed send) it tries to connect again
+        void Ship(const char *log_data, int size, int64_t offset);
+
+    private:
+        // connect and read the log offset the standby wants the log from
+        bool connect();
+        void disconnect();
+        // the standby timed out: back off before connecting again
+        void stalled();
+        // send the log on disk from shipped_ up to end
+        bool catchUp(int64_t end);
+        bool send(const char *data, int size);
+
+        DiskManager *disk_manager_;
+        std::string socket_path_;
+        int fd_ = -1;
+        // log offset of the next byte the standby expects
+        int64_t shipped_ = 0;
+        // no connection attempt before this, after a standby timed out
+        std::chrono::steady_clock::time_point retry_at_;
+    };
+
+} // namespace cmudb
@@ -54,17 +54,23 @@ namespace cmudb {
 
         ValueType RemoveAndReturnOnlyChild();
 
+        // the Move methods change the parent of the children they move,
+        // log records those changes
         void MoveHalfTo(BPlusTreeInternalPage *recipient,
-                        BufferPoolManager *buffer_pool_manager);
+                        BufferPoolManager *buffer_pool_manager,
+                        IndexLog *log = nullptr);
 
         void MoveAllTo(BPlusTreeInternalPage *recipient, int index_in_parent,
-                       BufferPoolManager *buffer_pool_manager);
+                       BufferPoolManager *buffer_pool_manager,
+                       IndexLog *log = nullptr);
 
         void MoveFirstToEndOf(BPlusTreeInternalPage *recipient,
-                              BufferPoolManager *buffer_pool_manager);
+                              BufferPoolManager *buffer_pool_manager,
+                              IndexLog *log = nullptr);
 
         void MoveLastToFrontOf(BPlusTreeInternalPage *recipient, int parent_index,
-                               BufferPoolManager *buffer_pool_manager);
+                               BufferPoolManager *buffer_pool_manager,
+                               IndexLog *log = nullptr);
 
         // DEUBG and PRINT
         std::string ToString(bool verbose) const;
@@ -83,7 +89,7 @@ namespace cmudb {
                           BufferPoolManager *buffer_pool_manager);
 
         void CopyFirstFrom(const MappingType &pair, int parent_index,
-                           BufferPoolManager *buffer_pool_manager);
+                           BufferPoolManager *buffer_pool_manager, IndexLog *log);
 
         MappingType array[0];
     };
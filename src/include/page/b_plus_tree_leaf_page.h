@@ -60,16 +60,20 @@ namespace cmudb {
 
         // Split and Merge utility methods
         void MoveHalfTo(BPlusTreeLeafPage *recipient,
-                        BufferPoolManager *buffer_pool_manager /* Unused */);
+                        BufferPoolManager *buffer_pool_manager /* Unused */,
+                        IndexLog * /* Unused */ = nullptr);
 
         void MoveAllTo(BPlusTreeLeafPage *recipient, int /* Unused */,
-                       BufferPoolManager * /* Unused */);
+                       BufferPoolManager * /* Unused */,
+                       IndexLog * /* Unused */ = nullptr);
 
         void MoveFirstToEndOf(BPlusTreeLeafPage *recipient,
-                              BufferPoolManager *buffer_pool_manager);
+                              BufferPoolManager *buffer_pool_manager,
+                              IndexLog * /* Unused */ = nullptr);
 
         void MoveLastToFrontOf(BPlusTreeLeafPage *recipient, int parentIndex,
-                               BufferPoolManager *buffer_pool_manager);
+                               BufferPoolManager *buffer_pool_manager,
+                               IndexLog * /* Unused */ = nullptr);
 
         // Debug
         std::string ToString(bool verbose = false) const;
@@ -35,6 +35,8 @@ namespace cmudb {
 // define page type enum
     enum class IndexPageType { INVALID_INDEX_PAGE = 0, LEAF_PAGE, INTERNAL_PAGE };
     enum class OpType { READ = 0, INSERT, DELETE };
+    // logs the page changes of a tree operation, see logging/index_log.h
+    class IndexLog;
 // Abstract class.
     class BPlusTreePage {
     public:
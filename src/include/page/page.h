@@ -8,14 +8,18 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstring>
 #include <iostream>
+#include <memory>
 
 #include "common/config.h"
 #include "common/rwmutex.h"
 
 namespace cmudb {
 
+    struct TxnLogBuffer;
+
     class Page {
         friend class BufferPoolManager;
 
@@ -44,7 +48,46 @@ namespace cmudb {
 
         inline lsn_t GetLSN() { return *reinterpret_cast<lsn_t *>(GetData() + 4); }
 
-        inline void SetLSN(lsn_t lsn) { memcpy(GetData() + 4, &lsn, 4); }
+        inline void SetLSN(lsn_t lsn) {
+            memcpy(GetData() + 4, &lsn, 4);
+            SetRecLSN(lsn);
+        }
+
+        // raise the LSN to lsn unless it is newer already: staged records get
+        // their LSNs after the change, merged by a thread without the latch
+        inline void AdvanceLSN(lsn_t lsn) {
+            auto *field = reinterpret_cast<lsn_t *>(GetData() + 4);
+            lsn_t current = __atomic_load_n(field, __ATOMIC_RELAXED);
+            while (current < lsn &&
+                   !__atomic_compare_exchange_n(field, &current, lsn, true,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+            SetRecLSN(lsn);
+        }
+
+        // the transaction log buffer holding the unmerged records of this
+        // page, see LogManager::StageLogRecord
+        inline std::shared_ptr<TxnLogBuffer> GetStager() {
+            return std::atomic_load(&stager_);
+        }
+
+        inline void SetStager(const std::shared_ptr<TxnLogBuffer> &stager) {
+            std::atomic_store(&stager_, stager);
+        }
+
+        // clear the stager if it still is stager
+        inline void ClearStager(const std::shared_ptr<TxnLogBuffer> &stager) {
+            auto expected = stager;
+            std::atomic_compare_exchange_strong(&stager_, &expected,
+                                                std::shared_ptr<TxnLogBuffer>());
+        }
+
+        // for pages without an LSN field (the header page): only put the page
+        // into the dirty page table
+        inline void SetRecLSN(lsn_t lsn) {
+            // 页面写回磁盘之后的第一条日志记录
+            lsn_t clean = INVALID_LSN;
+            rec_lsn_.compare_exchange_strong(clean, lsn);
+        }
 
     private:
         // method used by buffer pool manager
@@ -55,6 +98,10 @@ namespace cmudb {
         page_id_t page_id_ = INVALID_PAGE_ID;
         int pin_count_ = 0;
         bool is_dirty_ = false;
+        // recLSN for the dirty page table, reset when the page is written out
+        std::atomic<lsn_t> rec_lsn_{INVALID_LSN};
+        // 页面上还没合并到日志的修改都在这一个缓冲里
+        std::shared_ptr<TxnLogBuffer> stager_;
         RWMutex rwlatch_;
     };
 
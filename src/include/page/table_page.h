@@ -49,6 +49,8 @@ public:
   bool InsertTuple(const Tuple &tuple, RID &rid, Transaction *txn,
                    LockManager *lock_manager,
                    LogManager *log_manager); // return rid if success
+  // whether InsertTuple would find room for tuple, caller holds the latch
+  bool HasSpaceFor(const Tuple &tuple);
   bool MarkDelete(const RID &rid, Transaction *txn, LockManager *lock_manager,
                   LogManager *log_manager); // delete
   bool UpdateTuple(const Tuple &new_tuple, Tuple &old_tuple, const RID &rid,
@@ -64,12 +66,16 @@ public:
   // return tuple (with data pointing to heap) if success
   bool GetTuple(const RID &rid, Tuple &tuple, Transaction *txn,
                 LockManager *lock_manager);
+  // copy out the tuple without locking, false if the slot is empty or deleted
+  bool ReadTuple(const RID &rid, Tuple &tuple);
 
   /**
-   * Tuple iterator
+   * Tuple iterator, with include_deleted also stops at empty and deleted
+   * slots (older versions of them may still be visible to a snapshot)
    */
-  bool GetFirstTupleRid(RID &first_rid);
-  bool GetNextTupleRid(const RID &cur_rid, RID &next_rid);
+  bool GetFirstTupleRid(RID &first_rid, bool include_deleted = false);
+  bool GetNextTupleRid(const RID &cur_rid, RID &next_rid,
+                       bool include_deleted = false);
 
 private:
   /**
@@ -85,5 +91,9 @@ private:
                            // actual tuples because some slots may be empty
   void SetTupleCount(int32_t tuple_count);
   int32_t GetFreeSpaceSize();
+  // recovery changes pages with txn == nullptr, without locking or logging
+  static inline bool logged(Transaction *txn) {
+    return ENABLE_LOGGING && txn != nullptr;
+  }
 };
 } // namespace cmudb
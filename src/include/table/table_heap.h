@@ -7,6 +7,7 @@
 #pragma once
 
 #include "buffer/buffer_pool_manager.h"
+#include "concurrency/version_store.h"
 #include "logging/log_manager.h"
 #include "page/table_page.h"
 #include "table/table_iterator.h"
@@ -20,13 +21,15 @@ namespace cmudb {
     public:
         ~TableHeap() {}
 
-        // open a table heap
+        // open a table heap, keeps old tuple versions in version_store if given
         TableHeap(BufferPoolManager *buffer_pool_manager, LockManager *lock_manager,
-                  LogManager *log_manager, page_id_t first_page_id);
+                  LogManager *log_manager, page_id_t first_page_id,
+                  VersionStore *version_store = nullptr);
 
         // create table heap
         TableHeap(BufferPoolManager *buffer_pool_manager, LockManager *lock_manager,
-                  LogManager *log_manager, Transaction *txn);
+                  LogManager *log_manager, Transaction *txn,
+                  VersionStore *version_store = nullptr);
 
         // for insert, if tuple is too large (>~page_size), return false
         bool InsertTuple(const Tuple &tuple, RID &rid, Transaction *txn);
@@ -34,9 +37,15 @@ namespace cmudb {
         bool MarkDelete(const RID &rid, Transaction *txn); // for delete
 
         // if the new tuple is too large to fit in the old page, return false (will
-        // delete and insert)
+        // delete and insert). Optimistic transactions only buffer the update, it
+        // fails at commit instead
         bool UpdateTuple(const Tuple &tuple, const RID &rid, Transaction *txn);
 
+        // commit time of optimistic transactions: lock the tuple of a buffered
+        // write, then apply it to the page once the transaction is validated
+        bool LockBufferedWrite(const RID &rid, Transaction *txn);
+        bool ApplyBufferedWrite(const WriteRecord &record, Transaction *txn);
+
         // commit/abort time
         void ApplyDelete(const RID &rid,
                          Transaction *txn); // when commit delete or rollback insert
@@ -53,6 +62,34 @@ namespace cmudb {
         inline page_id_t GetFirstPageId() const { return first_page_id_; }
 
     private:
+        // take the table and page intention locks before latching the page
+        bool LockPage(page_id_t page_id, LockMode mode, Transaction *txn);
+        // whether txn already holds mode on the page, so LockPage won't wait
+        bool HoldsPage(page_id_t page_id, LockMode mode, Transaction *txn);
+        // snapshot and optimistic writers lock the tuple before latching the page
+        bool LockForWrite(const RID &rid, Transaction *txn);
+
+        bool MarkDeleteInPlace(const RID &rid, Transaction *txn);
+        bool UpdateInPlace(const Tuple &tuple, const RID &rid, Transaction *txn);
+
+        // snapshot and optimistic transactions read versions without locking
+        inline bool IsSnapshot(Transaction *txn) const {
+            return version_store_ != nullptr && txn != nullptr &&
+                   txn->GetMode() != ConcurrencyMode::TWO_PHASE_LOCKING;
+        }
+
+        // an optimistic transaction defers its updates and deletes until commit,
+        // rolling back (ABORTED) always works on the page
+        inline bool IsBuffered(Transaction *txn) const {
+            return version_store_ != nullptr &&
+                   txn->GetMode() == ConcurrencyMode::OPTIMISTIC &&
+                   txn->GetState() != TransactionState::ABORTED;
+        }
+
+        // the page must be latched
+        bool ReadSnapshot(TablePage *page, const RID &rid, Tuple &tuple,
+                          Transaction *txn);
+
         /**
          * Members
          */
@@ -60,6 +97,7 @@ namespace cmudb {
         LockManager *lock_manager_;
         LogManager *log_manager_;
         page_id_t first_page_id_;
+        VersionStore *version_store_;
     };
 
 } // namespace cmudb
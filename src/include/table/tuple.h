@@ -50,6 +50,9 @@ namespace cmudb {
         // deserialize tuple data(deep copy)
         void DeserializeFrom(const char *storage);
 
+        // copy size bytes of tuple data, without the size in front
+        void DeserializeFrom(const char *data, int32_t size);
+
         // return RID of current tuple
         inline RID GetRid() const { return rid_; }
 
@@ -62,10 +65,13 @@ namespace cmudb {
         // Get the value of a specified column (const)
         // checks the schema to see how to return the Value.
         Value GetValue(Schema *schema, const int column_id) const;
+        // Same, but a VARCHAR value points into the tuple data instead of
+        // owning a copy; use it while the tuple stays alive
+        Value GetValueView(Schema *schema, const int column_id) const;
 
         // Is the column value null ?
         inline bool IsNull(Schema *schema, const int column_id) const {
-            Value value = GetValue(schema, column_id);
+            Value value = GetValueView(schema, column_id);
             return value.IsNull();
         }
         inline bool IsAllocated() { return allocated_; }
@@ -0,0 +1,77 @@
+/**
+ * type_kernel.h
+ *
+ * Comparison and arithmetic on serialized column data, specialized at
+ * compile time for every pair of column types. A kernel is looked up once
+ * for a pair of columns (a key column, the two sides of a predicate) and then
+ * called for every row, without building a Value or going through
+ * Type::GetInstance and a virtual call for each operand.
+ *
+ * Pairs without a kernel (VARCHAR with anything but VARCHAR, BOOLEAN with
+ * anything but BOOLEAN, TIMESTAMP, modulo) get nullptr and should go through
+ * Value instead.
+ */
+#pragma once
+
+#include "type/type.h"
+
+namespace cmudb {
+class TypeKernel {
+public:
+  // a compare kernel returns this when either side is NULL
+  static const int ORDER_NULL = 2;
+
+  // -1, 0 or 1 as left is less than, equal to or greater than right.
+  // Each side points at the column data (for VARCHAR, at the length field).
+  typedef int (*CompareFunc)(const char *left, const char *right);
+  // Write left OP right into result, as the result type. Throws the same
+  // exceptions as the Value operations (overflow, division by zero).
+  typedef void (*ArithmeticFunc)(const char *left, const char *right,
+                                 char *result);
+
+  enum CompareOp {
+    EQUAL,
+    NOT_EQUAL,
+    LESS_THAN,
+    LESS_THAN_EQUAL,
+    GREATER_THAN,
+    GREATER_THAN_EQUAL
+  };
+  enum ArithmeticOp { ADD, SUBTRACT, MULTIPLY, DIVIDE };
+
+  // nullptr if the pair has no kernel
+  static CompareFunc GetCompare(TypeId left, TypeId right);
+  // *result_type is the type the kernel writes, as the Value operation
+  // would return it
+  static ArithmeticFunc GetArithmetic(ArithmeticOp op, TypeId left,
+                                      TypeId right, TypeId *result_type);
+
+  // What Value::CompareXXX would return, given a compare kernel's result
+  static inline CmpBool Evaluate(CompareOp op, int order) {
+    if (order == ORDER_NULL)
+      return CMP_NULL;
+    bool result;
+    switch (op) {
+    case EQUAL:
+      result = order == 0;
+      break;
+    case NOT_EQUAL:
+      result = order != 0;
+      break;
+    case LESS_THAN:
+      result = order < 0;
+      break;
+    case LESS_THAN_EQUAL:
+      result = order <= 0;
+      break;
+    case GREATER_THAN:
+      result = order > 0;
+      break;
+    default:
+      result = order >= 0;
+      break;
+    }
+    return result ? CMP_TRUE : CMP_FALSE;
+  }
+};
+} // namespace cmudb
@@ -156,6 +156,18 @@ public:
     return Type::GetInstance(type_id)->DeserializeFrom(storage);
   }
 
+  // Like DeserializeFrom, but a VARCHAR value points into storage instead of
+  // copying it, so it is only valid while storage is. Copy() makes it owning.
+  inline static Value DeserializeView(const char *storage,
+                                      const TypeId type_id) {
+    if (type_id != TypeId::VARCHAR)
+      return DeserializeFrom(storage, type_id);
+    uint32_t len = *reinterpret_cast<const uint32_t *>(storage);
+    if (len == PELOTON_VALUE_NULL)
+      return Value(type_id, nullptr, len, false);
+    return Value(type_id, storage + sizeof(uint32_t), len, false);
+  }
+
   // Return a string version of this value
   inline std::string ToString() const {
     return Type::GetInstance(type_id_)->ToString(*this);
@@ -163,7 +175,24 @@ public:
   // Create a copy of this value
   inline Value Copy() const { return Type::GetInstance(type_id_)->Copy(*this); }
 
+  // VARCHAR values that own at most this many bytes keep them in value_
+  // instead of on the heap
+  static const uint32_t VARLEN_INLINE_SIZE = 16;
+
 protected:
+  // owned bytes of a short VARCHAR live inside the value
+  inline bool IsVarlenInlined() const {
+    return manage_data_ && size_.len <= VARLEN_INLINE_SIZE;
+  }
+  inline const char *GetVarlen() const {
+    return IsVarlenInlined() ? value_.inlined : value_.const_varlen;
+  }
+  // space for len owned bytes, size_.len and manage_data_ must be set
+  inline char *AllocateVarlen(uint32_t len) {
+    return len <= VARLEN_INLINE_SIZE ? value_.inlined
+                                     : (value_.varlen = new char[len]);
+  }
+
   // The actual value item
   union Val {
     int8_t boolean;
@@ -175,6 +204,7 @@ protected:
     uint64_t timestamp;
     char *varlen;
     const char *const_varlen;
+    char inlined[VARLEN_INLINE_SIZE];
   } value_;
 
   union {
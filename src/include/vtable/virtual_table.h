@@ -8,6 +8,7 @@
 #include "catalog/schema.h"
 #include "concurrency/transaction_manager.h"
 #include "index/b_plus_tree_index.h"
+#include "logging/checkpoint_manager.h"
 #include "logging/log_manager.h"
 #include "sqlite/sqlite3ext.h"
 #include "table/table_heap.h"
@@ -26,7 +27,8 @@ Tuple ConstructTuple(Schema *schema, sqlite3_value **argv);
 
 Index *ConstructIndex(IndexMetadata *metadata,
                       BufferPoolManager *buffer_pool_manager,
-                      page_id_t root_id = INVALID_PAGE_ID);
+                      page_id_t root_id = INVALID_PAGE_ID,
+                      LogManager *log_manager = nullptr);
 Transaction *GetTransaction();
 
 /* API declaration */
@@ -76,17 +78,25 @@ public:
 
     // txn related
     lock_manager_ = new LockManager(true); // S2PL
-    transaction_manager_ = new TransactionManager(lock_manager_, log_manager_);
+    version_store_ = new VersionStore();
+    transaction_manager_ =
+        new TransactionManager(lock_manager_, log_manager_, version_store_);
+    checkpoint_manager_ =
+        new CheckpointManager(transaction_manager_, buffer_pool_manager_,
+                              log_manager_, disk_manager_);
   }
 
   ~StorageEngine() {
+    checkpoint_manager_->StopCheckpointThread();
     if (ENABLE_LOGGING)
       log_manager_->StopFlushThread();
     delete disk_manager_;
     delete buffer_pool_manager_;
     delete log_manager_;
     delete lock_manager_;
+    delete checkpoint_manager_;
     delete transaction_manager_;
+    delete version_store_;
   }
 
   DiskManager *disk_manager_;
@@ -94,6 +104,8 @@ public:
   LockManager *lock_manager_;
   TransactionManager *transaction_manager_;
   LogManager *log_manager_;
+  VersionStore *version_store_;
+  CheckpointManager *checkpoint_manager_;
 };
 
 StorageEngine *storage_engine_;
@@ -111,12 +123,14 @@ public:
     if (first_page_id != INVALID_PAGE_ID) {
       // reopen an exist table
       table_heap_ = new TableHeap(buffer_pool_manager, lock_manager,
-                                  log_manager, first_page_id);
+                                  log_manager, first_page_id,
+                                  storage_engine_->version_store_);
     } else {
       // create table for the first time
       Transaction *txn = storage_engine_->transaction_manager_->Begin();
-      table_heap_ =
-          new TableHeap(buffer_pool_manager, lock_manager, log_manager, txn);
+      table_heap_ = new TableHeap(buffer_pool_manager, lock_manager,
+                                  log_manager, txn,
+                                  storage_engine_->version_store_);
       storage_engine_->transaction_manager_->Commit(txn);
     }
   }
@@ -227,7 +241,8 @@ public:
       virtual_table_->table_heap_->GetTuple(rid, tuple, GetTransaction());
       return tuple.GetValue(schema, column);
     } else {
-      return table_iterator_->GetValue(schema, column);
+      // 迭代器里的元组一直活到下一次++，不用拷贝字符串
+      return table_iterator_->GetValueView(schema, column);
     }
   }
 
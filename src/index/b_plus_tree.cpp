@@ -16,11 +16,13 @@ namespace cmudb {
     BPLUSTREE_TYPE::BPlusTree(const std::string &name,
                               BufferPoolManager *buffer_pool_manager,
                               const KeyComparator &comparator,
-                              page_id_t root_page_id)
+                              page_id_t root_page_id,
+                              LogManager *log_manager)
             : index_name_(name),
               root_page_id_(root_page_id),
               buffer_pool_manager_(buffer_pool_manager),
-              comparator_(comparator) {}
+              comparator_(comparator),
+              log_manager_(log_manager) {}
 
 /**
  * Helper function to decide whether current b+tree is empty
@@ -33,6 +35,10 @@ namespace cmudb {
     template<typename KeyType, typename ValueType, typename KeyComparator>
     thread_local int BPlusTree<KeyType, ValueType, KeyComparator>::rootLockedCnt =
             0;
+
+    template<typename KeyType, typename ValueType, typename KeyComparator>
+    thread_local IndexLog *BPlusTree<KeyType, ValueType, KeyComparator>::indexLog =
+            nullptr;
 /*****************************************************************************
  * SEARCH
  *****************************************************************************/
@@ -72,14 +78,19 @@ namespace cmudb {
     INDEX_TEMPLATE_ARGUMENTS
     bool BPLUSTREE_TYPE::Insert(const KeyType &key, const ValueType &value,
                                 Transaction *transaction) {
+        IndexLog log(log_manager_, transaction);
+        indexLog = &log;
         LockRootPageId(true);
         if (IsEmpty()) {
             StartNewTree(key, value);
+            log.End();
             TryUnlockRootPageId(true);
+            indexLog = nullptr;
             return true;
         }
         TryUnlockRootPageId(true);
         bool res = InsertIntoLeaf(key, value, transaction);
+        indexLog = nullptr;
         // assert(Check());
         return res;
     }
@@ -97,12 +108,14 @@ namespace cmudb {
         Page *rootPage = buffer_pool_manager_->NewPage(newPageId);
         assert(rootPage != nullptr);
         //2
+        indexLog->Track(rootPage);
         auto *root = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(rootPage->GetData());
         root->Init(newPageId, INVALID_PAGE_ID);
         root_page_id_ = newPageId;
         UpdateRootPageId(true);
         //3
         root->Insert(key, value, comparator_);
+        indexLog->Log(rootPage, LogRecordType::INDEX_ROOT);
         buffer_pool_manager_->UnpinPage(newPageId, true);
     }
 
@@ -129,7 +142,9 @@ namespace cmudb {
             FreePagesInTransaction(true, transaction);
             return false;
         }
+        indexLog->Track(pageOf(leafPage));
         leafPage->Insert(key, value, comparator_);
+        indexLog->Log(pageOf(leafPage), LogRecordType::INDEX_INSERT);
         // 处理leaf page分裂的情况
         if (leafPage->GetSize() > leafPage->GetMaxSize()) {
             B_PLUS_TREE_LEAF_PAGE_TYPE *newLeafPage =
@@ -137,6 +152,8 @@ namespace cmudb {
             InsertIntoParent(leafPage, newLeafPage->KeyAt(0), newLeafPage,
                              transaction);
         }
+        // 放开latch之前结束这次操作的日志
+        indexLog->End();
         // buffer_pool_manager_->UnpinPage(leafPage->GetPageId(), true);
         FreePagesInTransaction(true, transaction);
         return true;
@@ -165,9 +182,13 @@ namespace cmudb {
         newPage->WLatch();
         transaction->AddIntoPageSet(newPage);
         //2.
+        indexLog->Track(newPage);
+        indexLog->Track(pageOf(node));
         N *newNode = reinterpret_cast<N *>(newPage->GetData());
         newNode->Init(newPageId, node->GetParentPageId());
-        node->MoveHalfTo(newNode, buffer_pool_manager_);
+        node->MoveHalfTo(newNode, buffer_pool_manager_, indexLog);
+        indexLog->Log(pageOf(node), LogRecordType::INDEX_SPLIT);
+        indexLog->Log(newPage, LogRecordType::INDEX_SPLIT);
         //3.
         return newNode;
     }
@@ -195,6 +216,9 @@ namespace cmudb {
             Page *const newPage = buffer_pool_manager_->NewPage(root_page_id_);
             assert(newPage != nullptr);
             assert(newPage->GetPinCount() == 1);
+            indexLog->Track(newPage);
+            indexLog->Track(pageOf(old_node));
+            indexLog->Track(pageOf(new_node));
             auto *newRoot = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(newPage->GetData());
             newRoot->Init(root_page_id_);
             //填充新的root page
@@ -203,6 +227,9 @@ namespace cmudb {
             // 更新leaf page的parent id
             old_node->SetParentPageId(root_page_id_);
             new_node->SetParentPageId(root_page_id_);
+            indexLog->Log(newPage, LogRecordType::INDEX_ROOT);
+            indexLog->Log(pageOf(old_node), LogRecordType::INDEX_ROOT);
+            indexLog->Log(pageOf(new_node), LogRecordType::INDEX_ROOT);
             // 此时默认为false，只需要更新page header里的root信息，不需要插入
             UpdateRootPageId();
             buffer_pool_manager_->UnpinPage(newRoot->GetPageId(), true);
@@ -212,9 +239,11 @@ namespace cmudb {
         auto *page = FetchPage(parentId);
         assert(page != nullptr);
         auto *parent = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page);
-        new_node->SetParentPageId(parentId);
+        assert(new_node->GetParentPageId() == parentId);
         //在parent page的末尾插入键值对
+        indexLog->Track(pageOf(parent));
         parent->InsertNodeAfter(old_node->GetPageId(), key, new_node->GetPageId());
+        indexLog->Log(pageOf(parent), LogRecordType::INDEX_SPLIT);
         if (parent->GetSize() > parent->GetMaxSize()) {
             // parent page的节点满了，需要继续分裂
             B_PLUS_TREE_INTERNAL_PAGE *newLeafPage =
@@ -238,17 +267,23 @@ namespace cmudb {
     INDEX_TEMPLATE_ARGUMENTS
     void BPLUSTREE_TYPE::Remove(const KeyType &key, Transaction *transaction) {
         if (IsEmpty()) return;
+        IndexLog log(log_manager_, transaction);
+        indexLog = &log;
         B_PLUS_TREE_LEAF_PAGE_TYPE *delTar =
                 FindLeafPage(key, false, OpType::DELETE, transaction);
 
         // leaf page中删除一个节点的方法，用memmove函数覆盖
+        indexLog->Track(pageOf(delTar));
         int curSize = delTar->RemoveAndDeleteRecord(key, comparator_);
+        indexLog->Log(pageOf(delTar), LogRecordType::INDEX_DELETE);
         // 删除目标节点后，leaf
         // page中的节点个数小于minsize，向兄弟page中借或者与兄弟page合并
         if (curSize < delTar->GetMinSize()) {
             CoalesceOrRedistribute(delTar, transaction);
         }
+        log.End();
         FreePagesInTransaction(true, transaction);
+        indexLog = nullptr;
         // assert(Check());
     }
 
@@ -293,7 +328,13 @@ namespace cmudb {
         }
         /* Redistribution: 从兄弟页面借一个元素 */
         int nodeInParentIndex = parentPage->ValueIndex(node->GetPageId());
+        indexLog->Track(pageOf(node2));
+        indexLog->Track(pageOf(node));
+        indexLog->Track(pageOf(parent));
         Redistribute(node2, node, nodeInParentIndex);  // unpin node,node2
+        indexLog->Log(pageOf(node2), LogRecordType::INDEX_REDISTRIBUTE);
+        indexLog->Log(pageOf(node), LogRecordType::INDEX_REDISTRIBUTE);
+        indexLog->Log(pageOf(parent), LogRecordType::INDEX_REDISTRIBUTE);
         buffer_pool_manager_->UnpinPage(parentPage->GetPageId(), false);
         return false;
     }
@@ -333,10 +374,17 @@ namespace cmudb {
             int index, Transaction *transaction) {
         // 在这里，兄弟页面永远是左页面
         assert(node->GetSize() + neighbor_node->GetSize() <= node->GetMaxSize());
-        node->MoveAllTo(neighbor_node, index, buffer_pool_manager_);
+        // 要删除的页面也记下来：操作没有完成时undo要恢复它
+        indexLog->Track(pageOf(neighbor_node));
+        indexLog->Track(pageOf(node));
+        node->MoveAllTo(neighbor_node, index, buffer_pool_manager_, indexLog);
+        indexLog->Log(pageOf(neighbor_node), LogRecordType::INDEX_MERGE);
+        indexLog->Log(pageOf(node), LogRecordType::INDEX_MERGE);
         //把当前页面加入到被删除页面的set中
         transaction->AddIntoDeletedPageSet(node->GetPageId());
+        indexLog->Track(pageOf(parent));
         parent->Remove(index);
+        indexLog->Log(pageOf(parent), LogRecordType::INDEX_MERGE);
         //parent page此时一定是内部页，而内部页的第一个键是无效的，所以当
         //parent page中的节点个数 等于 Minsize时也需要合并或分配
         if (parent->GetSize() <= parent->GetMinSize()) {
@@ -358,9 +406,9 @@ namespace cmudb {
     template<typename N>
     void BPLUSTREE_TYPE::Redistribute(N *neighbor_node, N *node, int index) {
         if (index == 0) {
-            neighbor_node->MoveFirstToEndOf(node, buffer_pool_manager_);
+            neighbor_node->MoveFirstToEndOf(node, buffer_pool_manager_, indexLog);
         } else {
-            neighbor_node->MoveLastToFrontOf(node, index, buffer_pool_manager_);
+            neighbor_node->MoveLastToFrontOf(node, index, buffer_pool_manager_, indexLog);
         }
     }
 /**
@@ -380,15 +428,19 @@ namespace cmudb {
         if (old_root_node->GetSize() == 1) {  // case 1
             B_PLUS_TREE_INTERNAL_PAGE *root =
                     reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(old_root_node);
+            indexLog->Track(pageOf(root));
             const page_id_t newRootId = root->RemoveAndReturnOnlyChild();
+            indexLog->Log(pageOf(root), LogRecordType::INDEX_ROOT);
             root_page_id_ = newRootId;
             UpdateRootPageId();
             // set the new root's parent id "INVALID_PAGE_ID"
             Page *page = buffer_pool_manager_->FetchPage(newRootId);
             assert(page != nullptr);
+            indexLog->Track(page);
             B_PLUS_TREE_INTERNAL_PAGE *newRoot =
                     reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page->GetData());
             newRoot->SetParentPageId(INVALID_PAGE_ID);
+            indexLog->Log(page, LogRecordType::INDEX_ROOT);
             buffer_pool_manager_->UnpinPage(newRootId, true);
             return true;
         }
@@ -526,6 +578,7 @@ namespace cmudb {
     void BPLUSTREE_TYPE::UpdateRootPageId(int insert_record) {
         auto *header_page = static_cast<HeaderPage *>(
                 buffer_pool_manager_->FetchPage(HEADER_PAGE_ID));
+        indexLog->Track(header_page);
         // header page 记录了tree的meta-data
         if (insert_record)
             // create a new record<index_name + root_page_id> in header_page
@@ -533,6 +586,7 @@ namespace cmudb {
         else
             // update root_page_id in header_page
             header_page->UpdateRecord(index_name_, root_page_id_);
+        indexLog->Log(header_page, LogRecordType::INDEX_ROOT);
         buffer_pool_manager_->UnpinPage(HEADER_PAGE_ID, true);
     }
 
@@ -0,0 +1,81 @@
+/**
+ * checkpoint_manager.cpp
+ */
+
+#include "logging/checkpoint_manager.h"
+
+namespace cmudb {
+
+/**
+ * 1.追加BEGIN_CHECKPOINT并拷贝活跃事务表，然后拷贝缓冲池的脏页表
+ * 2.redo点是BEGIN_CHECKPOINT、活跃事务的BEGIN和脏页recLSN中最小的LSN:
+ *   活跃事务的记录都在它之后，分析阶段从这里扫描就能重建出所有未完成的事务，
+ *   脏页表之外的页面在它之前的修改都已经写回了磁盘
+ * 3.同步数据文件：脏页表之外的页面可能只写到了OS的页缓存里
+ * 4.追加END_CHECKPOINT并等它落盘，再原子地替换主记录
+ * 5.回收redo点之前的日志段。同步或者主记录失败时旧的检查点仍然有效，日志不能回收
+ */
+    bool CheckpointManager::Checkpoint() {
+        assert(ENABLE_LOGGING);
+        lock_guard<mutex> guard(checkpoint_latch_);
+        ActiveTxnTable active_txns;
+        lsn_t begin_lsn = transaction_manager_->BeginCheckpoint(&active_txns);
+        DirtyPageTable dirty_pages = buffer_pool_manager_->GetDirtyPageTable();
+
+        lsn_t redo_lsn = begin_lsn;
+        for (auto &entry : active_txns) redo_lsn = min(redo_lsn, entry.second);
+        for (auto &entry : dirty_pages) redo_lsn = min(redo_lsn, entry.second);
+
+        LogRecord log{begin_lsn, dirty_pages, active_txns};
+        // END_CHECKPOINT没有往前的引用，长度和LSN无关
+        if (log.GetSize(begin_lsn) >= LOG_BUFFER_SIZE) {
+            LOG_DEBUG("checkpoint tables do not fit in a log buffer");
+            return false;
+        }
+        // 拷贝脏页表之前写回的页面也要真正落盘，redo点才能越过它们的修改
+        if (!disk_manager_->SyncData()) return false;
+        lsn_t end_lsn = log_manager_->AppendLogRecord(log);
+        log_manager_->WaitForPersistent(end_lsn);
+
+        int64_t checkpoint_offset = log_manager_->GetLogOffset(begin_lsn);
+        int64_t redo_offset = log_manager_->GetLogOffset(redo_lsn);
+        if (!disk_manager_->WriteMasterRecord(checkpoint_offset, end_lsn, redo_offset))
+            return false;
+        // 主记录已经指向新的检查点，之前的日志段不再需要
+        disk_manager_->TruncateLog(redo_offset);
+        log_manager_->DiscardLogOffsets(redo_lsn);
+        return true;
+    }
+
+    void CheckpointManager::RunCheckpointThread() {
+        assert(checkpoint_thread_ == nullptr);
+        stopCheckpoint_ = false;
+        checkpoint_thread_ = new thread(&CheckpointManager::runCheckpoints, this);
+    }
+
+    void CheckpointManager::StopCheckpointThread() {
+        if (checkpoint_thread_ == nullptr) return;
+        {
+            lock_guard<mutex> lg(threadMutex_);
+            stopCheckpoint_ = true;
+        }
+        threadCv_.notify_one();
+        checkpoint_thread_->join();
+        delete checkpoint_thread_;
+        checkpoint_thread_ = nullptr;
+    }
+
+/**
+ * 检查点线程每隔CHECKPOINT_INTERVAL醒来一次做一个检查点
+ */
+    void CheckpointManager::runCheckpoints() {
+        unique_lock<mutex> lk(threadMutex_);
+        while (!threadCv_.wait_for(lk, CHECKPOINT_INTERVAL,
+                                   [this] { return stopCheckpoint_; })) {
+            lk.unlock();
+            if (ENABLE_LOGGING) Checkpoint();
+            lk.lock();
+        }
+    }
+
+} // namespace cmudb
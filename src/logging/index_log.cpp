@@ -0,0 +1,59 @@
+/**
+ * index_log.cpp
+ */
+
+#include "logging/index_log.h"
+
+namespace cmudb {
+
+    void IndexLog::Track(Page *page) {
+        if (!enabled()) return;
+        for (auto &image : images_)
+            if (image.first == page) return;
+        std::unique_ptr<char[]> data(new char[PAGE_SIZE]);
+        memcpy(data.get(), page->GetData(), PAGE_SIZE);
+        images_.emplace_back(page, std::move(data));
+    }
+
+/**
+ * 只记录第一个和最后一个不同的字节之间的部分：叶子上的插入删除只移动一段数组，
+ * 父指针和链接的修改只有几个字节
+ */
+    void IndexLog::Log(Page *page, LogRecordType type) {
+        if (!enabled()) return;
+        auto it = images_.begin();
+        while (it != images_.end() && it->first != page) ++it;
+        assert(it != images_.end());
+        const char *old_data = it->second.get();
+        const char *new_data = page->GetData();
+        int begin = 0, end = PAGE_SIZE;
+        while (begin < end && old_data[begin] == new_data[begin]) begin++;
+        while (end > begin && old_data[end - 1] == new_data[end - 1]) end--;
+        if (begin < end) {
+            if (!logged_) {
+                // 先把暂存的表记录合并进日志，B+树的记录接在它们后面
+                log_manager_->MergeLogRecords(txn_);
+                undo_next_lsn_ = txn_->GetPrevLSN();
+                logged_ = true;
+            }
+            LogRecord log{txn_->GetTransactionId(), txn_->GetPrevLSN(), type,
+                          page->GetPageId(), begin, std::string(old_data + begin, end - begin),
+                          std::string(new_data + begin, end - begin)};
+            lsn_t lsn = log_manager_->AppendLogRecord(log);
+            txn_->SetPrevLSN(lsn);
+            // 头页面没有LSN字段
+            if (page->GetPageId() == HEADER_PAGE_ID) page->SetRecLSN(lsn);
+            else page->SetLSN(lsn);
+        }
+        images_.erase(it);
+    }
+
+    void IndexLog::End() {
+        assert(images_.empty());
+        if (!logged_) return;
+        LogRecord log{txn_->GetTransactionId(), txn_->GetPrevLSN(), undo_next_lsn_};
+        txn_->SetPrevLSN(log_manager_->AppendLogRecord(log));
+        logged_ = false;
+    }
+
+} // namespace cmudb
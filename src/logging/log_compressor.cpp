@@ -0,0 +1,138 @@
+/**
+ * log_compressor.cpp
+ */
+
+#include <cstring>
+#include <vector>
+
+#include "logging/log_compressor.h"
+
+namespace cmudb {
+
+/**
+ * 哈希链：head_记录每个哈希值最近的位置，chain把相同哈希值的位置从近到远串起来，
+ * level控制沿着链最多比较几个位置
+ */
+    int LogCompressor::Compress(const char *src, int size, char *dst, int capacity,
+                                int level) {
+        const auto *in = reinterpret_cast<const uint8_t *>(src);
+        std::vector<int32_t> head(1 << HASH_BITS, -1);
+        std::vector<int32_t> chain(size, -1);
+        auto hashAt = [in](int pos) {
+            uint32_t value;
+            memcpy(&value, in + pos, sizeof(value));
+            return (value * 2654435761U) >> (32 - HASH_BITS);
+        };
+        char *out = dst, *end = dst + capacity;
+        int anchor = 0, pos = 0;
+        while (pos < size - MF_LIMIT) {
+            uint32_t hash = hashAt(pos);
+            int best_length = 0, best_pos = -1;
+            int candidate = head[hash];
+            for (int probes = 0; candidate >= 0 && probes < level &&
+                                 pos - candidate <= MAX_OFFSET;
+                 probes++, candidate = chain[candidate]) {
+                int limit = size - LAST_LITERALS - pos;
+                int length = 0;
+                while (length < limit && in[candidate + length] == in[pos + length]) length++;
+                if (length > best_length) {
+                    best_length = length;
+                    best_pos = candidate;
+                }
+            }
+            chain[pos] = head[hash];
+            head[hash] = pos;
+            if (best_length < MIN_MATCH) {
+                pos++;
+                continue;
+            }
+            if (!putSequence(&out, end, src + anchor, pos - anchor, pos - best_pos, best_length))
+                return 0;
+            // 匹配里面的位置也放进链里，后面的匹配可以引用它们
+            for (int next = pos + 1; next < pos + best_length && next < size - MF_LIMIT; next++) {
+                uint32_t next_hash = hashAt(next);
+                chain[next] = head[next_hash];
+                head[next_hash] = next;
+            }
+            pos += best_length;
+            anchor = pos;
+        }
+        // 最后一个序列只有字面量
+        int literal_length = size - anchor;
+        if (end - out < 1) return 0;
+        char *token = out++;
+        *token = static_cast<char>((literal_length < 15 ? literal_length : 15) << 4);
+        if (literal_length >= 15 && !putLength(&out, end, literal_length - 15)) return 0;
+        if (end - out < literal_length) return 0;
+        memcpy(out, src + anchor, literal_length);
+        out += literal_length;
+        return static_cast<int>(out - dst);
+    }
+
+    bool LogCompressor::Decompress(const char *src, int size, char *dst, int raw_size) {
+        const auto *in = reinterpret_cast<const uint8_t *>(src);
+        const uint8_t *in_end = in + size;
+        char *out = dst, *out_end = dst + raw_size;
+        while (in < in_end) {
+            uint8_t token = *in++;
+            int literal_length = token >> 4;
+            if (literal_length == 15 && !getLength(&in, in_end, &literal_length)) return false;
+            if (literal_length > in_end - in || literal_length > out_end - out) return false;
+            memcpy(out, in, literal_length);
+            in += literal_length;
+            out += literal_length;
+            if (in == in_end) break;
+            if (in_end - in < 2) return false;
+            int offset = in[0] | (in[1] << 8);
+            in += 2;
+            if (offset == 0 || offset > out - dst) return false;
+            int match_length = token & 15;
+            if (match_length == 15 && !getLength(&in, in_end, &match_length)) return false;
+            match_length += MIN_MATCH;
+            if (match_length > out_end - out) return false;
+            // 引用可以和要写的部分重叠(重复的短串)，逐字节拷贝
+            const char *match = out - offset;
+            for (int i = 0; i < match_length; i++) out[i] = match[i];
+            out += match_length;
+        }
+        return out == out_end;
+    }
+
+    bool LogCompressor::putLength(char **out, char *end, int length) {
+        while (length >= 255) {
+            if (*out == end) return false;
+            *(*out)++ = static_cast<char>(255);
+            length -= 255;
+        }
+        if (*out == end) return false;
+        *(*out)++ = static_cast<char>(length);
+        return true;
+    }
+
+    bool LogCompressor::getLength(const uint8_t **in, const uint8_t *end, int *length) {
+        uint8_t byte;
+        do {
+            if (*in == end) return false;
+            byte = *(*in)++;
+            *length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    bool LogCompressor::putSequence(char **out, char *end, const char *literals,
+                                    int literal_length, int offset, int match_length) {
+        if (*out == end) return false;
+        char *token = (*out)++;
+        int extra = match_length - MIN_MATCH;
+        *token = static_cast<char>(((literal_length < 15 ? literal_length : 15) << 4) |
+                                   (extra < 15 ? extra : 15));
+        if (literal_length >= 15 && !putLength(out, end, literal_length - 15)) return false;
+        if (end - *out < literal_length + 2) return false;
+        memcpy(*out, literals, literal_length);
+        *out += literal_length;
+        *(*out)++ = static_cast<char>(offset & 0xFF);
+        *(*out)++ = static_cast<char>(offset >> 8);
+        return extra < 15 || putLength(out, end, extra - 15);
+    }
+
+} // namespace cmudb
@@ -4,6 +4,7 @@
 
 #include "logging/log_manager.h"
 #include <include/common/logger.h>
+#include "concurrency/transaction.h"
 
 namespace cmudb {
 
@@ -15,31 +16,61 @@ namespace cmudb {
  */
 void LogManager::RunFlushThread() {
     /**
-     * flush_buffer_用来将记录刷新到磁盘，log_buffer_用来并行的追加记录
-     * 当出现下列三种情况时交换flush_buffer_和log_buffer_：
-     *    1.When log_buffer is full
+     * buffers_是一个环，一个段用来并行的追加记录，写满的段由追加者封住，
+     * 刷新线程一个接一个地写出，追加者不用等待刷新，除非整个环都满了。
+     * 当出现下列情况时刷新：
+     *    1.When a log segment is full (sealed)
      *    2.When LOG_TIMEOUT is triggered
      *    3.When buffer pool is going to evict a dirty page from LRU replacer.
+     *    4.When a group of commits is ready (see groupReady) or the oldest
+     *      waiting commit has waited for about one log write (groupDeadline)
+     * 除了第一种情况，正在追加的段也会被封住写出
      */
     if (ENABLE_LOGGING) return;
     ENABLE_LOGGING = true;
     // 需要启动一个单独的后台线程负责将日志刷新到磁盘文件中
     flush_thread_ = new thread([&] {
         // 线程触发每LOG_TIMEOUT秒或者log_buffer已满
-        while (ENABLE_LOGGING) {
+        bool stopping = false;
+        while (!stopping) {
             unique_lock<mutex> latch(latch_);
-            //超时时触发
-            cv_.wait_for(latch, LOG_TIMEOUT, [&] { return needFlush_.load(); });
-            assert(flushBufferSize_ == 0);
-            if (logBufferOffset_ > 0) {
-                swap(log_buffer_, flush_buffer_);
-                swap(logBufferOffset_, flushBufferSize_);
-                disk_manager_->WriteLog(flush_buffer_, flushBufferSize_);
-                flushBufferSize_ = 0;
-                SetPersistentLSN(lastLsn_);
+            //超时时触发，有提交在等待时最多等到groupDeadline
+            chrono::steady_clock::time_point timeout =
+                    chrono::steady_clock::now() + LOG_TIMEOUT;
+            bool expired = false;
+            while (!needFlush_ && !sealed_[flushSegment_].load() && !groupReady()) {
+                auto deadline = groupCommit() && !waiters_.empty()
+                                ? min(timeout, groupDeadline()) : timeout;
+                if (cv_.wait_until(latch, deadline) == cv_status::timeout) {
+                    expired = chrono::steady_clock::now() >= deadline;
+                    if (expired) break;
+                }
             }
+            // 在latch_下判断是否停止：StopFlushThread之前追加的记录都在最后一轮写出
+            stopping = !ENABLE_LOGGING;
+            bool all = stopping || expired || needFlush_ ||
+                       (groupCommit() && !waiters_.empty());
             needFlush_ = false;
+            // 写的时候不持有latch_，等待环中空闲段的追加者和等待落盘的事务可以及时被唤醒
+            latch.unlock();
+            bool flushed = flushSegments(all);
+            latch.lock();
+            completeGroup();
             appendCv_.notify_all();
+            // 放开latch_再执行回调，回调里可以再调用OnPersistent等要latch_的方法。
+            // 回调不能追加日志或者同步提交：它们要等的正是这个线程
+            auto durable = durableCallbacks_.upper_bound(persistent_lsn_);
+            vector<std::function<void()>> callbacks;
+            for (auto it = durableCallbacks_.begin(); it != durable; ++it)
+                callbacks.push_back(std::move(it->second));
+            durableCallbacks_.erase(durableCallbacks_.begin(), durable);
+            latch.unlock();
+            for (auto &callback : callbacks) callback();
+            // 写失败的段还封着，过一会儿再写；停止时也要等它写出去
+            if (!flushed) {
+                stopping = false;
+                this_thread::sleep_for(chrono::milliseconds(LOG_RETRY_MS));
+            }
         }
     });
 }
@@ -51,7 +82,7 @@ void LogManager::StopFlushThread() {
     ENABLE_LOGGING = false;
     Flush(true);
     flush_thread_->join();
-    assert(logBufferOffset_ == 0 && flushBufferSize_ == 0);
+    assert(offsetOf(reserved_) == 0);
     delete flush_thread_;
 }
 
@@ -59,75 +90,307 @@ void LogManager::StopFlushThread() {
  * append a log record into log buffer
  * you MUST set the log record's lsn within this method
  * @return: lsn that is assigned to this log record
- *
- *
- * example below
- * // First, serialize the must have fields(20 bytes in total)
- * log_record.lsn_ = next_lsn_++;
- * memcpy(log_buffer_ + offset_, &log_record, 20);
- * int pos = offset_ + 20;
- *
- * if (log_record.log_record_type_ == LogRecordType::INSERT) {
- *    memcpy(log_buffer_ + pos, &log_record.insert_rid_, sizeof(RID));
- *    pos += sizeof(RID);
- *    // we have provided serialize function for tuple class
- *    log_record.insert_tuple_.SerializeTo(log_buffer_ + pos);
- *  }
- *
+ * the record is encoded as described in log_record.h
  */
 lsn_t LogManager::AppendLogRecord(LogRecord &log_record) {
-    unique_lock<mutex> latch(latch_);
-    if (logBufferOffset_ + log_record.GetSize() >= LOG_BUFFER_SIZE) {
-        needFlush_ = true;
-        cv_.notify_one();  // let RunFlushThread wake up.
-        appendCv_.wait(latch, [&] {
-            return logBufferOffset_ + log_record.GetSize() < LOG_BUFFER_SIZE;
-        });
+    LogRecord *record = &log_record;
+    return appendLogRecords(&record, 1, false);
+}
+
+lsn_t LogManager::appendLogRecords(LogRecord *const *records, int count, bool chain) {
+    // 用CAS预留空间和LSN。段满了就封住它切到下一个段，
+    // 只有整个环都满了才拿latch_等刷新线程腾出一个段。
+    // 记录里往前的引用按到自己LSN的距离编码，长度要跟着预留到的LSN重新算
+    auto sizeAt = [&](lsn_t lsn) {
+        int32_t size = 0;
+        for (int i = 0; i < count; i++) {
+            if (chain && i > 0) records[i]->prev_lsn_ = lsn + i - 1;
+            size += records[i]->GetSize(lsn + i);
+        }
+        return size;
+    };
+    uint64_t word = reserved_.load(memory_order_relaxed);
+    int32_t size;
+    while (true) {
+        size = sizeAt(lsnOf(word));
+        if (offsetOf(word) + size >= LOG_BUFFER_SIZE) {
+            if (!sealed_[nextSegment(segmentOf(word))].load(memory_order_acquire)) {
+                if (advance(&word)) {
+                    lock_guard<mutex> latch(latch_);
+                    cv_.notify_one();  // let RunFlushThread wake up.
+                    word = reserved_.load(memory_order_relaxed);
+                }
+                continue;
+            }
+            unique_lock<mutex> latch(latch_);
+            appendCv_.wait(latch, [&] {
+                word = reserved_.load(memory_order_relaxed);
+                return offsetOf(word) + sizeAt(lsnOf(word)) < LOG_BUFFER_SIZE ||
+                       !sealed_[nextSegment(segmentOf(word))].load();
+            });
+            continue;
+        }
+        uint64_t next = word + static_cast<uint64_t>(size) +
+                        (static_cast<uint64_t>(count) << LSN_SHIFT);
+        if (reserved_.compare_exchange_weak(word, next, memory_order_acq_rel))
+            break;
+    }
+    reservations_.fetch_add(1, memory_order_relaxed);
+    int buffer = segmentOf(word);
+    // 在自己预留的区域里序列化，和别的线程并行
+    char *data = buffers_[buffer] + offsetOf(word);
+    for (int i = 0; i < count; i++) {
+        records[i]->lsn_ = lsnOf(word) + i;
+        records[i]->size_ = records[i]->GetSize(records[i]->lsn_);
+        SerializeLogRecord(*records[i], data);
+        data += records[i]->size_;
+    }
+    filled_[buffer].fetch_add(size, memory_order_release);
+    return lsnOf(word);
+}
+
+/*
+ * 页面上没合并的记录只在它的stager一个缓冲里：换stager之前先合并旧的，
+ * 日志中同一个页面的记录和页面的修改顺序一致(redo插入时按顺序找空闲的槽)。
+ * 设置stager和放入记录都在缓冲的latch_下，并发的合并要么看不到stager，要么带上这条记录
+ */
+void LogManager::StageLogRecord(Transaction *txn, LogRecord &log_record, Page *page) {
+    auto buffer = txn->GetLogBuffer();
+    if (buffer == nullptr) {
+        buffer = make_shared<TxnLogBuffer>();
+        txn->SetLogBuffer(buffer);
+    }
+    auto stager = page->GetStager();
+    if (stager != nullptr && stager != buffer) merge(stager, nullptr, INVALID_LSN);
+    {
+        lock_guard<mutex> guard(buffer->latch_);
+        // 空的缓冲之后txn可能直接追加过记录(B+树)，合并时接在它后面
+        if (buffer->records_.empty())
+            buffer->prev_lsn_ = max(buffer->prev_lsn_, txn->GetPrevLSN());
+        page->SetStager(buffer);
+        // 合并时按LSN串起来，除了第一条prevLSN的引用都是1个字节
+        log_record.prev_lsn_ = INVALID_LSN;
+        buffer->size_ += log_record.GetSize(0);
+        buffer->records_.emplace_back(log_record, page);
+        if (buffer->size_ < TXN_LOG_BUFFER_SIZE) return;
+    }
+    txn->SetPrevLSN(merge(buffer, nullptr, txn->GetPrevLSN()));
+}
+
+lsn_t LogManager::MergeLogRecords(Transaction *txn, LogRecord *last) {
+    auto buffer = txn->GetLogBuffer();
+    if (buffer == nullptr) {
+        if (last != nullptr) {
+            last->prev_lsn_ = txn->GetPrevLSN();
+            txn->SetPrevLSN(AppendLogRecord(*last));
+        }
+        return txn->GetPrevLSN();
+    }
+    txn->SetPrevLSN(merge(buffer, last, txn->GetPrevLSN()));
+    return txn->GetPrevLSN();
+}
+
+void LogManager::MergePage(Page *page) {
+    auto stager = page->GetStager();
+    if (stager != nullptr) merge(stager, nullptr, INVALID_LSN);
+}
+
+/*
+ * 先推进页面的LSN再清除stager：看到stager为空的人(换出页面时)看到的LSN已经覆盖了页面上的修改
+ */
+lsn_t LogManager::merge(const shared_ptr<TxnLogBuffer> &buffer, LogRecord *last,
+                        lsn_t prev_lsn) {
+    lock_guard<mutex> guard(buffer->latch_);
+    vector<LogRecord *> records;
+    records.reserve(buffer->records_.size() + 1);
+    for (auto &staged : buffer->records_) records.push_back(&staged.first);
+    if (last != nullptr) records.push_back(last);
+    if (records.empty()) return max(buffer->prev_lsn_, prev_lsn);
+    records.front()->prev_lsn_ = max(buffer->prev_lsn_, prev_lsn);
+    lsn_t first = appendLogRecords(records.data(), static_cast<int>(records.size()), true);
+    for (size_t i = 0; i < buffer->records_.size(); i++)
+        buffer->records_[i].second->AdvanceLSN(first + static_cast<lsn_t>(i));
+    Page *cleared = nullptr;
+    for (auto &staged : buffer->records_) {
+        if (staged.second == cleared) continue;
+        cleared = staged.second;
+        cleared->ClearStager(buffer);
     }
-    log_record.lsn_ = next_lsn_++;
-    //header是公共字段，可以提前加上
-    memcpy(log_buffer_ + logBufferOffset_, &log_record, LogRecord::HEADER_SIZE);
-    int pos = logBufferOffset_ + LogRecord::HEADER_SIZE;
+    buffer->records_.clear();
+    buffer->size_ = 0;
+    buffer->prev_lsn_ = records.back()->lsn_;
+    return buffer->prev_lsn_;
+}
 
+void LogManager::SerializeLogRecord(const LogRecord &log_record, char *data) {
+    lsn_t lsn = log_record.lsn_;
+    //header是公共字段
+    data = LogRecord::PutVarint(data, log_record.restSize(lsn));
+    memcpy(data, &lsn, sizeof(lsn_t));
+    data += sizeof(lsn_t);
+    *data++ = static_cast<char>(log_record.log_record_type_);
+    data = LogRecord::PutVarint(data, log_record.txn_id_ + 1);
+    data = LogRecord::PutVarint(data, LogRecord::BackRef(lsn, log_record.prev_lsn_));
+
+    //补偿记录：先写undo_next_lsn和动作的类型，后面和动作类型的记录一样
+    LogRecordType type = log_record.log_record_type_;
+    if (type == LogRecordType::CLR) {
+        data = LogRecord::PutVarint(data, LogRecord::BackRef(lsn, log_record.undo_next_lsn_));
+        type = log_record.action_type_;
+        *data++ = static_cast<char>(type);
+    }
     //插入时
-    if (log_record.log_record_type_ == LogRecordType::INSERT) {
-        memcpy(log_buffer_ + pos, &log_record.insert_rid_, sizeof(RID));
-        pos += sizeof(RID);
-        // we have provided serialize function for tuple class
-        log_record.insert_tuple_.SerializeTo(log_buffer_ + pos);
+    if (type == LogRecordType::INSERT) {
+        data = LogRecord::PutRID(data, log_record.insert_rid_);
+        LogRecord::PutBytes(data, log_record.insert_tuple_.GetData(),
+                            log_record.insert_tuple_.GetLength());
         //删除时
-    } else if (log_record.log_record_type_ == LogRecordType::MARKDELETE ||
-               log_record.log_record_type_ == LogRecordType::APPLYDELETE ||
-               log_record.log_record_type_ == LogRecordType::ROLLBACKDELETE) {
-        memcpy(log_buffer_ + pos, &log_record.delete_rid_, sizeof(RID));
-        pos += sizeof(RID);
-        log_record.delete_tuple_.SerializeTo(log_buffer_ + pos);
-        //更新时
-    } else if (log_record.log_record_type_ == LogRecordType::UPDATE) {
-        memcpy(log_buffer_ + pos, &log_record.update_rid_, sizeof(RID));
-        pos += sizeof(RID);
-        log_record.old_tuple_.SerializeTo(log_buffer_ + pos);
-        pos += log_record.old_tuple_.GetLength() + sizeof(int32_t);
-        log_record.new_tuple_.SerializeTo(log_buffer_ + pos);
+    } else if (type == LogRecordType::MARKDELETE ||
+               type == LogRecordType::APPLYDELETE ||
+               type == LogRecordType::ROLLBACKDELETE) {
+        data = LogRecord::PutRID(data, log_record.delete_rid_);
+        LogRecord::PutBytes(data, log_record.delete_tuple_.GetData(),
+                            log_record.delete_tuple_.GetLength());
+        //更新时：旧元组，加上新元组中和旧元组不同的中间一段
+    } else if (type == LogRecordType::UPDATE) {
+        const Tuple &new_tuple = log_record.new_tuple_;
+        data = LogRecord::PutRID(data, log_record.update_rid_);
+        data = LogRecord::PutBytes(data, log_record.old_tuple_.GetData(),
+                                   log_record.old_tuple_.GetLength());
+        data = LogRecord::PutVarint(data, log_record.update_prefix_);
+        data = LogRecord::PutVarint(data, log_record.update_suffix_);
+        LogRecord::PutBytes(data, new_tuple.GetData() + log_record.update_prefix_,
+                            new_tuple.GetLength() - log_record.update_prefix_ -
+                            log_record.update_suffix_);
         //新开一个页面时
-    } else if (log_record.log_record_type_ == LogRecordType::NEWPAGE) {
-        // prev_page_id
-        memcpy(log_buffer_ + pos, &log_record.prev_page_id_, sizeof(page_id_t));
-        pos += sizeof(page_id_t);
-        memcpy(log_buffer_ + pos, &log_record.page_id_, sizeof(page_id_t));
+    } else if (type == LogRecordType::NEWPAGE) {
+        data = LogRecord::PutVarint(data, log_record.prev_page_id_ + 1);
+        LogRecord::PutVarint(data, log_record.page_id_ + 1);
+        //B+树页面的修改
+    } else if (IsIndexPageRecord(type)) {
+        int32_t length = static_cast<int32_t>(log_record.old_data_.size());
+        data = LogRecord::PutVarint(data, log_record.page_id_ + 1);
+        data = LogRecord::PutVarint(data, log_record.index_offset_);
+        data = LogRecord::PutBytes(data, log_record.old_data_.data(), length);
+        memcpy(data, log_record.new_data_.data(), length);
+    } else if (type == LogRecordType::INDEX_END) {
+        LogRecord::PutVarint(data, LogRecord::BackRef(lsn, log_record.undo_next_lsn_));
+        //检查点结束时
+    } else if (type == LogRecordType::END_CHECKPOINT) {
+        data = LogRecord::PutVarint(data, log_record.begin_lsn_ + 1);
+        data = LogRecord::PutVarint(data, log_record.dirty_pages_.size());
+        for (auto &entry : log_record.dirty_pages_) {
+            data = LogRecord::PutVarint(data, entry.first + 1);
+            data = LogRecord::PutVarint(data, entry.second + 1);
+        }
+        data = LogRecord::PutVarint(data, log_record.active_txns_.size());
+        for (auto &entry : log_record.active_txns_) {
+            data = LogRecord::PutVarint(data, entry.first + 1);
+            data = LogRecord::PutVarint(data, entry.second + 1);
+        }
     }
-    logBufferOffset_ += log_record.GetSize();
-    return lastLsn_ = log_record.lsn_;
+}
+
+/*
+ * 把预留字切到下一个段并把偏移量清零，LSN不变，之后的预留都落到新的段。
+ * 只有当前的段才会被封住，下一个段在它被封住之前不会变成非空闲，所以先检查再CAS是安全的
+ */
+bool LogManager::advance(uint64_t *word) {
+    int segment = segmentOf(*word);
+    int next = nextSegment(segment);
+    if (sealed_[next].load(memory_order_acquire)) return false;
+    uint64_t switched = (*word & ~((1ULL << LSN_SHIFT) - 1)) |
+                        (static_cast<uint64_t>(next) << SEGMENT_SHIFT);
+    if (!reserved_.compare_exchange_strong(*word, switched, memory_order_acq_rel))
+        return false;
+    sealedSize_[segment] = offsetOf(*word);
+    sealedLsn_[segment] = lsnOf(*word) - 1;
+    sealed_[segment].store(true, memory_order_release);
+    return true;
+}
+
+/*
+ * 封住的段从flushSegment_开始连续排列，之后是正在追加的段。
+ * all为true时只封住一次正在追加的段，不去追后来的追加者。
+ * 写失败时停在那个段上，返回false
+ */
+bool LogManager::flushSegments(bool all) {
+    while (true) {
+        int segment = flushSegment_;
+        if (!sealed_[segment].load(memory_order_acquire)) {
+            uint64_t word = reserved_.load(memory_order_relaxed);
+            if (!all || offsetOf(word) == 0) return true;
+            // 此时正在追加的就是flushSegment_，下一个段一定是空闲的
+            while (!advance(&word) && offsetOf(word) > 0 &&
+                   !sealed_[segment].load(memory_order_acquire)) {}
+            all = false;
+            continue;
+        }
+        int32_t size = sealedSize_[segment];
+        // 等所有预留在这个段里的记录都写完
+        while (filled_[segment].load(memory_order_acquire) != size)
+            this_thread::yield();
+        // 段是按顺序写的，段中的第一条记录紧接着上一个段的最后一条
+        lsn_t first = persistent_lsn_ + 1;
+        int64_t offset = disk_manager_->GetLogEnd();
+        auto start = chrono::steady_clock::now();
+        char *data = buffers_[segment];
+        int written = compress(&data, size);
+        if (!disk_manager_->WriteLog(data, written)) {
+            // 没有落盘：不发给备库，不推进persistent_lsn_，段留在环里
+            lock_guard<mutex> latch(latch_);
+            flushStats_.write_errors++;
+            return false;
+        }
+        auto latency = chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start);
+        // 连着备库时，记录先发给备库再算落盘，确认了的提交备库都收到了
+        if (shipper_ != nullptr) shipper_->Ship(data, written, offset);
+        filled_[segment].store(0, memory_order_relaxed);
+        SetPersistentLSN(sealedLsn_[segment]);
+        flushSegment_ = nextSegment(segment);
+        sealed_[segment].store(false, memory_order_release);
+        // 唤醒等待空闲段的追加者和等待落盘的事务
+        lock_guard<mutex> latch(latch_);
+        logOffsets_.emplace(first, offset);
+        auto &smoothed = stats_.flush_latency;
+        smoothed = smoothed.count() == 0 ? latency : (smoothed * 7 + latency) / 8;
+        flushStats_.flushes++;
+        flushStats_.log_bytes += size;
+        flushStats_.written_bytes += written;
+        flushStats_.flush_time += latency;
+        appendCv_.notify_all();
+    }
+}
+
+int LogManager::compress(char **data, int size) {
+    const int reserve = 1 + 2 * 5;
+    int level = LOG_COMPRESSION_LEVEL;
+    if (level <= 0 || size <= reserve) return size;
+    // 先压缩到留出最长的头的位置，再把头写在它前面
+    char *frame = frames_[frame_];
+    int stored = LogCompressor::Compress(*data, size, frame + reserve, size - reserve, level);
+    if (stored == 0) return size;
+    int header_size = 1 + LogRecord::VarintSize(size) + LogRecord::VarintSize(stored);
+    char *header = frame + reserve - header_size;
+    *data = header;
+    *header++ = 0;
+    header = LogRecord::PutVarint(header, size);
+    LogRecord::PutVarint(header, stored);
+    frame_ ^= 1;
+    return header_size + stored;
 }
 
 void LogManager::Flush(bool force) {
     unique_lock<mutex> latch(latch_);
     if (force) {
+        // 刷新时不持有latch_，用LSN判断调用之前追加的记录是否都已经落盘
+        lsn_t target = lsnOf(reserved_.load()) - 1;
         needFlush_ = true;
         cv_.notify_one();  // let RunFlushThread wake up.
         if (ENABLE_LOGGING)
             appendCv_.wait(latch, [&] {
-                return !needFlush_.load();
+                return persistent_lsn_ >= target;
             });  // block append thread
     } else {
         appendCv_.wait(latch);  // group commit,  But instead of forcing flush,
@@ -136,4 +399,96 @@ void LogManager::Flush(bool force) {
     }
 }
 
+/*
+ * 刷新线程每次写完都会notify_all，醒来后检查persistent_lsn_，
+ * 没有覆盖到lsn就继续等下一次刷新
+ */
+void LogManager::WaitForPersistent(lsn_t lsn) {
+    unique_lock<mutex> latch(latch_);
+    if (persistent_lsn_ >= lsn) return;
+    addWaiter(lsn);
+    appendCv_.wait(latch, [&] { return persistent_lsn_ >= lsn; });
+}
+
+void LogManager::OnPersistent(lsn_t lsn, std::function<void()> callback) {
+    unique_lock<mutex> latch(latch_);
+    if (persistent_lsn_ < lsn) {
+        durableCallbacks_.emplace(lsn, std::move(callback));
+        addWaiter(lsn);
+        return;
+    }
+    latch.unlock();
+    callback();
+}
+
+void LogManager::SetNextLSN(lsn_t lsn) {
+    assert(!ENABLE_LOGGING && offsetOf(reserved_) == 0);
+    uint64_t segment = static_cast<uint64_t>(segmentOf(reserved_)) << SEGMENT_SHIFT;
+    reserved_ = (static_cast<uint64_t>(lsn) << LSN_SHIFT) | segment;
+    persistent_lsn_ = lsn - 1;
+}
+
+int64_t LogManager::GetLogOffset(lsn_t lsn) {
+    lock_guard<mutex> latch(latch_);
+    assert(lsn <= persistent_lsn_);
+    auto it = logOffsets_.upper_bound(lsn);
+    return it == logOffsets_.begin() ? disk_manager_->GetLogStart() : prev(it)->second;
+}
+
+void LogManager::DiscardLogOffsets(lsn_t lsn) {
+    lock_guard<mutex> latch(latch_);
+    auto it = logOffsets_.upper_bound(lsn);
+    if (it != logOffsets_.begin()) logOffsets_.erase(logOffsets_.begin(), prev(it));
+}
+
+LogManager::GroupCommitStats LogManager::GetGroupCommitStats() {
+    lock_guard<mutex> latch(latch_);
+    return stats_;
+}
+
+LogManager::FlushStats LogManager::GetFlushStats() {
+    lock_guard<mutex> latch(latch_);
+    return flushStats_;
+}
+
+/*
+ * 第一个等待者要唤醒刷新线程，让它按groupDeadline重新计算等待时间
+ */
+void LogManager::addWaiter(lsn_t lsn) {
+    waiters_.emplace(lsn, chrono::steady_clock::now());
+    if (waiters_.size() == 1 || groupReady()) cv_.notify_one();
+}
+
+bool LogManager::groupReady() {
+    if (!groupCommit() || waiters_.empty()) return false;
+    return waiters_.size() >= GROUP_COMMIT_SIZE ||
+           offsetOf(reserved_.load(memory_order_relaxed)) >= GROUP_COMMIT_BYTES;
+}
+
+/*
+ * 等一次写日志的时间：这段时间里到达的提交和最早的等待者一起落盘，
+ * 而最早的等待者的延迟最多增加一倍
+ */
+chrono::steady_clock::time_point LogManager::groupDeadline() {
+    auto oldest = waiters_.begin()->second;
+    for (auto &waiter : waiters_) oldest = min(oldest, waiter.second);
+    return oldest + min(GROUP_COMMIT_MAX_DELAY, stats_.flush_latency);
+}
+
+void LogManager::completeGroup() {
+    auto durable = waiters_.upper_bound(persistent_lsn_);
+    if (durable == waiters_.begin()) return;
+    auto now = chrono::steady_clock::now();
+    uint64_t size = 0;
+    for (auto it = waiters_.begin(); it != durable; ++it, ++size) {
+        auto wait = chrono::duration_cast<chrono::microseconds>(now - it->second);
+        stats_.total_wait += wait;
+        stats_.max_wait = max(stats_.max_wait, wait);
+    }
+    waiters_.erase(waiters_.begin(), durable);
+    stats_.groups++;
+    stats_.commits += size;
+    stats_.max_group_size = max(stats_.max_group_size, size);
+}
+
 }  // namespace cmudb
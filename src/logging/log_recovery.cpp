@@ -2,6 +2,7 @@
  * log_recovey.cpp
  */
 
+#include "logging/log_compressor.h"
 #include "logging/log_recovery.h"
 #include "page/table_page.h"
 
@@ -11,127 +12,530 @@ namespace cmudb {
  * @return: true means deserialize succeed, otherwise can't deserialize cause
  * incomplete log record
  */
-    bool LogRecovery::DeserializeLogRecord(const char *data,
+    bool LogRecovery::DeserializeLogRecord(const char *data, const char *end,
                                            LogRecord &log_record) {
-        if (data + LogRecord::HEADER_SIZE > log_buffer_ + LOG_BUFFER_SIZE)
+        uint32_t rest, value;
+        const char *begin = data;
+        data = LogRecord::GetVarint(data, end, &rest);
+        // 日志结束之后是全零(ReadLog在文件末尾之后补零)，长度为0
+        if (data == nullptr || rest == 0 || rest > static_cast<uint32_t>(end - data))
             return false;
-        memcpy(&log_record, data, LogRecord::HEADER_SIZE); //COPY HEADER
-        if (log_record.size_ <= 0 || data + log_record.size_ > log_buffer_ + LOG_BUFFER_SIZE)
-            return false;
-        data += LogRecord::HEADER_SIZE;
-        switch (log_record.log_record_type_) {
+        end = data + rest;
+        log_record.size_ = static_cast<int32_t>(end - begin);
+        if (rest < sizeof(lsn_t) + 1) return false;
+        memcpy(&log_record.lsn_, data, sizeof(lsn_t));
+        data += sizeof(lsn_t);
+        lsn_t lsn = log_record.lsn_;
+        log_record.log_record_type_ = static_cast<LogRecordType>(*data++);
+        data = LogRecord::GetVarint(data, end, &value);
+        log_record.txn_id_ = static_cast<txn_id_t>(value) - 1;
+        data = LogRecord::GetVarint(data, end, &value);
+        log_record.prev_lsn_ = LogRecord::FromBackRef(lsn, value);
+        LogRecordType type = log_record.log_record_type_;
+        if (type == LogRecordType::CLR) {
+            data = LogRecord::GetVarint(data, end, &value);
+            log_record.undo_next_lsn_ = LogRecord::FromBackRef(lsn, value);
+            if (data == nullptr || data == end) return false;
+            type = log_record.action_type_ = static_cast<LogRecordType>(*data++);
+        }
+        const char *bytes;
+        int32_t length;
+        switch (type) {
             case LogRecordType::INSERT:
-                log_record.insert_rid_ = *reinterpret_cast<const RID *>(data);
-                log_record.insert_tuple_.DeserializeFrom(data + sizeof(RID));
+                data = LogRecord::GetRID(data, end, &log_record.insert_rid_);
+                data = LogRecord::GetBytes(data, end, &bytes, &length);
+                if (data != nullptr) log_record.insert_tuple_.DeserializeFrom(bytes, length);
                 break;
             case LogRecordType::MARKDELETE:
             case LogRecordType::APPLYDELETE:
             case LogRecordType::ROLLBACKDELETE:
-                log_record.delete_rid_ = *reinterpret_cast<const RID *>(data);
-                log_record.delete_tuple_.DeserializeFrom(data + sizeof(RID));
+                data = LogRecord::GetRID(data, end, &log_record.delete_rid_);
+                data = LogRecord::GetBytes(data, end, &bytes, &length);
+                if (data != nullptr) log_record.delete_tuple_.DeserializeFrom(bytes, length);
                 break;
-            case LogRecordType::UPDATE:
-                log_record.update_rid_ = *reinterpret_cast<const RID *>(data);
-                log_record.old_tuple_.DeserializeFrom(data + sizeof(RID));
-                log_record.new_tuple_.DeserializeFrom(data + sizeof(RID) + 4
-                                                      + log_record.old_tuple_.GetLength());
+            case LogRecordType::UPDATE: {
+                data = LogRecord::GetRID(data, end, &log_record.update_rid_);
+                data = LogRecord::GetBytes(data, end, &bytes, &length);
+                if (data == nullptr) break;
+                log_record.old_tuple_.DeserializeFrom(bytes, length);
+                uint32_t prefix, suffix;
+                data = LogRecord::GetVarint(data, end, &prefix);
+                data = LogRecord::GetVarint(data, end, &suffix);
+                data = LogRecord::GetBytes(data, end, &bytes, &length);
+                if (data == nullptr || prefix + suffix > static_cast<uint32_t>(
+                        log_record.old_tuple_.GetLength())) {
+                    data = nullptr;
+                    break;
+                }
+                // 新元组 = 旧元组的前缀 + 中间一段 + 旧元组的后缀
+                const char *old_data = log_record.old_tuple_.GetData();
+                std::string new_data(old_data, prefix);
+                new_data.append(bytes, length);
+                new_data.append(old_data + log_record.old_tuple_.GetLength() - suffix, suffix);
+                log_record.new_tuple_.DeserializeFrom(new_data.data(),
+                                                      static_cast<int32_t>(new_data.size()));
+                log_record.update_prefix_ = prefix;
+                log_record.update_suffix_ = suffix;
                 break;
+            }
             case LogRecordType::BEGIN:
             case LogRecordType::COMMIT:
             case LogRecordType::ABORT:
                 break;
             case LogRecordType::NEWPAGE:
-                log_record.prev_page_id_ = *reinterpret_cast<const page_id_t *>(data);
-                log_record.page_id_ = *reinterpret_cast<const page_id_t *>(data + sizeof(page_id_t));
+                data = LogRecord::GetVarint(data, end, &value);
+                log_record.prev_page_id_ = static_cast<page_id_t>(value) - 1;
+                data = LogRecord::GetVarint(data, end, &value);
+                log_record.page_id_ = static_cast<page_id_t>(value) - 1;
                 break;
+            case LogRecordType::INDEX_INSERT:
+            case LogRecordType::INDEX_DELETE:
+            case LogRecordType::INDEX_SPLIT:
+            case LogRecordType::INDEX_MERGE:
+            case LogRecordType::INDEX_REDISTRIBUTE:
+            case LogRecordType::INDEX_ROOT:
+                data = LogRecord::GetVarint(data, end, &value);
+                log_record.page_id_ = static_cast<page_id_t>(value) - 1;
+                data = LogRecord::GetVarint(data, end, &value);
+                log_record.index_offset_ = static_cast<int32_t>(value);
+                data = LogRecord::GetBytes(data, end, &bytes, &length);
+                if (data == nullptr || length > end - data) {
+                    data = nullptr;
+                    break;
+                }
+                log_record.old_data_.assign(bytes, length);
+                log_record.new_data_.assign(data, length);
+                data += length;
+                break;
+            case LogRecordType::INDEX_END:
+                data = LogRecord::GetVarint(data, end, &value);
+                log_record.undo_next_lsn_ = LogRecord::FromBackRef(lsn, value);
+                break;
+            case LogRecordType::BEGIN_CHECKPOINT:
+                break;
+            case LogRecordType::END_CHECKPOINT: {
+                uint32_t count, first, second;
+                data = LogRecord::GetVarint(data, end, &value);
+                log_record.begin_lsn_ = static_cast<lsn_t>(value) - 1;
+                data = LogRecord::GetVarint(data, end, &count);
+                log_record.dirty_pages_.clear();
+                for (uint32_t i = 0; i < count && data != nullptr; i++) {
+                    data = LogRecord::GetVarint(data, end, &first);
+                    data = LogRecord::GetVarint(data, end, &second);
+                    log_record.dirty_pages_.emplace_back(static_cast<page_id_t>(first) - 1,
+                                                         static_cast<lsn_t>(second) - 1);
+                }
+                data = LogRecord::GetVarint(data, end, &count);
+                log_record.active_txns_.clear();
+                for (uint32_t i = 0; i < count && data != nullptr; i++) {
+                    data = LogRecord::GetVarint(data, end, &first);
+                    data = LogRecord::GetVarint(data, end, &second);
+                    log_record.active_txns_.emplace_back(static_cast<txn_id_t>(first) - 1,
+                                                         static_cast<lsn_t>(second) - 1);
+                }
+                break;
+            }
             default:
-                assert(false);
+                return false;
         }
-        return true;
+        // 字段必须正好填满记录
+        return data == end;
+    }
+
+/*
+ * 压缩段的头：| 0 | 原来的长度 varint | 压缩后的长度 varint |
+ */
+    int LogRecovery::DecompressLogFrame(const char *data, const char *end, char *raw,
+                                        int *raw_size) {
+        const char *begin = data;
+        uint32_t size, stored;
+        if (data == end || *data != 0) return 0;
+        data = LogRecord::GetVarint(data + 1, end, &size);
+        data = LogRecord::GetVarint(data, end, &stored);
+        // 日志结束之后的零：原来的长度为0
+        if (data == nullptr || size == 0 || size > LOG_BUFFER_SIZE ||
+            stored > static_cast<uint32_t>(end - data) ||
+            !LogCompressor::Decompress(data, static_cast<int>(stored), raw,
+                                       static_cast<int>(size)))
+            return 0;
+        *raw_size = static_cast<int>(size);
+        return static_cast<int>(data + stored - begin);
     }
 
 /*
  *redo phase on TABLE PAGE level(table/table_page.h)
  *read log file from the beginning to end (you must prefetch log records into
  *log buffer to reduce unnecessary I/O operations), remember to compare page's
- *LSN with log_record's sequence number, and also build active_txn_ table &
- *lsn_mapping_ table
+ *LSN with log_record's sequence number, and also build active_txn_ table
+ *with the records of every transaction that has not ended
  */
     void LogRecovery::Redo() {
         //lock_guard<mutex> lock(mu_); no thread safe
         // ENABLE_LOGGING must be false when recovery
         assert(ENABLE_LOGGING == false);
-        // always replay history from start without checkpoint
-        offset_ = 0;
-        int bufferOffset = 0;
-        while (disk_manager_->ReadLog(log_buffer_ + bufferOffset,
-                                      LOG_BUFFER_SIZE - bufferOffset, offset_)) {// false means log eof
-            int bufferStart = offset_;
-            offset_ += LOG_BUFFER_SIZE - bufferOffset;
-            bufferOffset = 0;
+        // replay history from the redo point of the last checkpoint, or from
+        // the oldest log segment still on disk
+        int64_t redo_offset = readCheckpoint();
+        for (int i = 0; i < redo_threads_; i++) {
+            workers_.emplace_back(new RedoWorker);
+            workers_.back()->thread_ = thread(&LogRecovery::runRedoWorker, this,
+                                              workers_.back().get());
+        }
+        scanLog(redo_offset, [this](LogRecord &log, int64_t offset) {
+            max_lsn_ = max(max_lsn_, log.lsn_);
+            if (log.log_record_type_ == LogRecordType::BEGIN_CHECKPOINT ||
+                log.log_record_type_ == LogRecordType::END_CHECKPOINT)
+                return true;
+            TxnLog &txn = active_txn_[log.txn_id_];
+            txn.last_lsn_ = log.lsn_;
+            if (log.log_record_type_ == LogRecordType::BEGIN) {
+                txn.begin_lsn_ = log.lsn_;
+                return true;
+            }
+            if (log.log_record_type_ == LogRecordType::COMMIT ||
+                log.log_record_type_ == LogRecordType::ABORT) {
+                active_txn_.erase(log.GetTxnId());
+                return true;
+            }
+            txn.offsets_.emplace_back(log.lsn_, offset);
+            if (log.log_record_type_ == LogRecordType::INDEX_END) return true;
+            if (log.log_record_type_ == LogRecordType::NEWPAGE) {
+                // NEWPAGE也改了前一个页面的链接，等两个页面之前的记录都做完
+                drainWorkers();
+                redoRecord(log, recovered_pages_);
+            } else if (!skipRedo(log, offset)) {
+                dispatch(log);
+            }
+            return true;
+        });
+        for (auto &worker : workers_) {
+            {
+                lock_guard<mutex> lg(worker->latch_);
+                worker->stop_ = true;
+            }
+            worker->work_cv_.notify_one();
+            worker->thread_.join();
+            recovered_pages_.insert(worker->recovered_pages_.begin(),
+                                    worker->recovered_pages_.end());
+        }
+        workers_.clear();
+        dirty_pages_.clear();
+    }
+
+/**
+ * 备库上一条一条地重做主库传过来的记录，不用分析阶段：
+ * 事务的结束和检查点不改页面，主库回滚时写的记录也照样重做
+ */
+    void LogRecovery::Replay(LogRecord &log) {
+        assert(ENABLE_LOGGING == false);
+        max_lsn_ = max(max_lsn_, log.lsn_);
+        switch (log.log_record_type_) {
+            case LogRecordType::BEGIN:
+            case LogRecordType::COMMIT:
+            case LogRecordType::ABORT:
+            case LogRecordType::BEGIN_CHECKPOINT:
+            case LogRecordType::END_CHECKPOINT:
+            case LogRecordType::INDEX_END:
+                return;
+            default:
+                redoRecord(log, recovered_pages_);
+        }
+    }
+
+    void LogRecovery::FlushPages() {
+        for (page_id_t page_id : recovered_pages_)
+            buffer_pool_manager_->FlushPage(page_id);
+        recovered_pages_.clear();
+    }
+
+/**
+ * 按页面把记录分给redo线程，同一个页面上的记录总是由同一个线程按LSN的顺序处理
+ */
+    void LogRecovery::dispatch(const LogRecord &log) {
+        auto &worker = *workers_[static_cast<uint32_t>(ridOf(log).GetPageId()) % workers_.size()];
+        lock_guard<mutex> lg(worker.latch_);
+        worker.queue_.push_back(log);
+        if (worker.queue_.size() == 1) worker.work_cv_.notify_one();
+    }
+
+    void LogRecovery::drainWorkers() {
+        for (auto &worker : workers_) {
+            unique_lock<mutex> lk(worker->latch_);
+            worker->idle_cv_.wait(lk, [&] { return worker->queue_.empty() && !worker->busy_; });
+        }
+    }
+
+/**
+ * 每次取走队列中所有的记录，先预取它们的页面，让这些读请求同时在途，
+ * 然后按顺序重做。每次只pin一个页面，缓冲池再小也不会被redo线程占满
+ */
+    void LogRecovery::runRedoWorker(RedoWorker *worker) {
+        unique_lock<mutex> lk(worker->latch_);
+        while (true) {
+            worker->work_cv_.wait(lk, [&] { return worker->stop_ || !worker->queue_.empty(); });
+            if (worker->queue_.empty()) return;
+            std::deque<LogRecord> batch;
+            batch.swap(worker->queue_);
+            worker->busy_ = true;
+            lk.unlock();
+            page_id_t prefetched = INVALID_PAGE_ID;
+            for (auto &log : batch) {
+                page_id_t page_id = ridOf(log).GetPageId();
+                if (page_id != prefetched) disk_manager_->PrefetchPage(page_id);
+                prefetched = page_id;
+            }
+            for (auto &log : batch) redoRecord(log, worker->recovered_pages_);
+            lk.lock();
+            worker->busy_ = false;
+            if (worker->queue_.empty()) worker->idle_cv_.notify_all();
+        }
+    }
+
+/**
+ * 从主记录找到最后一个完整的检查点，读出END_CHECKPOINT中的脏页表。
+ * redo点不晚于检查点开始时所有活跃事务的BEGIN，从这里扫描就能重建活跃事务表，
+ * 不需要合并检查点中的活跃事务表
+ */
+    int64_t LogRecovery::readCheckpoint() {
+        dirty_pages_.clear();
+        int64_t redo_offset;
+        lsn_t checkpoint_lsn;
+        if (!disk_manager_->ReadMasterRecord(&checkpoint_offset_, &checkpoint_lsn,
+                                             &redo_offset)) {
+            checkpoint_offset_ = 0;
+            return disk_manager_->GetLogStart();
+        }
+        // END_CHECKPOINT跟在BEGIN_CHECKPOINT所在的段后面不远处
+        bool found = false;
+        scanLog(checkpoint_offset_, [&](LogRecord &log, int64_t) {
+            if (log.log_record_type_ != LogRecordType::END_CHECKPOINT ||
+                log.lsn_ != checkpoint_lsn)
+                return true;
+            for (auto &entry : log.GetDirtyPages()) dirty_pages_.insert(entry);
+            found = true;
+            return false;
+        });
+        if (found) return redo_offset;
+        // the master record points at a checkpoint that is not in the log
+        checkpoint_offset_ = 0;
+        return disk_manager_->GetLogStart();
+    }
+
+/**
+ * 两个窗口轮流使用：解析一个窗口的同时在后台读下一个。每个窗口前面留出
+ * LOG_BUFFER_SIZE字节，放上一个窗口末尾不完整的记录(记录总是小于一个日志缓冲)，
+ * 只拷贝这一小段，不用memmove整个窗口
+ */
+    void LogRecovery::scanLog(int64_t offset,
+                              const std::function<bool(LogRecord &, int64_t)> &visit) {
+        const int head = LOG_BUFFER_SIZE;
+        std::unique_ptr<char[]> windows[2] = {
+                std::unique_ptr<char[]>(new char[head + LOG_READ_SIZE]),
+                std::unique_ptr<char[]>(new char[head + LOG_READ_SIZE])};
+        auto read = [this, head](char *window, int64_t offset) {
+            return disk_manager_->ReadLog(window + head, LOG_READ_SIZE, offset);
+        };
+        std::unique_ptr<char[]> frame(new char[LOG_BUFFER_SIZE]);
+        auto next = std::async(std::launch::async, read, windows[0].get(), offset);
+        int tail = 0;
+        for (int w = 0; next.get(); w ^= 1) {
+            int64_t window_offset = offset;
+            offset += LOG_READ_SIZE;
+            next = std::async(std::launch::async, read, windows[w ^ 1].get(), offset);
+            char *data = windows[w].get() + head - tail;
+            char *end = windows[w].get() + head + LOG_READ_SIZE;
             LogRecord log;
-            while (DeserializeLogRecord(log_buffer_ + bufferOffset, log)) {
-                lsn_mapping_[log.GetLSN()] = bufferStart + bufferOffset;
-                active_txn_[log.txn_id_] = log.lsn_;
-                bufferOffset += log.size_;
-                if (log.log_record_type_ == LogRecordType::BEGIN) continue;
-                if (log.log_record_type_ == LogRecordType::COMMIT ||
-                    log.log_record_type_ == LogRecordType::ABORT) {
-                    assert(active_txn_.erase(log.GetTxnId()) > 0);
-                    continue;
-                }
-                if (log.log_record_type_ == LogRecordType::NEWPAGE) {
-                    auto page = static_cast<TablePage *>(buffer_pool_manager_->FetchPage(log.page_id_));
-                    assert(page != nullptr);
-                    bool needRedo = log.lsn_ > page->GetLSN();
-                    if (needRedo) {
-                        page->Init(log.page_id_, PAGE_SIZE, log.prev_page_id_, nullptr, nullptr);
-                        page->SetLSN(log.lsn_);
-                        if (log.prev_page_id_ != INVALID_PAGE_ID) {
-                            auto prevPage = static_cast<TablePage *>(
-                                    buffer_pool_manager_->FetchPage(log.prev_page_id_));
-                            assert(prevPage != nullptr);
-                            bool needChange = prevPage->GetNextPageId() == log.page_id_;
-                            prevPage->SetNextPageId(log.page_id_);
-                            buffer_pool_manager_->UnpinPage(prevPage->GetPageId(), needChange);
-                        }
+            while (true) {
+                int64_t record_offset = window_offset - (windows[w].get() + head - data);
+                int frame_size, raw_size;
+                if (DeserializeLogRecord(data, end, log)) {
+                    if (!visit(log, record_offset)) return;
+                    data += log.size_;
+                } else if ((frame_size = DecompressLogFrame(data, end, frame.get(),
+                                                            &raw_size)) > 0) {
+                    // 压缩段中的记录都用段的偏移量，压缩前的段里只有完整的记录
+                    for (char *raw = frame.get(), *raw_end = raw + raw_size; raw < raw_end;
+                         raw += log.size_) {
+                        if (!DeserializeLogRecord(raw, raw_end, log)) return;
+                        if (!visit(log, record_offset)) return;
                     }
-                    buffer_pool_manager_->UnpinPage(page->GetPageId(), needRedo);
-
-                    continue;
+                    data += frame_size;
+                } else {
+                    break;
                 }
-                RID rid = log.log_record_type_ == LogRecordType::INSERT ? log.insert_rid_ :
-                          log.log_record_type_ == LogRecordType::UPDATE ? log.update_rid_ :
-                          log.delete_rid_;
-                auto page = static_cast<TablePage *>(
-                        buffer_pool_manager_->FetchPage(rid.GetPageId()));
-                assert(page != nullptr);
-                bool needRedo = log.lsn_ > page->GetLSN();
-                if (needRedo) {
-                    if (log.log_record_type_ == LogRecordType::INSERT) {
-                        page->InsertTuple(log.insert_tuple_, rid, nullptr,
-                                          nullptr, nullptr);
-                    } else if (log.log_record_type_ == LogRecordType::UPDATE) {
-                        page->UpdateTuple(log.new_tuple_, log.old_tuple_, rid,
-                                          nullptr, nullptr, nullptr);
-                    } else if (log.log_record_type_ == LogRecordType::MARKDELETE) {
-                        page->MarkDelete(rid, nullptr, nullptr, nullptr);
-                    } else if (log.log_record_type_ == LogRecordType::APPLYDELETE) {
-                        page->ApplyDelete(rid, nullptr, nullptr);
-                    } else if (log.log_record_type_ == LogRecordType::ROLLBACKDELETE) {
-                        page->RollbackDelete(rid, nullptr, nullptr);
-                    } else {
-                        assert(false);//invalid area
-                    }
-                    page->SetLSN(log.lsn_);
+            }
+            tail = static_cast<int>(end - data);
+            // 剩下的不是一条记录的开头：日志结束了(ReadLog在文件末尾之后补零)
+            if (tail >= head) return;
+            memcpy(windows[w ^ 1].get() + head - tail, data, tail);
+        }
+    }
+
+/**
+ * 事务的记录按LSN排列，二分找到偏移量。窗口里没有就读一个以这条记录结尾的窗口，
+ * 之后沿着prev_lsn_往回的记录大多就在这个窗口里
+ */
+    bool LogRecovery::readRecord(const TxnLog &txn_log, lsn_t lsn, LogWindow *window,
+                                 LogRecord *log) {
+        auto it = lower_bound(txn_log.offsets_.begin(), txn_log.offsets_.end(),
+                              make_pair(lsn, INT64_MIN));
+        if (it == txn_log.offsets_.end() || it->first != lsn) return false;
+        int64_t offset = it->second;
+        if (offset < window->start_ || offset >= window->start_ + window->size_ ||
+            !recordAt(window, offset, lsn, log)) {
+            window->start_ = max<int64_t>(disk_manager_->GetLogStart(),
+                                          offset + LOG_BUFFER_SIZE - LOG_READ_SIZE);
+            window->size_ = LOG_READ_SIZE;
+            if (!disk_manager_->ReadLog(window->data_.get(), LOG_READ_SIZE, window->start_) ||
+                !recordAt(window, offset, lsn, log))
+                return false;
+        }
+        assert(log->lsn_ == lsn);
+        return true;
+    }
+
+/**
+ * 压缩段按偏移量缓存在窗口里：undo沿着prev_lsn_往回走，同一个段里的记录接着用
+ */
+    bool LogRecovery::recordAt(LogWindow *window, int64_t offset, lsn_t lsn,
+                               LogRecord *log) {
+        if (offset != window->frame_offset_) {
+            const char *data = window->data_.get() + offset - window->start_;
+            const char *end = window->data_.get() + window->size_;
+            if (DeserializeLogRecord(data, end, *log)) return true;
+            window->frame_offset_ = -1;
+            if (DecompressLogFrame(data, end, window->frame_.get(), &window->frame_size_) == 0)
+                return false;
+            window->frame_offset_ = offset;
+        }
+        const char *raw = window->frame_.get();
+        const char *raw_end = raw + window->frame_size_;
+        for (; raw < raw_end && DeserializeLogRecord(raw, raw_end, *log); raw += log->size_)
+            if (log->lsn_ == lsn) return true;
+        return false;
+    }
+
+    bool LogRecovery::skipRedo(const LogRecord &log, int64_t offset) {
+        if (offset >= checkpoint_offset_) return false;
+        // 检查点之前的修改：页面不在脏页表中，或者早于页面的recLSN，说明已经在磁盘上
+        auto it = dirty_pages_.find(ridOf(log).GetPageId());
+        return it == dirty_pages_.end() || log.lsn_ < it->second;
+    }
+
+    void LogRecovery::redoRecord(LogRecord &log,
+                                 std::unordered_set<page_id_t> &recovered_pages) {
+        if (log.log_record_type_ == LogRecordType::NEWPAGE) {
+            // the link from the previous page is not covered by its recLSN,
+            // so NEWPAGE records are always checked against the pages
+            auto page = static_cast<TablePage *>(buffer_pool_manager_->FetchPage(log.page_id_));
+            assert(page != nullptr);
+            bool needRedo = log.lsn_ > page->GetLSN();
+            if (needRedo) {
+                page->Init(log.page_id_, PAGE_SIZE, log.prev_page_id_, nullptr, nullptr);
+                page->SetLSN(log.lsn_);
+                recovered_pages.insert(log.page_id_);
+                if (log.prev_page_id_ != INVALID_PAGE_ID) {
+                    auto prevPage = static_cast<TablePage *>(
+                            buffer_pool_manager_->FetchPage(log.prev_page_id_));
+                    assert(prevPage != nullptr);
+                    bool needChange = prevPage->GetNextPageId() == log.page_id_;
+                    prevPage->SetNextPageId(log.page_id_);
+                    if (needChange) recovered_pages.insert(log.prev_page_id_);
+                    buffer_pool_manager_->UnpinPage(prevPage->GetPageId(), needChange);
                 }
-                buffer_pool_manager_->UnpinPage(page->GetPageId(), needRedo);
             }
-            memmove(log_buffer_, log_buffer_ + bufferOffset, LOG_BUFFER_SIZE - bufferOffset);
-            bufferOffset = LOG_BUFFER_SIZE - bufferOffset;//rest partial log
+            buffer_pool_manager_->UnpinPage(page->GetPageId(), needRedo);
+            return;
+        }
+        // a CLR is redone like the action it carries
+        RID rid = ridOf(log);
+        auto page = static_cast<TablePage *>(
+                buffer_pool_manager_->FetchPage(rid.GetPageId()));
+        assert(page != nullptr);
+        // 头页面的修改总是重做：按日志的顺序重写这些字节，结果和最后一次写一样
+        bool needRedo = log.IsHeaderPageRecord() || log.lsn_ > page->GetLSN();
+        if (needRedo) {
+            applyAction(page, log);
+            setPageLSN(page, log, log.lsn_);
+            recovered_pages.insert(rid.GetPageId());
+        }
+        buffer_pool_manager_->UnpinPage(rid.GetPageId(), needRedo);
+    }
+
+    RID LogRecovery::ridOf(const LogRecord &log) {
+        LogRecordType type = log.GetActionType();
+        if (IsIndexPageRecord(type)) return {log.page_id_, 0};
+        return type == LogRecordType::INSERT ? log.insert_rid_ :
+               type == LogRecordType::UPDATE ? log.update_rid_ :
+               log.delete_rid_;
+    }
+
+    LogRecord LogRecovery::undoAction(const LogRecord &log) {
+        if (IsIndexPageRecord(log.GetActionType()))
+            return {log.txn_id_, INVALID_LSN, log.GetActionType(), log.page_id_,
+                    log.index_offset_, log.new_data_, log.old_data_};
+        switch (log.GetActionType()) {
+            case LogRecordType::INSERT:
+                return {log.txn_id_, INVALID_LSN, LogRecordType::APPLYDELETE,
+                        log.insert_rid_, log.insert_tuple_};
+            case LogRecordType::UPDATE:
+                return {log.txn_id_, INVALID_LSN, LogRecordType::UPDATE,
+                        log.update_rid_, log.new_tuple_, log.old_tuple_};
+            case LogRecordType::MARKDELETE:
+                return {log.txn_id_, INVALID_LSN, LogRecordType::ROLLBACKDELETE,
+                        log.delete_rid_, log.delete_tuple_};
+            case LogRecordType::APPLYDELETE:
+                return {log.txn_id_, INVALID_LSN, LogRecordType::INSERT,
+                        log.delete_rid_, log.delete_tuple_};
+            case LogRecordType::ROLLBACKDELETE:
+                return {log.txn_id_, INVALID_LSN, LogRecordType::MARKDELETE,
+                        log.delete_rid_, log.delete_tuple_};
+            default:
+                assert(false);
+                return {};
+        }
+    }
+
+    // 不加锁也不写日志地把insert/delete/update类型的动作做到页面上
+    void LogRecovery::applyAction(TablePage *page, LogRecord &action) {
+        RID rid = ridOf(action);
+        if (IsIndexPageRecord(action.GetActionType())) {
+            // 写回这段字节，页面的LSN保持不变
+            lsn_t lsn = page->GetLSN();
+            memcpy(page->GetData() + action.index_offset_, action.new_data_.data(),
+                   action.new_data_.size());
+            if (!action.IsHeaderPageRecord()) memcpy(page->GetData() + 4, &lsn, sizeof(lsn_t));
+            return;
+        }
+        switch (action.GetActionType()) {
+            case LogRecordType::INSERT:
+                page->InsertTuple(action.insert_tuple_, rid, nullptr, nullptr, nullptr);
+                break;
+            case LogRecordType::UPDATE: {
+                Tuple old_tuple;
+                page->UpdateTuple(action.new_tuple_, old_tuple, rid,
+                                  nullptr, nullptr, nullptr);
+                break;
+            }
+            case LogRecordType::MARKDELETE:
+                page->MarkDelete(rid, nullptr, nullptr, nullptr);
+                break;
+            case LogRecordType::APPLYDELETE:
+                page->ApplyDelete(rid, nullptr, nullptr);
+                break;
+            case LogRecordType::ROLLBACKDELETE:
+                page->RollbackDelete(rid, nullptr, nullptr);
+                break;
+            default:
+                assert(false);//invalid area
         }
     }
 
+    void LogRecovery::setPageLSN(Page *page, const LogRecord &log, lsn_t lsn) {
+        if (log.IsHeaderPageRecord()) page->SetRecLSN(lsn);
+        else page->SetLSN(lsn);
+    }
+
 /*
  *undo phase on TABLE PAGE level(table/table_page.h)
  *iterate through active txn map and undo each operation
@@ -140,21 +544,20 @@ namespace cmudb {
         //lock_guard<mutex> lock(mu_); no thread safe
         // ENABLE_LOGGING must be false when recovery
         assert(ENABLE_LOGGING == false);
-        for (auto &txn : active_txn_) {
-            lsn_t lsn = txn.second;
-            while (lsn != INVALID_LSN) {
-                LogRecord log;
-                disk_manager_->ReadLog(log_buffer_, PAGE_SIZE, lsn_mapping_[lsn]);
-                assert(DeserializeLogRecord(log_buffer_, log));
-                assert(log.lsn_ == lsn);
-                lsn = log.prev_lsn_;
-                if (log.log_record_type_ == LogRecordType::BEGIN) {
-                    assert(log.prev_lsn_ == INVALID_LSN);
+        LogWindow window;
+        LogRecord log;
+        for (auto &entry : active_txn_) {
+            TxnLog &txn = entry.second;
+            lsn_t lsn = txn.last_lsn_;
+            while (lsn != INVALID_LSN && lsn != txn.begin_lsn_) {
+                if (!readRecord(txn, lsn, &window, &log)) break;  // before the redo point
+                // 补偿过的记录和完成了的B+树操作不再撤销
+                if (log.log_record_type_ == LogRecordType::CLR ||
+                    log.log_record_type_ == LogRecordType::INDEX_END) {
+                    lsn = log.undo_next_lsn_;
                     continue;
                 }
-                if (log.log_record_type_ == LogRecordType::COMMIT ||
-                    log.log_record_type_ == LogRecordType::ABORT)
-                    assert(false);
+                lsn = log.prev_lsn_;
                 if (log.log_record_type_ == LogRecordType::NEWPAGE) {
                     if (!buffer_pool_manager_->DeletePage(log.page_id_))
                         disk_manager_->DeallocatePage(log.page_id_);
@@ -164,38 +567,178 @@ namespace cmudb {
                         assert(prevPage != nullptr);
                         assert(prevPage->GetNextPageId() == log.page_id_);
                         prevPage->SetNextPageId(INVALID_PAGE_ID);
+                        recovered_pages_.insert(log.prev_page_id_);
                         buffer_pool_manager_->UnpinPage(prevPage->GetPageId(), true);
                     }
                     continue;
                 }
-                RID rid = log.log_record_type_ == LogRecordType::INSERT ? log.insert_rid_ :
-                          log.log_record_type_ == LogRecordType::UPDATE ? log.update_rid_ :
-                          log.delete_rid_;
+                LogRecord action = undoAction(log);
+                RID rid = ridOf(action);
                 auto page = static_cast<TablePage *>(buffer_pool_manager_->FetchPage(rid.GetPageId()));
                 assert(page != nullptr);
-                assert(page->GetLSN() >= log.lsn_);
-                if (log.log_record_type_ == LogRecordType::INSERT) {
-                    page->ApplyDelete(log.insert_rid_, nullptr, nullptr);
-                } else if (log.log_record_type_ == LogRecordType::UPDATE) {
-                    Tuple tuple;
-                    page->UpdateTuple(log.old_tuple_, tuple, log.update_rid_,
-                                      nullptr, nullptr, nullptr);
-                    assert(tuple.GetLength() == log.new_tuple_.GetLength() &&
-                           memcmp(tuple.GetData(), log.new_tuple_.GetData(), tuple.GetLength()) == 0);
-                } else if (log.log_record_type_ == LogRecordType::MARKDELETE) {
-                    page->RollbackDelete(log.delete_rid_, nullptr, nullptr);
-                } else if (log.log_record_type_ == LogRecordType::APPLYDELETE) {
-                    page->InsertTuple(log.delete_tuple_, log.delete_rid_,
-                                      nullptr, nullptr, nullptr);
-                } else if (log.log_record_type_ == LogRecordType::ROLLBACKDELETE) {
-                    page->MarkDelete(log.delete_rid_, nullptr, nullptr, nullptr);
-                } else
-                    assert(false);
-                buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+                assert(log.IsHeaderPageRecord() || page->GetLSN() >= log.lsn_);
+                applyAction(page, action);
+                recovered_pages_.insert(rid.GetPageId());
+                buffer_pool_manager_->UnpinPage(rid.GetPageId(), true);
             }
         }
+        // 没有写补偿记录，把恢复的结果写回磁盘才算持久
+        for (page_id_t page_id : recovered_pages_)
+            buffer_pool_manager_->FlushPage(page_id);
+        recovered_pages_.clear();
+        // FlushPage只写到OS的页缓存，ABORT落盘之前回滚的结果必须先落盘；
+        // 同步失败时不写ABORT，下次恢复重新redo并回滚这些loser
+        if (!active_txn_.empty() && !disk_manager_->SyncData()) {
+            active_txn_.clear();
+            return;
+        }
+        // 再给每个loser补一条ABORT，下次恢复不会把回滚过的记录再撤销一次
+        std::vector<char> aborts;
+        for (auto &entry : active_txn_) {
+            LogRecord abort{entry.first, entry.second.last_lsn_, LogRecordType::ABORT};
+            abort.lsn_ = ++max_lsn_;
+            abort.size_ = abort.GetSize(abort.lsn_);
+            aborts.resize(aborts.size() + abort.size_);
+            LogManager::SerializeLogRecord(abort, aborts.data() + aborts.size() - abort.size_);
+        }
         active_txn_.clear();
-        lsn_mapping_.clear();
+        if (!aborts.empty()) disk_manager_->WriteLog(aborts.data(), static_cast<int>(aborts.size()));
+    }
+
+/**
+ * 1.LSN接着日志中最大的LSN分配，开始写日志
+ * 2.接管每个loser：按页面的链接找到行所在的表，加上表和页面的意向锁以及行的写锁
+ * 3.后台线程并行地回滚loser，loser之间改的行不相交，只在页面上加latch
+ */
+    void LogRecovery::StartUndo(TransactionManager *transaction_manager,
+                                LockManager *lock_manager, LogManager *log_manager) {
+        assert(ENABLE_LOGGING == false && undo_threads_.empty());
+        transaction_manager_ = transaction_manager;
+        log_manager_ = log_manager;
+        log_manager_->SetNextLSN(max_lsn_ + 1);
+        log_manager_->RunFlushThread();
+        recovered_pages_.clear();
+
+        std::unordered_map<page_id_t, page_id_t> tables;
+        LogWindow window;
+        LogRecord log;
+        for (auto &entry : active_txn_) {
+            TxnLog &txn_log = entry.second;
+            Transaction *txn = transaction_manager_->AdoptLoser(
+                    entry.first, txn_log.begin_lsn_, txn_log.last_lsn_);
+            for (auto &record : txn_log.offsets_) {
+                bool read = readRecord(txn_log, record.first, &window, &log);
+                assert(read);
+                (void) read;
+                if (log.log_record_type_ == LogRecordType::NEWPAGE ||
+                    log.log_record_type_ == LogRecordType::INDEX_END ||
+                    IsIndexPageRecord(log.GetActionType()))
+                    continue;
+                RID rid = ridOf(log);
+                page_id_t table_id = tableOf(rid.GetPageId(), &tables);
+                bool locked = lock_manager->LockPage(txn, table_id, rid.GetPageId(),
+                                                     LockMode::INTENTION_EXCLUSIVE) &&
+                              lock_manager->LockExclusive(txn, rid);
+                assert(locked);
+                (void) locked;
+            }
+            // 没有完成的B+树操作在新事务进来之前回滚，树的结构要先完整
+            txn_log.last_lsn_ = undoRecords(txn, txn_log, txn_log.last_lsn_, &window, true);
+            losers_.emplace_back(txn, &txn_log);
+        }
+        int threads = min(redo_threads_, static_cast<int>(losers_.size()));
+        for (int i = 0; i < threads; i++)
+            undo_threads_.emplace_back(&LogRecovery::runUndoWorker, this);
+    }
+
+    void LogRecovery::WaitForUndo() {
+        for (auto &thread : undo_threads_) thread.join();
+        undo_threads_.clear();
+        if (transaction_manager_ != nullptr) active_txn_.clear();
+    }
+
+    page_id_t LogRecovery::tableOf(page_id_t page_id,
+                                   std::unordered_map<page_id_t, page_id_t> *tables) {
+        std::vector<page_id_t> path;
+        page_id_t table_id = page_id;
+        while (true) {
+            auto it = tables->find(table_id);
+            if (it != tables->end()) {
+                table_id = it->second;
+                break;
+            }
+            path.push_back(table_id);
+            auto page = static_cast<TablePage *>(buffer_pool_manager_->FetchPage(table_id));
+            assert(page != nullptr);
+            page_id_t prev_page_id = page->GetPrevPageId();
+            buffer_pool_manager_->UnpinPage(table_id, false);
+            if (prev_page_id == INVALID_PAGE_ID) break;
+            table_id = prev_page_id;
+        }
+        for (page_id_t visited : path) (*tables)[visited] = table_id;
+        return table_id;
+    }
+
+    void LogRecovery::runUndoWorker() {
+        LogWindow window;
+        while (true) {
+            std::pair<Transaction *, TxnLog *> loser;
+            {
+                lock_guard<mutex> lg(undo_latch_);
+                if (losers_.empty()) return;
+                loser = losers_.back();
+                losers_.pop_back();
+            }
+            undoLoser(loser.first, *loser.second, &window);
+        }
+    }
+
+/**
+ * 沿着prev_lsn_往回撤销，每撤销一条记录就写一条CLR，它的undo_next_lsn_是
+ * 下一条要撤销的记录；遇到CLR直接跳到它的undo_next_lsn_，之前补偿过的记录不会
+ * 再撤销一次。新页面的分配不撤销：新事务可能已经往页面里插入了元组
+ */
+    void LogRecovery::undoLoser(Transaction *txn, TxnLog &txn_log, LogWindow *window) {
+        undoRecords(txn, txn_log, txn_log.last_lsn_, window, false);
+        transaction_manager_->EndLoser(txn);
+        delete txn;
+    }
+
+/**
+ * 完成了的B+树操作以INDEX_END结束，跳过它的所有记录，树的修改不随事务回滚；
+ * 没有INDEX_END的操作在最后面，用修改之前的字节撤销
+ */
+    lsn_t LogRecovery::undoRecords(Transaction *txn, const TxnLog &txn_log, lsn_t lsn,
+                                   LogWindow *window, bool index_only) {
+        LogRecord log;
+        while (lsn != INVALID_LSN && lsn != txn_log.begin_lsn_) {
+            if (!readRecord(txn_log, lsn, window, &log)) break;  // before the redo point
+            if (log.log_record_type_ == LogRecordType::CLR) {
+                lsn = log.undo_next_lsn_;
+                continue;
+            }
+            if (index_only && !IsIndexPageRecord(log.log_record_type_)) break;
+            if (log.log_record_type_ == LogRecordType::INDEX_END) {
+                lsn = log.undo_next_lsn_;
+                continue;
+            }
+            lsn = log.prev_lsn_;
+            if (log.log_record_type_ == LogRecordType::NEWPAGE) continue;
+            LogRecord action = undoAction(log);
+            RID rid = ridOf(action);
+            auto page = static_cast<TablePage *>(buffer_pool_manager_->FetchPage(rid.GetPageId()));
+            assert(page != nullptr);
+            page->WLatch();
+            // 新事务可能在这个页面的别的行上暂存了记录，CLR要排在它们后面
+            log_manager_->MergePage(page);
+            applyAction(page, action);
+            LogRecord clr{txn->GetTransactionId(), txn->GetPrevLSN(), lsn, action};
+            txn->SetPrevLSN(log_manager_->AppendLogRecord(clr));
+            setPageLSN(page, action, txn->GetPrevLSN());
+            page->WUnlatch();
+            buffer_pool_manager_->UnpinPage(rid.GetPageId(), true);
+        }
+        return lsn;
     }
 
 } // namespace cmudb
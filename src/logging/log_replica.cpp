@@ -0,0 +1,184 @@
+/**
+ * log_replica.cpp
+ */
+
+#include <cstring>
+#include <memory>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/logger.h"
+#include "logging/log_replica.h"
+
+namespace cmudb {
+
+    LogReplica::LogReplica(const std::string &db_file, const std::string &socket_path)
+            : socket_path_(socket_path) {
+        disk_manager_ = new DiskManager(db_file);
+        // 备库不写自己的日志记录，缓冲池换出页面时不用等日志落盘
+        buffer_pool_manager_ = new BufferPoolManager(BUFFER_POOL_SIZE, disk_manager_, nullptr);
+        log_recovery_ = new LogRecovery(disk_manager_, buffer_pool_manager_);
+    }
+
+    LogReplica::~LogReplica() {
+        Stop();
+        delete log_recovery_;
+        delete buffer_pool_manager_;
+        delete disk_manager_;
+    }
+
+/**
+ * 本地日志里的记录都已经收齐了(只写完整的记录)，先把它们重做一遍，
+ * 主库再从本地日志的结尾接着发
+ */
+    void LogReplica::Start() {
+        assert(ENABLE_LOGGING == false && receiver_ == nullptr);
+        log_recovery_->Redo();
+        applied_lsn_ = log_recovery_->GetMaxLSN();
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socket_path_.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(socket_path_.c_str());
+        if (listen_fd_ < 0 ||
+            bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            listen(listen_fd_, 1) != 0) {
+            LOG_DEBUG("standby cannot listen on %s", socket_path_.c_str());
+            return;
+        }
+        stop_ = false;
+        receiver_ = new std::thread(&LogReplica::runReceiver, this);
+    }
+
+/**
+ * shutdown让阻塞在accept和recv上的接收线程返回
+ */
+    void LogReplica::Stop() {
+        if (listen_fd_ >= 0) {
+            {
+                std::lock_guard<std::mutex> lg(latch_);
+                stop_ = true;
+                if (conn_fd_ >= 0) shutdown(conn_fd_, SHUT_RDWR);
+            }
+            shutdown(listen_fd_, SHUT_RDWR);
+            if (receiver_ != nullptr) {
+                receiver_->join();
+                delete receiver_;
+                receiver_ = nullptr;
+            }
+            close(listen_fd_);
+            listen_fd_ = -1;
+            unlink(socket_path_.c_str());
+        }
+        log_recovery_->FlushPages();
+    }
+
+    void LogReplica::Read(const std::function<void(BufferPoolManager *)> &read) {
+        pages_latch_.RLock();
+        read(buffer_pool_manager_);
+        pages_latch_.RUnlock();
+    }
+
+    lsn_t LogReplica::GetAppliedLSN() {
+        std::lock_guard<std::mutex> lg(latch_);
+        return applied_lsn_;
+    }
+
+    bool LogReplica::WaitForLSN(lsn_t lsn, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lk(latch_);
+        return applied_cv_.wait_for(lk, timeout, [&] { return applied_lsn_ >= lsn; });
+    }
+
+/**
+ * 一次只接一个主库，断开之后等它重连
+ */
+    void LogReplica::runReceiver() {
+        while (true) {
+            int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) return;
+            {
+                std::lock_guard<std::mutex> lg(latch_);
+                if (stop_) {
+                    close(fd);
+                    return;
+                }
+                conn_fd_ = fd;
+            }
+            receive(fd);
+            std::lock_guard<std::mutex> lg(latch_);
+            conn_fd_ = -1;
+            close(fd);
+            if (stop_) return;
+        }
+    }
+
+/**
+ * 告诉主库从哪里发，然后收字节流。记录可能被拆在两次recv里，不完整的尾巴
+ * 拷到另一个缓冲区的前面等后面的字节(WriteLog不接受连着两次用同一个缓冲区)；
+ * 断开时丢掉它，重连后主库会再发一次
+ */
+    void LogReplica::receive(int fd) {
+        int64_t offset = disk_manager_->GetLogEnd();
+        if (::send(fd, &offset, sizeof(offset), MSG_NOSIGNAL) != sizeof(offset)) return;
+        std::unique_ptr<char[]> buffers[2] = {std::unique_ptr<char[]>(new char[LOG_READ_SIZE]),
+                                              std::unique_ptr<char[]>(new char[LOG_READ_SIZE])};
+        int filled = 0;
+        for (int b = 0;; b ^= 1) {
+            char *buffer = buffers[b].get();
+            ssize_t n = recv(fd, buffer + filled, LOG_READ_SIZE - filled, 0);
+            if (n <= 0) return;
+            filled += n;
+            int used = apply(buffer, filled);
+            if (used < 0) return;
+            // 记录都小于一个日志缓冲，缓冲区满了还解析不出记录说明数据坏了
+            if (used == 0 && filled == LOG_READ_SIZE) {
+                LOG_DEBUG("standby received a corrupt log stream");
+                return;
+            }
+            filled -= used;
+            memcpy(buffers[b ^ 1].get(), buffer + used, filled);
+        }
+    }
+
+/**
+ * 先写本地日志再改页面，备库的页面也遵守WAL；改页面时挡住读者。
+ * 主库压缩过的段也是完整地发过来的。写本地日志失败时返回-1
+ */
+    int LogReplica::apply(char *data, int size) {
+        std::vector<LogRecord> records;
+        LogRecord log;
+        int used = 0, frame_size, raw_size;
+        while (true) {
+            if (LogRecovery::DeserializeLogRecord(data + used, data + size, log)) {
+                used += log.GetSize();
+                records.push_back(log);
+            } else if ((frame_size = LogRecovery::DecompressLogFrame(
+                    data + used, data + size, frame_.get(), &raw_size)) > 0) {
+                // 压缩的段原样写到本地日志，里面的记录一起应用
+                for (const char *raw = frame_.get(), *raw_end = raw + raw_size; raw < raw_end;
+                     raw += log.GetSize()) {
+                    if (!LogRecovery::DeserializeLogRecord(raw, raw_end, log)) break;
+                    records.push_back(log);
+                }
+                used += frame_size;
+            } else {
+                break;
+            }
+        }
+        if (records.empty()) return 0;
+        // 本地日志写不进去就不能改页面，断开连接，重连后主库从本地日志的结尾重发
+        if (!disk_manager_->WriteLog(data, used)) return -1;
+        pages_latch_.WLock();
+        for (auto &record : records) log_recovery_->Replay(record);
+        pages_latch_.WUnlock();
+        {
+            std::lock_guard<std::mutex> lg(latch_);
+            applied_lsn_ = records.back().GetLSN();
+        }
+        applied_cv_.notify_all();
+        return used;
+    }
+
+} // namespace cmudb
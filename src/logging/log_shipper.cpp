@@ -0,0 +1,117 @@
+/**
+ * log_shipper.cpp
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common/logger.h"
+#include "logging/log_shipper.h"
+
+namespace cmudb {
+
+/**
+ * 日志按写到磁盘的顺序原样发给备库，备库从一个记录的边界开始要，
+ * 之后收到的字节流就是一条接一条的记录
+ */
+    void LogShipper::Ship(const char *log_data, int size, int64_t offset) {
+        if (fd_ < 0 && (std::chrono::steady_clock::now() < retry_at_ || !connect()))
+            return;
+        int64_t end = offset + size;
+        // 备库缺的是连上之前写的日志，先从磁盘上补
+        if (shipped_ < offset && !catchUp(offset)) return;
+        if (shipped_ > end) {
+            LOG_DEBUG("standby is ahead of the primary log");
+            disconnect();
+            return;
+        }
+        if (!send(log_data + shipped_ - offset, end - shipped_)) return;
+        shipped_ = end;
+    }
+
+/**
+ * 备库接受连接后先发一个int64_t：它的日志结束的偏移量，也就是它要的第一个字节。
+ * 它要的日志已经被检查点回收时拒绝连接，新的备库只能在第一次截断日志之前接上。
+ * 收发都有超时：Ship在刷日志的线程上，不能被不读的备库卡住所有的提交
+ */
+    bool LogShipper::connect() {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        timeval timeout{LOG_SHIP_TIMEOUT_MS / 1000, LOG_SHIP_TIMEOUT_MS % 1000 * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socket_path_.c_str(), sizeof(addr.sun_path) - 1);
+        int64_t offset;
+        if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            close(fd);
+            return false;
+        }
+        if (recv(fd, &offset, sizeof(offset), MSG_WAITALL) != sizeof(offset)) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) stalled();
+            close(fd);
+            return false;
+        }
+        if (offset < disk_manager_->GetLogStart() || offset > disk_manager_->GetLogEnd()) {
+            LOG_DEBUG("standby wants log offset %lld that is not on disk",
+                      static_cast<long long>(offset));
+            close(fd);
+            return false;
+        }
+        fd_ = fd;
+        shipped_ = offset;
+        return true;
+    }
+
+    void LogShipper::disconnect() {
+        if (fd_ < 0) return;
+        close(fd_);
+        fd_ = -1;
+    }
+
+    void LogShipper::stalled() {
+        LOG_DEBUG("standby took no log for %d ms, dropping it", LOG_SHIP_TIMEOUT_MS);
+        retry_at_ = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(LOG_SHIP_TIMEOUT_MS);
+    }
+
+    bool LogShipper::catchUp(int64_t end) {
+        std::unique_ptr<char[]> buffer(new char[LOG_READ_SIZE]);
+        while (shipped_ < end) {
+            int size = static_cast<int>(std::min<int64_t>(LOG_READ_SIZE, end - shipped_));
+            // 检查点可能刚好回收了这段日志
+            if (!disk_manager_->ReadLog(buffer.get(), size, shipped_)) {
+                LOG_DEBUG("log offset %lld to catch up from is truncated",
+                          static_cast<long long>(shipped_));
+                disconnect();
+                return false;
+            }
+            if (!send(buffer.get(), size)) return false;
+            shipped_ += size;
+        }
+        return true;
+    }
+
+    bool LogShipper::send(const char *data, int size) {
+        while (size > 0) {
+            // 备库断开时不要SIGPIPE
+            ssize_t n = ::send(fd_, data, size, MSG_NOSIGNAL);
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) stalled();
+                disconnect();
+                return false;
+            }
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+} // namespace cmudb
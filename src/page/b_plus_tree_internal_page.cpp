@@ -5,9 +5,25 @@
 #include <sstream>
 
 #include "common/exception.h"
+#include "logging/index_log.h"
 #include "page/b_plus_tree_internal_page.h"
 
 namespace cmudb {
+/**
+ * 修改子页面的parent_id，log不为空时为这个修改写日志
+ */
+    static void setParent(page_id_t child_id, page_id_t parent_id,
+                          BufferPoolManager *buffer_pool_manager, IndexLog *log,
+                          LogRecordType type) {
+        Page *page = buffer_pool_manager->FetchPage(child_id);
+        assert(page != nullptr);
+        if (log != nullptr) log->Track(page);
+        reinterpret_cast<BPlusTreePage *>(page->GetData())->SetParentPageId(parent_id);
+        if (log != nullptr) log->Log(page, type);
+        //使用完后，一定要记得将页面取消固定
+        buffer_pool_manager->UnpinPage(child_id, true);
+    }
+
 /*****************************************************************************
  * HELPER METHODS AND UTILITIES
  *****************************************************************************/
@@ -152,7 +168,8 @@ namespace cmudb {
 */
     INDEX_TEMPLATE_ARGUMENTS
     void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveHalfTo(
-            BPlusTreeInternalPage *recipient, BufferPoolManager *buffer_pool_manager) {
+            BPlusTreeInternalPage *recipient, BufferPoolManager *buffer_pool_manager,
+            IndexLog *log) {
         assert(recipient != nullptr);
         int total = GetMaxSize() + 1;
         assert(GetSize() == total);
@@ -162,12 +179,8 @@ namespace cmudb {
             recipient->array[i - copyIdx].first = array[i].first;
             recipient->array[i - copyIdx].second = array[i].second;
             // update children's parent page
-            auto childRawPage = buffer_pool_manager->FetchPage(array[i].second);
-            BPlusTreePage *childTreePage =
-                    reinterpret_cast<BPlusTreePage *>(childRawPage->GetData());
-            childTreePage->SetParentPageId(recipPageId);
-            //使用完后，一定要记得将页面取消固定
-            buffer_pool_manager->UnpinPage(array[i].second, true);
+            setParent(array[i].second, recipPageId, buffer_pool_manager, log,
+                      LogRecordType::INDEX_SPLIT);
         }
         //改变当前页面和新页面的size
         SetSize(copyIdx);
@@ -213,7 +226,7 @@ namespace cmudb {
     INDEX_TEMPLATE_ARGUMENTS
     void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveAllTo(
             BPlusTreeInternalPage *recipient, int index_in_parent,
-            BufferPoolManager *buffer_pool_manager) {
+            BufferPoolManager *buffer_pool_manager, IndexLog *log) {
         int start = recipient->GetSize();
         page_id_t recipPageId = recipient->GetPageId();
         // first find parent
@@ -232,11 +245,8 @@ namespace cmudb {
             recipient->array[start + i].first = array[i].first;
             recipient->array[start + i].second = array[i].second;
             // 更新移动元素所指向子页面的parent_id
-            auto childRawPage = buffer_pool_manager->FetchPage(array[i].second);
-            BPlusTreePage *childTreePage =
-                    reinterpret_cast<BPlusTreePage *>(childRawPage->GetData());
-            childTreePage->SetParentPageId(recipPageId);
-            buffer_pool_manager->UnpinPage(array[i].second, true);
+            setParent(array[i].second, recipPageId, buffer_pool_manager, log,
+                      LogRecordType::INDEX_MERGE);
         }
         // 更新合并后页面和当前页面的size
         recipient->SetSize(start + GetSize());
@@ -257,7 +267,8 @@ namespace cmudb {
 */
     INDEX_TEMPLATE_ARGUMENTS
     void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveFirstToEndOf(
-            BPlusTreeInternalPage *recipient, BufferPoolManager *buffer_pool_manager) {
+            BPlusTreeInternalPage *recipient, BufferPoolManager *buffer_pool_manager,
+            IndexLog *log) {
         //todo:第一个key不是无效的吗
         MappingType pair{KeyAt(0), ValueAt(0)};
         IncreaseSize(-1);
@@ -265,15 +276,10 @@ namespace cmudb {
                 static_cast<size_t>(GetSize() * sizeof(MappingType)));
         recipient->CopyLastFrom(pair, buffer_pool_manager);
         // 更新移动元素所指向子页面的parent_id
-        page_id_t childPageId = pair.second;
-        Page *page = buffer_pool_manager->FetchPage(childPageId);
-        assert(page != nullptr);
-        BPlusTreePage *child = reinterpret_cast<BPlusTreePage *>(page->GetData());
-        child->SetParentPageId(recipient->GetPageId());
-        assert(child->GetParentPageId() == recipient->GetPageId());
-        buffer_pool_manager->UnpinPage(child->GetPageId(), true);
+        setParent(pair.second, recipient->GetPageId(), buffer_pool_manager, log,
+                  LogRecordType::INDEX_REDISTRIBUTE);
         // update relevant key & value pair in its parent page.
-        page = buffer_pool_manager->FetchPage(GetParentPageId());
+        Page *page = buffer_pool_manager->FetchPage(GetParentPageId());
         B_PLUS_TREE_INTERNAL_PAGE *parent =
                 reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page->GetData());
         parent->SetKeyAt(parent->ValueIndex(GetPageId()), array[0].first);
@@ -296,28 +302,23 @@ namespace cmudb {
     INDEX_TEMPLATE_ARGUMENTS
     void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveLastToFrontOf(
             BPlusTreeInternalPage *recipient, int parent_index,
-            BufferPoolManager *buffer_pool_manager) {
+            BufferPoolManager *buffer_pool_manager, IndexLog *log) {
         MappingType pair{KeyAt(GetSize() - 1), ValueAt(GetSize() - 1)};
         IncreaseSize(-1);
-        recipient->CopyFirstFrom(pair, parent_index, buffer_pool_manager);
+        recipient->CopyFirstFrom(pair, parent_index, buffer_pool_manager, log);
     }
 
     INDEX_TEMPLATE_ARGUMENTS
     void B_PLUS_TREE_INTERNAL_PAGE_TYPE::CopyFirstFrom(
             const MappingType &pair, int parent_index,
-            BufferPoolManager *buffer_pool_manager) {
+            BufferPoolManager *buffer_pool_manager, IndexLog *log) {
         assert(GetSize() + 1 < GetMaxSize());
         memmove(array + 1, array, GetSize() * sizeof(MappingType));
         IncreaseSize(1);
         array[0] = pair;
-        page_id_t childPageId = pair.second;
-        Page *page = buffer_pool_manager->FetchPage(childPageId);
-        assert(page != nullptr);
-        BPlusTreePage *child = reinterpret_cast<BPlusTreePage *>(page->GetData());
-        child->SetParentPageId(GetPageId());
-        assert(child->GetParentPageId() == GetPageId());
-        buffer_pool_manager->UnpinPage(child->GetPageId(), true);
-        page = buffer_pool_manager->FetchPage(GetParentPageId());
+        setParent(pair.second, GetPageId(), buffer_pool_manager, log,
+                  LogRecordType::INDEX_REDISTRIBUTE);
+        Page *page = buffer_pool_manager->FetchPage(GetParentPageId());
         B_PLUS_TREE_INTERNAL_PAGE *parent =
                 reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page->GetData());
         parent->SetKeyAt(parent_index, array[0].first);
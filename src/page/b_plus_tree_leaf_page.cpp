@@ -123,7 +123,7 @@ namespace cmudb {
     INDEX_TEMPLATE_ARGUMENTS
     void B_PLUS_TREE_LEAF_PAGE_TYPE::MoveHalfTo(
             BPlusTreeLeafPage *recipient,
-            __attribute__((unused)) BufferPoolManager *buffer_pool_manager) {
+            __attribute__((unused)) BufferPoolManager *buffer_pool_manager, IndexLog *) {
         assert(recipient != nullptr);
         int total = GetMaxSize() + 1;
         assert(GetSize() == total);
@@ -197,7 +197,7 @@ namespace cmudb {
  */
     INDEX_TEMPLATE_ARGUMENTS
     void B_PLUS_TREE_LEAF_PAGE_TYPE::MoveAllTo(BPlusTreeLeafPage *recipient,
-                                               int, BufferPoolManager *) {
+                                               int, BufferPoolManager *, IndexLog *) {
         assert(recipient != nullptr);
 
         int startIdx = recipient->GetSize();//7 is 4,5,6,7; 8 is 4,5,6,7,8
@@ -224,7 +224,7 @@ namespace cmudb {
     INDEX_TEMPLATE_ARGUMENTS
     void B_PLUS_TREE_LEAF_PAGE_TYPE::MoveFirstToEndOf(
             BPlusTreeLeafPage *recipient,
-            BufferPoolManager *buffer_pool_manager) {
+            BufferPoolManager *buffer_pool_manager, IndexLog *) {
         MappingType pair = GetItem(0);
         IncreaseSize(-1);
         memmove(array, array + 1, static_cast<size_t>(GetSize() * sizeof(MappingType)));
@@ -249,7 +249,7 @@ namespace cmudb {
     INDEX_TEMPLATE_ARGUMENTS
     void B_PLUS_TREE_LEAF_PAGE_TYPE::MoveLastToFrontOf(
             BPlusTreeLeafPage *recipient, int parentIndex,
-            BufferPoolManager *buffer_pool_manager) {
+            BufferPoolManager *buffer_pool_manager, IndexLog *) {
         MappingType pair = GetItem(GetSize() - 1);
         IncreaseSize(-1);
         recipient->CopyFirstFrom(pair, parentIndex, buffer_pool_manager);
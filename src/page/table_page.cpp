@@ -12,20 +12,21 @@ namespace cmudb {
  * Header related
  * (1) explicitly create a log record (include/logging/log_record.h)
  * (2) invoke SerializeLogRecord method of Log Manager to write it into log_buffer when the global variable
- * ENABLE_LOGGING(include/common/config.h) is set to be true.
+ * ENABLE_LOGGING(include/common/config.h) is set to be true and txn is not
+ * nullptr (recovery changes pages without logging, see logged()).
  * (3) Update prevLSN for current transaction.
  * (4) Update LSN for current page
+ * The records are staged in the transaction's log buffer (see
+ * LogManager::StageLogRecord), (3) and (4) happen when it is merged.
  */
     void TablePage::Init(page_id_t page_id, size_t page_size,
                          page_id_t prev_page_id, LogManager *log_manager,
                          Transaction *txn) {
         memcpy(GetData(), &page_id, 4); // set page_id
-        if (ENABLE_LOGGING) {
+        if (logged(txn)) {
             assert(page_id != INVALID_PAGE_ID);
             LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::NEWPAGE, prev_page_id, page_id};
-            lsn_t lsn = log_manager->AppendLogRecord(log);
-            txn->SetPrevLSN(lsn);
-            SetLSN(lsn);
+            log_manager->StageLogRecord(txn, log, this);
         }
         SetPrevPageId(prev_page_id);
         SetNextPageId(INVALID_PAGE_ID);
@@ -69,7 +70,7 @@ namespace cmudb {
         for (i = 0; i < GetTupleCount(); ++i) {
             rid.Set(GetPageId(), i);
             if (GetTupleSize(i) == 0) { // empty slot
-                if (ENABLE_LOGGING) {
+                if (logged(txn)) {
                     assert(txn->GetSharedLockSet()->find(rid) ==
                            txn->GetSharedLockSet()->end() &&
                            txn->GetExclusiveLockSet()->find(rid) ==
@@ -94,19 +95,24 @@ namespace cmudb {
             SetTupleCount(GetTupleCount() + 1);
         }
         // write the log after set rid
-        if (ENABLE_LOGGING) {
+        if (logged(txn)) {
             // acquire the exclusive lock
             assert(lock_manager->LockExclusive(txn, rid.Get()));
             LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::INSERT,
                           rid, tuple};
-            lsn_t lsn = log_manager->AppendLogRecord(log);
-            txn->SetPrevLSN(lsn);
-            SetLSN(lsn);
+            log_manager->StageLogRecord(txn, log, this);
         }
         // LOG_DEBUG("Tuple inserted");
         return true;
     }
 
+    bool TablePage::HasSpaceFor(const Tuple &tuple) {
+        if (GetFreeSpaceSize() < tuple.size_) return false;
+        for (int i = 0; i < GetTupleCount(); ++i)
+            if (GetTupleSize(i) == 0) return true;
+        return GetFreeSpaceSize() >= tuple.size_ + 8;
+    }
+
 /*
  * MarkDelete method does not truly delete a tuple from table page
  * Instead it set the tuple as 'deleted' by changing the tuple size metadata to
@@ -117,7 +123,7 @@ namespace cmudb {
                                LockManager *lock_manager, LogManager *log_manager) {
         int slot_num = rid.GetSlotNum();
         if (slot_num >= GetTupleCount()) {
-            if (ENABLE_LOGGING) {
+            if (logged(txn)) {
                 txn->SetState(TransactionState::ABORTED);
             }
             return false;
@@ -125,13 +131,13 @@ namespace cmudb {
 
         int32_t tuple_size = GetTupleSize(slot_num);
         if (tuple_size < 0) {
-            if (ENABLE_LOGGING) {
+            if (logged(txn)) {
                 txn->SetState(TransactionState::ABORTED);
             }
             return false;
         }
 
-        if (ENABLE_LOGGING) {
+        if (logged(txn)) {
             // acquire exclusive lock
             // if has shared lock
             if (txn->GetSharedLockSet()->find(rid) != txn->GetSharedLockSet()->end()) {
@@ -144,9 +150,7 @@ namespace cmudb {
             }
             LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::MARKDELETE,
                           rid, Tuple{}};
-            lsn_t lsn = log_manager->AppendLogRecord(log);
-            txn->SetPrevLSN(lsn);
-            SetLSN(lsn);
+            log_manager->StageLogRecord(txn, log, this);
         }
 
         // set tuple size to negative value
@@ -161,14 +165,14 @@ namespace cmudb {
                                 LogManager *log_manager) {
         int slot_num = rid.GetSlotNum();
         if (slot_num >= GetTupleCount()) {
-            if (ENABLE_LOGGING) {
+            if (logged(txn)) {
                 txn->SetState(TransactionState::ABORTED);
             }
             return false;
         }
         int32_t tuple_size = GetTupleSize(slot_num); // old tuple size
         if (tuple_size <= 0) {
-            if (ENABLE_LOGGING) {
+            if (logged(txn)) {
                 txn->SetState(TransactionState::ABORTED);
             }
             return false;
@@ -189,7 +193,7 @@ namespace cmudb {
         old_tuple.rid_ = rid;
         old_tuple.allocated_ = true;
 
-        if (ENABLE_LOGGING) {
+        if (logged(txn)) {
             // acquire exclusive lock
             // if has shared lock
             if (txn->GetSharedLockSet()->find(rid) != txn->GetSharedLockSet()->end()) {
@@ -202,9 +206,7 @@ namespace cmudb {
             }
             LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::UPDATE,
                           rid, old_tuple, new_tuple};
-            lsn_t lsn = log_manager->AppendLogRecord(log);
-            txn->SetPrevLSN(lsn);
-            SetLSN(lsn);
+            log_manager->StageLogRecord(txn, log, this);
         }
 
         // update
@@ -252,15 +254,14 @@ namespace cmudb {
         delete_tuple.rid_ = rid;
         delete_tuple.allocated_ = true;
 
-        if (ENABLE_LOGGING) {
-            // must already grab the exclusive lock
+        if (logged(txn)) {
+            // must already grab the exclusive lock, or hold it on the page/table
             assert(txn->GetExclusiveLockSet()->find(rid) !=
-                   txn->GetExclusiveLockSet()->end());
+                   txn->GetExclusiveLockSet()->end() ||
+                   LockManager::RowLockCovered(txn, rid, LockMode::EXCLUSIVE));
             LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::APPLYDELETE,
                           rid, delete_tuple};
-            lsn_t lsn = log_manager->AppendLogRecord(log);
-            txn->SetPrevLSN(lsn);
-            SetLSN(lsn);
+            log_manager->StageLogRecord(txn, log, this);
         }
 
         int32_t free_space_pointer =
@@ -287,16 +288,15 @@ namespace cmudb {
  */
     void TablePage::RollbackDelete(const RID &rid, Transaction *txn,
                                    LogManager *log_manager) {
-        if (ENABLE_LOGGING) {
-            // must have already grab the exclusive lock
+        if (logged(txn)) {
+            // must have already grab the exclusive lock, or hold it on the page/table
             assert(txn->GetExclusiveLockSet()->find(rid) !=
-                   txn->GetExclusiveLockSet()->end());
+                   txn->GetExclusiveLockSet()->end() ||
+                   LockManager::RowLockCovered(txn, rid, LockMode::EXCLUSIVE));
 
             LogRecord log{txn->GetTransactionId(), txn->GetPrevLSN(), LogRecordType::ROLLBACKDELETE,
                           rid, Tuple{}};
-            lsn_t lsn = log_manager->AppendLogRecord(log);
-            txn->SetPrevLSN(lsn);
-            SetLSN(lsn);
+            log_manager->StageLogRecord(txn, log, this);
         }
 
         int slot_num = rid.GetSlotNum();
@@ -333,6 +333,17 @@ namespace cmudb {
             }
         }
 
+        return ReadTuple(rid, tuple);
+    }
+
+    bool TablePage::ReadTuple(const RID &rid, Tuple &tuple) {
+        int slot_num = rid.GetSlotNum();
+        if (slot_num >= GetTupleCount())
+            return false;
+        int32_t tuple_size = GetTupleSize(slot_num);
+        if (tuple_size <= 0)
+            return false;
+
         int32_t tuple_offset = GetTupleOffset(slot_num);
         tuple.size_ = tuple_size;
         if (tuple.allocated_)
@@ -347,9 +358,9 @@ namespace cmudb {
 /**
  * Tuple iterator
  */
-    bool TablePage::GetFirstTupleRid(RID &first_rid) {
+    bool TablePage::GetFirstTupleRid(RID &first_rid, bool include_deleted) {
         for (int i = 0; i < GetTupleCount(); ++i) {
-            if (GetTupleSize(i) > 0) { // valid tuple
+            if (include_deleted || GetTupleSize(i) > 0) { // valid tuple
                 first_rid.Set(GetPageId(), i);
                 return true;
             }
@@ -359,10 +370,11 @@ namespace cmudb {
         return false;
     }
 
-    bool TablePage::GetNextTupleRid(const RID &cur_rid, RID &next_rid) {
+    bool TablePage::GetNextTupleRid(const RID &cur_rid, RID &next_rid,
+                                    bool include_deleted) {
         assert(cur_rid.GetPageId() == GetPageId());
         for (auto i = cur_rid.GetSlotNum() + 1; i < GetTupleCount(); ++i) {
-            if (GetTupleSize(i) > 0) { // valid tuple
+            if (include_deleted || GetTupleSize(i) > 0) { // valid tuple
                 next_rid.Set(GetPageId(), i);
                 return true;
             }
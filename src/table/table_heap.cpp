@@ -12,16 +12,17 @@ namespace cmudb {
 // open table
 TableHeap::TableHeap(BufferPoolManager *buffer_pool_manager,
                      LockManager *lock_manager, LogManager *log_manager,
-                     page_id_t first_page_id)
+                     page_id_t first_page_id, VersionStore *version_store)
     : buffer_pool_manager_(buffer_pool_manager), lock_manager_(lock_manager),
-      log_manager_(log_manager), first_page_id_(first_page_id) {}
+      log_manager_(log_manager), first_page_id_(first_page_id),
+      version_store_(version_store) {}
 
 // create table
 TableHeap::TableHeap(BufferPoolManager *buffer_pool_manager,
                      LockManager *lock_manager, LogManager *log_manager,
-                     Transaction *txn)
+                     Transaction *txn, VersionStore *version_store)
     : buffer_pool_manager_(buffer_pool_manager), lock_manager_(lock_manager),
-      log_manager_(log_manager) {
+      log_manager_(log_manager), version_store_(version_store) {
   auto first_page =
       static_cast<TablePage *>(buffer_pool_manager_->NewPage(first_page_id_));
   assert(first_page != nullptr); // todo: abort table creation?
@@ -46,14 +47,33 @@ bool TableHeap::InsertTuple(const Tuple &tuple, RID &rid, Transaction *txn) {
     return false;
   }
 
+  // walk the full pages under latches only, the page lock is taken on the
+  // page the tuple goes to
   cur_page->WLatch();
-  while (!cur_page->InsertTuple(
-      tuple, rid, txn, lock_manager_,
-      log_manager_)) { // fail to insert due to not enough space
+  while (true) {
+    page_id_t page_id = cur_page->GetPageId();
+    if (cur_page->HasSpaceFor(tuple)) {
+      if (HoldsPage(page_id, LockMode::INTENTION_EXCLUSIVE, txn)) {
+        bool inserted =
+            cur_page->InsertTuple(tuple, rid, txn, lock_manager_, log_manager_);
+        assert(inserted);
+        (void)inserted;
+        break;
+      }
+      // the lock may have to wait: not under the latch. Someone may fill the
+      // page meanwhile, so look again
+      cur_page->WUnlatch();
+      if (!LockPage(page_id, LockMode::INTENTION_EXCLUSIVE, txn)) {
+        buffer_pool_manager_->UnpinPage(page_id, false);
+        return false;
+      }
+      cur_page->WLatch();
+      continue;
+    }
     auto next_page_id = cur_page->GetNextPageId();
     if (next_page_id != INVALID_PAGE_ID) { // valid next page
       cur_page->WUnlatch();
-      buffer_pool_manager_->UnpinPage(cur_page->GetPageId(), false);
+      buffer_pool_manager_->UnpinPage(page_id, false);
       cur_page = static_cast<TablePage *>(
           buffer_pool_manager_->FetchPage(next_page_id));
       cur_page->WLatch();
@@ -62,21 +82,30 @@ bool TableHeap::InsertTuple(const Tuple &tuple, RID &rid, Transaction *txn) {
           static_cast<TablePage *>(buffer_pool_manager_->NewPage(next_page_id));
       if (new_page == nullptr) {
         cur_page->WUnlatch();
-        buffer_pool_manager_->UnpinPage(cur_page->GetPageId(), false);
+        buffer_pool_manager_->UnpinPage(page_id, false);
         txn->SetState(TransactionState::ABORTED);
         return false;
       }
+      // nobody else can see the new page yet, so this never blocks
+      if (!LockPage(next_page_id, LockMode::INTENTION_EXCLUSIVE, txn)) {
+        cur_page->WUnlatch();
+        buffer_pool_manager_->UnpinPage(page_id, false);
+        buffer_pool_manager_->UnpinPage(next_page_id, false);
+        buffer_pool_manager_->DeletePage(next_page_id);
+        return false;
+      }
       new_page->WLatch();
       // std::cout << "new table page " << next_page_id << " created" <<
       // std::endl;
       cur_page->SetNextPageId(next_page_id);
-      new_page->Init(next_page_id, PAGE_SIZE, cur_page->GetPageId(),
-                     log_manager_, txn);
+      new_page->Init(next_page_id, PAGE_SIZE, page_id, log_manager_, txn);
       cur_page->WUnlatch();
-      buffer_pool_manager_->UnpinPage(cur_page->GetPageId(), true);
+      buffer_pool_manager_->UnpinPage(page_id, true);
       cur_page = new_page;
     }
   }
+  if (version_store_ != nullptr)
+    version_store_->RecordWrite(txn, rid, nullptr);
   cur_page->WUnlatch();
   buffer_pool_manager_->UnpinPage(cur_page->GetPageId(), true);
   txn->GetWriteSet()->emplace_back(rid, WType::INSERT, Tuple{}, this);
@@ -84,7 +113,18 @@ bool TableHeap::InsertTuple(const Tuple &tuple, RID &rid, Transaction *txn) {
 }
 
 bool TableHeap::MarkDelete(const RID &rid, Transaction *txn) {
+  if (IsBuffered(txn)) {
+    txn->GetWriteSet()->emplace_back(rid, WType::DELETE, Tuple{}, this);
+    return true;
+  }
+  return MarkDeleteInPlace(rid, txn);
+}
+
+bool TableHeap::MarkDeleteInPlace(const RID &rid, Transaction *txn) {
   // todo: remove empty page
+  if (!LockPage(rid.GetPageId(), LockMode::INTENTION_EXCLUSIVE, txn) ||
+      !LockForWrite(rid, txn))
+    return false;
   auto page = reinterpret_cast<TablePage *>(
       buffer_pool_manager_->FetchPage(rid.GetPageId()));
   if (page == nullptr) {
@@ -92,7 +132,17 @@ bool TableHeap::MarkDelete(const RID &rid, Transaction *txn) {
     return false;
   }
   page->WLatch();
-  page->MarkDelete(rid, txn, lock_manager_, log_manager_);
+  // older snapshots still see the deleted image
+  Tuple old_tuple;
+  bool versioned = version_store_ != nullptr && page->ReadTuple(rid, old_tuple);
+  if (versioned && !version_store_->CheckWrite(txn, rid)) {
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+    txn->SetState(TransactionState::ABORTED);
+    return false;
+  }
+  if (page->MarkDelete(rid, txn, lock_manager_, log_manager_) && versioned)
+    version_store_->RecordWrite(txn, rid, &old_tuple);
   page->WUnlatch();
   buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
   txn->GetWriteSet()->emplace_back(rid, WType::DELETE, Tuple{}, this);
@@ -101,6 +151,19 @@ bool TableHeap::MarkDelete(const RID &rid, Transaction *txn) {
 
 bool TableHeap::UpdateTuple(const Tuple &tuple, const RID &rid,
                             Transaction *txn) {
+  // the buffered record keeps the new tuple until commit
+  if (IsBuffered(txn)) {
+    txn->GetWriteSet()->emplace_back(rid, WType::UPDATE, tuple, this);
+    return true;
+  }
+  return UpdateInPlace(tuple, rid, txn);
+}
+
+bool TableHeap::UpdateInPlace(const Tuple &tuple, const RID &rid,
+                              Transaction *txn) {
+  if (!LockPage(rid.GetPageId(), LockMode::INTENTION_EXCLUSIVE, txn) ||
+      !LockForWrite(rid, txn))
+    return false;
   auto page = reinterpret_cast<TablePage *>(
       buffer_pool_manager_->FetchPage(rid.GetPageId()));
   if (page == nullptr) {
@@ -109,8 +172,20 @@ bool TableHeap::UpdateTuple(const Tuple &tuple, const RID &rid,
   }
   Tuple old_tuple;
   page->WLatch();
+  // rolling back restores the old version, the version store is fixed up by
+  // the transaction manager afterwards
+  bool versioned = version_store_ != nullptr &&
+                   txn->GetState() != TransactionState::ABORTED;
+  if (versioned && !version_store_->CheckWrite(txn, rid)) {
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+    txn->SetState(TransactionState::ABORTED);
+    return false;
+  }
   bool is_updated = page->UpdateTuple(tuple, old_tuple, rid, txn, lock_manager_,
                                       log_manager_);
+  if (is_updated && versioned)
+    version_store_->RecordWrite(txn, rid, &old_tuple);
   page->WUnlatch();
   buffer_pool_manager_->UnpinPage(page->GetPageId(), is_updated);
   if (is_updated && txn->GetState() != TransactionState::ABORTED)
@@ -118,6 +193,19 @@ bool TableHeap::UpdateTuple(const Tuple &tuple, const RID &rid,
   return is_updated;
 }
 
+bool TableHeap::LockBufferedWrite(const RID &rid, Transaction *txn) {
+  return LockPage(rid.GetPageId(), LockMode::INTENTION_EXCLUSIVE, txn) &&
+         LockForWrite(rid, txn);
+}
+
+// appends the usual write record (with the old tuple) for rollback
+bool TableHeap::ApplyBufferedWrite(const WriteRecord &record,
+                                   Transaction *txn) {
+  if (record.wtype_ == WType::DELETE)
+    return MarkDeleteInPlace(record.rid_, txn);
+  return UpdateInPlace(record.tuple_, record.rid_, txn);
+}
+
 void TableHeap::ApplyDelete(const RID &rid, Transaction *txn) {
   auto page = reinterpret_cast<TablePage *>(
       buffer_pool_manager_->FetchPage(rid.GetPageId()));
@@ -141,6 +229,10 @@ void TableHeap::RollbackDelete(const RID &rid, Transaction *txn) {
 
 // called by tuple iterator
 bool TableHeap::GetTuple(const RID &rid, Tuple &tuple, Transaction *txn) {
+  // snapshot reads take no locks at all
+  bool snapshot = IsSnapshot(txn);
+  if (!snapshot && !LockPage(rid.GetPageId(), LockMode::INTENTION_SHARED, txn))
+    return false;
   auto page = static_cast<TablePage *>(
       buffer_pool_manager_->FetchPage(rid.GetPageId()));
   if (page == nullptr) {
@@ -148,12 +240,65 @@ bool TableHeap::GetTuple(const RID &rid, Tuple &tuple, Transaction *txn) {
     return false;
   }
   page->RLatch();
-  bool res = page->GetTuple(rid, tuple, txn, lock_manager_);
+  bool res = snapshot ? ReadSnapshot(page, rid, tuple, txn)
+                      : page->GetTuple(rid, tuple, txn, lock_manager_);
   page->RUnlatch();
   buffer_pool_manager_->UnpinPage(rid.GetPageId(), false);
   return res;
 }
 
+bool TableHeap::LockPage(page_id_t page_id, LockMode mode, Transaction *txn) {
+  if (!ENABLE_LOGGING)
+    return true;
+  return lock_manager_->LockPage(txn, first_page_id_, page_id, mode);
+}
+
+bool TableHeap::HoldsPage(page_id_t page_id, LockMode mode, Transaction *txn) {
+  if (!ENABLE_LOGGING)
+    return true;
+  auto pages = txn->GetPageLockSet();
+  auto held = pages->find(page_id);
+  return held != pages->end() &&
+         LockManager::supremum(held->second.second, mode) == held->second.second;
+}
+
+// snapshot transactions never hold shared tuple locks, so no upgrade here
+bool TableHeap::LockForWrite(const RID &rid, Transaction *txn) {
+  if (!ENABLE_LOGGING || txn->GetMode() == ConcurrencyMode::TWO_PHASE_LOCKING ||
+      txn->GetExclusiveLockSet()->count(rid) != 0)
+    return true;
+  return lock_manager_->LockExclusive(txn, rid);
+}
+
+bool TableHeap::ReadSnapshot(TablePage *page, const RID &rid, Tuple &tuple,
+                             Transaction *txn) {
+  if (txn->GetMode() == ConcurrencyMode::OPTIMISTIC) {
+    txn->GetReadSet()->insert(rid);
+    // read your own buffered writes, the newest one wins
+    auto write_set = txn->GetWriteSet();
+    for (auto it = write_set->rbegin(); it != write_set->rend(); ++it) {
+      if (it->table_ != this || !(it->rid_ == rid) ||
+          it->wtype_ == WType::INSERT)
+        continue;
+      if (it->wtype_ == WType::DELETE)
+        return false;
+      // rid may be tuple.rid_ itself (iterator)
+      RID read_rid = rid;
+      tuple = it->tuple_;
+      tuple.rid_ = read_rid;
+      return true;
+    }
+  }
+  switch (version_store_->Read(txn, rid, &tuple)) {
+  case VersionStore::Visibility::IN_PLACE:
+    return page->ReadTuple(rid, tuple);
+  case VersionStore::Visibility::UNDO:
+    return true;
+  default:
+    return false;
+  }
+}
+
 bool TableHeap::DeleteTableHeap() {
   // todo: real delete
   return true;
@@ -166,7 +311,7 @@ TableIterator TableHeap::begin(Transaction *txn) {
   RID rid;
   // if failed (no tuple), rid will be the result of default
   // constructor, which means eof
-  page->GetFirstTupleRid(rid);
+  page->GetFirstTupleRid(rid, IsSnapshot(txn));
   page->RUnlatch();
   buffer_pool_manager_->UnpinPage(first_page_id_, false);
   return TableIterator(this, rid, txn);
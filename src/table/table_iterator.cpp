@@ -10,8 +10,11 @@ namespace cmudb {
 
 TableIterator::TableIterator(TableHeap *table_heap, RID rid, Transaction *txn)
     : table_heap_(table_heap), tuple_(new Tuple(rid)), txn_(txn) {
-  if (rid.GetPageId() != INVALID_PAGE_ID) {
-    table_heap_->GetTuple(tuple_->rid_, *tuple_, txn_);
+  if (rid.GetPageId() != INVALID_PAGE_ID &&
+      !table_heap_->GetTuple(tuple_->rid_, *tuple_, txn_) &&
+      table_heap_->IsSnapshot(txn_)) {
+    // not visible in the snapshot, move on to the first visible one
+    ++(*this);
   }
 };
 
@@ -32,23 +35,30 @@ TableIterator &TableIterator::operator++() {
   cur_page->RLatch();
   assert(cur_page != nullptr); // all pages are pinned
 
-  RID next_tuple_rid;
-  if (!cur_page->GetNextTupleRid(tuple_->rid_,
-                                 next_tuple_rid)) { // end of this page
-    while (cur_page->GetNextPageId() != INVALID_PAGE_ID) {
-      auto next_page = static_cast<TablePage *>(
-          buffer_pool_manager->FetchPage(cur_page->GetNextPageId()));
-      cur_page->RUnlatch();
-      buffer_pool_manager->UnpinPage(cur_page->GetPageId(), false);
-      cur_page = next_page;
-      cur_page->RLatch();
-      if (cur_page->GetFirstTupleRid(next_tuple_rid))
-        break;
+  // a snapshot scan also visits deleted slots and skips what it cannot see
+  bool snapshot = table_heap_->IsSnapshot(txn_);
+  bool visible;
+  do {
+    RID next_tuple_rid;
+    if (!cur_page->GetNextTupleRid(tuple_->rid_, next_tuple_rid,
+                                   snapshot)) { // end of this page
+      while (cur_page->GetNextPageId() != INVALID_PAGE_ID) {
+        auto next_page = static_cast<TablePage *>(
+            buffer_pool_manager->FetchPage(cur_page->GetNextPageId()));
+        cur_page->RUnlatch();
+        buffer_pool_manager->UnpinPage(cur_page->GetPageId(), false);
+        cur_page = next_page;
+        cur_page->RLatch();
+        if (cur_page->GetFirstTupleRid(next_tuple_rid, snapshot))
+          break;
+      }
     }
-  }
-  tuple_->rid_ = next_tuple_rid;
+    tuple_->rid_ = next_tuple_rid;
+    visible = !snapshot || *this == table_heap_->end() ||
+              table_heap_->ReadSnapshot(cur_page, tuple_->rid_, *tuple_, txn_);
+  } while (!visible);
 
-  if (*this != table_heap_->end()) {
+  if (!snapshot && *this != table_heap_->end()) {
     table_heap_->GetTuple(tuple_->rid_, *tuple_, txn_);
   }
   // release until copy the tuple
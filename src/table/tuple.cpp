@@ -53,6 +53,10 @@ Tuple::Tuple(const Tuple &other)
 }
 
 Tuple &Tuple::operator=(const Tuple &other) {
+  if (this == &other)
+    return *this;
+  if (allocated_)
+    delete[] data_;
   allocated_ = other.allocated_;
   rid_ = other.rid_;
   size_ = other.size_;
@@ -79,6 +83,13 @@ Value Tuple::GetValue(Schema *schema, const int column_id) const {
   return Value::DeserializeFrom(data_ptr, column_type);
 }
 
+Value Tuple::GetValueView(Schema *schema, const int column_id) const {
+  assert(schema);
+  assert(data_);
+  return Value::DeserializeView(GetDataPtr(schema, column_id),
+                                schema->GetType(column_id));
+}
+
 const char *Tuple::GetDataPtr(Schema *schema, const int column_id) const {
   assert(schema);
   assert(data_);
@@ -110,7 +121,7 @@ std::string Tuple::ToString(Schema *schema) const {
     if (IsNull(schema, column_itr)) {
       os << "<NULL>";
     } else {
-      Value val = (GetValue(schema, column_itr));
+      Value val = (GetValueView(schema, column_itr));
       os << val.ToString();
     }
   }
@@ -129,13 +140,17 @@ void Tuple::SerializeTo(char *storage) const {
 
 //反序列化则是相反的操作，将对象从序列化数据中还原出来。
 void Tuple::DeserializeFrom(const char *storage) {
-  uint32_t size = *reinterpret_cast<const int32_t *>(storage);
+  DeserializeFrom(storage + sizeof(int32_t),
+                  *reinterpret_cast<const int32_t *>(storage));
+}
+
+void Tuple::DeserializeFrom(const char *data, int32_t size) {
   // construct a tuple
   this->size_ = size;
   if (this->allocated_)
     delete[] this->data_;
   this->data_ = new char[this->size_];
-  memcpy(this->data_, storage + sizeof(int32_t), this->size_);
+  memcpy(this->data_, data, this->size_);
   this->allocated_ = true;
 }
 
@@ -0,0 +1,206 @@
+/**
+ * type_kernel.cpp
+ */
+#include <cstring>
+#include <type_traits>
+
+#include "common/exception.h"
+#include "type/limits.h"
+#include "type/type_kernel.h"
+#include "type/type_util.h"
+
+namespace cmudb {
+namespace {
+// C type of a column, its NULL and the TypeId an arithmetic result gets
+template <class T> struct RawTraits;
+template <> struct RawTraits<int8_t> {
+  static int8_t Null() { return PELOTON_INT8_NULL; }
+  static const TypeId TYPE = TypeId::TINYINT;
+};
+template <> struct RawTraits<int16_t> {
+  static int16_t Null() { return PELOTON_INT16_NULL; }
+  static const TypeId TYPE = TypeId::SMALLINT;
+};
+template <> struct RawTraits<int32_t> {
+  static int32_t Null() { return PELOTON_INT32_NULL; }
+  static const TypeId TYPE = TypeId::INTEGER;
+};
+template <> struct RawTraits<int64_t> {
+  static int64_t Null() { return PELOTON_INT64_NULL; }
+  static const TypeId TYPE = TypeId::BIGINT;
+};
+template <> struct RawTraits<double> {
+  static double Null() { return PELOTON_DECIMAL_NULL; }
+  static const TypeId TYPE = TypeId::DECIMAL;
+};
+
+template <class T> inline T Load(const char *data) {
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+// Same as the Value operations: DECIMAL if either side is, otherwise the
+// wider integer, the left one if they are the same size
+template <class L, class R> struct ResultOf {
+  typedef typename std::conditional<
+      std::is_same<L, double>::value || std::is_same<R, double>::value, double,
+      typename std::conditional<(sizeof(L) >= sizeof(R)), L, R>::type>::type
+      type;
+};
+
+template <class L, class R>
+int CompareRaw(const char *left, const char *right) {
+  L x = Load<L>(left);
+  R y = Load<R>(right);
+  if (x == RawTraits<L>::Null() || y == RawTraits<R>::Null())
+    return TypeKernel::ORDER_NULL;
+  return x < y ? -1 : (y < x ? 1 : 0);
+}
+
+// a VARCHAR is its length (counting the trailing '\0') and then its bytes
+int CompareVarlen(const char *left, const char *right) {
+  uint32_t len1 = Load<uint32_t>(left);
+  uint32_t len2 = Load<uint32_t>(right);
+  if (len1 == PELOTON_VALUE_NULL || len2 == PELOTON_VALUE_NULL)
+    return TypeKernel::ORDER_NULL;
+  int cmp = TypeUtil::CompareStrings(left + sizeof(uint32_t), len1 - 1,
+                                     right + sizeof(uint32_t), len2 - 1);
+  return cmp < 0 ? -1 : (cmp > 0 ? 1 : 0);
+}
+
+inline void OutOfRange() {
+  throw Exception(EXCEPTION_TYPE_OUT_OF_RANGE, "Numeric value out of range.");
+}
+
+inline void DivideByZero() {
+  throw Exception(EXCEPTION_TYPE_DIVIDE_BY_ZERO,
+                  "Division by zero on right-hand side");
+}
+
+// integer results are checked for overflow, DECIMAL ones are not
+template <class T> T Apply(TypeKernel::ArithmeticOp op, T x, T y) {
+  T result = 0;
+  switch (op) {
+  case TypeKernel::ADD:
+    if (__builtin_add_overflow(x, y, &result))
+      OutOfRange();
+    break;
+  case TypeKernel::SUBTRACT:
+    if (__builtin_sub_overflow(x, y, &result))
+      OutOfRange();
+    break;
+  case TypeKernel::MULTIPLY:
+    if (__builtin_mul_overflow(x, y, &result))
+      OutOfRange();
+    break;
+  case TypeKernel::DIVIDE:
+    if (y == 0)
+      DivideByZero();
+    result = static_cast<T>(x / y);
+    break;
+  }
+  return result;
+}
+
+double Apply(TypeKernel::ArithmeticOp op, double x, double y) {
+  switch (op) {
+  case TypeKernel::ADD:
+    return x + y;
+  case TypeKernel::SUBTRACT:
+    return x - y;
+  case TypeKernel::MULTIPLY:
+    return x * y;
+  default:
+    if (y == 0)
+      DivideByZero();
+    return x / y;
+  }
+}
+
+// op是模板参数，每个组合编译出一个版本；两边都能放进结果类型，先转换再算
+template <class L, class R, TypeKernel::ArithmeticOp OP>
+void ArithmeticRaw(const char *left, const char *right, char *result) {
+  typedef typename ResultOf<L, R>::type T;
+  L x = Load<L>(left);
+  R y = Load<R>(right);
+  T value;
+  if (x == RawTraits<L>::Null() || y == RawTraits<R>::Null())
+    value = RawTraits<T>::Null();
+  else
+    value = Apply(OP, static_cast<T>(x), static_cast<T>(y));
+  memcpy(result, &value, sizeof(T));
+}
+
+template <class L, class R>
+TypeKernel::ArithmeticFunc ArithmeticFor(TypeKernel::ArithmeticOp op,
+                                         TypeId *result_type) {
+  *result_type = RawTraits<typename ResultOf<L, R>::type>::TYPE;
+  switch (op) {
+  case TypeKernel::ADD:
+    return &ArithmeticRaw<L, R, TypeKernel::ADD>;
+  case TypeKernel::SUBTRACT:
+    return &ArithmeticRaw<L, R, TypeKernel::SUBTRACT>;
+  case TypeKernel::MULTIPLY:
+    return &ArithmeticRaw<L, R, TypeKernel::MULTIPLY>;
+  default:
+    return &ArithmeticRaw<L, R, TypeKernel::DIVIDE>;
+  }
+}
+
+// 在每个分支里把T定义成类型对应的C类型
+#define KERNEL_NUMERIC_SWITCH(TYPE, ...)                                       \
+  switch (TYPE) {                                                              \
+  case TypeId::TINYINT: {                                                      \
+    typedef int8_t T;                                                          \
+    __VA_ARGS__;                                                               \
+  }                                                                            \
+  case TypeId::SMALLINT: {                                                     \
+    typedef int16_t T;                                                         \
+    __VA_ARGS__;                                                               \
+  }                                                                            \
+  case TypeId::INTEGER: {                                                      \
+    typedef int32_t T;                                                         \
+    __VA_ARGS__;                                                               \
+  }                                                                            \
+  case TypeId::BIGINT: {                                                       \
+    typedef int64_t T;                                                         \
+    __VA_ARGS__;                                                               \
+  }                                                                            \
+  case TypeId::DECIMAL: {                                                      \
+    typedef double T;                                                          \
+    __VA_ARGS__;                                                               \
+  }                                                                            \
+  default:                                                                     \
+    return nullptr;                                                            \
+  } // SWITCH
+
+template <class L> TypeKernel::CompareFunc CompareLeft(TypeId right) {
+  KERNEL_NUMERIC_SWITCH(right, return &CompareRaw<L, T>);
+}
+
+template <class L>
+TypeKernel::ArithmeticFunc ArithmeticLeft(TypeKernel::ArithmeticOp op,
+                                          TypeId right, TypeId *result_type) {
+  KERNEL_NUMERIC_SWITCH(right, return ArithmeticFor<L, T>(op, result_type));
+}
+} // namespace
+
+const int TypeKernel::ORDER_NULL;
+
+TypeKernel::CompareFunc TypeKernel::GetCompare(TypeId left, TypeId right) {
+  if (left == TypeId::VARCHAR || right == TypeId::VARCHAR)
+    return left == right ? &CompareVarlen : nullptr;
+  // BOOLEAN和TINYINT一样是int8_t，NULL也一样
+  if (left == TypeId::BOOLEAN || right == TypeId::BOOLEAN)
+    return left == right ? &CompareRaw<int8_t, int8_t> : nullptr;
+  KERNEL_NUMERIC_SWITCH(left, return CompareLeft<T>(right));
+}
+
+TypeKernel::ArithmeticFunc TypeKernel::GetArithmetic(ArithmeticOp op,
+                                                     TypeId left, TypeId right,
+                                                     TypeId *result_type) {
+  KERNEL_NUMERIC_SWITCH(left,
+                        return ArithmeticLeft<T>(op, right, result_type));
+}
+} // namespace cmudb
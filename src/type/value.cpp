@@ -17,7 +17,7 @@ Value::Value(const Value &other) {
     if (size_.len == PELOTON_VALUE_NULL) {
       value_.varlen = nullptr;
     } else {
-      if (manage_data_) {
+      if (manage_data_ && !IsVarlenInlined()) {
         value_.varlen = new char[size_.len];
         memcpy(value_.varlen, other.value_.varlen, size_.len);
       } else {
@@ -238,10 +238,8 @@ Value::Value(TypeId type, const char *data, uint32_t len, bool manage_data)
       manage_data_ = manage_data;
       if (manage_data_) {
         assert(len < PELOTON_VARCHAR_MAX_LEN);
-        value_.varlen = new char[len];
-        assert(value_.varlen != nullptr);
         size_.len = len;
-        memcpy(value_.varlen, data, len);
+        memcpy(AllocateVarlen(len), data, len);
       } else {
         // FUCK YOU GCC I do what I want.
         value_.const_varlen = data;
@@ -261,10 +259,8 @@ Value::Value(TypeId type, const std::string &data) : Value(type) {
     manage_data_ = true;
     // TODO: How to represent a null string here?
     uint32_t len = data.length() + 1;
-    value_.varlen = new char[len];
-    assert(value_.varlen != nullptr);
     size_.len = len;
-    memcpy(value_.varlen, data.c_str(), len);
+    memcpy(AllocateVarlen(len), data.c_str(), len);
     break;
   }
   default:
@@ -277,7 +273,7 @@ Value::Value(TypeId type, const std::string &data) : Value(type) {
 Value::~Value() {
   switch (type_id_) {
   case TypeId::VARCHAR:
-    if (manage_data_) {
+    if (manage_data_ && !IsVarlenInlined()) {
       delete[] value_.varlen;
     }
     break;
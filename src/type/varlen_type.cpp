@@ -30,7 +30,7 @@ VarlenType::~VarlenType() {}
 
 // Access the raw variable length data
 const char *VarlenType::GetData(const Value &val) const {
-  return val.value_.varlen;
+  return val.GetVarlen();
 }
 
 // Get the length of the variable length data (including the length field)
@@ -151,7 +151,7 @@ void VarlenType::SerializeTo(const Value &val, char *storage) const {
     return;
   } else {
     memcpy(storage, &len, sizeof(uint32_t));
-    memcpy(storage + sizeof(uint32_t), val.value_.varlen, len);
+    memcpy(storage + sizeof(uint32_t), val.GetVarlen(), len);
   }
 }
 
@@ -165,7 +165,12 @@ Value VarlenType::DeserializeFrom(const char *storage) const {
   return Value(type_id_, storage + sizeof(uint32_t), len, true);
 }
 
-Value VarlenType::Copy(const Value &val) const { return Value(val); }
+// a view into page memory becomes a value that owns its bytes
+Value VarlenType::Copy(const Value &val) const {
+  if (val.manage_data_ || val.IsNull())
+    return Value(val);
+  return Value(type_id_, GetData(val), GetLength(val), true);
+}
 
 Value VarlenType::CastAs(const Value &value, const TypeId type_id) const {
   std::string str;
@@ -44,7 +44,8 @@ int VtabCreate(sqlite3 *db, void *pAux, int argc, const char *const *argv,
     // create index object, allocate memory space
     IndexMetadata *index_metadata =
         ParseIndexStatement(index_string, std::string(argv[2]), schema);
-    index = ConstructIndex(index_metadata, buffer_pool_manager);
+    index = ConstructIndex(index_metadata, buffer_pool_manager, INVALID_PAGE_ID,
+                           log_manager);
   }
   // create table object, allocate memory space
   VirtualTable *table = new VirtualTable(schema, buffer_pool_manager,
@@ -92,7 +93,8 @@ int VtabConnect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
     // Retrieve index root page info from header page
     page_id_t index_root_id;
     header_page->GetRootId(index_metadata->GetName(), index_root_id);
-    index = ConstructIndex(index_metadata, buffer_pool_manager, index_root_id);
+    index = ConstructIndex(index_metadata, buffer_pool_manager, index_root_id,
+                           log_manager);
   }
   VirtualTable *table =
       new VirtualTable(schema, buffer_pool_manager, lock_manager, log_manager,
@@ -362,6 +364,7 @@ __declspec(dllexport)
   storage_engine_ = new StorageEngine(db_file_name);
   // start the logging
   storage_engine_->log_manager_->RunFlushThread();
+  storage_engine_->checkpoint_manager_->RunCheckpointThread();
   // create header page from BufferPoolManager if necessary
   if (!is_file_exist) {
     page_id_t header_page_id;
@@ -507,7 +510,7 @@ Tuple ConstructTuple(Schema *schema, sqlite3_value **argv) {
 // serve the functionality of index factory
 Index *ConstructIndex(IndexMetadata *metadata,
                       BufferPoolManager *buffer_pool_manager,
-                      page_id_t root_id) {
+                      page_id_t root_id, LogManager *log_manager) {
   // The size of the key in bytes
   Schema *key_schema = metadata->GetKeySchema();
   int key_size = key_schema->GetLength();
@@ -516,19 +519,19 @@ Index *ConstructIndex(IndexMetadata *metadata,
 
   if (key_size <= 4) {
     return new BPlusTreeIndex<GenericKey<4>, RID, GenericComparator<4>>(
-        metadata, buffer_pool_manager, root_id);
+        metadata, buffer_pool_manager, root_id, log_manager);
   } else if (key_size <= 8) {
     return new BPlusTreeIndex<GenericKey<8>, RID, GenericComparator<8>>(
-        metadata, buffer_pool_manager, root_id);
+        metadata, buffer_pool_manager, root_id, log_manager);
   } else if (key_size <= 16) {
     return new BPlusTreeIndex<GenericKey<16>, RID, GenericComparator<16>>(
-        metadata, buffer_pool_manager, root_id);
+        metadata, buffer_pool_manager, root_id, log_manager);
   } else if (key_size <= 32) {
     return new BPlusTreeIndex<GenericKey<32>, RID, GenericComparator<32>>(
-        metadata, buffer_pool_manager, root_id);
+        metadata, buffer_pool_manager, root_id, log_manager);
   } else {
     return new BPlusTreeIndex<GenericKey<64>, RID, GenericComparator<64>>(
-        metadata, buffer_pool_manager, root_id);
+        metadata, buffer_pool_manager, root_id, log_manager);
   }
 }
 
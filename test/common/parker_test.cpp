@@ -0,0 +1,50 @@
+/**
+ * parker_test.cpp
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "common/parker.h"
+#include "gtest/gtest.h"
+
+namespace cmudb {
+
+TEST(ParkerTest, UnparkBeforePark) {
+  Parker parker;
+  parker.Unpark(3);
+  EXPECT_EQ(3, parker.Park());
+  parker.Reset();
+  parker.Unpark(1);
+  EXPECT_EQ(1, parker.Park());
+}
+
+// the waiter is long past spinning and asleep when it gets unparked
+TEST(ParkerTest, UnparkSleepingWaiter) {
+  Parker parker;
+  std::atomic<int> result{0};
+  std::thread waiter([&] { result = parker.Park(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(0, result);
+  parker.Unpark(2);
+  waiter.join();
+  EXPECT_EQ(2, result);
+}
+
+TEST(ParkerTest, PingPongTest) {
+  const int rounds = 1000;
+  std::vector<Parker> ping(rounds), pong(rounds);
+  std::thread t([&] {
+    for (int i = 0; i < rounds; i++) {
+      EXPECT_EQ(i + 1, ping[i].Park());
+      pong[i].Unpark(i + 1);
+    }
+  });
+  for (int i = 0; i < rounds; i++) {
+    ping[i].Unpark(i + 1);
+    EXPECT_EQ(i + 1, pong[i].Park());
+  }
+  t.join();
+}
+} // namespace cmudb
@@ -2,7 +2,10 @@
  * lock_manager_test.cpp
  */
 
+#include <atomic>
+#include <random>
 #include <thread>
+#include <vector>
 
 #include "concurrency/transaction_manager.h"
 #include "gtest/gtest.h"
@@ -1044,4 +1047,323 @@ TEST(LockManagerTest, LockUpgradeTest2)
 
 }
 
+/*
+ * Stress the sharded lock table: every thread runs short transactions that lock
+ * a handful of random rids. Each transaction either commits or dies under
+ * wait-die, and all of its locks must be gone afterwards. Throughput is printed
+ * for growing thread counts.
+ */
+TEST(LockManagerTest, ShardedStressTest) {
+  const int num_rids = 4096;
+  const int locks_per_txn = 8;
+  const int txns_per_thread = 500;
+
+  for (int num_threads : {1, 2, 4, 8}) {
+    LockManager lock_mgr{true};
+    TransactionManager txn_mgr{&lock_mgr};
+    std::atomic<int> committed{0}, aborted{0};
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.emplace_back([&, t] {
+        std::mt19937 gen(t);
+        std::uniform_int_distribution<int> dis(0, num_rids - 1);
+        for (int i = 0; i < txns_per_thread; i++) {
+          Transaction *txn = txn_mgr.Begin();
+          bool res = true;
+          for (int j = 0; res && j < locks_per_txn; j++) {
+            int r = dis(gen);
+            RID rid{r / 32, r % 32};
+            if (txn->GetSharedLockSet()->count(rid) ||
+                txn->GetExclusiveLockSet()->count(rid))
+              continue;
+            res = j % 4 == 0 ? lock_mgr.LockExclusive(txn, rid)
+                             : lock_mgr.LockShared(txn, rid);
+          }
+          if (res) {
+            txn_mgr.Commit(txn);
+            committed++;
+          } else {
+            EXPECT_EQ(TransactionState::ABORTED, txn->GetState());
+            txn_mgr.Abort(txn);
+            aborted++;
+          }
+          EXPECT_TRUE(txn->GetSharedLockSet()->empty());
+          EXPECT_TRUE(txn->GetExclusiveLockSet()->empty());
+          delete txn;
+        }
+      });
+    }
+    for (auto &thread : threads)
+      thread.join();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+    EXPECT_EQ(num_threads * txns_per_thread, committed + aborted);
+    LOG_INFO("%d threads: %d committed, %d aborted, %lld txns/s", num_threads,
+             committed.load(), aborted.load(),
+             (long long)(committed + aborted) * 1000 / (ms + 1));
+  }
+}
+
+// under DETECTION a younger transaction waits for an older holder instead of dying
+TEST(LockManagerTest, DetectionWaitTest) {
+  LockManager lock_mgr{true, DeadlockPolicy::DETECTION};
+  TransactionManager txn_mgr{&lock_mgr};
+  RID rid{0, 0};
+
+  Transaction txn0(0), txn1(1);
+  EXPECT_TRUE(lock_mgr.LockExclusive(&txn0, rid));
+  std::thread t1([&] {
+    EXPECT_TRUE(lock_mgr.LockExclusive(&txn1, rid));
+    EXPECT_EQ(TransactionState::GROWING, txn1.GetState());
+    txn_mgr.Commit(&txn1);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  txn_mgr.Commit(&txn0);
+  t1.join();
+  EXPECT_EQ(TransactionState::COMMITTED, txn1.GetState());
+}
+
+// a real deadlock is broken by aborting the youngest transaction in the cycle
+TEST(LockManagerTest, DetectionDeadlockTest) {
+  LockManager lock_mgr{true, DeadlockPolicy::DETECTION};
+  TransactionManager txn_mgr{&lock_mgr};
+  RID rid0{0, 0};
+  RID rid1{0, 1};
+
+  Transaction txn0(0), txn1(1);
+  EXPECT_TRUE(lock_mgr.LockExclusive(&txn0, rid0));
+  EXPECT_TRUE(lock_mgr.LockExclusive(&txn1, rid1));
+  std::thread t1([&] {
+    EXPECT_FALSE(lock_mgr.LockExclusive(&txn1, rid0));
+    EXPECT_EQ(TransactionState::ABORTED, txn1.GetState());
+    txn_mgr.Abort(&txn1);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_TRUE(lock_mgr.LockExclusive(&txn0, rid1));
+  EXPECT_EQ(TransactionState::GROWING, txn0.GetState());
+  t1.join();
+  txn_mgr.Commit(&txn0);
+  EXPECT_TRUE(txn0.GetExclusiveLockSet()->empty());
+  EXPECT_TRUE(txn1.GetExclusiveLockSet()->empty());
+}
+
+// IS/IX/S/SIX compatibility and lock conversion on a table
+TEST(LockManagerTest, IntentionLockTest) {
+  EXPECT_TRUE(LockManager::compatible(LockMode::INTENTION_SHARED,
+                                      LockMode::SHARED_INTENTION_EXCLUSIVE));
+  EXPECT_FALSE(LockManager::compatible(LockMode::INTENTION_EXCLUSIVE,
+                                       LockMode::SHARED));
+  EXPECT_EQ(LockMode::SHARED_INTENTION_EXCLUSIVE,
+            LockManager::supremum(LockMode::INTENTION_EXCLUSIVE,
+                                  LockMode::SHARED));
+
+  LockManager lock_mgr{true};
+  TransactionManager txn_mgr{&lock_mgr};
+  Transaction txn0(0), txn1(1), txn2(2);
+  EXPECT_TRUE(lock_mgr.LockTable(&txn0, 0, LockMode::INTENTION_SHARED));
+  EXPECT_TRUE(lock_mgr.LockTable(&txn1, 0, LockMode::INTENTION_EXCLUSIVE));
+  // younger txn dies on the older IX holder
+  EXPECT_FALSE(lock_mgr.LockTable(&txn2, 0, LockMode::SHARED));
+  EXPECT_EQ(TransactionState::ABORTED, txn2.GetState());
+  txn_mgr.Abort(&txn2);
+
+  // older txn waits for IS -> S until the IX holder commits
+  std::atomic<bool> converted{false};
+  std::thread t0([&] {
+    EXPECT_TRUE(lock_mgr.LockTable(&txn0, 0, LockMode::SHARED));
+    converted = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(converted);
+  txn_mgr.Commit(&txn1);
+  t0.join();
+  EXPECT_EQ(LockMode::SHARED, txn0.GetTableLockSet()->at(0));
+  EXPECT_TRUE(lock_mgr.LockTable(&txn0, 0, LockMode::INTENTION_EXCLUSIVE));
+  EXPECT_EQ(LockMode::SHARED_INTENTION_EXCLUSIVE,
+            txn0.GetTableLockSet()->at(0));
+  txn_mgr.Commit(&txn0);
+  EXPECT_TRUE(txn0.GetTableLockSet()->empty());
+  EXPECT_TRUE(txn1.GetTableLockSet()->empty());
+}
+
+// row locks under a page lock escalate to a table lock past the threshold
+TEST(LockManagerTest, EscalationTest) {
+  LockManager lock_mgr{true};
+  TransactionManager txn_mgr{&lock_mgr};
+  lock_mgr.SetEscalationThreshold(4);
+
+  Transaction txn0(0), txn1(1), txn2(2);
+  EXPECT_TRUE(lock_mgr.LockPage(&txn0, 0, 0, LockMode::INTENTION_SHARED));
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(lock_mgr.LockShared(&txn0, RID{0, i}));
+  }
+  EXPECT_EQ(LockMode::SHARED, txn0.GetTableLockSet()->at(0));
+  EXPECT_TRUE(txn0.GetSharedLockSet()->empty());
+  // covered by the table lock, no new row lock
+  EXPECT_TRUE(lock_mgr.LockShared(&txn0, RID{0, 5}));
+  EXPECT_TRUE(txn0.GetSharedLockSet()->empty());
+
+  // readers can still come in, writers of the table cannot
+  EXPECT_TRUE(lock_mgr.LockPage(&txn2, 0, 1, LockMode::INTENTION_SHARED));
+  EXPECT_TRUE(lock_mgr.LockShared(&txn2, RID{1, 0}));
+  EXPECT_FALSE(lock_mgr.LockPage(&txn1, 0, 1, LockMode::INTENTION_EXCLUSIVE));
+  EXPECT_EQ(TransactionState::ABORTED, txn1.GetState());
+  txn_mgr.Abort(&txn1);
+
+  // escalation never waits: with a concurrent IX on the table it is skipped
+  Transaction txn3(3), txn4(4);
+  EXPECT_TRUE(lock_mgr.LockPage(&txn4, 10, 11, LockMode::INTENTION_EXCLUSIVE));
+  EXPECT_TRUE(lock_mgr.LockExclusive(&txn4, RID{11, 0}));
+  EXPECT_TRUE(lock_mgr.LockPage(&txn3, 10, 10, LockMode::INTENTION_SHARED));
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(lock_mgr.LockShared(&txn3, RID{10, i}));
+  }
+  EXPECT_EQ(LockMode::INTENTION_SHARED, txn3.GetTableLockSet()->at(10));
+  EXPECT_EQ(4U, txn3.GetSharedLockSet()->size());
+
+  for (auto txn : {&txn0, &txn2, &txn3, &txn4}) {
+    txn_mgr.Commit(txn);
+    EXPECT_TRUE(txn->GetSharedLockSet()->empty());
+    EXPECT_TRUE(txn->GetExclusiveLockSet()->empty());
+    EXPECT_TRUE(txn->GetPageLockSet()->empty());
+    EXPECT_TRUE(txn->GetTableLockSet()->empty());
+  }
+}
+
+// commit walks the txn's request chain and wakes up every waiting queue once
+TEST(LockManagerTest, BatchedReleaseTest) {
+  LockManager lock_mgr{true};
+  TransactionManager txn_mgr{&lock_mgr};
+  const int num_rows = 1000, num_waiters = 4;
+
+  Transaction owner(num_waiters);
+  EXPECT_TRUE(lock_mgr.LockPage(&owner, 0, 0, LockMode::INTENTION_EXCLUSIVE));
+  for (int i = 0; i < num_rows; i++) {
+    EXPECT_TRUE(lock_mgr.LockExclusive(&owner, RID{i, 0}));
+  }
+  // older transactions wait on some of the rows
+  std::vector<std::thread> waiters;
+  std::atomic<int> granted{0};
+  for (int i = 0; i < num_waiters; i++) {
+    waiters.emplace_back([&, i] {
+      Transaction txn(i);
+      EXPECT_TRUE(lock_mgr.LockShared(&txn, RID{i * 7, 0}));
+      EXPECT_TRUE(lock_mgr.LockShared(&txn, RID{i * 7 + 1, 0}));
+      granted++;
+      txn_mgr.Commit(&txn);
+      EXPECT_EQ(txn.GetLockChain(), txn.GetLockChain()->next_);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(0, granted);
+
+  auto start = std::chrono::steady_clock::now();
+  txn_mgr.Commit(&owner);
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  LOG_INFO("released %d locks in %ld us", num_rows + 2, (long)elapsed.count());
+  for (auto &t : waiters) t.join();
+  EXPECT_EQ(num_waiters, granted);
+  EXPECT_EQ(owner.GetLockChain(), owner.GetLockChain()->next_);
+  EXPECT_TRUE(owner.GetExclusiveLockSet()->empty());
+  EXPECT_TRUE(owner.GetTableLockSet()->empty());
+}
+
+/*
+ * Handoff benchmark: an older transaction waits on a row held by a younger
+ * one; prints the average time from the holder's commit until the waiter's
+ * lock call returns.
+ */
+TEST(LockManagerTest, HandoffLatencyBenchmark) {
+  LockManager lock_mgr{true};
+  TransactionManager txn_mgr{&lock_mgr};
+  const int rounds = 200;
+  RID rid{0, 0};
+  std::chrono::nanoseconds total{0};
+
+  for (int i = 0; i < rounds; i++) {
+    Transaction waiter(2 * i), holder(2 * i + 1);
+    EXPECT_TRUE(lock_mgr.LockExclusive(&holder, rid));
+    std::chrono::steady_clock::time_point granted;
+    std::thread t([&] {
+      EXPECT_TRUE(lock_mgr.LockExclusive(&waiter, rid));
+      granted = std::chrono::steady_clock::now();
+    });
+    // short holds are handed off while the waiter still spins, every tenth
+    // one after it went to sleep
+    std::this_thread::sleep_for(std::chrono::microseconds(i % 10 ? 0 : 1000));
+    auto start = std::chrono::steady_clock::now();
+    txn_mgr.Commit(&holder);
+    t.join();
+    total += granted - start;
+    txn_mgr.Commit(&waiter);
+  }
+  LOG_INFO("average handoff latency %ld ns",
+           (long)(total.count() / rounds));
+}
+
+/*
+ * Hot-row benchmark: every transaction locks two of a few hot rows in random
+ * order and holds them for a short while, retrying with its original id until
+ * it commits. Prints throughput and abort rate under wait-die and under
+ * deadlock detection.
+ */
+TEST(LockManagerTest, HotRowBenchmark) {
+  const int num_threads = 4;
+  const int txns_per_thread = 100;
+  const int num_hot_rows = 4;
+  auto interval = CYCLE_DETECTION_INTERVAL;
+  CYCLE_DETECTION_INTERVAL = std::chrono::milliseconds(1);
+
+  for (auto policy : {DeadlockPolicy::WAIT_DIE, DeadlockPolicy::DETECTION}) {
+    LockManager lock_mgr{true, policy};
+    TransactionManager txn_mgr{&lock_mgr};
+    std::atomic<txn_id_t> next_txn_id{0};
+    std::atomic<int> aborted{0};
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.emplace_back([&, t] {
+        std::mt19937 gen(t);
+        std::uniform_int_distribution<int> dis(0, num_hot_rows - 1);
+        for (int i = 0; i < txns_per_thread; i++) {
+          txn_id_t txn_id = next_txn_id++;
+          while (true) {
+            Transaction txn(txn_id);
+            int r0 = dis(gen), r1 = dis(gen);
+            if (r1 == r0)
+              r1 = (r0 + 1) % num_hot_rows;
+            if (lock_mgr.LockExclusive(&txn, RID{0, r0}) &&
+                lock_mgr.LockExclusive(&txn, RID{0, r1})) {
+              std::this_thread::sleep_for(std::chrono::microseconds(100));
+              txn_mgr.Commit(&txn);
+              break;
+            }
+            txn_mgr.Abort(&txn);
+            aborted++;
+          }
+        }
+      });
+    }
+    for (auto &thread : threads)
+      thread.join();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+    int committed = num_threads * txns_per_thread;
+    LOG_INFO("%s: %d committed, %d aborted (%.1f%% abort rate), %lld txns/s",
+             policy == DeadlockPolicy::WAIT_DIE ? "wait-die" : "detection",
+             committed, aborted.load(),
+             100.0 * aborted / (committed + aborted),
+             (long long)committed * 1000 / (ms + 1));
+  }
+  CYCLE_DETECTION_INTERVAL = interval;
+}
+
 } // namespace cmudb
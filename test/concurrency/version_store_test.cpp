@@ -0,0 +1,444 @@
+/**
+ * version_store_test.cpp
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <future>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "concurrency/transaction_manager.h"
+#include "concurrency/version_store.h"
+#include "logging/common.h"
+#include "table/table_heap.h"
+#include "vtable/virtual_table.h"
+#include "gtest/gtest.h"
+
+namespace cmudb {
+
+class VersionStoreTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    remove("test.db");
+    remove("test.log");
+    storage_engine_ = new StorageEngine("test.db");
+    storage_engine_->log_manager_->RunFlushThread();
+    txn_mgr_ = new TransactionManager(storage_engine_->lock_manager_,
+                                      storage_engine_->log_manager_, &vs_);
+    schema_ = ParseCreateStatement("a varchar, b smallint, c bigint");
+    Transaction *txn = txn_mgr_->Begin();
+    table_ = new TableHeap(storage_engine_->buffer_pool_manager_,
+                           storage_engine_->lock_manager_,
+                           storage_engine_->log_manager_, txn, &vs_);
+    txn_mgr_->Commit(txn);
+    delete txn;
+  }
+
+  void TearDown() override {
+    if (ENABLE_LOGGING)
+      storage_engine_->log_manager_->StopFlushThread();
+    delete table_;
+    delete txn_mgr_;
+    delete schema_;
+    delete storage_engine_;
+    remove("test.db");
+    remove("test.log");
+  }
+
+  // insert and commit a tuple
+  RID Insert(const Tuple &tuple) {
+    Transaction *txn = txn_mgr_->Begin();
+    RID rid;
+    EXPECT_TRUE(table_->InsertTuple(tuple, rid, txn));
+    txn_mgr_->Commit(txn);
+    delete txn;
+    return rid;
+  }
+
+  // a fixed-size tuple, so updates always fit in place
+  Tuple Row(int64_t c) {
+    std::vector<Value> values{Value(TypeId::VARCHAR, "row", 4, true),
+                              Value(TypeId::SMALLINT, (int32_t)0),
+                              Value(TypeId::BIGINT, c)};
+    return Tuple(values, schema_);
+  }
+
+  int64_t ValueOf(const Tuple &tuple) {
+    return tuple.GetValue(schema_, 2).GetAs<int64_t>();
+  }
+
+  static bool SameData(const Tuple &a, const Tuple &b) {
+    return a.GetLength() == b.GetLength() &&
+           memcmp(a.GetData(), b.GetData(), a.GetLength()) == 0;
+  }
+
+  int Count(Transaction *txn) {
+    int count = 0;
+    for (auto it = table_->begin(txn); it != table_->end(); ++it)
+      count++;
+    return count;
+  }
+
+  StorageEngine *storage_engine_;
+  VersionStore vs_;
+  TransactionManager *txn_mgr_;
+  Schema *schema_;
+  TableHeap *table_;
+};
+
+// a snapshot reader neither blocks on nor sees an uncommitted update, and
+// keeps seeing its snapshot after the writer commits
+TEST_F(VersionStoreTest, ReadDoesNotBlockOnWriter) {
+  Tuple v1 = ConstructTuple(schema_);
+  Tuple v2 = ConstructTuple(schema_);
+  RID rid = Insert(v1);
+
+  Transaction *writer = txn_mgr_->Begin();
+  EXPECT_TRUE(table_->UpdateTuple(v2, rid, writer));
+
+  Transaction *reader =
+      txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  Tuple result;
+  // would wait for the X lock of the writer under 2PL
+  auto read = std::async(std::launch::async, [&] {
+    return table_->GetTuple(rid, result, reader);
+  });
+  ASSERT_EQ(std::future_status::ready,
+            read.wait_for(std::chrono::seconds(5)));
+  EXPECT_TRUE(read.get());
+  EXPECT_TRUE(SameData(v1, result));
+  EXPECT_TRUE(reader->GetSharedLockSet()->empty());
+
+  txn_mgr_->Commit(writer);
+  EXPECT_TRUE(table_->GetTuple(rid, result, reader));
+  EXPECT_TRUE(SameData(v1, result));
+  txn_mgr_->Commit(reader);
+
+  Transaction *later = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_TRUE(table_->GetTuple(rid, result, later));
+  EXPECT_TRUE(SameData(v2, result));
+  txn_mgr_->Commit(later);
+  delete writer;
+  delete reader;
+  delete later;
+}
+
+// first-updater-wins: overwriting a version committed after the snapshot
+// aborts the snapshot writer
+TEST_F(VersionStoreTest, WriteWriteConflict) {
+  Tuple v1 = ConstructTuple(schema_);
+  RID rid = Insert(v1);
+
+  Transaction *t1 = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  Transaction *t2 = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_TRUE(table_->UpdateTuple(ConstructTuple(schema_), rid, t1));
+  txn_mgr_->Commit(t1);
+
+  EXPECT_FALSE(table_->UpdateTuple(ConstructTuple(schema_), rid, t2));
+  EXPECT_EQ(TransactionState::ABORTED, t2->GetState());
+  txn_mgr_->Abort(t2);
+
+  // a snapshot taken after t1 committed may write
+  Transaction *t3 = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_TRUE(table_->MarkDelete(rid, t3));
+  txn_mgr_->Commit(t3);
+  delete t1;
+  delete t2;
+  delete t3;
+}
+
+// scans of an old snapshot still return deleted tuples and skip newer inserts
+TEST_F(VersionStoreTest, SnapshotScan) {
+  RID r1 = Insert(ConstructTuple(schema_));
+  Insert(ConstructTuple(schema_));
+
+  Transaction *reader = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_EQ(2, Count(reader));
+
+  Transaction *writer = txn_mgr_->Begin();
+  EXPECT_TRUE(table_->MarkDelete(r1, writer));
+  RID r3;
+  EXPECT_TRUE(table_->InsertTuple(ConstructTuple(schema_), r3, writer));
+  txn_mgr_->Commit(writer);
+
+  EXPECT_EQ(2, Count(reader));
+  Tuple result;
+  EXPECT_TRUE(table_->GetTuple(r1, result, reader));
+  EXPECT_FALSE(table_->GetTuple(r3, result, reader));
+  txn_mgr_->Commit(reader);
+
+  Transaction *later = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_EQ(2, Count(later));
+  EXPECT_FALSE(table_->GetTuple(r1, result, later));
+  EXPECT_TRUE(table_->GetTuple(r3, result, later));
+  txn_mgr_->Commit(later);
+  delete reader;
+  delete writer;
+  delete later;
+}
+
+// an aborted write leaves nothing behind, committed chains are collected
+// once no snapshot needs them
+TEST_F(VersionStoreTest, AbortAndCollect) {
+  // every commit would wait LOG_TIMEOUT for the group flush
+  storage_engine_->log_manager_->StopFlushThread();
+  Tuple v1 = ConstructTuple(schema_);
+  RID rid = Insert(v1);
+  vs_.Collect(INT64_MAX);
+  EXPECT_EQ(0U, vs_.Size());
+
+  Transaction *txn = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_TRUE(table_->UpdateTuple(ConstructTuple(schema_), rid, txn));
+  EXPECT_EQ(1U, vs_.Size());
+  txn_mgr_->Abort(txn);
+  EXPECT_EQ(0U, vs_.Size());
+
+  Transaction *reader = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  Tuple result;
+  EXPECT_TRUE(table_->GetTuple(rid, result, reader));
+  EXPECT_TRUE(SameData(v1, result));
+
+  for (int i = 0; i < VERSION_GC_INTERVAL; i++) {
+    Transaction *writer = txn_mgr_->Begin();
+    EXPECT_TRUE(table_->UpdateTuple(ConstructTuple(schema_), rid, writer));
+    txn_mgr_->Commit(writer);
+    delete writer;
+  }
+  // the reader still needs the first version
+  EXPECT_EQ(1U, vs_.Size());
+  EXPECT_TRUE(table_->GetTuple(rid, result, reader));
+  EXPECT_TRUE(SameData(v1, result));
+  txn_mgr_->Commit(reader);
+
+  // the next collection drops the whole chain
+  for (int i = 0; i < VERSION_GC_INTERVAL && vs_.Size() != 0; i++) {
+    Transaction *writer = txn_mgr_->Begin();
+    EXPECT_TRUE(table_->UpdateTuple(ConstructTuple(schema_), rid, writer));
+    txn_mgr_->Commit(writer);
+    delete writer;
+  }
+  EXPECT_EQ(0U, vs_.Size());
+  delete txn;
+  delete reader;
+}
+
+// optimistic writes stay buffered until commit, the transaction itself
+// reads them back
+TEST_F(VersionStoreTest, OptimisticBufferedWrites) {
+  RID r1 = Insert(Row(1));
+  RID r2 = Insert(Row(2));
+
+  Transaction *txn = txn_mgr_->Begin(ConcurrencyMode::OPTIMISTIC);
+  Tuple result;
+  EXPECT_TRUE(table_->UpdateTuple(Row(10), r1, txn));
+  EXPECT_TRUE(table_->MarkDelete(r2, txn));
+  RID r3;
+  EXPECT_TRUE(table_->InsertTuple(Row(3), r3, txn));
+  EXPECT_TRUE(table_->GetTuple(r1, result, txn));
+  EXPECT_EQ(10, ValueOf(result));
+  EXPECT_FALSE(table_->GetTuple(r2, result, txn));
+  EXPECT_EQ(2, Count(txn));
+  EXPECT_TRUE(txn->GetExclusiveLockSet()->count(r1) == 0);
+
+  // nothing but the insert reached the pages
+  Transaction *reader = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_TRUE(table_->GetTuple(r1, result, reader));
+  EXPECT_EQ(1, ValueOf(result));
+  EXPECT_EQ(2, Count(reader));
+  txn_mgr_->Commit(reader);
+
+  EXPECT_TRUE(txn_mgr_->Commit(txn));
+  Transaction *later = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_TRUE(table_->GetTuple(r1, result, later));
+  EXPECT_EQ(10, ValueOf(result));
+  EXPECT_FALSE(table_->GetTuple(r2, result, later));
+  EXPECT_TRUE(table_->GetTuple(r3, result, later));
+  txn_mgr_->Commit(later);
+  delete txn;
+  delete reader;
+  delete later;
+}
+
+// validation fails when a tuple read was overwritten after the snapshot; two
+// optimistic transactions reading each other's writes cannot both commit
+TEST_F(VersionStoreTest, OptimisticValidation) {
+  RID r1 = Insert(Row(1));
+  RID r2 = Insert(Row(2));
+  Tuple result;
+
+  Transaction *t1 = txn_mgr_->Begin(ConcurrencyMode::OPTIMISTIC);
+  EXPECT_TRUE(table_->GetTuple(r1, result, t1));
+  Transaction *writer = txn_mgr_->Begin();
+  EXPECT_TRUE(table_->UpdateTuple(Row(11), r1, writer));
+  txn_mgr_->Commit(writer);
+  EXPECT_TRUE(table_->UpdateTuple(Row(12), r2, t1));
+  EXPECT_FALSE(txn_mgr_->Commit(t1));
+  EXPECT_EQ(TransactionState::ABORTED, t1->GetState());
+
+  // write skew
+  Transaction *t2 = txn_mgr_->Begin(ConcurrencyMode::OPTIMISTIC);
+  Transaction *t3 = txn_mgr_->Begin(ConcurrencyMode::OPTIMISTIC);
+  EXPECT_TRUE(table_->GetTuple(r1, result, t2));
+  EXPECT_TRUE(table_->GetTuple(r2, result, t2));
+  EXPECT_TRUE(table_->GetTuple(r1, result, t3));
+  EXPECT_TRUE(table_->GetTuple(r2, result, t3));
+  EXPECT_TRUE(table_->UpdateTuple(Row(21), r1, t2));
+  EXPECT_TRUE(table_->UpdateTuple(Row(22), r2, t3));
+  EXPECT_TRUE(txn_mgr_->Commit(t2));
+  EXPECT_FALSE(txn_mgr_->Commit(t3));
+
+  Transaction *later = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_TRUE(table_->GetTuple(r1, result, later));
+  EXPECT_EQ(21, ValueOf(result));
+  EXPECT_TRUE(table_->GetTuple(r2, result, later));
+  EXPECT_EQ(2, ValueOf(result));
+  txn_mgr_->Commit(later);
+  EXPECT_TRUE(t3->GetExclusiveLockSet()->empty());
+  delete t1;
+  delete writer;
+  delete t2;
+  delete t3;
+  delete later;
+}
+
+// the versions of a commit are visible before its COMMIT record is appended
+// (its deletes come in between); a snapshot that read them may not commit
+// until that record is in the log, and its commit waits for it to be durable
+TEST_F(VersionStoreTest, SnapshotCommitFollowsObservedCommit) {
+  RID deleted = Insert(Row(1));
+  RID updated;
+  do {
+    updated = Insert(Row(1));
+  } while (updated.GetPageId() == deleted.GetPageId());
+
+  Transaction *writer = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+  EXPECT_TRUE(table_->UpdateTuple(Row(2), updated, writer));
+  EXPECT_TRUE(table_->MarkDelete(deleted, writer));
+  // holding the read latch stops the writer in ApplyDelete, after it
+  // published its versions and before it appends COMMIT
+  auto bpm = storage_engine_->buffer_pool_manager_;
+  Page *page = bpm->FetchPage(deleted.GetPageId());
+  page->RLatch();
+  auto commit_writer = std::async(std::launch::async,
+                                  [&] { return txn_mgr_->Commit(writer); });
+
+  Transaction *reader;
+  Tuple result;
+  while (true) {
+    reader = txn_mgr_->Begin(ConcurrencyMode::SNAPSHOT_ISOLATION);
+    EXPECT_TRUE(table_->GetTuple(updated, result, reader));
+    if (ValueOf(result) == 2)
+      break;
+    txn_mgr_->Commit(reader);
+    delete reader;
+  }
+  auto commit_reader = std::async(std::launch::async,
+                                  [&] { return txn_mgr_->Commit(reader); });
+  EXPECT_EQ(std::future_status::timeout,
+            commit_reader.wait_for(std::chrono::milliseconds(100)));
+
+  page->RUnlatch();
+  bpm->UnpinPage(page->GetPageId(), false);
+  EXPECT_TRUE(commit_reader.get());
+  EXPECT_GE(storage_engine_->log_manager_->GetPersistentLSN(),
+            writer->GetPrevLSN());
+  EXPECT_TRUE(commit_writer.get());
+  delete writer;
+  delete reader;
+}
+
+/*
+ * YCSB-style read-mostly benchmark (workload B): every transaction does ten
+ * operations, 95% reads and 5% updates, with 80% of them on the hottest 20%
+ * of the rows. Prints throughput and abort rate under strict 2PL and under
+ * optimistic concurrency control. Logging is off, a commit would otherwise
+ * wait LOG_TIMEOUT for the group flush, so the 2PL transactions take their
+ * tuple locks themselves.
+ */
+TEST_F(VersionStoreTest, ReadMostlyBenchmark) {
+  storage_engine_->log_manager_->StopFlushThread();
+  const int num_rows = 1000;
+  const int num_threads = 4;
+  const int txns_per_thread = 500;
+  const int ops_per_txn = 10;
+  std::vector<RID> rids;
+  Transaction *loader = txn_mgr_->Begin();
+  for (int i = 0; i < num_rows; i++) {
+    RID rid;
+    EXPECT_TRUE(table_->InsertTuple(Row(i), rid, loader));
+    rids.push_back(rid);
+  }
+  txn_mgr_->Commit(loader);
+  delete loader;
+  LockManager *lock_mgr = storage_engine_->lock_manager_;
+
+  for (auto mode :
+       {ConcurrencyMode::TWO_PHASE_LOCKING, ConcurrencyMode::OPTIMISTIC}) {
+    std::atomic<txn_id_t> next_txn_id{1 << 20};
+    std::atomic<int> aborted{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.emplace_back([&, t] {
+        std::mt19937 gen(t);
+        std::uniform_int_distribution<int> percent(0, 99);
+        std::uniform_int_distribution<int> hot(0, num_rows / 5 - 1);
+        std::uniform_int_distribution<int> cold(num_rows / 5, num_rows - 1);
+        Tuple row = Row(t);
+        Tuple result;
+        for (int i = 0; i < txns_per_thread; i++) {
+          // 2PL retries with its original id so that wait-die lets it age
+          txn_id_t txn_id = next_txn_id++;
+          std::mt19937 ops(gen());
+          while (true) {
+            std::unique_ptr<Transaction> txn(
+                mode == ConcurrencyMode::OPTIMISTIC
+                    ? txn_mgr_->Begin(mode)
+                    : new Transaction(txn_id));
+            auto replay = ops;
+            bool ok = true;
+            for (int op = 0; ok && op < ops_per_txn; op++) {
+              const RID &rid =
+                  rids[percent(replay) < 80 ? hot(replay) : cold(replay)];
+              bool update = percent(replay) < 5;
+              if (mode == ConcurrencyMode::TWO_PHASE_LOCKING) {
+                if (update && txn->GetSharedLockSet()->count(rid))
+                  ok = lock_mgr->LockUpgrade(txn.get(), rid);
+                else if (update && !txn->GetExclusiveLockSet()->count(rid))
+                  ok = lock_mgr->LockExclusive(txn.get(), rid);
+                else if (!update && !txn->GetSharedLockSet()->count(rid) &&
+                         !txn->GetExclusiveLockSet()->count(rid))
+                  ok = lock_mgr->LockShared(txn.get(), rid);
+              }
+              if (ok)
+                ok = update ? table_->UpdateTuple(row, rid, txn.get())
+                            : table_->GetTuple(rid, result, txn.get());
+            }
+            // a failed commit has already rolled back
+            if (!ok)
+              txn_mgr_->Abort(txn.get());
+            else if (txn_mgr_->Commit(txn.get()))
+              break;
+            aborted++;
+          }
+        }
+      });
+    }
+    for (auto &thread : threads)
+      thread.join();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+    int committed = num_threads * txns_per_thread;
+    LOG_INFO("%s: %d committed, %d aborted (%.1f%% abort rate), %lld txns/s",
+             mode == ConcurrencyMode::OPTIMISTIC ? "optimistic" : "strict 2PL",
+             committed, aborted.load(),
+             100.0 * aborted / (committed + aborted),
+             (long long)committed * 1000 / (ms + 1));
+  }
+}
+
+} // namespace cmudb
@@ -1,12 +1,31 @@
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <future>
+#include <map>
 #include <unordered_map>
 #include <random>
 #include <functional>
-
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "index/b_plus_tree.h"
 #include "logging/common.h"
+#include "logging/log_compressor.h"
 #include "logging/log_recovery.h"
+#include "logging/log_replica.h"
+#include "logging/log_shipper.h"
+#include "page/header_page.h"
 #include "vtable/virtual_table.h"
 #include "table/table_heap.h"
 #include "gtest/gtest.h"
@@ -735,4 +754,1469 @@ TEST(LogManagerTest, UndoTest) {
   remove("test.log");
 }
 
+/*
+ * Early lock release: a commit drops its locks once the commit record is in
+ * the log buffer, but a transaction that then reads its write does not
+ * report success before that commit record is on disk.
+ */
+TEST(LogManagerTest, EarlyLockRelease) {
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  auto *txn_mgr = storage_engine->transaction_manager_;
+  auto *log_mgr = storage_engine->log_manager_;
+  // no timed group flush while the locks are checked
+  auto timeout = LOG_TIMEOUT;
+  auto delay = GROUP_COMMIT_MAX_DELAY;
+  LOG_TIMEOUT = std::chrono::seconds(10);
+  GROUP_COMMIT_MAX_DELAY = std::chrono::microseconds(0);
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        log_mgr, txn);
+  txn_mgr->Commit(txn);
+  delete txn;
+  log_mgr->RunFlushThread();
+
+  Schema *schema = ParseCreateStatement("a varchar, b smallint, c bigint");
+  Tuple tuple = ConstructTuple(schema);
+  // t2 is older, under wait-die it waits for the lock of t1 instead of dying
+  Transaction *t2 = txn_mgr->Begin();
+  Transaction *t1 = txn_mgr->Begin();
+  RID rid;
+  EXPECT_TRUE(test_table->InsertTuple(tuple, rid, t1));
+  auto commit1 = std::async(std::launch::async,
+                            [&] { return txn_mgr->Commit(t1); });
+
+  EXPECT_TRUE(test_table->UpdateTuple(tuple, rid, t2));
+  lsn_t commit_lsn = t1->GetPrevLSN();
+  EXPECT_LT(log_mgr->GetPersistentLSN(), commit_lsn);
+  EXPECT_EQ(std::future_status::timeout,
+            commit1.wait_for(std::chrono::seconds(0)));
+
+  auto commit2 = std::async(std::launch::async,
+                            [&] { return txn_mgr->Commit(t2); });
+  while (commit2.wait_for(std::chrono::milliseconds(1)) !=
+         std::future_status::ready)
+    log_mgr->Flush(true);
+  EXPECT_TRUE(commit2.get());
+  EXPECT_GT(log_mgr->GetPersistentLSN(), commit_lsn);
+  EXPECT_TRUE(commit1.get());
+
+  log_mgr->StopFlushThread();
+  LOG_TIMEOUT = timeout;
+  GROUP_COMMIT_MAX_DELAY = delay;
+  delete t1;
+  delete t2;
+  delete test_table;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+}
+
+/*
+ * Asynchronous commit: one thread keeps many transactions in flight, their
+ * callbacks run in commit order once the group flush writes them out.
+ */
+TEST(LogManagerTest, AsyncCommit) {
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  auto *txn_mgr = storage_engine->transaction_manager_;
+  auto *log_mgr = storage_engine->log_manager_;
+  auto timeout = LOG_TIMEOUT;
+  auto delay = GROUP_COMMIT_MAX_DELAY;
+  LOG_TIMEOUT = std::chrono::seconds(10);
+  GROUP_COMMIT_MAX_DELAY = std::chrono::microseconds(0);
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        log_mgr, txn);
+  txn_mgr->Commit(txn);
+  delete txn;
+  log_mgr->RunFlushThread();
+
+  Schema *schema = ParseCreateStatement("a varchar, b smallint, c bigint");
+  Tuple tuple = ConstructTuple(schema);
+  const int num_txns = 10;
+  std::mutex mutex;
+  std::vector<int> durable;
+  for (int i = 0; i < num_txns; i++) {
+    txn = txn_mgr->Begin();
+    RID rid;
+    EXPECT_TRUE(test_table->InsertTuple(tuple, rid, txn));
+    txn_mgr->CommitAsync(txn, [&, i](bool committed) {
+      EXPECT_TRUE(committed);
+      std::lock_guard<std::mutex> guard(mutex);
+      durable.push_back(i);
+    });
+    delete txn;
+  }
+  txn = txn_mgr->Begin();
+  std::future<bool> last = txn_mgr->CommitAsync(txn);
+  delete txn;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    EXPECT_TRUE(durable.empty());
+  }
+  EXPECT_EQ(std::future_status::timeout,
+            last.wait_for(std::chrono::seconds(0)));
+
+  log_mgr->Flush(true);
+  EXPECT_TRUE(last.get());
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    EXPECT_EQ(num_txns, (int)durable.size());
+    EXPECT_TRUE(std::is_sorted(durable.begin(), durable.end()));
+  }
+
+  log_mgr->StopFlushThread();
+  LOG_TIMEOUT = timeout;
+  GROUP_COMMIT_MAX_DELAY = delay;
+  delete test_table;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+}
+
+// Point every descriptor this process has open on file name at /dev/full,
+// where writes fail. Returns each descriptor with a copy of the original
+static std::vector<std::pair<int, int>> BreakFile(const std::string &name) {
+  char cwd[4096];
+  EXPECT_NE(nullptr, getcwd(cwd, sizeof(cwd)));
+  std::string path = std::string(cwd) + "/" + name;
+  std::vector<int> fds;
+  DIR *dir = opendir("/proc/self/fd");
+  while (dir != nullptr) {
+    struct dirent *entry = readdir(dir);
+    if (entry == nullptr) break;
+    char target[4096];
+    std::string link = std::string("/proc/self/fd/") + entry->d_name;
+    ssize_t n = readlink(link.c_str(), target, sizeof(target) - 1);
+    if (n > 0 && std::string(target, n) == path) fds.push_back(atoi(entry->d_name));
+  }
+  if (dir != nullptr) closedir(dir);
+  std::vector<std::pair<int, int>> saved;
+  int full = open("/dev/full", O_WRONLY);
+  for (int fd : fds) {
+    saved.emplace_back(fd, dup(fd));
+    dup2(full, fd);
+  }
+  close(full);
+  return saved;
+}
+
+static void RepairFile(const std::vector<std::pair<int, int>> &saved) {
+  for (auto &fd : saved) {
+    dup2(fd.second, fd.first);
+    close(fd.second);
+  }
+}
+
+/*
+ * A log write that fails does not make anything durable: the commit waits,
+ * its callback does not run, and the segment is written again once the disk
+ * works.
+ */
+TEST(LogManagerTest, LogWriteFailure) {
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  auto *txn_mgr = storage_engine->transaction_manager_;
+  auto *log_mgr = storage_engine->log_manager_;
+  auto timeout = LOG_TIMEOUT;
+  auto delay = GROUP_COMMIT_MAX_DELAY;
+  LOG_TIMEOUT = std::chrono::seconds(10);
+  GROUP_COMMIT_MAX_DELAY = std::chrono::microseconds(0);
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        log_mgr, txn);
+  txn_mgr->Commit(txn);
+  delete txn;
+  log_mgr->RunFlushThread();
+
+  Schema *schema = ParseCreateStatement("a varchar, b smallint, c bigint");
+  Tuple tuple = ConstructTuple(schema);
+  txn = txn_mgr->Begin();
+  RID rid;
+  EXPECT_TRUE(test_table->InsertTuple(tuple, rid, txn));
+  int64_t log_end = storage_engine->disk_manager_->GetLogEnd();
+  auto saved = BreakFile("test.log");
+  ASSERT_FALSE(saved.empty());
+  std::atomic<bool> durable(false);
+  txn_mgr->CommitAsync(txn, [&](bool committed) {
+    EXPECT_TRUE(committed);
+    durable = true;
+  });
+  lsn_t commit_lsn = txn->GetPrevLSN();
+  delete txn;
+  auto flush = std::async(std::launch::async, [&] { log_mgr->Flush(true); });
+
+  // the flush thread keeps retrying, nothing counts as written meanwhile
+  while (log_mgr->GetFlushStats().write_errors < 3)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_FALSE(durable);
+  EXPECT_LT(log_mgr->GetPersistentLSN(), commit_lsn);
+  EXPECT_EQ(log_end, storage_engine->disk_manager_->GetLogEnd());
+  EXPECT_EQ(std::future_status::timeout,
+            flush.wait_for(std::chrono::seconds(0)));
+
+  RepairFile(saved);
+  flush.get();
+  // the callback runs on the flush thread right after the flush
+  for (int i = 0; i < 1000 && !durable; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_TRUE(durable);
+  EXPECT_GE(log_mgr->GetPersistentLSN(), commit_lsn);
+  EXPECT_LT(log_end, storage_engine->disk_manager_->GetLogEnd());
+  log_mgr->StopFlushThread();
+
+  // the retried segment follows the earlier log without a gap
+  LogRecovery log_recovery(storage_engine->disk_manager_,
+                           storage_engine->buffer_pool_manager_);
+  log_recovery.Redo();
+  EXPECT_EQ(commit_lsn, log_recovery.GetMaxLSN());
+
+  LOG_TIMEOUT = timeout;
+  GROUP_COMMIT_MAX_DELAY = delay;
+  delete test_table;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+}
+
+/*
+ * Group commit: concurrent committers are flushed in groups without waiting
+ * for LOG_TIMEOUT. Prints the group size and commit wait metrics.
+ */
+TEST(LogManagerTest, GroupCommit) {
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  auto *txn_mgr = storage_engine->transaction_manager_;
+  auto *log_mgr = storage_engine->log_manager_;
+  auto timeout = LOG_TIMEOUT;
+  LOG_TIMEOUT = std::chrono::seconds(10);
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        log_mgr, txn);
+  txn_mgr->Commit(txn);
+  delete txn;
+  log_mgr->RunFlushThread();
+  Schema *schema = ParseCreateStatement("a varchar, b smallint, c bigint");
+
+  // a lone commit does not wait for LOG_TIMEOUT
+  auto start = std::chrono::steady_clock::now();
+  txn = txn_mgr->Begin();
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+  EXPECT_EQ(1u, log_mgr->GetGroupCommitStats().commits);
+
+  const int num_threads = 16;
+  const int txns_per_thread = 20;
+  std::vector<std::thread> threads;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < txns_per_thread; j++) {
+        Transaction *txn = txn_mgr->Begin();
+        Tuple tuple = ConstructTuple(schema);
+        RID rid;
+        EXPECT_TRUE(test_table->InsertTuple(tuple, rid, txn));
+        EXPECT_TRUE(txn_mgr->Commit(txn));
+        delete txn;
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  EXPECT_LT(elapsed, std::chrono::seconds(5));
+
+  auto stats = log_mgr->GetGroupCommitStats();
+  // commits already covered by another group's flush do not wait
+  EXPECT_LT(1u, stats.commits);
+  EXPECT_GE(1u + num_threads * txns_per_thread, stats.commits);
+  EXPECT_LE(stats.groups, stats.commits);
+  EXPECT_LE(stats.max_group_size, (uint64_t)num_threads);
+  EXPECT_LE(stats.AverageWait(), stats.max_wait);
+  LOG_INFO("%d commits in %lld ms, %llu groups (avg %.1f, max %llu), "
+           "avg wait %lld us, max wait %lld us, log write %lld us",
+           num_threads * txns_per_thread, (long long)elapsed.count(),
+           (unsigned long long)stats.groups, stats.AverageGroupSize(),
+           (unsigned long long)stats.max_group_size,
+           (long long)stats.AverageWait().count(),
+           (long long)stats.max_wait.count(),
+           (long long)stats.flush_latency.count());
+
+  log_mgr->StopFlushThread();
+  LOG_TIMEOUT = timeout;
+  delete test_table;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+}
+
+/*
+ * The log striped across three files reads back in order, also after the
+ * files are reopened.
+ */
+TEST(LogManagerTest, StripedLog) {
+  const int num_stripes = 3;
+  const int sizes[] = {100, LOG_STRIPE_SIZE - 100, 3 * LOG_STRIPE_SIZE + 7,
+                       LOG_STRIPE_SIZE, 5000};
+  int total = 0;
+  for (int size : sizes) total += size;
+  std::vector<char> expected(total);
+  for (int i = 0; i < total; i++) expected[i] = (char)(i * 7 % 251);
+
+  DiskManager *disk_manager = new DiskManager("stripe.db", num_stripes);
+  std::vector<char> buffers[2];
+  int offset = 0;
+  for (int i = 0; i < 5; i++) {
+    // consecutive log writes come from different buffers
+    auto &buffer = buffers[i % 2];
+    buffer.assign(expected.begin() + offset, expected.begin() + offset + sizes[i]);
+    disk_manager->WriteLog(buffer.data(), sizes[i]);
+    offset += sizes[i];
+  }
+  EXPECT_EQ(5, disk_manager->GetNumFlushes());
+
+  for (int reopen = 0; reopen < 2; reopen++) {
+    std::vector<char> actual(total);
+    for (offset = 0; offset < total; offset += 999)
+      ASSERT_TRUE(disk_manager->ReadLog(actual.data() + offset,
+                                        std::min(999, total - offset), offset));
+    EXPECT_TRUE(expected == actual);
+    // reading past the end fills zeros
+    char tail[16];
+    ASSERT_TRUE(disk_manager->ReadLog(tail, sizeof(tail), total - 1));
+    EXPECT_EQ(expected[total - 1], tail[0]);
+    EXPECT_EQ(0, tail[1]);
+    EXPECT_FALSE(disk_manager->ReadLog(tail, sizeof(tail), total));
+
+    delete disk_manager;
+    disk_manager = reopen == 0 ? new DiskManager("stripe.db", num_stripes)
+                               : nullptr;
+  }
+
+  struct stat stat_buf;
+  int64_t file_sizes = 0;
+  for (auto name : {"stripe.log", "stripe.log.1", "stripe.log.2"}) {
+    ASSERT_EQ(0, stat(name, &stat_buf));
+    EXPECT_LT(0, stat_buf.st_size);
+    file_sizes += stat_buf.st_size;
+    remove(name);
+  }
+  EXPECT_EQ(total, file_sizes);
+  remove("stripe.db");
+}
+
+/*
+ * A segmented log rolls over to a new file named by its starting offset,
+ * truncation archives whole segments and the rest survives a reopen.
+ */
+TEST(LogManagerTest, LogSegments) {
+  const int segment_size = 8192;
+  const int write_size = 3000;
+  const int num_writes = 10;
+  const int total = write_size * num_writes;
+  std::vector<char> expected(total);
+  for (int i = 0; i < total; i++) expected[i] = (char)(i * 13 % 253);
+  auto segment_file = [](int start, int stripe) {
+    char name[64];
+    snprintf(name, sizeof(name), "segment.log.%016x%s", start,
+             stripe == 0 ? "" : ".1");
+    return std::string(name);
+  };
+
+  DiskManager *disk_manager = new DiskManager("segment.db", 2, segment_size);
+  std::vector<char> buffers[2];
+  for (int i = 0; i < num_writes; i++) {
+    auto &buffer = buffers[i % 2];
+    buffer.assign(expected.begin() + i * write_size,
+                  expected.begin() + (i + 1) * write_size);
+    disk_manager->WriteLog(buffer.data(), write_size);
+  }
+  // a segment rolls over between writes once it holds segment_size bytes
+  struct stat stat_buf;
+  for (int start : {0, 9000, 18000, 27000})
+    for (int stripe = 0; stripe < 2; stripe++)
+      EXPECT_EQ(0, stat(segment_file(start, stripe).c_str(), &stat_buf));
+
+  EXPECT_EQ(0, disk_manager->TruncateLog(8999));
+  mkdir("segment_archive", 0755);
+  disk_manager->SetLogArchive("segment_archive");
+  EXPECT_EQ(2, disk_manager->TruncateLog(20000));
+  for (int start : {0, 9000}) {
+    EXPECT_NE(0, stat(segment_file(start, 0).c_str(), &stat_buf));
+    std::string archived = "segment_archive/" + segment_file(start, 0);
+    EXPECT_EQ(0, stat(archived.c_str(), &stat_buf));
+    remove(archived.c_str());
+    remove(("segment_archive/" + segment_file(start, 1)).c_str());
+  }
+  rmdir("segment_archive");
+
+  for (int reopen = 0; reopen < 2; reopen++) {
+    EXPECT_EQ(18000, disk_manager->GetLogStart());
+    char byte;
+    EXPECT_FALSE(disk_manager->ReadLog(&byte, 1, 17999));
+    std::vector<char> actual(total - 18000);
+    for (int offset = 18000; offset < total; offset += 1000)
+      ASSERT_TRUE(disk_manager->ReadLog(actual.data() + offset - 18000,
+                                        std::min(1000, total - offset), offset));
+    EXPECT_TRUE(std::equal(actual.begin(), actual.end(), expected.begin() + 18000));
+    EXPECT_FALSE(disk_manager->ReadLog(&byte, 1, total));
+
+    delete disk_manager;
+    disk_manager = reopen == 0 ? new DiskManager("segment.db", 2, segment_size)
+                               : nullptr;
+  }
+
+  for (int start : {18000, 27000})
+    for (int stripe = 0; stripe < 2; stripe++)
+      EXPECT_EQ(0, remove(segment_file(start, stripe).c_str()));
+  remove("segment.db");
+}
+
+/*
+ * Log offsets keep growing across truncation. A log that starts past 4 GiB
+ * (as if that much had been written and truncated) is written, read back,
+ * pointed at by the master record, truncated and recovered.
+ */
+TEST(LogManagerTest, LargeLogOffsets) {
+  const int64_t start = 6LL << 30;
+  const int segment_size = 8192;
+  char name[64];
+  snprintf(name, sizeof(name), "big.log.%016llx", (unsigned long long)start);
+  fclose(fopen(name, "w"));
+
+  DiskManager *disk_manager = new DiskManager("big.db", 1, segment_size);
+  EXPECT_EQ(start, disk_manager->GetLogStart());
+  EXPECT_EQ(start, disk_manager->GetLogEnd());
+  // BEGIN and COMMIT of 1000 transactions, over several log segments
+  LogManager *log_manager = new LogManager(disk_manager);
+  log_manager->RunFlushThread();
+  std::vector<lsn_t> begins;
+  for (txn_id_t txn = 0; txn < 1000; txn++) {
+    LogRecord begin{txn, INVALID_LSN, LogRecordType::BEGIN};
+    begins.push_back(log_manager->AppendLogRecord(begin));
+    LogRecord commit{txn, begins.back(), LogRecordType::COMMIT};
+    log_manager->AppendLogRecord(commit);
+    if (txn % 100 == 99) log_manager->Flush(true);
+  }
+  lsn_t last_lsn = log_manager->GetPersistentLSN();
+  // the flushed segment holding each tenth BEGIN, read back from its offset
+  std::vector<int64_t> offsets;
+  for (int i = 0; i < 10; i++) {
+    lsn_t lsn = begins[i * 100];
+    offsets.push_back(log_manager->GetLogOffset(lsn));
+    EXPECT_LE(start, offsets.back());
+    std::vector<char> data(LOG_BUFFER_SIZE);
+    ASSERT_TRUE(disk_manager->ReadLog(data.data(), LOG_BUFFER_SIZE, offsets.back()));
+    LogRecord log;
+    bool found = false;
+    for (const char *pos = data.data(), *data_end = pos + data.size();
+         !found && LogRecovery::DeserializeLogRecord(pos, data_end, log);
+         pos += log.GetSize())
+      found = log.GetLSN() == lsn;
+    EXPECT_TRUE(found);
+  }
+  log_manager->StopFlushThread();
+  delete log_manager;
+  int64_t end = disk_manager->GetLogEnd();
+  EXPECT_GT(end, offsets[9]);
+  EXPECT_GT(offsets[9], start + segment_size);
+
+  disk_manager->WriteMasterRecord(offsets[8], 7, offsets[5]);
+  int64_t checkpoint_offset, redo_offset;
+  lsn_t checkpoint_lsn;
+  ASSERT_TRUE(disk_manager->ReadMasterRecord(&checkpoint_offset, &checkpoint_lsn,
+                                             &redo_offset));
+  EXPECT_EQ(offsets[8], checkpoint_offset);
+  EXPECT_EQ(7, checkpoint_lsn);
+  EXPECT_EQ(offsets[5], redo_offset);
+  EXPECT_LT(0, disk_manager->TruncateLog(offsets[5]));
+  EXPECT_LT(start, disk_manager->GetLogStart());
+  EXPECT_GE(offsets[5], disk_manager->GetLogStart());
+  delete disk_manager;
+
+  // recovery scans the rest of the log after a reopen
+  disk_manager = new DiskManager("big.db", 1, segment_size);
+  EXPECT_EQ(end, disk_manager->GetLogEnd());
+  remove("big.master");
+  BufferPoolManager *buffer_pool_manager =
+      new BufferPoolManager(BUFFER_POOL_SIZE, disk_manager, nullptr);
+  LogRecovery *log_recovery = new LogRecovery(disk_manager, buffer_pool_manager);
+  log_recovery->Redo();
+  EXPECT_EQ(last_lsn, log_recovery->GetMaxLSN());
+  delete log_recovery;
+  delete buffer_pool_manager;
+  delete disk_manager;
+
+  DIR *dir = opendir(".");
+  while (dir != nullptr) {
+    struct dirent *entry = readdir(dir);
+    if (entry == nullptr) break;
+    if (strncmp(entry->d_name, "big.log.", 8) == 0) remove(entry->d_name);
+  }
+  if (dir != nullptr) closedir(dir);
+  remove("big.db");
+}
+
+/*
+ * Fuzzy checkpoints: recovery starts at the redo point in the master record,
+ * skips the changes the dirty page table shows are on disk and still rolls
+ * back a transaction that was active across the last checkpoint.
+ */
+TEST(LogManagerTest, CheckpointRecovery) {
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  storage_engine->log_manager_->RunFlushThread();
+  auto *txn_mgr = storage_engine->transaction_manager_;
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        storage_engine->log_manager_, txn);
+  page_id_t first_page_id = test_table->GetFirstPageId();
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+
+  Schema *schema = ParseCreateStatement("a varchar, b smallint, c bigint");
+  std::vector<RID> committed;
+  auto insert_committed = [&](int count) {
+    Transaction *txn = txn_mgr->Begin();
+    for (int i = 0; i < count; i++) {
+      RID rid;
+      EXPECT_TRUE(test_table->InsertTuple(ConstructTuple(schema), rid, txn));
+      committed.push_back(rid);
+    }
+    EXPECT_TRUE(txn_mgr->Commit(txn));
+    delete txn;
+  };
+
+  insert_committed(10);
+  EXPECT_TRUE(storage_engine->checkpoint_manager_->Checkpoint());
+  int64_t checkpoint_offset, redo_offset;
+  lsn_t checkpoint_lsn;
+  ASSERT_TRUE(storage_engine->disk_manager_->ReadMasterRecord(
+      &checkpoint_offset, &checkpoint_lsn, &redo_offset));
+  // the table page is dirty since the table was created
+  EXPECT_EQ(0, redo_offset);
+
+  // once the page is written out the redo point moves past the inserts
+  EXPECT_TRUE(storage_engine->buffer_pool_manager_->FlushPage(first_page_id));
+  insert_committed(10);
+  Transaction *loser = txn_mgr->Begin();
+  std::vector<RID> uncommitted(2);
+  EXPECT_TRUE(test_table->InsertTuple(ConstructTuple(schema), uncommitted[0],
+                                      loser));
+  EXPECT_TRUE(storage_engine->checkpoint_manager_->Checkpoint());
+  ASSERT_TRUE(storage_engine->disk_manager_->ReadMasterRecord(
+      &checkpoint_offset, &checkpoint_lsn, &redo_offset));
+  EXPECT_GT(redo_offset, 0);
+  EXPECT_LT(redo_offset, checkpoint_offset);
+
+  // the page written out above may still be in the OS page cache only: a
+  // checkpoint that cannot sync the data file keeps the old redo point
+  auto *disk_manager = storage_engine->disk_manager_;
+  int syncs = disk_manager->GetNumDataSyncs();
+  auto saved = BreakFile("test.db");
+  ASSERT_FALSE(saved.empty());
+  EXPECT_FALSE(storage_engine->checkpoint_manager_->Checkpoint());
+  RepairFile(saved);
+  int64_t failed_checkpoint_offset, failed_redo_offset;
+  lsn_t failed_checkpoint_lsn;
+  ASSERT_TRUE(disk_manager->ReadMasterRecord(
+      &failed_checkpoint_offset, &failed_checkpoint_lsn, &failed_redo_offset));
+  EXPECT_EQ(checkpoint_offset, failed_checkpoint_offset);
+  EXPECT_EQ(checkpoint_lsn, failed_checkpoint_lsn);
+  EXPECT_EQ(redo_offset, failed_redo_offset);
+  EXPECT_EQ(syncs, disk_manager->GetNumDataSyncs());
+  EXPECT_TRUE(storage_engine->checkpoint_manager_->Checkpoint());
+  EXPECT_EQ(syncs + 1, disk_manager->GetNumDataSyncs());
+
+  insert_committed(10);
+  EXPECT_TRUE(test_table->InsertTuple(ConstructTuple(schema), uncommitted[1],
+                                      loser));
+  storage_engine->log_manager_->Flush(true);
+  // crash: the loser never commits and the buffer pool is not flushed
+  delete loser;
+  delete test_table;
+  delete storage_engine;
+
+  storage_engine = new StorageEngine("test.db");
+  LogRecovery *log_recovery = new LogRecovery(
+      storage_engine->disk_manager_, storage_engine->buffer_pool_manager_);
+  log_recovery->Redo();
+  log_recovery->Undo();
+
+  txn = storage_engine->transaction_manager_->Begin();
+  test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                             storage_engine->lock_manager_,
+                             storage_engine->log_manager_, first_page_id);
+  Tuple tuple;
+  for (auto &rid : committed) EXPECT_TRUE(test_table->GetTuple(rid, tuple, txn));
+  for (auto &rid : uncommitted)
+    EXPECT_FALSE(test_table->GetTuple(rid, tuple, txn));
+  storage_engine->transaction_manager_->Commit(txn);
+
+  delete txn;
+  delete test_table;
+  delete log_recovery;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+}
+
+/*
+ * Parallel redo: records are spread over the redo threads by page, every
+ * page still sees its updates in log order.
+ */
+TEST(LogManagerTest, ParallelRedo) {
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  storage_engine->log_manager_->RunFlushThread();
+  auto *txn_mgr = storage_engine->transaction_manager_;
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        storage_engine->log_manager_, txn);
+  page_id_t first_page_id = test_table->GetFirstPageId();
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+
+  Schema *schema = ParseCreateStatement("a varchar, b smallint, e varchar(16)");
+  std::unordered_map<RID, Tuple> vals;
+  txn = txn_mgr->Begin();
+  for (int i = 0; i < 60; i++) {
+    RID rid;
+    Tuple tuple = ConstructTuple(schema);
+    EXPECT_TRUE(test_table->InsertTuple(tuple, rid, txn));
+    vals[rid] = tuple;
+  }
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+  for (int round = 0; round < 3; round++) {
+    txn = txn_mgr->Begin();
+    for (auto &entry : vals) {
+      Tuple tuple = ConstructTuple(schema);
+      if (test_table->UpdateTuple(tuple, entry.first, txn)) entry.second = tuple;
+    }
+    EXPECT_TRUE(txn_mgr->Commit(txn));
+    delete txn;
+  }
+  delete test_table;
+  delete storage_engine;
+
+  storage_engine = new StorageEngine("test.db");
+  LogRecovery *log_recovery = new LogRecovery(
+      storage_engine->disk_manager_, storage_engine->buffer_pool_manager_, 4);
+  log_recovery->Redo();
+  log_recovery->Undo();
+
+  test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                             storage_engine->lock_manager_,
+                             storage_engine->log_manager_, first_page_id);
+  txn = storage_engine->transaction_manager_->Begin();
+  size_t size = 0;
+  for (auto iter = test_table->begin(txn), end = test_table->end(); iter != end;
+       ++iter, ++size) {
+    auto found = vals.find(iter->GetRid());
+    ASSERT_TRUE(found != vals.end());
+    EXPECT_EQ(1, found->second.GetValue(schema, 2).CompareEquals(
+                     iter->GetValue(schema, 2)));
+  }
+  EXPECT_EQ(vals.size(), size);
+  storage_engine->transaction_manager_->Commit(txn);
+
+  delete txn;
+  delete test_table;
+  delete log_recovery;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+}
+
+/*
+ * Restart undo: the losers are rolled back in the background with CLRs while
+ * a new transaction commits. Recovering the log again replays the CLRs and
+ * finds no loser left.
+ */
+TEST(LogManagerTest, RestartUndo) {
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  storage_engine->log_manager_->RunFlushThread();
+  auto *txn_mgr = storage_engine->transaction_manager_;
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        storage_engine->log_manager_, txn);
+  page_id_t first_page_id = test_table->GetFirstPageId();
+  Schema *schema = ParseCreateStatement("a varchar, b smallint, e varchar(16)");
+  std::vector<RID> committed(4);
+  std::vector<Tuple> tuples;
+  for (auto &rid : committed) {
+    tuples.push_back(ConstructTuple(schema));
+    EXPECT_TRUE(test_table->InsertTuple(tuples.back(), rid, txn));
+  }
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+
+  // two losers: one updates and inserts, the other deletes and inserts
+  Transaction *loser1 = txn_mgr->Begin();
+  Transaction *loser2 = txn_mgr->Begin();
+  std::vector<RID> uncommitted(2);
+  EXPECT_TRUE(test_table->UpdateTuple(ConstructTuple(schema), committed[0], loser1));
+  EXPECT_TRUE(test_table->InsertTuple(ConstructTuple(schema), uncommitted[0], loser1));
+  EXPECT_TRUE(test_table->MarkDelete(committed[1], loser2));
+  EXPECT_TRUE(test_table->InsertTuple(ConstructTuple(schema), uncommitted[1], loser2));
+  storage_engine->log_manager_->Flush(true);
+  lsn_t last_lsn = storage_engine->log_manager_->GetPersistentLSN();
+  delete loser1;
+  delete loser2;
+  delete test_table;
+  delete storage_engine;
+
+  storage_engine = new StorageEngine("test.db");
+  txn_mgr = storage_engine->transaction_manager_;
+  LogRecovery *log_recovery = new LogRecovery(
+      storage_engine->disk_manager_, storage_engine->buffer_pool_manager_);
+  log_recovery->Redo();
+  log_recovery->StartUndo(txn_mgr, storage_engine->lock_manager_,
+                          storage_engine->log_manager_);
+  EXPECT_TRUE(ENABLE_LOGGING);
+
+  // open for new transactions while the losers are rolled back
+  test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                             storage_engine->lock_manager_,
+                             storage_engine->log_manager_, first_page_id);
+  txn = txn_mgr->Begin();
+  EXPECT_GT(txn->GetPrevLSN(), last_lsn);
+  committed.emplace_back();
+  tuples.push_back(ConstructTuple(schema));
+  EXPECT_TRUE(test_table->InsertTuple(tuples.back(), committed.back(), txn));
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+  log_recovery->WaitForUndo();
+  delete log_recovery;
+  storage_engine->log_manager_->Flush(true);
+  delete test_table;
+  delete storage_engine;
+
+  // crash again: the CLRs are redone, the losers have ended
+  storage_engine = new StorageEngine("test.db");
+  log_recovery = new LogRecovery(storage_engine->disk_manager_,
+                                 storage_engine->buffer_pool_manager_);
+  log_recovery->Redo();
+  log_recovery->Undo();
+  test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                             storage_engine->lock_manager_,
+                             storage_engine->log_manager_, first_page_id);
+  txn = storage_engine->transaction_manager_->Begin();
+  Tuple tuple;
+  for (size_t i = 0; i < committed.size(); i++) {
+    ASSERT_TRUE(test_table->GetTuple(committed[i], tuple, txn));
+    EXPECT_EQ(1, tuples[i].GetValue(schema, 2).CompareEquals(
+                     tuple.GetValue(schema, 2)));
+  }
+  for (auto &rid : uncommitted) {
+    if (rid.Get() != committed.back().Get()) {
+      EXPECT_FALSE(test_table->GetTuple(rid, tuple, txn));
+    }
+  }
+  storage_engine->transaction_manager_->Commit(txn);
+
+  delete txn;
+  delete test_table;
+  delete log_recovery;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+}
+
+// the log of a loser spans several recovery read windows
+TEST(LogManagerTest, LargeLogRecovery) {
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  storage_engine->log_manager_->RunFlushThread();
+  auto *txn_mgr = storage_engine->transaction_manager_;
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        storage_engine->log_manager_, txn);
+  page_id_t first_page_id = test_table->GetFirstPageId();
+  Schema *schema = ParseCreateStatement("a varchar, b smallint, e varchar(16)");
+  RID rid;
+  Tuple tuple = ConstructTuple(schema);
+  EXPECT_TRUE(test_table->InsertTuple(tuple, rid, txn));
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+
+  Transaction *loser = txn_mgr->Begin();
+  while (storage_engine->disk_manager_->GetLogEnd() < 2 * LOG_READ_SIZE)
+    EXPECT_TRUE(test_table->UpdateTuple(ConstructTuple(schema), rid, loser));
+  storage_engine->log_manager_->Flush(true);
+  delete loser;
+  delete test_table;
+  delete storage_engine;
+
+  storage_engine = new StorageEngine("test.db");
+  LogRecovery *log_recovery = new LogRecovery(
+      storage_engine->disk_manager_, storage_engine->buffer_pool_manager_);
+  log_recovery->Redo();
+  log_recovery->Undo();
+  test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                             storage_engine->lock_manager_,
+                             storage_engine->log_manager_, first_page_id);
+  txn = storage_engine->transaction_manager_->Begin();
+  Tuple old_tuple;
+  ASSERT_TRUE(test_table->GetTuple(rid, old_tuple, txn));
+  EXPECT_EQ(1, tuple.GetValue(schema, 2).CompareEquals(old_tuple.GetValue(schema, 2)));
+  storage_engine->transaction_manager_->Commit(txn);
+
+  delete txn;
+  delete test_table;
+  delete log_recovery;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+}
+
+// B+ tree operations are redone from the log, an unfinished one is undone
+TEST(LogManagerTest, IndexRecovery) {
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  storage_engine->log_manager_->RunFlushThread();
+  auto *bpm = storage_engine->buffer_pool_manager_;
+  auto *txn_mgr = storage_engine->transaction_manager_;
+  page_id_t header_page_id;
+  bpm->NewPage(header_page_id);
+  EXPECT_EQ(HEADER_PAGE_ID, header_page_id);
+  bpm->UnpinPage(header_page_id, true);
+
+  Schema *key_schema = ParseCreateStatement("a bigint");
+  GenericComparator<8> comparator(key_schema);
+  auto *tree = new BPlusTree<GenericKey<8>, RID, GenericComparator<8>>(
+      "foo_pk", bpm, comparator, INVALID_PAGE_ID, storage_engine->log_manager_);
+  GenericKey<8> index_key;
+  // splits while inserting, merges and redistributions while removing
+  Transaction *txn = txn_mgr->Begin();
+  for (int64_t key = 1; key <= 300; key++) {
+    index_key.SetFromInteger(key);
+    EXPECT_TRUE(tree->Insert(index_key, RID(key), txn));
+  }
+  for (int64_t key = 1; key <= 300; key += 3) {
+    index_key.SetFromInteger(key);
+    tree->Remove(index_key, txn);
+  }
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+
+  // a loser: its finished tree operations stay, like on abort
+  Transaction *loser = txn_mgr->Begin();
+  for (int64_t key = 301; key <= 320; key++) {
+    index_key.SetFromInteger(key);
+    EXPECT_TRUE(tree->Insert(index_key, RID(key), loser));
+  }
+  // and an operation that did not reach its INDEX_END
+  auto *header_page = static_cast<HeaderPage *>(bpm->FetchPage(HEADER_PAGE_ID));
+  IndexLog log(storage_engine->log_manager_, loser);
+  log.Track(header_page);
+  header_page->UpdateRecord("foo_pk", 12345);
+  log.Log(header_page, LogRecordType::INDEX_ROOT);
+  bpm->UnpinPage(HEADER_PAGE_ID, true);
+  storage_engine->log_manager_->Flush(true);
+  delete loser;
+  delete tree;
+  delete storage_engine;
+
+  storage_engine = new StorageEngine("test.db");
+  bpm = storage_engine->buffer_pool_manager_;
+  LogRecovery *log_recovery = new LogRecovery(storage_engine->disk_manager_, bpm);
+  log_recovery->Redo();
+  log_recovery->Undo();
+  delete log_recovery;
+
+  header_page = static_cast<HeaderPage *>(bpm->FetchPage(HEADER_PAGE_ID));
+  page_id_t root_page_id;
+  EXPECT_TRUE(header_page->GetRootId("foo_pk", root_page_id));
+  EXPECT_NE(12345, root_page_id);
+  bpm->UnpinPage(HEADER_PAGE_ID, false);
+  tree = new BPlusTree<GenericKey<8>, RID, GenericComparator<8>>(
+      "foo_pk", bpm, comparator, root_page_id);
+  EXPECT_TRUE(tree->Check(true));
+  std::vector<RID> rids;
+  for (int64_t key = 1; key <= 320; key++) {
+    rids.clear();
+    index_key.SetFromInteger(key);
+    bool removed = key <= 300 && key % 3 == 1;
+    EXPECT_EQ(!removed, tree->GetValue(index_key, rids)) << key;
+  }
+
+  delete tree;
+  delete key_schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+}
+
+/*
+ * Every record type comes back from the log as it was appended, and the
+ * compact encoding keeps small records small: an update stores only the
+ * bytes of the new tuple that differ from the old one.
+ */
+TEST(LogManagerTest, CompactEncoding) {
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  auto *log_mgr = storage_engine->log_manager_;
+  log_mgr->RunFlushThread();
+  Schema *schema = ParseCreateStatement("a varchar, b bigint, c bigint");
+  Tuple old_tuple = ConstructTuple(schema);
+  Tuple new_tuple = old_tuple;
+  new_tuple.GetData()[sizeof(int32_t)] ^= 1;
+
+  txn_id_t txn_id = 1000;
+  std::vector<LogRecord> records;
+  records.reserve(10);
+  records.emplace_back(txn_id, INVALID_LSN, LogRecordType::BEGIN);
+  records.emplace_back(txn_id, 0, LogRecordType::INSERT, RID{3, 7}, old_tuple);
+  records.emplace_back(txn_id, 1, LogRecordType::UPDATE, RID{3, 7}, old_tuple,
+                       new_tuple);
+  records.emplace_back(txn_id, 2, LogRecordType::MARKDELETE, RID{3, 7},
+                       new_tuple);
+  records.emplace_back(txn_id, 3, LogRecordType::NEWPAGE, 3, 4);
+  records.emplace_back(txn_id, 4, LogRecordType::INDEX_SPLIT, 5, 24,
+                       std::string("abc"), std::string("xyz"));
+  records.emplace_back(txn_id, 5, 4);
+  records.emplace_back(txn_id, 6, 2, records[2]);
+  records.emplace_back(INVALID_LSN, DirtyPageTable{{3, 1}, {5, 5}},
+                       ActiveTxnTable{{txn_id, 0}});
+  records.emplace_back(txn_id, 7, LogRecordType::COMMIT);
+  for (size_t i = 0; i < records.size(); i++)
+    EXPECT_EQ((lsn_t)i, log_mgr->AppendLogRecord(records[i]));
+  log_mgr->StopFlushThread();
+
+  std::vector<char> log(storage_engine->disk_manager_->GetLogEnd());
+  ASSERT_TRUE(storage_engine->disk_manager_->ReadLog(log.data(),
+                                                     (int)log.size(), 0));
+  const char *data = log.data(), *end = data + log.size();
+  auto same = [](const Tuple &a, const Tuple &b) {
+    return a.GetLength() == b.GetLength() &&
+           memcmp(a.GetData(), b.GetData(), a.GetLength()) == 0;
+  };
+  std::vector<LogRecord> reads(records.size());
+  for (size_t i = 0; i < records.size(); i++) {
+    LogRecord &record = records[i], &read = reads[i];
+    ASSERT_TRUE(LogRecovery::DeserializeLogRecord(data, end, read));
+    EXPECT_EQ(record.GetSize(), read.GetSize());
+    EXPECT_EQ(record.GetLSN(), read.GetLSN());
+    EXPECT_EQ(record.GetTxnId(), read.GetTxnId());
+    EXPECT_EQ(record.GetPrevLSN(), read.GetPrevLSN());
+    EXPECT_EQ(record.GetLogRecordType(), read.GetLogRecordType());
+    EXPECT_EQ(record.GetActionType(), read.GetActionType());
+    data += read.GetSize();
+  }
+  EXPECT_EQ(end, data);
+
+  // the fields of each type
+  EXPECT_EQ(RID(3, 7), reads[1].GetInsertRID());
+  EXPECT_TRUE(same(old_tuple, reads[1].GetInserteTuple()));
+  EXPECT_EQ(RID(3, 7), reads[2].GetUpdateRID());
+  EXPECT_TRUE(same(old_tuple, reads[2].GetOldTuple()));
+  EXPECT_TRUE(same(new_tuple, reads[2].GetNewTuple()));
+  // the new tuple is one byte apart from the old one
+  EXPECT_LT(reads[2].GetSize(), old_tuple.GetLength() + 20);
+  EXPECT_EQ(RID(3, 7), reads[3].GetDeleteRID());
+  EXPECT_EQ(3, reads[4].GetNewPageRecord());
+  EXPECT_EQ(4, reads[6].GetUndoNextLSN());
+  EXPECT_EQ(2, reads[7].GetUndoNextLSN());
+  EXPECT_TRUE(same(new_tuple, reads[7].GetNewTuple()));
+  EXPECT_EQ(INVALID_LSN, reads[8].GetBeginLSN());
+  EXPECT_EQ((DirtyPageTable{{3, 1}, {5, 5}}), reads[8].GetDirtyPages());
+  EXPECT_EQ((ActiveTxnTable{{txn_id, 0}}), reads[8].GetActiveTxns());
+  // a commit is a header of a few bytes
+  EXPECT_LE(reads[9].GetSize(), 10);
+
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+}
+
+/*
+ * Hot standby in a second process: the primary (a child process) commits a
+ * transaction before the standby listens, the standby catches up on it from
+ * the primary's log once it connects and then follows a second transaction
+ * live. A restarted standby redoes its own log.
+ */
+TEST(LogManagerTest, HotStandby) {
+  const char *files[] = {"primary.db", "primary.log", "standby.db",
+                         "standby.log", "standby.sock"};
+  for (auto file : files)
+    remove(file);
+  Schema *schema = ParseCreateStatement("a bigint, b bigint");
+  const int num_tuples = 50;
+  int to_standby[2], to_primary[2];
+  ASSERT_EQ(0, pipe(to_standby));
+  ASSERT_EQ(0, pipe(to_primary));
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // primary: report the table and the persistent LSN after each commit
+    auto report = [&](int32_t value) {
+      if (write(to_standby[1], &value, sizeof(value)) != sizeof(value))
+        _exit(1);
+    };
+    StorageEngine *storage_engine = new StorageEngine("primary.db");
+    LogShipper shipper(storage_engine->disk_manager_, "standby.sock");
+    storage_engine->log_manager_->SetLogShipper(&shipper);
+    storage_engine->log_manager_->RunFlushThread();
+    auto *txn_mgr = storage_engine->transaction_manager_;
+    Transaction *txn = txn_mgr->Begin();
+    TableHeap table(storage_engine->buffer_pool_manager_,
+                    storage_engine->lock_manager_,
+                    storage_engine->log_manager_, txn);
+    std::vector<RID> rids(num_tuples);
+    for (int i = 0; i < num_tuples; i++) {
+      Tuple tuple({Value(TypeId::BIGINT, (int64_t)i),
+                   Value(TypeId::BIGINT, (int64_t)i)}, schema);
+      if (!table.InsertTuple(tuple, rids[i], txn))
+        _exit(1);
+    }
+    txn_mgr->Commit(txn);
+    delete txn;
+    report(table.GetFirstPageId());
+    report(storage_engine->log_manager_->GetPersistentLSN());
+
+    // wait for the standby to listen
+    char ready;
+    if (read(to_primary[0], &ready, 1) != 1)
+      _exit(1);
+    txn = txn_mgr->Begin();
+    for (int i = 0; i < num_tuples; i++) {
+      Tuple tuple({Value(TypeId::BIGINT, (int64_t)i),
+                   Value(TypeId::BIGINT, (int64_t)-i)}, schema);
+      if (i == 0 ? !table.MarkDelete(rids[i], txn)
+                 : !table.UpdateTuple(tuple, rids[i], txn))
+        _exit(1);
+    }
+    txn_mgr->Commit(txn);
+    delete txn;
+    report(storage_engine->log_manager_->GetPersistentLSN());
+    storage_engine->log_manager_->StopFlushThread();
+    delete storage_engine;
+    _exit(0);
+  }
+
+  auto receive = [&]() {
+    int32_t value = INVALID_LSN;
+    EXPECT_EQ((ssize_t)sizeof(value), read(to_standby[0], &value, sizeof(value)));
+    return value;
+  };
+  page_id_t first_page_id = receive();
+  lsn_t first_lsn = receive();
+  // the b column of every tuple on the standby, by a
+  auto scan = [&](LogReplica &replica) {
+    std::map<int64_t, int64_t> rows;
+    replica.Read([&](BufferPoolManager *bpm) {
+      Transaction txn(0);
+      TableHeap table(bpm, nullptr, nullptr, first_page_id);
+      for (auto it = table.begin(&txn); it != table.end(); ++it)
+        rows[it->GetValue(schema, 0).GetAs<int64_t>()] =
+            it->GetValue(schema, 1).GetAs<int64_t>();
+    });
+    return rows;
+  };
+
+  auto *replica = new LogReplica("standby.db", "standby.sock");
+  replica->Start();
+  ASSERT_EQ(1, write(to_primary[1], "r", 1));
+  lsn_t second_lsn = receive();
+  EXPECT_LT(first_lsn, second_lsn);
+  ASSERT_TRUE(replica->WaitForLSN(second_lsn, std::chrono::seconds(10)));
+  auto rows = scan(*replica);
+  EXPECT_EQ((size_t)num_tuples - 1, rows.size());
+  for (auto &row : rows)
+    EXPECT_EQ(-row.first, row.second);
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  delete replica;
+
+  replica = new LogReplica("standby.db", "standby.sock");
+  replica->Start();
+  EXPECT_LE(second_lsn, replica->GetAppliedLSN());
+  EXPECT_EQ(rows, scan(*replica));
+  delete replica;
+
+  for (int fd : {to_standby[0], to_standby[1], to_primary[0], to_primary[1]})
+    close(fd);
+  delete schema;
+  for (auto file : files)
+    remove(file);
+}
+
+/*
+ * The shipper runs on the flush thread, so a standby that connects and then
+ * stops reading is dropped after LOG_SHIP_TIMEOUT_MS instead of stalling
+ * every commit, and not tried again for as long. A new standby that asks
+ * for log the primary already truncated is refused.
+ */
+TEST(LogManagerTest, LogShipperLimits) {
+  const char *files[] = {"ship.db", "ship.sock"};
+  for (auto file : files)
+    remove(file);
+  DiskManager *disk_manager = new DiskManager("ship.db", 1, 8192);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, "ship.sock", sizeof(addr.sun_path) - 1);
+  ASSERT_EQ(0, bind(listen_fd, reinterpret_cast<sockaddr *>(&addr),
+                    sizeof(addr)));
+  ASSERT_EQ(0, listen(listen_fd, 4));
+  // a standby asking for the log from offset, it reads nothing afterwards
+  // and returns what it gets from recv once the primary closes
+  auto standby = [&](int64_t offset) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    EXPECT_EQ((ssize_t)sizeof(offset),
+              ::send(fd, &offset, sizeof(offset), MSG_NOSIGNAL));
+    return fd;
+  };
+
+  LogShipper shipper(disk_manager, "ship.sock");
+  std::vector<char> data(8 << 20);
+  auto stalled = std::async(std::launch::async, [&] { return standby(0); });
+  auto start = std::chrono::steady_clock::now();
+  shipper.Ship(data.data(), static_cast<int>(data.size()), 0);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_GE(elapsed, std::chrono::milliseconds(LOG_SHIP_TIMEOUT_MS));
+  EXPECT_LT(elapsed, std::chrono::milliseconds(5 * LOG_SHIP_TIMEOUT_MS));
+  int stalled_fd = stalled.get();
+  // backing off: returns at once without connecting
+  start = std::chrono::steady_clock::now();
+  shipper.Ship(data.data(), static_cast<int>(data.size()), 0);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(LOG_SHIP_TIMEOUT_MS / 2));
+  close(stalled_fd);
+
+  // truncate the log past offset 0
+  std::vector<char> buffers[2] = {std::vector<char>(3000),
+                                  std::vector<char>(3000)};
+  for (int i = 0; i < 10; i++)
+    EXPECT_TRUE(disk_manager->WriteLog(buffers[i % 2].data(), 3000));
+  EXPECT_GT(disk_manager->TruncateLog(disk_manager->GetLogEnd()), 0);
+  ASSERT_GT(disk_manager->GetLogStart(), 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(LOG_SHIP_TIMEOUT_MS));
+  auto refused = std::async(std::launch::async, [&] {
+    int fd = standby(0);
+    char byte;
+    ssize_t n = recv(fd, &byte, 1, 0);
+    close(fd);
+    return n;
+  });
+  shipper.Ship(buffers[0].data(), 3000, disk_manager->GetLogEnd());
+  EXPECT_EQ(0, refused.get());
+
+  close(listen_fd);
+  delete disk_manager;
+  for (auto file : files)
+    remove(file);
+  for (int start : {0, 9000, 18000, 27000}) {
+    char name[64];
+    snprintf(name, sizeof(name), "ship.log.%016x", start);
+    remove(name);
+  }
+}
+
+/*
+ * Per-transaction log buffers: a transaction's records are staged and merged
+ * into the log in one reservation at commit. Two transactions inserting into
+ * the same page force each other's buffers out, so the log keeps the page's
+ * order and redo puts every tuple back into its slot.
+ */
+TEST(LogManagerTest, TxnLogBuffer) {
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  storage_engine->log_manager_->RunFlushThread();
+  auto *txn_mgr = storage_engine->transaction_manager_;
+  auto *log_manager = storage_engine->log_manager_;
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        log_manager, txn);
+  page_id_t first_page_id = test_table->GetFirstPageId();
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+
+  Schema *schema = ParseCreateStatement("b smallint, c bigint");
+  std::unordered_map<RID, Tuple> vals;
+  // BEGIN, then the inserts and the COMMIT in one merge
+  uint64_t reservations = log_manager->GetReservationCount();
+  txn = txn_mgr->Begin();
+  for (int i = 0; i < 10; i++) {
+    RID rid;
+    Tuple tuple = ConstructTuple(schema);
+    EXPECT_TRUE(test_table->InsertTuple(tuple, rid, txn));
+    vals[rid] = tuple;
+  }
+  EXPECT_EQ(reservations + 1, log_manager->GetReservationCount());
+  lsn_t begin_lsn = txn->GetPrevLSN();
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  EXPECT_EQ(reservations + 2, log_manager->GetReservationCount());
+  // BEGIN, 10 INSERTs, COMMIT
+  EXPECT_EQ(begin_lsn + 11, txn->GetPrevLSN());
+  delete txn;
+
+  Transaction *t1 = txn_mgr->Begin();
+  Transaction *t2 = txn_mgr->Begin();
+  for (int i = 0; i < 10; i++) {
+    Transaction *owner = i % 2 == 0 ? t1 : t2;
+    RID rid;
+    Tuple tuple = ConstructTuple(schema);
+    EXPECT_TRUE(test_table->InsertTuple(tuple, rid, owner));
+    vals[rid] = tuple;
+  }
+  EXPECT_TRUE(txn_mgr->Commit(t1));
+  EXPECT_TRUE(txn_mgr->Commit(t2));
+  delete t1;
+  delete t2;
+
+  // flushing a page merges its staged records, which reach the disk first
+  txn = txn_mgr->Begin();
+  RID staged;
+  EXPECT_TRUE(test_table->InsertTuple(ConstructTuple(schema), staged, txn));
+  auto *bpm = storage_engine->buffer_pool_manager_;
+  EXPECT_TRUE(bpm->FlushPage(staged.GetPageId()));
+  Page *page = bpm->FetchPage(staged.GetPageId());
+  EXPECT_GE(log_manager->GetPersistentLSN(), page->GetLSN());
+  bpm->UnpinPage(page->GetPageId(), false);
+  txn_mgr->Abort(txn);
+  delete txn;
+  delete test_table;
+  delete storage_engine;
+
+  storage_engine = new StorageEngine("test.db");
+  LogRecovery *log_recovery = new LogRecovery(
+      storage_engine->disk_manager_, storage_engine->buffer_pool_manager_);
+  log_recovery->Redo();
+  log_recovery->Undo();
+
+  test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                             storage_engine->lock_manager_,
+                             storage_engine->log_manager_, first_page_id);
+  txn = storage_engine->transaction_manager_->Begin();
+  size_t size = 0;
+  for (auto iter = test_table->begin(txn), end = test_table->end(); iter != end;
+       ++iter, ++size) {
+    auto found = vals.find(iter->GetRid());
+    ASSERT_TRUE(found != vals.end());
+    EXPECT_EQ(1, found->second.GetValue(schema, 1).CompareEquals(
+                     iter->GetValue(schema, 1)));
+  }
+  EXPECT_EQ(vals.size(), size);
+  storage_engine->transaction_manager_->Commit(txn);
+
+  delete txn;
+  delete test_table;
+  delete log_recovery;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+}
+
+/*
+ * Compressed log segments: the codec round-trips, and a log whose segments
+ * were compressed recovers, including undo reading a loser's records back
+ * out of compressed segments.
+ */
+TEST(LogManagerTest, LogCompression) {
+  std::string text;
+  for (int i = 0; text.size() < 4000; i++)
+    text += "order " + std::to_string(i % 37) + " shipped, no damage reported; ";
+  std::mt19937 random(7);
+  for (int i = 0; i < 200; i++) text[random() % text.size()] = static_cast<char>(random());
+  std::vector<char> compressed(text.size()), decompressed(text.size());
+  for (int level : {1, 4, 16}) {
+    int size = LogCompressor::Compress(text.data(), static_cast<int>(text.size()),
+                                       compressed.data(), static_cast<int>(compressed.size()),
+                                       level);
+    ASSERT_GT(size, 0);
+    EXPECT_LT(size, static_cast<int>(text.size()) / 2);
+    ASSERT_TRUE(LogCompressor::Decompress(compressed.data(), size, decompressed.data(),
+                                          static_cast<int>(text.size())));
+    EXPECT_EQ(text, std::string(decompressed.data(), decompressed.size()));
+    EXPECT_FALSE(LogCompressor::Decompress(compressed.data(), size - 1, decompressed.data(),
+                                           static_cast<int>(text.size())));
+  }
+  // random bytes do not fit into fewer bytes
+  std::string noise(1000, 0);
+  for (auto &byte : noise) byte = static_cast<char>(random());
+  EXPECT_EQ(0, LogCompressor::Compress(noise.data(), 1000, compressed.data(), 999, 4));
+
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+  LOG_COMPRESSION_LEVEL = 4;
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  storage_engine->log_manager_->RunFlushThread();
+  auto *txn_mgr = storage_engine->transaction_manager_;
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                        storage_engine->lock_manager_,
+                                        storage_engine->log_manager_, txn);
+  page_id_t first_page_id = test_table->GetFirstPageId();
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+
+  Schema *schema = ParseCreateStatement("a int, b varchar(200)");
+  auto row = [&](int a, const std::string &b) {
+    std::vector<Value> values{Value(TypeId::INTEGER, a),
+                              Value(TypeId::VARCHAR, b.c_str(),
+                                    static_cast<int>(b.size()) + 1, true)};
+    return Tuple(values, schema);
+  };
+  std::string note = "customer note: delivered to the front desk, signed by reception";
+  std::map<int, RID> rids;
+  txn = txn_mgr->Begin();
+  for (int i = 0; i < 40; i++) {
+    RID rid;
+    ASSERT_TRUE(test_table->InsertTuple(row(i, note), rid, txn));
+    rids[i] = rid;
+  }
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+  // a loser whose records are on disk when the system crashes
+  Transaction *loser = txn_mgr->Begin();
+  for (int i = 0; i < 40; i += 4)
+    EXPECT_TRUE(test_table->UpdateTuple(row(i, "returned"), rids[i], loser));
+  storage_engine->log_manager_->MergeLogRecords(loser);
+  storage_engine->log_manager_->Flush(true);
+  auto stats = storage_engine->log_manager_->GetFlushStats();
+  EXPECT_GT(stats.flushes, 0u);
+  EXPECT_GT(stats.CompressionRatio(), 1.5);
+  EXPECT_GT(stats.Throughput(), 0);
+  delete loser;
+  delete test_table;
+  delete storage_engine;
+
+  storage_engine = new StorageEngine("test.db");
+  LogRecovery *log_recovery = new LogRecovery(
+      storage_engine->disk_manager_, storage_engine->buffer_pool_manager_);
+  log_recovery->Redo();
+  log_recovery->Undo();
+  test_table = new TableHeap(storage_engine->buffer_pool_manager_,
+                             storage_engine->lock_manager_,
+                             storage_engine->log_manager_, first_page_id);
+  txn = storage_engine->transaction_manager_->Begin();
+  Value expected(TypeId::VARCHAR, note.c_str(), static_cast<int>(note.size()) + 1, true);
+  size_t size = 0;
+  for (auto iter = test_table->begin(txn), end = test_table->end(); iter != end;
+       ++iter, ++size)
+    EXPECT_EQ(1, expected.CompareEquals(iter->GetValue(schema, 1)));
+  EXPECT_EQ(rids.size(), size);
+  storage_engine->transaction_manager_->Commit(txn);
+
+  LOG_COMPRESSION_LEVEL = 0;
+  delete txn;
+  delete test_table;
+  delete log_recovery;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+  remove("test.master");
+}
+
+/*
+ * Append benchmark: many threads append insert records concurrently. Prints
+ * the append throughput, then reads the log back and checks that every LSN
+ * was written exactly once, in order.
+ */
+TEST(LogManagerTest, ConcurrentAppendBenchmark) {
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  auto *log_mgr = storage_engine->log_manager_;
+  log_mgr->RunFlushThread();
+
+  const int num_threads = 32;
+  const int records_per_thread = 2000;
+  Schema *schema = ParseCreateStatement("a varchar, b bigint, c bigint");
+  Tuple tuple = ConstructTuple(schema);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < records_per_thread; i++) {
+        LogRecord log{t, INVALID_LSN, LogRecordType::INSERT, RID{t, i}, tuple};
+        log_mgr->AppendLogRecord(log);
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  log_mgr->StopFlushThread();
+  int num_records = num_threads * records_per_thread;
+  LOG_INFO("%d threads appended %d records, %lld records/s", num_threads,
+           num_records, (long long)num_records * 1000000 / (us + 1));
+
+  std::vector<char> log(storage_engine->disk_manager_->GetLogEnd());
+  ASSERT_TRUE(storage_engine->disk_manager_->ReadLog(log.data(),
+                                                     (int)log.size(), 0));
+  const char *data = log.data(), *end = data + log.size();
+  LogRecord record;
+  std::vector<int> next_slot(num_threads, 0);
+  for (int i = 0; i < num_records; i++) {
+    ASSERT_TRUE(LogRecovery::DeserializeLogRecord(data, end, record));
+    ASSERT_EQ(i, record.GetLSN());
+    // records of one thread keep their order
+    RID rid = record.GetInsertRID();
+    ASSERT_EQ(next_slot[rid.GetPageId()]++, rid.GetSlotNum());
+    data += record.GetSize();
+  }
+  EXPECT_EQ(end, data);
+
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+}
+
 } // namespace cmudb
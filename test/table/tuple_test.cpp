@@ -61,4 +61,47 @@ TEST(TupleTest, TableHeapTest) {
   delete disk_manager;
 }
 
+// an insert locks only the page the tuple lands on, not the full pages it
+// passes on the way, so an S lock on one of those does not stop it
+TEST(TupleTest, InsertLocksLandingPage) {
+  remove("test.db");
+  remove("test.log");
+  StorageEngine *storage_engine = new StorageEngine("test.db");
+  storage_engine->log_manager_->RunFlushThread();
+  auto *txn_mgr = storage_engine->transaction_manager_;
+  auto *lock_mgr = storage_engine->lock_manager_;
+  Schema *schema = ParseCreateStatement("a varchar, b smallint, c bigint");
+
+  Transaction *txn = txn_mgr->Begin();
+  TableHeap *table = new TableHeap(storage_engine->buffer_pool_manager_,
+                                   lock_mgr, storage_engine->log_manager_, txn);
+  page_id_t first_page_id = table->GetFirstPageId();
+  RID rid;
+  do {
+    EXPECT_TRUE(table->InsertTuple(ConstructTuple(schema), rid, txn));
+  } while (rid.GetPageId() == first_page_id);
+  EXPECT_TRUE(txn_mgr->Commit(txn));
+  delete txn;
+
+  // the older reader holds S on the full first page
+  Transaction *reader = txn_mgr->Begin();
+  EXPECT_TRUE(lock_mgr->LockPage(reader, first_page_id, first_page_id,
+                                 LockMode::SHARED));
+  Transaction *writer = txn_mgr->Begin();
+  EXPECT_TRUE(table->InsertTuple(ConstructTuple(schema), rid, writer));
+  EXPECT_NE(first_page_id, rid.GetPageId());
+  EXPECT_EQ(1U, writer->GetPageLockSet()->size());
+  EXPECT_EQ(1U, writer->GetPageLockSet()->count(rid.GetPageId()));
+  EXPECT_TRUE(txn_mgr->Commit(writer));
+  EXPECT_TRUE(txn_mgr->Commit(reader));
+  delete writer;
+  delete reader;
+
+  delete table;
+  delete schema;
+  delete storage_engine;
+  remove("test.db");
+  remove("test.log");
+}
+
 } // namespace cmudb
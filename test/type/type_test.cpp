@@ -2,6 +2,7 @@
  * type_test.cpp
  */
 #include "common/exception.h"
+#include "type/type_kernel.h"
 #include "type/value.h"
 #include "gtest/gtest.h"
 
@@ -76,4 +77,158 @@ TEST(TypeTests, TemplateTest) {
   BPlusTreePage<Value, Value> node;
   node.GetInfo(val1, val2);
 }
+
+TEST(TypeTests, VarlenStorageTest) {
+  // short strings are kept inside the value, long ones on the heap
+  std::string short_str = "short", long_str(100, 'x');
+  Value short_val(TypeId::VARCHAR, short_str);
+  Value long_val(TypeId::VARCHAR, long_str);
+  EXPECT_TRUE(short_val.GetData() >= reinterpret_cast<char *>(&short_val) &&
+              short_val.GetData() < reinterpret_cast<char *>(&short_val + 1));
+  EXPECT_FALSE(long_val.GetData() >= reinterpret_cast<char *>(&long_val) &&
+               long_val.GetData() < reinterpret_cast<char *>(&long_val + 1));
+  std::vector<Value> values(4, short_val);
+  values.push_back(long_val);
+  values = std::vector<Value>(values.rbegin(), values.rend());
+  EXPECT_EQ(values[0].ToString(), long_str);
+  EXPECT_EQ(values[4].ToString(), short_str);
+  Value other(TypeId::VARCHAR, long_str);
+  std::swap(other, values[1]);
+  EXPECT_EQ(other.ToString(), short_str);
+  EXPECT_EQ(values[1].ToString(), long_str);
+
+  // views point into the serialized data, Copy owns its bytes
+  char storage[128];
+  for (auto *val : {&short_val, &long_val}) {
+    val->SerializeTo(storage);
+    Value view = Value::DeserializeView(storage, TypeId::VARCHAR);
+    EXPECT_EQ(view.GetData(), storage + sizeof(uint32_t));
+    EXPECT_EQ(view.CompareEquals(*val), CMP_TRUE);
+    Value copy = view.Copy();
+    Value owned = Value::DeserializeFrom(storage, TypeId::VARCHAR);
+    memset(storage, 0, sizeof(storage));
+    EXPECT_EQ(copy.CompareEquals(*val), CMP_TRUE);
+    EXPECT_EQ(owned.CompareEquals(*val), CMP_TRUE);
+  }
+  Value(TypeId::VARCHAR, nullptr, 0, false).SerializeTo(storage);
+  EXPECT_TRUE(Value::DeserializeView(storage, TypeId::VARCHAR).IsNull());
+  Value int_val(TypeId::INTEGER, 7);
+  int_val.SerializeTo(storage);
+  EXPECT_EQ(Value::DeserializeView(storage, TypeId::INTEGER)
+                .CompareEquals(int_val),
+            CMP_TRUE);
+}
+
+TEST(TypeTests, KernelTest) {
+  // every numeric pair agrees with the Value operations, NULLs included
+  const std::vector<TypeId> numeric_types = {
+      TypeId::TINYINT, TypeId::SMALLINT, TypeId::INTEGER, TypeId::BIGINT,
+      TypeId::DECIMAL};
+  auto make = [](TypeId type, int v) {
+    if (type == TypeId::DECIMAL)
+      return Value(type, v + 0.5);
+    return Value(TypeId::BIGINT, static_cast<int64_t>(v)).CastAs(type);
+  };
+  auto make_null = [](TypeId type) {
+    switch (type) {
+    case TypeId::TINYINT:
+      return Value(type, PELOTON_INT8_NULL);
+    case TypeId::SMALLINT:
+      return Value(type, PELOTON_INT16_NULL);
+    case TypeId::INTEGER:
+      return Value(type, PELOTON_INT32_NULL);
+    case TypeId::BIGINT:
+      return Value(type, PELOTON_INT64_NULL);
+    default:
+      return Value(type, PELOTON_DECIMAL_NULL);
+    }
+  };
+  // the kernel wrote the same value the Value operation returned
+  auto expect_result = [](const char *result, TypeId result_type,
+                          const Value &expected) {
+    Value actual = Value::DeserializeFrom(result, result_type);
+    EXPECT_EQ(actual.IsNull(), expected.IsNull());
+    if (!expected.IsNull()) {
+      EXPECT_EQ(result_type, expected.GetTypeId());
+      EXPECT_EQ(actual.ToString(), expected.ToString());
+    }
+  };
+  const TypeKernel::CompareOp ops[] = {
+      TypeKernel::EQUAL,        TypeKernel::NOT_EQUAL,
+      TypeKernel::LESS_THAN,    TypeKernel::LESS_THAN_EQUAL,
+      TypeKernel::GREATER_THAN, TypeKernel::GREATER_THAN_EQUAL};
+  char left[16], right[16], result[16];
+  for (auto left_type : numeric_types) {
+    for (auto right_type : numeric_types) {
+      auto compare = TypeKernel::GetCompare(left_type, right_type);
+      ASSERT_NE(compare, nullptr);
+      std::vector<Value> lefts = {make(left_type, -3), make(left_type, 7),
+                                  make(left_type, 0), make_null(left_type)};
+      std::vector<Value> rights = {make(right_type, 7), make(right_type, -3),
+                                   make(right_type, 2), make_null(right_type)};
+      for (auto &l : lefts) {
+        for (auto &r : rights) {
+          l.SerializeTo(left);
+          r.SerializeTo(right);
+          int order = compare(left, right);
+          EXPECT_EQ(TypeKernel::Evaluate(ops[0], order), l.CompareEquals(r));
+          EXPECT_EQ(TypeKernel::Evaluate(ops[1], order),
+                    l.CompareNotEquals(r));
+          EXPECT_EQ(TypeKernel::Evaluate(ops[2], order), l.CompareLessThan(r));
+          EXPECT_EQ(TypeKernel::Evaluate(ops[3], order),
+                    l.CompareLessThanEquals(r));
+          EXPECT_EQ(TypeKernel::Evaluate(ops[4], order),
+                    l.CompareGreaterThan(r));
+          EXPECT_EQ(TypeKernel::Evaluate(ops[5], order),
+                    l.CompareGreaterThanEquals(r));
+
+          TypeId result_type;
+          auto add = TypeKernel::GetArithmetic(TypeKernel::ADD, left_type,
+                                               right_type, &result_type);
+          auto multiply = TypeKernel::GetArithmetic(
+              TypeKernel::MULTIPLY, left_type, right_type, &result_type);
+          auto divide = TypeKernel::GetArithmetic(
+              TypeKernel::DIVIDE, left_type, right_type, &result_type);
+          add(left, right, result);
+          expect_result(result, result_type, l.Add(r));
+          multiply(left, right, result);
+          expect_result(result, result_type, l.Multiply(r));
+          divide(left, right, result);
+          expect_result(result, result_type, l.Divide(r));
+        }
+      }
+    }
+  }
+
+  // overflow and division by zero throw like the Value operations
+  TypeId result_type;
+  auto add = TypeKernel::GetArithmetic(TypeKernel::ADD, TypeId::TINYINT,
+                                       TypeId::TINYINT, &result_type);
+  EXPECT_EQ(result_type, TypeId::TINYINT);
+  Value(TypeId::TINYINT, static_cast<int8_t>(100)).SerializeTo(left);
+  EXPECT_THROW(add(left, left, result), Exception);
+  auto divide = TypeKernel::GetArithmetic(TypeKernel::DIVIDE, TypeId::INTEGER,
+                                          TypeId::BIGINT, &result_type);
+  EXPECT_EQ(result_type, TypeId::BIGINT);
+  Value(TypeId::INTEGER, 5).SerializeTo(left);
+  Value(TypeId::BIGINT, static_cast<int64_t>(0)).SerializeTo(right);
+  EXPECT_THROW(divide(left, right, result), Exception);
+
+  // VARCHAR only with VARCHAR, the rest goes through Value
+  char varlen_left[32], varlen_right[32];
+  auto compare = TypeKernel::GetCompare(TypeId::VARCHAR, TypeId::VARCHAR);
+  Value(TypeId::VARCHAR, "apple").SerializeTo(varlen_left);
+  Value(TypeId::VARCHAR, "apples").SerializeTo(varlen_right);
+  EXPECT_EQ(compare(varlen_left, varlen_right), -1);
+  EXPECT_EQ(compare(varlen_right, varlen_left), 1);
+  EXPECT_EQ(compare(varlen_left, varlen_left), 0);
+  Value(TypeId::VARCHAR, nullptr, 0, false).SerializeTo(varlen_right);
+  EXPECT_EQ(compare(varlen_left, varlen_right), TypeKernel::ORDER_NULL);
+  EXPECT_EQ(TypeKernel::GetCompare(TypeId::VARCHAR, TypeId::INTEGER), nullptr);
+  EXPECT_EQ(TypeKernel::GetCompare(TypeId::BOOLEAN, TypeId::TINYINT), nullptr);
+  EXPECT_NE(TypeKernel::GetCompare(TypeId::BOOLEAN, TypeId::BOOLEAN), nullptr);
+  EXPECT_EQ(TypeKernel::GetArithmetic(TypeKernel::ADD, TypeId::VARCHAR,
+                                      TypeId::INTEGER, &result_type),
+            nullptr);
+}
 } // namespace cmudb